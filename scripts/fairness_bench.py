@@ -0,0 +1,292 @@
+"""
+Measures how much a router that is flooded with frames delays the other
+routers configured by the same controller (head-of-line blocking).
+
+The script acts as a (minimal) controller: it configures the routers of
+a topology file, then sends ICMP echo requests to an interface of each
+router except the flooded one, and measures how long the replies take,
+first on their own, and then while the flooded router is sent as many
+frames as chirouter will accept. Run it against chirouter with and
+without fair scheduling (-s) to compare, e.g.:
+
+    ./chirouter -s &
+    python scripts/fairness_bench.py topologies/3router.json
+
+By default, the flooded router is sent ICMP echo replies, which it has to
+process but doesn't answer, so that how fast this script can read what
+chirouter sends back doesn't limit the flood (with --answered, it is sent
+echo requests instead, and the replies share the connection to the
+controller with the replies of all the other routers).
+
+Sending as many frames as possible also fills the socket buffers between
+this script and chirouter, which delays all the routers alike (and, if
+they share a CPU, takes CPU time away from chirouter): use --rate to send
+more frames than the flooded router can process, but fewer than chirouter
+can receive.
+
+The script only needs the standard library (it doesn't use the chirouter
+Python package, which requires Mininet), and works with Python 2 and 3.
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import json
+import socket
+import struct
+import threading
+import time
+
+MSG_TYPE_HELLO = 1
+MSG_TYPE_ROUTERS = 2
+MSG_TYPE_ROUTER = 3
+MSG_TYPE_INTERFACE = 4
+MSG_TYPE_RTABLE_ENTRY = 5
+MSG_TYPE_END_CONFIG = 6
+MSG_TYPE_ETHERNET_FRAME = 7
+
+SUBTYPE_NONE = 0
+SUBTYPE_TO_ROUTER = 2
+
+# ICMP types, and identifiers of the echo requests sent to measure
+# latency, and of those sent to flood a router
+ICMP_ECHO_REPLY = 0
+ICMP_ECHO_REQUEST = 8
+PROBE_ID = 0x5052
+FLOOD_ID = 0x464c
+
+# Number of frames sent at once to the flooded router
+FLOOD_BATCH = 64
+
+
+def msg(msg_type, subtype, payload=b""):
+    return struct.pack("!BBH", msg_type, subtype, len(payload)) + payload
+
+
+def checksum(data):
+    if len(data) % 2:
+        data += b"\0"
+    s = sum(struct.unpack("!%dH" % (len(data) // 2), data))
+    while s >> 16:
+        s = (s & 0xffff) + (s >> 16)
+    return ~s & 0xffff
+
+
+def echo(icmp_type, dst_mac, src_mac, src_ip, dst_ip, ident, seq, size):
+    icmp = struct.pack("!BBHHH", icmp_type, 0, 0, ident, seq) + b"x" * max(size - 42, 0)
+    icmp = icmp[:2] + struct.pack("!H", checksum(icmp)) + icmp[4:]
+    ip = struct.pack("!BBHHHBBH4s4s", 0x45, 0, 20 + len(icmp), 0, 0, 64, 1, 0, src_ip, dst_ip)
+    ip = ip[:10] + struct.pack("!H", checksum(ip)) + ip[12:]
+    return dst_mac + src_mac + struct.pack("!H", 0x0800) + ip + icmp
+
+
+def frame_msg(rid, iface_id, frame):
+    return msg(MSG_TYPE_ETHERNET_FRAME, SUBTYPE_TO_ROUTER,
+               struct.pack("!BBH", rid, iface_id, len(frame)) + frame)
+
+
+def percentile(values, pct):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+class Router(object):
+    def __init__(self, rid, d):
+        self.rid = rid
+        self.name = "r{}".format(d["id"])
+        self.interfaces = sorted(d["interfaces"], key=lambda i: i["name"])
+        self.rtable = d["rtable"]
+        self.seq = 0
+        self.sent = {}
+        self.rtts = []
+
+        # Every router is pinged on its first interface, from a host
+        # at the last address of the interface's network
+        iface = self.interfaces[0]
+        ip = struct.unpack("!I", socket.inet_aton(iface["ip"]))[0]
+        mask = struct.unpack("!I", socket.inet_aton(iface["mask"]))[0]
+        host = (ip & mask) | (~mask & 0xfffffffe)
+        self.ip = socket.inet_aton(iface["ip"])
+        self.host_ip = struct.pack("!I", host if host != ip else host - 1)
+        self.host_mac = struct.pack("!BBBBBB", 2, 0, 0, 0xff, rid, 1)
+
+    def mac(self, iface_id):
+        return struct.pack("!BBBBBB", 2, 0, 0, 0, self.rid, iface_id)
+
+    def config_msgs(self):
+        msgs = [msg(MSG_TYPE_ROUTER, SUBTYPE_NONE,
+                    struct.pack("!BBB", self.rid, len(self.interfaces), len(self.rtable)) +
+                    self.name.encode())]
+        for iface_id, iface in enumerate(self.interfaces):
+            msgs.append(msg(MSG_TYPE_INTERFACE, SUBTYPE_NONE,
+                            struct.pack("!BB", self.rid, iface_id) + self.mac(iface_id) +
+                            socket.inet_aton(iface["ip"]) + iface["name"].encode()))
+        names = [iface["name"] for iface in self.interfaces]
+        for rte in self.rtable:
+            msgs.append(msg(MSG_TYPE_RTABLE_ENTRY, SUBTYPE_NONE,
+                            struct.pack("!BBH", self.rid, names.index(rte["iface"]), rte["metric"]) +
+                            socket.inet_aton(rte["destination"]) + socket.inet_aton(rte["mask"]) +
+                            socket.inet_aton(rte["gateway"])))
+        return msgs
+
+    def echo(self, icmp_type, ident, seq, size):
+        frame = echo(icmp_type, self.mac(0), self.host_mac, self.host_ip, self.ip, ident, seq, size)
+        return frame_msg(self.rid, 0, frame)
+
+
+class Controller(object):
+    def __init__(self, host, port, routers):
+        self.routers = routers
+        self.sock = socket.create_connection((host, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.send_lock = threading.Lock()
+        self.flood_replies = 0
+        self.done = False
+
+    def configure(self):
+        self.sock.sendall(msg(MSG_TYPE_HELLO, SUBTYPE_TO_ROUTER))
+        if len(self.sock.recv(4)) != 4:
+            raise IOError("chirouter closed the connection")
+        config = [msg(MSG_TYPE_ROUTERS, SUBTYPE_NONE, struct.pack("!B", len(self.routers)))]
+        for router in self.routers:
+            config += router.config_msgs()
+        config.append(msg(MSG_TYPE_END_CONFIG, SUBTYPE_NONE))
+        self.sock.sendall(b"".join(config))
+
+    def send(self, data):
+        with self.send_lock:
+            self.sock.sendall(data)
+
+    def receive(self):
+        buf = bytearray()
+        while not self.done:
+            data = self.sock.recv(1 << 20)
+            if not data:
+                break
+            now = time.time()
+            buf += data
+
+            pos = 0
+            while len(buf) - pos >= 4:
+                msg_type, _, payload_len = struct.unpack_from("!BBH", buf, pos)
+                if len(buf) - pos < 4 + payload_len:
+                    break
+                # ICMP echo replies (the frame starts at offset 8)
+                if (msg_type == MSG_TYPE_ETHERNET_FRAME and payload_len >= 46 and
+                        buf[pos + 20:pos + 22] == b"\x08\x00" and buf[pos + 31] == 1 and buf[pos + 42] == 0):
+                    rid = buf[pos + 4]
+                    ident, seq = struct.unpack_from("!HH", buf, pos + 46)
+                    if ident == FLOOD_ID:
+                        self.flood_replies += 1
+                    elif ident == PROBE_ID:
+                        router = self.routers[rid]
+                        sent = router.sent.pop(seq, None)
+                        if sent is not None:
+                            router.rtts.append(now - sent)
+                pos += 4 + payload_len
+            del buf[:pos]
+
+    def flood(self, router, icmp_type, size, rate):
+        batch = b"".join(router.echo(icmp_type, FLOOD_ID, i, size) for i in range(FLOOD_BATCH))
+        start = time.time()
+        while not self.done and not self.stop_flood:
+            self.send(batch)
+            self.flood_sent += FLOOD_BATCH
+            if rate > 0:
+                delay = start + self.flood_sent / rate - time.time()
+                if delay > 0:
+                    time.sleep(delay)
+
+    def probe(self, routers, duration, interval, size):
+        end = time.time() + duration
+        while time.time() < end:
+            for router in routers:
+                router.seq = (router.seq + 1) & 0xffff
+                data = router.echo(ICMP_ECHO_REQUEST, PROBE_ID, router.seq, size)
+                with self.send_lock:
+                    router.sent[router.seq] = time.time()
+                    self.sock.sendall(data)
+            time.sleep(interval)
+
+    def run_phase(self, name, probed, flooded, args):
+        for router in probed:
+            router.sent.clear()
+            router.rtts = []
+        self.flood_replies = 0
+        self.flood_sent = 0
+        self.stop_flood = False
+
+        flood_thread = None
+        if flooded is not None:
+            icmp_type = ICMP_ECHO_REQUEST if args.answered else ICMP_ECHO_REPLY
+            flood_thread = threading.Thread(target=self.flood, args=(flooded, icmp_type, args.size, args.rate))
+            flood_thread.daemon = True
+            flood_thread.start()
+            time.sleep(0.5)
+            self.flood_replies = 0
+
+        start = time.time()
+        self.probe(probed, args.duration, args.interval / 1000.0, args.size)
+        elapsed = time.time() - start
+        flood_replies = self.flood_replies
+
+        if flood_thread is not None:
+            self.stop_flood = True
+            flood_thread.join()
+        time.sleep(1.0)
+
+        print("{}:".format(name))
+        if flooded is not None:
+            print("  {:<8} {:>10.0f} frames/s sent, {:.0f} replies/s".format(
+                  flooded.name + "*", self.flood_sent / elapsed, flood_replies / elapsed))
+        for router in probed:
+            rtts = [rtt * 1000 for rtt in router.rtts]
+            print("  {:<8} {:>6} probes  {:>4} lost  p50 {:>8.3f} ms  p99 {:>8.3f} ms  max {:>8.3f} ms".format(
+                  router.name, len(rtts), len(router.sent),
+                  percentile(rtts, 50), percentile(rtts, 99), max(rtts) if rtts else float("nan")))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure head-of-line blocking across routers")
+    parser.add_argument("topology", help="Topology file (e.g., topologies/3router.json)")
+    parser.add_argument("--host", default="localhost", help="Host chirouter is running on")
+    parser.add_argument("--port", type=int, default=23300, help="Port chirouter is listening on")
+    parser.add_argument("--flood", default=None, help="Name of the router to flood (default: the first one)")
+    parser.add_argument("--duration", type=float, default=5.0, help="Duration of each phase, in seconds")
+    parser.add_argument("--interval", type=float, default=5.0,
+                        help="Time between echo requests to each router, in milliseconds")
+    parser.add_argument("--rate", type=float, default=0,
+                        help="Frames per second sent to the flooded router (default: as many as possible)")
+    parser.add_argument("--answered", action="store_true",
+                        help="Flood the router with echo requests instead of echo replies")
+    parser.add_argument("--size", type=int, default=98, help="Size of the Ethernet frames, in bytes")
+    args = parser.parse_args()
+
+    with open(args.topology) as f:
+        topology = json.load(f)
+    routers = [Router(rid, d) for rid, d in
+               enumerate(s for s in topology["switches"] if s["type"] == "router")]
+
+    flooded = routers[0]
+    if args.flood is not None:
+        flooded = [r for r in routers if r.name == args.flood][0]
+    probed = [r for r in routers if r is not flooded]
+
+    controller = Controller(args.host, args.port, routers)
+    controller.configure()
+    receiver = threading.Thread(target=controller.receive)
+    receiver.daemon = True
+    receiver.start()
+    time.sleep(0.5)
+
+    controller.run_phase("No flood", probed, None, args)
+    controller.run_phase("Flooding {}".format(flooded.name), probed, flooded, args)
+
+    controller.done = True
+    controller.sock.close()
+
+
+if __name__ == "__main__":
+    main()
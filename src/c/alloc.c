@@ -0,0 +1,129 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module provides wrappers around the C heap allocation functions
+ *  that keep track of how many allocations and frees have been done.
+ *
+ *  See alloc.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "alloc.h"
+
+/* The counters are updated from several threads (the server thread
+ * and the ARP threads), so we use relaxed atomic increments */
+static atomic_uint_fast64_t num_allocs;
+static atomic_uint_fast64_t num_frees;
+
+
+/* See alloc.h */
+void *chirouter_calloc(size_t nmemb, size_t size)
+{
+    void *ptr = calloc(nmemb, size);
+
+    if (ptr != NULL)
+    {
+        atomic_fetch_add_explicit(&num_allocs, 1, memory_order_relaxed);
+    }
+
+    return ptr;
+}
+
+
+/* See alloc.h */
+void *chirouter_aligned_calloc(size_t alignment, size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size != 0 && nmemb > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+
+    if (posix_memalign(&ptr, alignment, nmemb * size) != 0)
+    {
+        return NULL;
+    }
+
+    memset(ptr, 0, nmemb * size);
+    atomic_fetch_add_explicit(&num_allocs, 1, memory_order_relaxed);
+
+    return ptr;
+}
+
+
+/* See alloc.h */
+void chirouter_free(void *ptr)
+{
+    if (ptr != NULL)
+    {
+        atomic_fetch_add_explicit(&num_frees, 1, memory_order_relaxed);
+    }
+
+    free(ptr);
+}
+
+
+/* See alloc.h */
+void chirouter_alloc_stats(uint64_t *allocs, uint64_t *frees)
+{
+    if (allocs != NULL)
+    {
+        *allocs = atomic_load_explicit(&num_allocs, memory_order_relaxed);
+    }
+
+    if (frees != NULL)
+    {
+        *frees = atomic_load_explicit(&num_frees, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,121 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module provides wrappers around the C heap allocation functions
+ *  that keep track of how many allocations and frees have been done.
+ *  All heap allocations in the router code should go through these
+ *  wrappers, so that we can check that the frame processing path
+ *  does not allocate memory once the router is running.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * chirouter_calloc - Allocate zeroed memory
+ *
+ * Same as calloc(), but increments the allocation counter.
+ *
+ * nmemb: Number of elements
+ *
+ * size: Size of each element
+ *
+ * Returns: pointer to the allocated memory, or NULL on failure.
+ */
+void *chirouter_calloc(size_t nmemb, size_t size);
+
+
+/*
+ * chirouter_aligned_calloc - Allocate zeroed, aligned memory
+ *
+ * Same as chirouter_calloc, but the returned memory is aligned
+ * to "alignment" bytes. The memory must be freed with chirouter_free.
+ *
+ * alignment: Alignment (must be a power of two, and a multiple
+ *            of sizeof(void *))
+ *
+ * nmemb: Number of elements
+ *
+ * size: Size of each element
+ *
+ * Returns: pointer to the allocated memory, or NULL on failure.
+ */
+void *chirouter_aligned_calloc(size_t alignment, size_t nmemb, size_t size);
+
+
+/*
+ * chirouter_free - Free memory
+ *
+ * Same as free(), but increments the free counter (if ptr is not NULL).
+ * Memory allocated with chirouter_calloc must be freed with this function.
+ *
+ * ptr: Pointer to memory allocated with chirouter_calloc
+ *
+ * Returns: nothing
+ */
+void chirouter_free(void *ptr);
+
+
+/*
+ * chirouter_alloc_stats - Get the allocation counters
+ *
+ * allocs: Pointer to where the number of allocations done so far
+ *         will be stored (can be NULL)
+ *
+ * frees: Pointer to where the number of frees done so far
+ *        will be stored (can be NULL)
+ *
+ * Returns: nothing
+ */
+void chirouter_alloc_stats(uint64_t *allocs, uint64_t *frees);
+
+#endif
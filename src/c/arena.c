@@ -0,0 +1,157 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a simple arena (region) allocator.
+ *
+ *  See arena.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "arena.h"
+#include "alloc.h"
+
+
+/* See arena.h */
+void chirouter_arena_init(chirouter_arena_t *arena)
+{
+    arena->blocks = NULL;
+    arena->allocated = 0;
+    pthread_mutex_init(&arena->lock, NULL);
+}
+
+
+/* See arena.h */
+void *chirouter_arena_alloc(chirouter_arena_t *arena, size_t nmemb, size_t size, size_t align)
+{
+    chirouter_arena_block_t *block;
+    size_t offset = 0, len;
+    void *ptr = NULL;
+
+    if (size != 0 && nmemb > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+    len = nmemb * size;
+
+    pthread_mutex_lock(&arena->lock);
+
+    block = arena->blocks;
+    if (block != NULL)
+    {
+        offset = (block->used + align - 1) & ~(align - 1);
+    }
+
+    if (block == NULL || offset + len > block->size)
+    {
+        /* Allocations larger than a block get a block of their own
+         * (placed behind the current block, so we can keep carving
+         * small allocations out of the current block) */
+        size_t block_size = len > ARENA_BLOCK_SIZE ? len : ARENA_BLOCK_SIZE;
+
+        chirouter_arena_block_t *new_block =
+                chirouter_aligned_calloc(ARENA_MAX_ALIGN, 1, sizeof(chirouter_arena_block_t) + block_size);
+        if (new_block == NULL)
+        {
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+        new_block->size = block_size;
+        new_block->used = 0;
+
+        if (block != NULL && len > ARENA_BLOCK_SIZE)
+        {
+            new_block->next = block->next;
+            block->next = new_block;
+        }
+        else
+        {
+            new_block->next = block;
+            arena->blocks = new_block;
+        }
+
+        block = new_block;
+        offset = 0;
+    }
+
+    /* Blocks are allocated zeroed and never reused, so
+     * there is no need to zero the allocated memory */
+    ptr = block->data + offset;
+    block->used = offset + len;
+    arena->allocated += len;
+
+    pthread_mutex_unlock(&arena->lock);
+
+    return ptr;
+}
+
+
+/* See arena.h */
+void chirouter_arena_release(chirouter_arena_t *arena)
+{
+    chirouter_arena_block_t *block, *next;
+
+    pthread_mutex_lock(&arena->lock);
+    for (block = arena->blocks; block != NULL; block = next)
+    {
+        next = block->next;
+        chirouter_free(block);
+    }
+    arena->blocks = NULL;
+    arena->allocated = 0;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+
+/* See arena.h */
+void chirouter_arena_destroy(chirouter_arena_t *arena)
+{
+    chirouter_arena_release(arena);
+    pthread_mutex_destroy(&arena->lock);
+}
@@ -0,0 +1,155 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a simple arena (region) allocator.
+ *
+ *  Each router carves all its long-lived data structures (interfaces,
+ *  routing table, frame buffers, pending ARP requests, etc.) out of its
+ *  own arena. Memory allocated from an arena is never freed individually:
+ *  the whole arena is released in a single operation when the router is
+ *  destroyed. Structures that come and go while the router is running
+ *  (like pending ARP requests) are recycled through free lists instead.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Default size of the blocks the arena is carved from */
+#define ARENA_BLOCK_SIZE (64u * 1024u)
+
+/* Maximum alignment of allocations from an arena */
+#define ARENA_MAX_ALIGN (64u)
+
+/* A block of memory in an arena */
+typedef struct chirouter_arena_block
+{
+    /* Next block in the arena */
+    struct chirouter_arena_block *next;
+
+    /* Size of the data area, and number of bytes used */
+    size_t size;
+    size_t used;
+
+    /* Data area */
+    uint8_t data[] __attribute__ ((aligned (ARENA_MAX_ALIGN)));
+} chirouter_arena_block_t;
+
+/* An arena */
+typedef struct chirouter_arena
+{
+    /* List of blocks (the first block is the one
+     * currently being allocated from) */
+    chirouter_arena_block_t *blocks;
+
+    /* Total number of bytes allocated from the arena */
+    size_t allocated;
+
+    /* Protects the arena, since a router's arena can be used
+     * from the server thread and from the router's ARP thread */
+    pthread_mutex_t lock;
+} chirouter_arena_t;
+
+
+/*
+ * chirouter_arena_init - Initialize an arena
+ *
+ * No memory is allocated until the first call to chirouter_arena_alloc
+ *
+ * arena: Arena
+ *
+ * Returns: nothing
+ */
+void chirouter_arena_init(chirouter_arena_t *arena);
+
+
+/*
+ * chirouter_arena_alloc - Allocate zeroed memory from an arena
+ *
+ * arena: Arena
+ *
+ * nmemb: Number of elements
+ *
+ * size: Size of each element
+ *
+ * align: Alignment of the allocated memory (must be a power
+ *        of two, no larger than ARENA_MAX_ALIGN)
+ *
+ * Returns: pointer to the allocated memory (which will remain valid until
+ *          the arena is released), or NULL if memory could not be allocated.
+ */
+void *chirouter_arena_alloc(chirouter_arena_t *arena, size_t nmemb, size_t size, size_t align);
+
+
+/*
+ * chirouter_arena_release - Release all the memory in an arena
+ *
+ * After calling this function, the arena can be reused (as if it
+ * had just been initialized) or discarded.
+ *
+ * arena: Arena
+ *
+ * Returns: nothing
+ */
+void chirouter_arena_release(chirouter_arena_t *arena);
+
+
+/*
+ * chirouter_arena_destroy - Release an arena and free its resources
+ *
+ * arena: Arena
+ *
+ * Returns: nothing
+ */
+void chirouter_arena_destroy(chirouter_arena_t *arena);
+
+#endif
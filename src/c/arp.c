@@ -7,8 +7,10 @@
  *  Most importantly, this module defines a function chirouter_arp_process
  *  that is run as a separate thread, and which will wake up every second
  *  to purge stale entries in the ARP cache (entries that are more than 15 seconds
- *  old) and to traverse the list of pending ARP requests. For each pending
- *  request in the list, it will call chirouter_arp_process_pending_req,
+ *  old) and to re-validate entries that are still in use before they expire.
+ *  The thread also wakes up several times per second to traverse the list
+ *  of pending ARP requests. For each pending request that is due to be
+ *  re-sent, it will call chirouter_arp_process_pending_req,
  *  which must either re-send the pending ARP request or cancel the
  *  request and send ICMP Host Unreachable messages in reply to all
  *  the withheld frames.
@@ -71,17 +73,30 @@
 #include <stdbool.h>
 
 #include "arp.h"
+#include "server.h"
 #include "chirouter.h"
 #include "utils.h"
+#include "alloc.h"
+#include "framepool.h"
 #include "utlist.h"
 
 #define ARP_REQ_KEEP (0)
 #define ARP_REQ_REMOVE (1)
 
+/* How often the ARP thread checks for pending requests that are due */
+#define ARP_TICK_MS (10)
+
+/* Jitter added to (or subtracted from) each wait in the ARP
+ * retransmission schedule, as a percentage of the wait */
+#define ARP_RETRANSMIT_JITTER_PCT (10)
+
 /* ICMP send frame function */
 void chirouter_send_icmp(chirouter_ctx_t *ctx, uint8_t type, uint8_t code, 
                                                 ethernet_frame_t *frame);
 
+/* Routing table lookup function */
+chirouter_rtable_entry_t* chirouter_rtable_lookup(chirouter_ctx_t *ctx, uint32_t ip);
+
 void chirouter_send_arp_message(chirouter_ctx_t *ctx, 
                                 chirouter_interface_t *out_interface, 
                                 uint8_t *dst_mac, uint32_t dst_ip, int type)
@@ -100,7 +115,15 @@ void chirouter_send_arp_message(chirouter_ctx_t *ctx,
     arp_packet->pln = IPV4_ADDR_LEN;
     if (type == ARP_OP_REQUEST)
     {
-        memcpy(hdr->dst, "\xFF\xFF\xFF\xFF\xFF\xFF", ETHER_ADDR_LEN);
+        if (dst_mac != NULL)
+        {
+            // unicast request to re-validate a cached entry
+            memcpy(hdr->dst, dst_mac, ETHER_ADDR_LEN);
+        }
+        else
+        {
+            memcpy(hdr->dst, "\xFF\xFF\xFF\xFF\xFF\xFF", ETHER_ADDR_LEN);
+        }
         memcpy(hdr->src, out_interface->mac, ETHER_ADDR_LEN);
         arp_packet->op = htons(ARP_OP_REQUEST);
         memcpy(arp_packet->sha, out_interface->mac, ETHER_ADDR_LEN);
@@ -135,12 +158,16 @@ void chirouter_send_arp_message(chirouter_ctx_t *ctx,
  *
  * Given a pending ARP request, this function will do the following:
  *
- * - If the request has been sent less than five times, re-send the request
- *   (and update the the chirouter_pending_arp_req_t struct to reflect
- *   the number of times the request has been sent) and return ARP_REQ_KEEP
- * - If the request has been sent five times, send an ICMP Host Unreachable
+ * - If the request has been sent fewer times than there are waits in the
+ *   ARP retransmission schedule, re-send the request (and update the
+ *   chirouter_pending_arp_req_t struct to reflect the number of times
+ *   the request has been sent) and return ARP_REQ_KEEP
+ * - Otherwise (the last wait has expired), send an ICMP Host Unreachable
  *   reply for each of the withheld frames and return ARP_REQ_REMOVE
  *
+ * This function is only called once the request is due (i.e., once
+ * the wait after the last time it was sent has expired)
+ *
  * ctx: Router context
  *
  * pending_req: Pending ARP request
@@ -153,15 +180,11 @@ int chirouter_arp_process_pending_req(chirouter_ctx_t *ctx,
                                 chirouter_pending_arp_req_t *pending_req)
 {
     /* Your code goes here */
-    if (pending_req->times_sent < 5)
+    if (pending_req->times_sent < ctx->server->arp_schedule_len)
     {
-        // send arp request
+        // send arp request (if the interface's ARP rate allows it)
         chilog(DEBUG, "[ARP MESSAGE]: SENDING ARP REQUEST FROM CHIROUTER ARP PROCESS FUNCTION");
-        chirouter_send_arp_message(ctx, pending_req->out_interface, 
-                                    NULL, in_addr_to_uint32(pending_req->ip), 
-                                    ARP_OP_REQUEST);
-        pending_req->times_sent++;
-        pending_req->last_sent = time(NULL);
+        chirouter_arp_pending_req_send(ctx, pending_req);
         return ARP_REQ_KEEP;
     }
     else 
@@ -179,15 +202,215 @@ int chirouter_arp_process_pending_req(chirouter_ctx_t *ctx,
         return ARP_REQ_REMOVE;
     }
 }
-      
+
+/*
+ * chirouter_arp_take_token - Check whether an ARP request can be sent on an interface
+ *
+ * Refills the interface's token bucket (arp_rate tokens per second, up
+ * to arp_burst tokens) and takes a token from it if there is one.
+ *
+ * ctx: Router context
+ *
+ * iface: Interface the ARP request would be sent on
+ *
+ * now: Current time (see chirouter_now_ms)
+ *
+ * Returns: true if the request can be sent, false otherwise
+ */
+bool chirouter_arp_take_token(chirouter_ctx_t *ctx, chirouter_interface_t *iface,
+                              uint64_t now)
+{
+    server_ctx_t *server = ctx->server;
+
+    if (server->arp_rate == 0)
+    {
+        return true;
+    }
+
+    double elapsed = (now - iface->arp_tokens_updated) / 1000.0;
+    iface->arp_tokens += elapsed * server->arp_rate;
+    if (iface->arp_tokens_updated == 0 || iface->arp_tokens > server->arp_burst)
+    {
+        iface->arp_tokens = server->arp_burst;
+    }
+    iface->arp_tokens_updated = now;
+
+    if (iface->arp_tokens < 1.0)
+    {
+        return false;
+    }
+
+    iface->arp_tokens -= 1.0;
+    return true;
+}
+
+
+/* See arp.h */
+bool chirouter_arp_pending_req_send(chirouter_ctx_t *ctx,
+                                    chirouter_pending_arp_req_t *pending_req)
+{
+    uint64_t now = chirouter_now_ms();
+
+    if (!chirouter_arp_take_token(ctx, pending_req->out_interface, now))
+    {
+        chilog(DEBUG, "[ARP MESSAGE]: ARP RATE EXCEEDED, DEFERRING REQUEST");
+        return false;
+    }
+
+    chirouter_send_arp_message(ctx, pending_req->out_interface, 
+                                NULL, in_addr_to_uint32(pending_req->ip), 
+                                ARP_OP_REQUEST);
+    pending_req->times_sent++;
+    pending_req->last_sent = now;
+
+    uint32_t wait = ctx->server->arp_schedule[pending_req->times_sent - 1];
+    int64_t max_jitter = (int64_t) wait * ARP_RETRANSMIT_JITTER_PCT / 100;
+    int64_t jitter = (int64_t) (rand_r(&ctx->arp_seed) % (2 * max_jitter + 1)) - max_jitter;
+    pending_req->next_send = now + wait + jitter;
+
+    return true;
+}
+
+
+/*
+ * chirouter_arp_refresh_entry - Re-validate an ARP cache entry before it expires
+ *
+ * Entries that have been used to forward frames since they were added
+ * are re-validated with a unicast ARP request to the cached MAC address
+ * once they are within ARPCACHE_REFRESH_AHEAD seconds of expiring.
+ * The entry remains valid (and keeps being used for forwarding) while
+ * the refresh is in flight; the ARP reply will update it in place.
+ *
+ * ctx: Router context
+ *
+ * entry: ARP cache entry
+ *
+ * curtime: Current time
+ *
+ * Returns: nothing
+ */
+void chirouter_arp_refresh_entry(chirouter_ctx_t *ctx,
+                                 chirouter_arpcache_entry_t *entry, time_t curtime)
+{
+    double entry_age = difftime(curtime, entry->time_added);
+
+    if (entry_age < ARPCACHE_ENTRY_TIMEOUT - ARPCACHE_REFRESH_AHEAD)
+    {
+        return;
+    }
+
+    if (!entry->pinned && entry->time_used < entry->time_added)
+    {
+        // not used since it was added; let it expire
+        return;
+    }
+
+    chirouter_rtable_entry_t *rentry = chirouter_rtable_lookup(ctx, in_addr_to_uint32(entry->ip));
+    if (rentry == NULL)
+    {
+        return;
+    }
+
+    if (!chirouter_arp_take_token(ctx, rentry->interface, chirouter_now_ms()))
+    {
+        // try again on the next purge
+        return;
+    }
+
+    chilog(DEBUG, "[ARP MESSAGE]: REFRESHING ARP CACHE ENTRY");
+    chirouter_send_arp_message(ctx, rentry->interface, entry->mac,
+                               in_addr_to_uint32(entry->ip), ARP_OP_REQUEST);
+}
+
+
+/* See arp.h */
+chirouter_interface_t* chirouter_arp_gateway_interface(chirouter_ctx_t *ctx, 
+                                                       struct in_addr *ip)
+{
+    if (ip->s_addr == 0)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < ctx->num_rtable_entries; i++)
+    {
+        if (ctx->routing_table[i].gw.s_addr == ip->s_addr)
+        {
+            return ctx->routing_table[i].interface;
+        }
+    }
+    return NULL;
+}
+
+
+/* See arp.h */
+void chirouter_arp_resolve_gateways(chirouter_ctx_t *ctx)
+{
+    pthread_mutex_lock(&(ctx->lock_arp));
+    for (int i = 0; i < ctx->num_rtable_entries; i++)
+    {
+        struct in_addr *gw = &ctx->routing_table[i].gw;
+
+        if (gw->s_addr == 0)
+        {
+            continue;
+        }
+
+        // several entries can share a gateway: only send one request
+        if (chirouter_arp_cache_lookup(ctx, gw) == NULL &&
+            chirouter_arp_pending_req_lookup(ctx, gw) == NULL)
+        {
+            chilog(DEBUG, "[ARP MESSAGE]: RESOLVING GATEWAY %s", inet_ntoa(*gw));
+            chirouter_pending_arp_req_t *pending_req = 
+                    chirouter_arp_pending_req_add(ctx, gw, ctx->routing_table[i].interface);
+            if (pending_req != NULL)
+            {
+                chirouter_arp_pending_req_send(ctx, pending_req);
+            }
+        }
+    }
+    pthread_mutex_unlock(&(ctx->lock_arp));
+}
 
 
 /***** DO NOT MODIFY THE CODE BELOW *****/
 
 
+/*
+ * chirouter_arp_static_slot - Find the slot for an IP address in the table of static ARP entries
+ *
+ * ctx: Router context (its table of static entries must not be empty)
+ *
+ * ip: IP address
+ *
+ * Returns: the slot with the static entry for the IP address, if there
+ *          is one, or the (invalid) slot where it would be added.
+ */
+static chirouter_arpcache_entry_t* chirouter_arp_static_slot(chirouter_ctx_t *ctx, struct in_addr *ip)
+{
+    uint32_t mask = ctx->static_arp_size - 1;
+    uint32_t i = ((ip->s_addr * 2654435761u) >> 7) & mask;
+
+    while(ctx->static_arp[i].valid && ctx->static_arp[i].ip.s_addr != ip->s_addr)
+    {
+        i = (i + 1) & mask;
+    }
+
+    return &ctx->static_arp[i];
+}
+
+
 /* See arp.h */
 chirouter_arpcache_entry_t* chirouter_arp_cache_lookup(chirouter_ctx_t *ctx, struct in_addr *ip)
 {
+    if(ctx->num_static_arp > 0)
+    {
+        chirouter_arpcache_entry_t *entry = chirouter_arp_static_slot(ctx, ip);
+
+        if(entry->valid)
+            return entry;
+    }
+
     for(int i=0; i < ARPCACHE_SIZE; i++)
     {
         if(ctx->arpcache[i].valid && ctx->arpcache[i].ip.s_addr == ip->s_addr)
@@ -203,20 +426,112 @@ chirouter_arpcache_entry_t* chirouter_arp_cache_lookup(chirouter_ctx_t *ctx, str
 /* See arp.h */
 int chirouter_arp_cache_add(chirouter_ctx_t *ctx, struct in_addr *ip, uint8_t *mac)
 {
+    chirouter_arpcache_entry_t *entry = chirouter_arp_cache_lookup(ctx, ip);
+
+    if(entry != NULL)
+    {
+        if(!entry->permanent)
+        {
+            memcpy(entry->mac, mac, ETHER_ADDR_LEN);
+            entry->time_added = time(NULL);
+        }
+
+        return 0;
+    }
+
+    /* Use a free entry or, if the cache is full, evict the
+     * least recently used (or refreshed) entry. Pinned entries
+     * are never evicted (and static entries are not in the cache) */
+    chirouter_arpcache_entry_t *victim = NULL;
+    time_t victim_time = 0;
+
     for(int i=0; i < ARPCACHE_SIZE; i++)
     {
         if(!ctx->arpcache[i].valid)
         {
-            ctx->arpcache[i].valid = true;
-            memcpy(&ctx->arpcache[i].ip, ip, sizeof(struct in_addr));
-            memcpy(ctx->arpcache[i].mac, mac, ETHER_ADDR_LEN);
-            ctx->arpcache[i].time_added = time(NULL);
+            victim = &ctx->arpcache[i];
+            break;
+        }
+
+        if(ctx->arpcache[i].pinned)
+            continue;
+
+        time_t last_time = ctx->arpcache[i].time_added;
+        if(ctx->arpcache[i].time_used > last_time)
+            last_time = ctx->arpcache[i].time_used;
 
-            return 0;
+        if(victim == NULL || last_time < victim_time)
+        {
+            victim = &ctx->arpcache[i];
+            victim_time = last_time;
         }
     }
 
-    return 1;
+    if(victim == NULL)
+        return 1;
+
+    victim->valid = true;
+    memcpy(&victim->ip, ip, sizeof(struct in_addr));
+    memcpy(victim->mac, mac, ETHER_ADDR_LEN);
+    victim->time_added = time(NULL);
+    victim->time_used = 0;
+    victim->pinned = (chirouter_arp_gateway_interface(ctx, ip) != NULL);
+    victim->permanent = false;
+
+    return 0;
+}
+
+
+/* See arp.h */
+int chirouter_arp_cache_add_permanent(chirouter_ctx_t *ctx, struct in_addr *ip, uint8_t *mac)
+{
+    chirouter_arpcache_entry_t *entry;
+
+    /* Keep the table at most half full, so lookups stay short */
+    if(2 * (ctx->num_static_arp + 1) > ctx->static_arp_size)
+    {
+        chirouter_arpcache_entry_t *old = ctx->static_arp;
+        uint32_t old_size = ctx->static_arp_size;
+        uint32_t size = old_size ? 2 * old_size : ARP_STATIC_INITIAL_SIZE;
+
+        ctx->static_arp = chirouter_calloc(size, sizeof(chirouter_arpcache_entry_t));
+        if(ctx->static_arp == NULL)
+        {
+            ctx->static_arp = old;
+            return 1;
+        }
+        ctx->static_arp_size = size;
+
+        for(uint32_t i = 0; i < old_size; i++)
+        {
+            if(old[i].valid)
+                *chirouter_arp_static_slot(ctx, &old[i].ip) = old[i];
+        }
+        chirouter_free(old);
+    }
+
+    /* A dynamic entry for the same address would never be used again */
+    for(int i=0; i < ARPCACHE_SIZE; i++)
+    {
+        if(ctx->arpcache[i].valid && ctx->arpcache[i].ip.s_addr == ip->s_addr)
+            ctx->arpcache[i].valid = false;
+    }
+
+    entry = chirouter_arp_static_slot(ctx, ip);
+    if(!entry->valid)
+    {
+        ctx->num_static_arp++;
+    }
+
+    entry->valid = true;
+    memcpy(&entry->ip, ip, sizeof(struct in_addr));
+    memcpy(entry->mac, mac, ETHER_ADDR_LEN);
+    entry->time_added = time(NULL);
+    entry->time_used = 0;
+    entry->pinned = false;
+    entry->permanent = true;
+
+    return 0;
 }
 
 
@@ -239,11 +554,26 @@ chirouter_pending_arp_req_t* chirouter_arp_pending_req_lookup(chirouter_ctx_t *c
 /* See arp.h */
 chirouter_pending_arp_req_t* chirouter_arp_pending_req_add(chirouter_ctx_t *ctx, struct in_addr *ip, chirouter_interface_t *iface)
 {
-    chirouter_pending_arp_req_t *pending_req = calloc(1, sizeof(chirouter_pending_arp_req_t));
+    chirouter_pending_arp_req_t *pending_req = ctx->free_pending_arp_reqs;
+
+    if (pending_req != NULL)
+    {
+        ctx->free_pending_arp_reqs = pending_req->next;
+    }
+    else
+    {
+        pending_req = chirouter_arena_alloc(&ctx->arena, 1, sizeof(chirouter_pending_arp_req_t),
+                                            _Alignof(chirouter_pending_arp_req_t));
+        if (pending_req == NULL)
+        {
+            return NULL;
+        }
+    }
 
     memcpy(&pending_req->ip, ip, sizeof(struct in_addr));
     pending_req->times_sent = 0;
-    pending_req->last_sent = time(NULL);
+    pending_req->last_sent = 0;
+    pending_req->next_send = chirouter_now_ms();
     pending_req->out_interface = iface;
     pending_req->withheld_frames = NULL;
 
@@ -256,15 +586,24 @@ chirouter_pending_arp_req_t* chirouter_arp_pending_req_add(chirouter_ctx_t *ctx,
 /* See arp.h */
 int chirouter_arp_pending_req_add_frame(chirouter_ctx_t *ctx, chirouter_pending_arp_req_t *pending_req, ethernet_frame_t *frame)
 {
-    withheld_frame_t *withheld = calloc(1, sizeof(withheld_frame_t));
+    chirouter_frame_buf_t *buf;
 
-    withheld->frame = calloc(1, sizeof(ethernet_frame_t));
-    withheld->frame->raw = calloc(1, frame->length);
-    memcpy(withheld->frame->raw, frame->raw, frame->length);
-    withheld->frame->length = frame->length;
-    withheld->frame->in_interface = frame->in_interface;
+    /* A frame can only be withheld once, since its buffer
+     * has a single withheld list node */
+    if (frame->buf != NULL && frame->buf->withheld.prev == NULL)
+    {
+        buf = chirouter_frame_buf_ref(frame->buf);
+    }
+    else
+    {
+        buf = chirouter_frame_buf_copy(&ctx->framepool, frame);
+        if (buf == NULL)
+        {
+            return 1;
+        }
+    }
 
-    DL_APPEND(pending_req->withheld_frames, withheld);
+    DL_APPEND(pending_req->withheld_frames, &buf->withheld);
 
     return 0;
 }
@@ -277,52 +616,135 @@ int chirouter_arp_pending_req_free_frames(chirouter_pending_arp_req_t *pending_r
 
     DL_FOREACH_SAFE(pending_req->withheld_frames, elt, tmp)
     {
-        free(elt->frame->raw);
-        free(elt->frame);
         DL_DELETE(pending_req->withheld_frames, elt);
-        free(elt);
+        elt->prev = elt->next = NULL;
+        chirouter_frame_buf_put(elt->frame->buf);
     }
 
     return 0;
 }
 
 
+/* See arp.h */
+void chirouter_arp_pending_req_remove(chirouter_ctx_t *ctx, chirouter_pending_arp_req_t *pending_req)
+{
+    chirouter_arp_pending_req_free_frames(pending_req);
+    DL_DELETE(ctx->pending_arp_reqs, pending_req);
+
+    pending_req->prev = NULL;
+    pending_req->next = ctx->free_pending_arp_reqs;
+    ctx->free_pending_arp_reqs = pending_req;
+}
+
+
+/* See arp.h */
+int chirouter_arp_parse_schedule(const char *str, uint32_t *schedule, unsigned int *len)
+{
+    const char *p = str;
+    unsigned int n = 0;
+
+    while (true)
+    {
+        char *end;
+        long wait = strtol(p, &end, 10);
+
+        if (end == p || wait <= 0 || wait > UINT32_MAX || n == ARP_MAX_RETRIES)
+        {
+            return 1;
+        }
+        schedule[n++] = (uint32_t) wait;
+
+        if (*end == '\0')
+        {
+            break;
+        }
+        else if (*end != ',')
+        {
+            return 1;
+        }
+        p = end + 1;
+    }
+
+    *len = n;
+    return 0;
+}
+
+
+/* See arp.h */
+void chirouter_arp_purge(chirouter_ctx_t *ctx, time_t curtime)
+{
+    for(int i = 0; i < ARPCACHE_SIZE; i++)
+    {
+        chirouter_arpcache_entry_t *cache_entry = &ctx->arpcache[i];
+        double entry_age = difftime(curtime, cache_entry->time_added);
+
+        if ((cache_entry->valid) && (entry_age > ARPCACHE_ENTRY_TIMEOUT)) {
+            cache_entry->valid = false;
+
+            /* Gateways are kept resolved: if the refresh failed,
+             * go back to broadcasting requests for it */
+            chirouter_interface_t *gw_iface = chirouter_arp_gateway_interface(ctx, &cache_entry->ip);
+            if (gw_iface != NULL && chirouter_arp_pending_req_lookup(ctx, &cache_entry->ip) == NULL) {
+                chirouter_arp_pending_req_add(ctx, &cache_entry->ip, gw_iface);
+            }
+        }
+        else if (cache_entry->valid) {
+            chirouter_arp_refresh_entry(ctx, cache_entry, curtime);
+        }
+    }
+}
+
+
+/* See arp.h */
+void chirouter_arp_process_pending_reqs(chirouter_ctx_t *ctx, uint64_t now)
+{
+    chirouter_pending_arp_req_t *elt, *tmp;
+
+    DL_FOREACH_SAFE(ctx->pending_arp_reqs, elt, tmp)
+    {
+        if(elt->next_send > now)
+            continue;
+
+        if(chirouter_arp_process_pending_req(ctx, elt) == ARP_REQ_REMOVE)
+        {
+            chirouter_arp_pending_req_remove(ctx, elt);
+        }
+    }
+}
+
+
 /* See arp.h */
 void* chirouter_arp_process(void *args)
 {
     chirouter_ctx_t *ctx = (chirouter_ctx_t *) args;
 
-    while (1) {
-        sleep(1.0);
+    struct timespec tick;
+    tick.tv_sec = 0;
+    tick.tv_nsec = ARP_TICK_MS * 1000000L;
+    time_t last_purge = time(NULL);
+
+    chirouter_arp_resolve_gateways(ctx);
+
+    while (!atomic_load(&ctx->arp_thread_stop)) {
+        nanosleep(&tick, NULL);
+
+        if (atomic_load(&ctx->arp_thread_stop))
+            break;
 
         pthread_mutex_lock(&(ctx->lock_arp));
 
-        /* Purge the cache */
+        /* Purge the cache (once per second) */
         time_t curtime = time(NULL);
-        for(int i = 0; i < ARPCACHE_SIZE; i++)
+        if (curtime != last_purge)
         {
-            chirouter_arpcache_entry_t *cache_entry = &ctx->arpcache[i];
-            double entry_age = difftime(curtime, cache_entry->time_added);
-
-            if ((cache_entry->valid) && (entry_age > ARPCACHE_ENTRY_TIMEOUT)) {
-                cache_entry->valid = false;
-            }
+            chirouter_arp_purge(ctx, curtime);
+            last_purge = curtime;
         }
 
-        /* Process pending ARP requests */
+        /* Process pending ARP requests that are due */
         if (ctx->pending_arp_reqs != NULL)
         {
-            chirouter_pending_arp_req_t *elt, *tmp;
-
-            DL_FOREACH_SAFE(ctx->pending_arp_reqs, elt, tmp)
-            {
-                if(chirouter_arp_process_pending_req(ctx, elt) == ARP_REQ_REMOVE)
-                {
-                    chirouter_arp_pending_req_free_frames(elt);
-                    DL_DELETE(ctx->pending_arp_reqs, elt);
-                    free(elt);
-                }
-            }
+            chirouter_arp_process_pending_reqs(ctx, chirouter_now_ms());
         }
 
         pthread_mutex_unlock(&(ctx->lock_arp));
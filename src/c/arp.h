@@ -7,8 +7,10 @@
  *  Most importantly, this module defines a function chirouter_arp_process
  *  that is run as a separate thread, and which will wake up every second
  *  to purge stale entries in the ARP cache (entries that are more than 15 seconds
- *  old) and to traverse the list of pending ARP requests. For each pending
- *  request in the list, it will call chirouter_arp_process_pending_req,
+ *  old) and to re-validate entries that are still in use before they expire.
+ *  The thread also wakes up several times per second to traverse the list
+ *  of pending ARP requests. For each pending request that is due to be
+ *  re-sent, it will call chirouter_arp_process_pending_req,
  *  which must either re-send the pending ARP request or cancel the
  *  request and send ICMP Host Unreachable messages in reply to all
  *  the withheld frames.
@@ -68,6 +70,24 @@
 #include <pthread.h>
 #include "chirouter.h"
 
+/*
+ * chirouter_send_arp_message - Send an ARP request or reply
+ *
+ * ctx: Router context
+ *
+ * out_interface: Interface to send the ARP message on
+ *
+ * dst_mac: For replies, MAC address of the host we are replying to.
+ *          For requests, NULL to broadcast the request, or the MAC
+ *          address of a cached entry to send a unicast request
+ *          (used to re-validate entries that are about to expire)
+ *
+ * dst_ip: IP address of the target (network order)
+ *
+ * type: ARP_OP_REQUEST or ARP_OP_REPLY
+ *
+ * Returns: nothing
+ */
 void chirouter_send_arp_message(chirouter_ctx_t *ctx, chirouter_interface_t *out_interface, 
                                                 uint8_t *dst_mac, uint32_t dst_ip, int type);
 
@@ -98,13 +118,41 @@ chirouter_arpcache_entry_t* chirouter_arp_cache_lookup(chirouter_ctx_t *ctx, str
  * ctx: Router context
  *
  * ip, mac: IP address (and MAC address corresponding to that IP address)
- *          to be added to the cache.
- *
- * Returns: 0 on success, 1 on error.
+ *          to be added to the cache. If the cache already contains a
+ *          valid entry for the IP address, that entry is updated
+ *          and re-validated instead of adding a duplicate entry
+ *          (unless it is a static entry, which is left as is).
+ *          If the cache is full, the least recently used entry
+ *          is evicted (entries for gateways are never evicted).
+ *
+ * Returns: 0 on success, 1 if the cache is full of gateway entries.
  */
 int chirouter_arp_cache_add(chirouter_ctx_t *ctx, struct in_addr *ip, uint8_t *mac);
 
 
+/*
+ * chirouter_arp_cache_add_permanent - Add a static ARP entry
+ *
+ * Static entries are kept in a table of their own (which grows as
+ * needed), not in the ARP cache. This function must only be called
+ * while the router is being configured, since growing the table
+ * moves its entries.
+ *
+ * Note: The lock_arp mutex in the router context must be locked before
+ *       calling this function
+ *
+ * ctx: Router context
+ *
+ * ip, mac: IP address (and MAC address corresponding to that IP address)
+ *          of the static entry. If there is already a static entry for
+ *          the IP address, it is updated. If the ARP cache contains
+ *          an entry for the IP address, it is removed from the cache.
+ *
+ * Returns: 0 on success, 1 if the table can't be grown.
+ */
+int chirouter_arp_cache_add_permanent(chirouter_ctx_t *ctx, struct in_addr *ip, uint8_t *mac);
+
+
 /*
  * chirouter_arp_pending_req_lookup - Look up a pending ARP request by IP
  *
@@ -139,11 +187,35 @@ chirouter_pending_arp_req_t* chirouter_arp_pending_req_lookup(chirouter_ctx_t *c
  * iface: Router interface on which the ARP request was sent.
  *
  * Returns: A pointer to the pending request (a chirouter_pending_arp_req_t struct)
- *          that was added to the pending ARP request list.
+ *          that was added to the pending ARP request list, or NULL if
+ *          memory for the request could not be allocated.
  */
 chirouter_pending_arp_req_t* chirouter_arp_pending_req_add(chirouter_ctx_t *ctx, struct in_addr *ip, chirouter_interface_t *iface);
 
 
+/*
+ * chirouter_arp_pending_req_send - Send (or re-send) a pending ARP request
+ *
+ * ARP requests are paced on each interface using a token bucket
+ * (see the -r and -b command-line options). If the interface's rate
+ * allows it, the request is broadcast, its times_sent and last_sent
+ * fields are updated, and its next retransmission is scheduled according
+ * to the router's ARP schedule (with +/-10% jitter, so retransmissions for
+ * many addresses don't all happen at once). Otherwise, the request stays due and the ARP thread will
+ * send it as soon as the rate allows it.
+ *
+ * Note: The lock_arp mutex in the router context must be locked before
+ *       calling this function.
+ *
+ * ctx: Router context
+ *
+ * pending_req: Pending ARP request
+ *
+ * Returns: true if the request was sent, false if it was deferred.
+ */
+bool chirouter_arp_pending_req_send(chirouter_ctx_t *ctx, chirouter_pending_arp_req_t *pending_req);
+
+
 /*
  * chirouter_arp_pending_req_add_frame - Add an Ethernet frame to a pending ARP request list
  *
@@ -154,8 +226,10 @@ chirouter_pending_arp_req_t* chirouter_arp_pending_req_add(chirouter_ctx_t *ctx,
  *
  * pending_req: Pending request that the frame should be added to.
  *
- * frame: Frame to be added. Note: This function will make a deep copy of the frame
- *        and will add that copy to the list of withheld frames.
+ * frame: Frame to be added. Note: If the frame is stored in a frame pool buffer,
+ *        this function takes a reference to that buffer. Otherwise, it copies
+ *        the frame into a buffer from the router's frame pool (see framepool.h).
+ *        Either way, the caller can keep using (or release) its own frame.
  *
  * Returns: 0 on success, 1 on error.
  */
@@ -165,6 +239,10 @@ int chirouter_arp_pending_req_add_frame(chirouter_ctx_t *ctx, chirouter_pending_
 /*
  * chirouter_arp_pending_req_free_frames - Frees all the frames associated with a pending ARP request
  *
+ * Drops the pending request's reference to each of its withheld frames
+ * (returning their buffers to the frame pool, unless they are still
+ * referenced elsewhere)
+ *
  * Note: The lock_arp mutex in the router context must be locked before
  *       calling this function.
  *
@@ -175,6 +253,120 @@ int chirouter_arp_pending_req_add_frame(chirouter_ctx_t *ctx, chirouter_pending_
 int chirouter_arp_pending_req_free_frames(chirouter_pending_arp_req_t *pending_req);
 
 
+/*
+ * chirouter_arp_pending_req_remove - Remove a pending ARP request
+ *
+ * Frees the request's withheld frames (see chirouter_arp_pending_req_free_frames),
+ * removes the request from the list of pending ARP requests, and keeps
+ * it so it can be reused by chirouter_arp_pending_req_add. The request
+ * must not be used after calling this function.
+ *
+ * Note: The lock_arp mutex in the router context must be locked before
+ *       calling this function.
+ *
+ * ctx: Router context
+ *
+ * pending_req: Pending ARP request
+ *
+ * Returns: nothing
+ */
+void chirouter_arp_pending_req_remove(chirouter_ctx_t *ctx, chirouter_pending_arp_req_t *pending_req);
+
+
+/*
+ * chirouter_arp_gateway_interface - Check whether an IP address is a gateway
+ *
+ * ctx: Router context
+ *
+ * ip: IP address
+ *
+ * Returns: If the IP address is the gateway of an entry in the routing table,
+ *          returns the interface of that entry (i.e., the interface through
+ *          which the gateway is reached). Otherwise, returns NULL.
+ */
+chirouter_interface_t* chirouter_arp_gateway_interface(chirouter_ctx_t *ctx, struct in_addr *ip);
+
+
+/*
+ * chirouter_arp_resolve_gateways - Send ARP requests for all the gateways
+ *
+ * Adds a pending ARP request for every distinct non-zero gateway in the
+ * routing table (unless it is already cached or pending), and sends as
+ * many of them as the interfaces' ARP rate allows; the rest are sent by
+ * the ARP thread as the rate allows. This is done once, when the ARP
+ * thread starts, so that next hops are resolved before the first frames
+ * need them.
+ *
+ * Note: The lock_arp mutex must NOT be locked when calling this function
+ *
+ * ctx: Router context
+ *
+ * Returns: nothing
+ */
+void chirouter_arp_resolve_gateways(chirouter_ctx_t *ctx);
+
+
+/*
+ * chirouter_arp_parse_schedule - Parse an ARP retransmission schedule
+ *
+ * Parses a comma-separated list of waits, in milliseconds
+ * (e.g., "50,100,200,400,800"). See the arp_schedule field
+ * of server_ctx_t for how the schedule is used.
+ *
+ * str: String to parse
+ *
+ * schedule: Array of (at least) ARP_MAX_RETRIES elements where the
+ *           parsed schedule will be stored
+ *
+ * len: Pointer to where the number of parsed waits will be stored
+ *
+ * Returns: 0 on success, 1 if the string is not a valid schedule
+ *          (an empty list, a non-positive or non-numeric wait, or more
+ *          than ARP_MAX_RETRIES waits)
+ */
+int chirouter_arp_parse_schedule(const char *str, uint32_t *schedule, unsigned int *len);
+
+
+/*
+ * chirouter_arp_purge - Purge the ARP cache
+ *
+ * Removes the entries that are more than ARPCACHE_ENTRY_TIMEOUT seconds
+ * old (adding a pending ARP request for the ones that are gateways, so
+ * they are resolved again), and re-validates the ones that are about to
+ * expire (see chirouter_arp_refresh_entry). Static entries are not in
+ * the cache, so they never expire. The ARP thread calls this function
+ * once per second.
+ *
+ * Note: The lock_arp mutex must be locked when calling this function
+ *
+ * ctx: Router context
+ *
+ * curtime: Current time
+ *
+ * Returns: nothing
+ */
+void chirouter_arp_purge(chirouter_ctx_t *ctx, time_t curtime);
+
+
+/*
+ * chirouter_arp_process_pending_reqs - Process the pending ARP requests that are due
+ *
+ * Re-sends (as the interfaces' ARP rate allows) or abandons every pending
+ * ARP request whose next_send time has come (see
+ * chirouter_arp_process_pending_req). The ARP thread calls this function
+ * several times per second.
+ *
+ * Note: The lock_arp mutex must be locked when calling this function
+ *
+ * ctx: Router context
+ *
+ * now: Current time (see chirouter_now_ms)
+ *
+ * Returns: nothing
+ */
+void chirouter_arp_process_pending_reqs(chirouter_ctx_t *ctx, uint64_t now);
+
+
 /* DO NOT USE THIS FUNCTION */
 /* This is the thread function that periodically purges the ARP cache
  * and processes the pending ARP requests. The thread is created in server.c */
@@ -58,6 +58,7 @@
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 #include "protocols/ethernet.h"
@@ -65,6 +66,7 @@
 #include "protocols/ipv4.h"
 #include "protocols/icmp.h"
 #include "log.h"
+#include "arena.h"
 
 #define MAX_ROUTER_NAMELEN (8u)
 #define MAX_IFACE_NAMELEN (32u)
@@ -72,9 +74,19 @@
 #define MAX_NUM_RTABLE_ENTRIES (65536u)
 #define ARPCACHE_SIZE (100u)
 #define ARPCACHE_ENTRY_TIMEOUT (15u)
+#define ARPCACHE_REFRESH_AHEAD (3u)
+#define ARP_STATIC_INITIAL_SIZE (64u)
+#define ARP_MAX_RETRIES (16u)
+#define FRAMEPOOL_BUFS_PER_INTERFACE (8u)
+#define FRAMEPOOL_MIN_GROW (16u)
+#define FRAME_BUF_ALIGN (64u)
 
 
 typedef struct server_ctx server_ctx_t;
+typedef struct server_conn server_conn_t;
+typedef struct chirouter_drr_queue chirouter_drr_queue_t;
+typedef struct chirouter_vector chirouter_vector_t;
+typedef struct chirouter_port chirouter_port_t;
 
 
 /* Represents a single Ethernet interface */
@@ -97,6 +109,16 @@ typedef struct chirouter_interface
     /* Interface ID for capture file */
     uint32_t pcap_iface_id;
 
+    /* Linux interface this interface is bound to, when chirouter routes
+     * Linux interfaces itself (see dataplane.h), or NULL if its frames
+     * are exchanged with a controller */
+    chirouter_port_t *port;
+
+    /* Token bucket used to pace the ARP requests sent on this
+     * interface (protected by the router's lock_arp mutex) */
+    double arp_tokens;
+    uint64_t arp_tokens_updated;
+
 } chirouter_interface_t;
 
 
@@ -111,6 +133,12 @@ typedef struct ethernet_frame
 
     /* Interface on which the frame arrived */
     chirouter_interface_t *in_interface;
+
+    /* Frame pool buffer that "raw" points into, or NULL if the frame
+     * is stored somewhere else (e.g., in the server's receive buffer,
+     * in which case it is only valid until chirouter_process_ethernet_frame
+     * returns). See framepool.h */
+    struct chirouter_frame_buf *buf;
 } ethernet_frame_t;
 
 
@@ -143,14 +171,31 @@ typedef struct chirouter_arpcache_entry
     /* IP address */
     struct in_addr ip;
 
-    /* Time when this entry was created */
+    /* Time when this entry was created (or last re-validated
+     * by an ARP reply) */
     time_t time_added;
 
+    /* Time when this entry was last used to forward a frame.
+     * Entries used since they were added are refreshed with
+     * a unicast ARP request shortly before they expire. */
+    time_t time_used;
+
     /* Is this a valid entry?
      * If an entry is not valid, this means
      * it is available and can be used to store
      * a new (valid) entry. */
     bool valid;
+
+    /* Is this the entry for a gateway in the routing table?
+     * Pinned entries are always refreshed before they expire,
+     * and are never evicted to make room for other entries. */
+    bool pinned;
+
+    /* Is this a static entry (provided by the controller or
+     * in a neighbor file)? Permanent entries are kept in the
+     * router's table of static entries, not in the ARP cache:
+     * they never expire, and are not updated by ARP messages. */
+    bool permanent;
 } chirouter_arpcache_entry_t;
 
 
@@ -166,6 +211,50 @@ typedef struct withheld_frame
     struct withheld_frame *next;
 } withheld_frame_t;
 
+
+/* A preallocated buffer that can hold one Ethernet frame. Buffers
+ * are reference-counted, so the same frame can be held (e.g., withheld
+ * in a pending ARP request and queued for transmission) without being
+ * copied. See framepool.h */
+typedef struct chirouter_frame_buf
+{
+    /* Number of references to this buffer */
+    atomic_uint refcount;
+
+    /* Pool the buffer belongs to */
+    struct chirouter_framepool *pool;
+
+    /* Next buffer in the pool's free list */
+    struct chirouter_frame_buf *next_free;
+
+    /* The frame stored in this buffer (frame.raw points to data) */
+    ethernet_frame_t frame;
+
+    /* List node used to withhold the frame in a pending ARP request */
+    withheld_frame_t withheld;
+
+    /* Frame contents */
+    uint8_t data[ETHER_FRAME_MAX_LEN] __attribute__ ((aligned (FRAME_BUF_ALIGN)));
+} chirouter_frame_buf_t;
+
+
+/* A per-router pool of frame buffers */
+typedef struct chirouter_framepool
+{
+    /* Arena the buffers are allocated from */
+    chirouter_arena_t *arena;
+
+    /* Number of buffers in the pool */
+    unsigned int size;
+
+    /* Free buffers */
+    chirouter_frame_buf_t *free_list;
+    unsigned int num_free;
+
+    /* Protects the free list */
+    pthread_mutex_t lock;
+} chirouter_framepool_t;
+
 /* Represents a pending ARP request for which
  * we have not yet received an ARP reply */
 typedef struct chirouter_pending_arp_req
@@ -177,9 +266,15 @@ typedef struct chirouter_pending_arp_req
     chirouter_interface_t *out_interface;
 
     /* The number of times this ARP request has been sent,
-     * and the last time we sent the request */
+     * and the last time we sent the request (in milliseconds,
+     * see chirouter_now_ms) */
     uint32_t times_sent;
-    time_t last_sent;
+    uint64_t last_sent;
+
+    /* When the request is next due to be (re)sent, in milliseconds
+     * (see chirouter_now_ms). If the interface's ARP rate does not
+     * allow sending it by then, it is sent as soon as it does. */
+    uint64_t next_send;
 
     /* List of Ethernet frames containing IP datagrams destined
      * to "ip", but which we cannot yet send because we do not
@@ -215,20 +310,48 @@ typedef struct chirouter_ctx
     /* ARP cache */
     chirouter_arpcache_entry_t arpcache[ARPCACHE_SIZE];
 
+    /* Static ARP entries, in a hash table (with open addressing,
+     * indexed by IP address) of static_arp_size entries, a power of
+     * two. The table grows as static entries are added, so they
+     * don't take up room in the ARP cache, and any number of them
+     * fit. Static entries are only added while the router is being
+     * configured, so the table never moves once frames are being
+     * forwarded (see chirouter_arp_cache_add_permanent). */
+    chirouter_arpcache_entry_t *static_arp;
+    uint32_t static_arp_size;
+    uint32_t num_static_arp;
+
     /* List of pending ARP requests */
     chirouter_pending_arp_req_t* pending_arp_reqs;
 
+    /* Pending ARP requests that have been removed and can be
+     * reused (see chirouter_arp_pending_req_remove) */
+    chirouter_pending_arp_req_t* free_pending_arp_reqs;
+
 
     /* Mutex to protect both the ARP cache and the list of
      * pending ARP requests. Lock this mutex if *either* of
      * these data structures are going to be used */
     pthread_mutex_t lock_arp;
 
+    /* Pool of frame buffers, used to hold frames that must outlive
+     * the call to chirouter_process_ethernet_frame (see framepool.h) */
+    chirouter_framepool_t framepool;
+
 
     /*** NOTE: You should NOT use or modify the fields below ***/
 
+    /* Arena that all of the router's data structures are allocated
+     * from, so they can all be freed at once (see arena.h) */
+    chirouter_arena_t arena;
+
     /* ARP thread */
     pthread_t arp_thread;
+    bool arp_thread_started;
+    atomic_bool arp_thread_stop;
+
+    /* Seed used to add jitter to ARP retransmissions */
+    unsigned int arp_seed;
 
     /* Used during configuration of router */
     uint16_t max_interfaces;
@@ -239,6 +362,33 @@ typedef struct chirouter_ctx
 
     /* Server context */
     server_ctx_t *server;
+
+    /* Connection to the controller that owns this router */
+    server_conn_t *conn;
+
+    /* Worker thread that processes this router's frames in worker-pool
+     * mode (see worker.h), the number of frames handed to the workers,
+     * and the number of those frames that have been processed */
+    unsigned int worker;
+    uint64_t frames_dispatched;
+    atomic_uint_fast64_t frames_done;
+
+    /* Time spent processing this router's frames (in nanoseconds), its
+     * value at the last rebalancing, and the difference between them */
+    atomic_uint_fast64_t busy_ns;
+    uint64_t busy_ns_last;
+    uint64_t load;
+
+    /* Fair scheduling only (see drr.h): queue of frames received for
+     * this router that have not been processed yet, the router's weight,
+     * and how many bytes of frames it can still be served in its turn */
+    chirouter_drr_queue_t *inq;
+    unsigned int drr_weight;
+    size_t drr_deficit;
+
+    /* Vector mode only (see vector.h): frames received for this router
+     * that will be processed together as a single vector */
+    chirouter_vector_t *vec;
 } chirouter_ctx_t;
 
 
@@ -268,10 +418,12 @@ int chirouter_send_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uin
 
 int chirouter_ctx_init(chirouter_ctx_t *ctx);
 int chirouter_ctx_load_rtable(chirouter_ctx_t *ctx, const char* rtable_filename);
+int chirouter_ctx_load_neighbors(chirouter_ctx_t *ctx, const char* neighbors_filename);
 int chirouter_ctx_add_iface(chirouter_ctx_t *ctx, const char* iface, uint8_t mac[ETHER_ADDR_LEN], struct in_addr *ip);
 void chirouter_ctx_log(chirouter_ctx_t *ctx, loglevel_t loglevel);
 int chirouter_ctx_destroy(chirouter_ctx_t *ctx);
 
 int chirouter_process_ethernet_frame(chirouter_ctx_t *ctx, ethernet_frame_t *frame);
+chirouter_rtable_entry_t* chirouter_rtable_lookup(chirouter_ctx_t *ctx, uint32_t ip);
 
 #endif
@@ -54,10 +54,14 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include "utlist.h"
 #include "chirouter.h"
 #include "log.h"
 #include "arp.h"
+#include "alloc.h"
+#include "framepool.h"
 
 /*
  * chirouter_ctx_init - Initializes a router context
@@ -70,7 +74,98 @@ int chirouter_ctx_init(chirouter_ctx_t *ctx)
 {
     pthread_mutex_init(&ctx->lock_arp, NULL);
 
+    chirouter_arena_init(&ctx->arena);
+
+    chirouter_framepool_init(&ctx->framepool, &ctx->arena);
+
     ctx->pending_arp_reqs = NULL;
+    ctx->free_pending_arp_reqs = NULL;
+
+    ctx->static_arp = NULL;
+    ctx->static_arp_size = 0;
+    ctx->num_static_arp = 0;
+
+    ctx->arp_thread_started = false;
+    atomic_init(&ctx->arp_thread_stop, false);
+    atomic_init(&ctx->frames_done, 0);
+    atomic_init(&ctx->busy_ns, 0);
+    ctx->arp_seed = (unsigned int) (time(NULL) ^ (uintptr_t) ctx);
+
+    return 0;
+}
+
+
+/*
+ * chirouter_ctx_load_neighbors - Load static ARP entries from a file
+ *
+ * The file contains one entry per line, with the name of the router,
+ * the IP address, and the MAC address, separated by whitespace:
+ *
+ *     r1  10.0.0.2  02:00:00:00:00:02
+ *
+ * Blank lines and lines starting with '#' are ignored. Only the
+ * entries for this router are added to its ARP cache.
+ *
+ * ctx: Router context
+ *
+ * neighbors_filename: Path to the neighbor file
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ */
+int chirouter_ctx_load_neighbors(chirouter_ctx_t *ctx, const char* neighbors_filename)
+{
+    FILE *f;
+    char line[256], name[MAX_ROUTER_NAMELEN + 1], ip_str[INET_ADDRSTRLEN];
+    unsigned int mac[ETHER_ADDR_LEN];
+    int lineno = 0, nentries = 0;
+
+    f = fopen(neighbors_filename, "r");
+    if(f == NULL)
+    {
+        chilog(ERROR, "Could not open neighbor file %s", neighbors_filename);
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->lock_arp);
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        struct in_addr ip;
+        uint8_t hwaddr[ETHER_ADDR_LEN];
+
+        lineno++;
+
+        if(line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+            continue;
+
+        if(sscanf(line, "%8s %15s %x:%x:%x:%x:%x:%x", name, ip_str,
+                  &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 8
+           || inet_pton(AF_INET, ip_str, &ip) != 1)
+        {
+            chilog(ERROR, "%s:%d: Invalid neighbor entry", neighbors_filename, lineno);
+            pthread_mutex_unlock(&ctx->lock_arp);
+            fclose(f);
+            return -1;
+        }
+
+        if(strcmp(name, ctx->name) != 0)
+            continue;
+
+        for(int i=0; i < ETHER_ADDR_LEN; i++)
+            hwaddr[i] = mac[i];
+
+        if(chirouter_arp_cache_add_permanent(ctx, &ip, hwaddr))
+        {
+            chilog(WARNING, "Router %s: Could not allocate static ARP entry for %s", ctx->name, ip_str);
+            continue;
+        }
+        nentries++;
+    }
+    pthread_mutex_unlock(&ctx->lock_arp);
+
+    fclose(f);
+
+    if(nentries > 0)
+        chilog(INFO, "Router %s: Loaded %d static ARP entries", ctx->name, nentries);
 
     return 0;
 }
@@ -124,15 +219,13 @@ void chirouter_ctx_log(chirouter_ctx_t *ctx, loglevel_t loglevel)
         {
             chirouter_rtable_entry_t *entry = &ctx->routing_table[i];
 
-            char* dest = strdup(inet_ntoa(entry->dest));
-            char* gw = strdup(inet_ntoa(entry->gw));
-            char* mask = strdup(inet_ntoa(entry->mask));
+            char dest[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN], mask[INET_ADDRSTRLEN];
 
-            chilog(loglevel, "%-16s%-16s%-16s%-16s", dest, gw, mask, entry->interface->name);
+            inet_ntop(AF_INET, &entry->dest, dest, sizeof(dest));
+            inet_ntop(AF_INET, &entry->gw, gw, sizeof(gw));
+            inet_ntop(AF_INET, &entry->mask, mask, sizeof(mask));
 
-            free(dest);
-            free(gw);
-            free(mask);
+            chilog(loglevel, "%-16s%-16s%-16s%-16s", dest, gw, mask, entry->interface->name);
         }
     }
 }
@@ -148,16 +241,32 @@ void chirouter_ctx_log(chirouter_ctx_t *ctx, loglevel_t loglevel)
  */
 int chirouter_ctx_destroy(chirouter_ctx_t *ctx)
 {
+    /* The ARP thread uses the router data structures,
+     * so wait for it to exit before freeing them */
+    if(ctx->arp_thread_started)
+    {
+        atomic_store(&ctx->arp_thread_stop, true);
+        pthread_join(ctx->arp_thread, NULL);
+        ctx->arp_thread_started = false;
+    }
+
     pthread_mutex_destroy(&ctx->lock_arp);
 
-    chirouter_pending_arp_req_t *elt, *tmp;
+    /* The interfaces, routing table, pending ARP requests, and frame
+     * buffers were all allocated from the arena, so there is no need
+     * to walk through them: releasing the arena frees all of them */
+    chirouter_framepool_destroy(&ctx->framepool);
+    chirouter_arena_destroy(&ctx->arena);
 
-    DL_FOREACH_SAFE(ctx->pending_arp_reqs, elt, tmp)
-    {
-        chirouter_arp_pending_req_free_frames(elt);
-        DL_DELETE(ctx->pending_arp_reqs, elt);
-        free(elt);
-    }
+    /* The table of static ARP entries grows, so it has its own allocation */
+    chirouter_free(ctx->static_arp);
+    ctx->static_arp = NULL;
+    ctx->static_arp_size = ctx->num_static_arp = 0;
+
+    ctx->interfaces = NULL;
+    ctx->routing_table = NULL;
+    ctx->pending_arp_reqs = NULL;
+    ctx->free_pending_arp_reqs = NULL;
 
     return 0;
 }
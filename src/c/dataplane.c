@@ -0,0 +1,733 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module lets chirouter route Linux interfaces itself, without
+ *  a controller.
+ *
+ *  See dataplane.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "dataplane.h"
+#include "alloc.h"
+#include "pcap.h"
+#include "arp.h"
+#include "framepool.h"
+#include "utils.h"
+#include "log.h"
+
+/* Longest line, and longest word in a line, of a configuration file */
+#define DATAPLANE_MAX_LINE (256)
+#define DATAPLANE_MAX_WORD (63)
+
+
+/*
+ * chirouter_dataplane_parse - Process the lines of a configuration file
+ *
+ * The file is read three times: the first time to count the routers,
+ * the second time to count the interfaces and routing table entries of
+ * each router (so they can be allocated), and the third time to fill
+ * them in. The syntax of each line is checked every time.
+ *
+ * dp: Data plane
+ *
+ * f: Configuration file
+ *
+ * filename: Path to the configuration file (used in log messages)
+ *
+ * pass: Pass (1, 2, or 3)
+ *
+ * Returns: 0 on success, -1 if the file is not valid
+ */
+static int chirouter_dataplane_parse(chirouter_dataplane_t *dp, FILE *f, const char *filename, int pass)
+{
+    char line[DATAPLANE_MAX_LINE], word[DATAPLANE_MAX_WORD + 1];
+    chirouter_ctx_t *r = NULL;
+    uint16_t num_routers = 0;
+    unsigned int num_ports = 0;
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+
+        if (line[0] == '#' || sscanf(line, "%63s", word) != 1)
+            continue;
+
+        if (!strcmp(word, "router"))
+        {
+            char name[DATAPLANE_MAX_WORD + 1];
+
+            if (sscanf(line, "%*s %63s", name) != 1 || strlen(name) > MAX_ROUTER_NAMELEN)
+            {
+                chilog(ERROR, "%s:%d: Invalid router (must be \"router NAME\", with at most %u characters "
+                              "in the name)", filename, lineno, MAX_ROUTER_NAMELEN);
+                return -1;
+            }
+
+            if (pass > 1)
+            {
+                r = &dp->routers[num_routers];
+                strcpy(r->name, name);
+                r->r_id = num_routers;
+            }
+            else
+            {
+                r = NULL;
+            }
+            num_routers++;
+        }
+        else if (!strcmp(word, "interface"))
+        {
+            char name[DATAPLANE_MAX_WORD + 1], ip_str[DATAPLANE_MAX_WORD + 1], ifname[DATAPLANE_MAX_WORD + 1];
+            unsigned int mac[ETHER_ADDR_LEN];
+            struct in_addr ip;
+
+            if (sscanf(line, "%*s %63s %x:%x:%x:%x:%x:%x %63s %63s", name, &mac[0], &mac[1], &mac[2],
+                       &mac[3], &mac[4], &mac[5], ip_str, ifname) != 9
+                || strlen(name) > MAX_IFACE_NAMELEN || strlen(ifname) >= IFNAMSIZ
+                || inet_pton(AF_INET, ip_str, &ip) != 1)
+            {
+                chilog(ERROR, "%s:%d: Invalid interface (must be \"interface NAME MAC IP LINUX_IFACE\")",
+                       filename, lineno);
+                return -1;
+            }
+
+            if (num_routers == 0)
+            {
+                chilog(ERROR, "%s:%d: Interface does not belong to any router", filename, lineno);
+                return -1;
+            }
+
+            if (pass == 2)
+            {
+                if (r->max_interfaces == UINT8_MAX + 1)
+                {
+                    chilog(ERROR, "%s:%d: Router %s has too many interfaces", filename, lineno, r->name);
+                    return -1;
+                }
+                r->max_interfaces++;
+            }
+            else if (pass == 3)
+            {
+                chirouter_interface_t *iface = &r->interfaces[r->num_interfaces];
+                chirouter_port_t *port = &dp->ports[num_ports];
+
+                strcpy(iface->name, name);
+                for (int i = 0; i < ETHER_ADDR_LEN; i++)
+                    iface->mac[i] = mac[i];
+                iface->ip = ip;
+                iface->pox_iface_id = r->num_interfaces;
+                iface->port = port;
+
+                port->dp = dp;
+                strcpy(port->ifname, ifname);
+                port->router = r;
+                port->iface = iface;
+
+                r->num_interfaces++;
+            }
+            num_ports++;
+        }
+        else if (!strcmp(word, "route"))
+        {
+            char dest_str[DATAPLANE_MAX_WORD + 1], mask_str[DATAPLANE_MAX_WORD + 1],
+                 gw_str[DATAPLANE_MAX_WORD + 1], name[DATAPLANE_MAX_WORD + 1];
+            struct in_addr dest, mask, gw;
+            unsigned int metric = 0;
+            int nfields;
+
+            nfields = sscanf(line, "%*s %63s %63s %63s %63s %u", dest_str, mask_str, gw_str, name, &metric);
+            if (nfields < 4 || metric > UINT16_MAX
+                || inet_pton(AF_INET, dest_str, &dest) != 1 || inet_pton(AF_INET, mask_str, &mask) != 1
+                || inet_pton(AF_INET, gw_str, &gw) != 1)
+            {
+                chilog(ERROR, "%s:%d: Invalid route (must be \"route DEST MASK GATEWAY IFACE [METRIC]\")",
+                       filename, lineno);
+                return -1;
+            }
+
+            if (num_routers == 0)
+            {
+                chilog(ERROR, "%s:%d: Route does not belong to any router", filename, lineno);
+                return -1;
+            }
+
+            if (pass == 2)
+            {
+                if (r->max_rtable_entries == UINT16_MAX)
+                {
+                    chilog(ERROR, "%s:%d: Router %s has too many routes", filename, lineno, r->name);
+                    return -1;
+                }
+                r->max_rtable_entries++;
+            }
+            else if (pass == 3)
+            {
+                chirouter_rtable_entry_t *rtentry = &r->routing_table[r->num_rtable_entries];
+
+                rtentry->interface = NULL;
+                for (int i = 0; i < r->num_interfaces; i++)
+                {
+                    if (!strcmp(r->interfaces[i].name, name))
+                        rtentry->interface = &r->interfaces[i];
+                }
+
+                if (rtentry->interface == NULL)
+                {
+                    chilog(ERROR, "%s:%d: Router %s has no interface %s (above this line)", filename, lineno,
+                           r->name, name);
+                    return -1;
+                }
+
+                rtentry->dest = dest;
+                rtentry->mask = mask;
+                rtentry->gw = gw;
+                rtentry->metric = metric;
+                r->num_rtable_entries++;
+            }
+        }
+        else
+        {
+            chilog(ERROR, "%s:%d: Unknown keyword %s", filename, lineno, word);
+            return -1;
+        }
+    }
+
+    if (pass == 1)
+    {
+        if (num_routers == 0 || num_routers > UINT8_MAX + 1)
+        {
+            chilog(ERROR, "%s: Must have between 1 and %u routers", filename, UINT8_MAX + 1);
+            return -1;
+        }
+        dp->num_routers = num_routers;
+    }
+    else if (pass == 2)
+    {
+        dp->num_ports = num_ports;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_dataplane_load - Load the routers from a configuration file
+ *
+ * dp: Data plane
+ *
+ * filename: Path to the configuration file
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+static int chirouter_dataplane_load(chirouter_dataplane_t *dp, const char *filename)
+{
+    FILE *f;
+    int rc = 0;
+
+    f = fopen(filename, "r");
+    if (f == NULL)
+    {
+        chilog(ERROR, "Could not open configuration file %s", filename);
+        return -1;
+    }
+
+    for (int pass = 1; pass <= 3 && rc == 0; pass++)
+    {
+        rewind(f);
+        rc = chirouter_dataplane_parse(dp, f, filename, pass);
+        if (rc)
+            break;
+
+        if (pass == 1)
+        {
+            dp->routers = chirouter_calloc(dp->num_routers, sizeof(chirouter_ctx_t));
+            if (dp->routers == NULL)
+            {
+                dp->num_routers = 0;
+                rc = -1;
+                break;
+            }
+
+            for (int i = 0; i < dp->num_routers && rc == 0; i++)
+            {
+                rc = chirouter_ctx_init(&dp->routers[i]);
+                dp->routers[i].server = dp->server;
+                dp->routers[i].conn = NULL;
+            }
+        }
+        else if (pass == 2)
+        {
+            dp->ports = chirouter_calloc(dp->num_ports, sizeof(chirouter_port_t));
+            if (dp->num_ports > 0 && dp->ports == NULL)
+            {
+                dp->num_ports = 0;
+                rc = -1;
+            }
+
+            for (int i = 0; i < dp->num_routers && rc == 0; i++)
+            {
+                chirouter_ctx_t *r = &dp->routers[i];
+
+                r->interfaces = chirouter_arena_alloc(&r->arena, r->max_interfaces, sizeof(chirouter_interface_t),
+                                                      _Alignof(chirouter_interface_t));
+                r->routing_table = chirouter_arena_alloc(&r->arena, r->max_rtable_entries,
+                                                         sizeof(chirouter_rtable_entry_t),
+                                                         _Alignof(chirouter_rtable_entry_t));
+                if ((r->max_interfaces > 0 && r->interfaces == NULL) ||
+                    (r->max_rtable_entries > 0 && r->routing_table == NULL) ||
+                    chirouter_framepool_reserve(&r->framepool, FRAMEPOOL_BUFS_PER_INTERFACE * r->max_interfaces))
+                {
+                    chilog(CRITICAL, "Could not allocate memory for router %s", r->name);
+                    rc = -1;
+                }
+            }
+        }
+    }
+
+    fclose(f);
+
+    return rc;
+}
+
+
+/*
+ * chirouter_dataplane_port_open - Open a port
+ *
+ * port: Port
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+static int chirouter_dataplane_port_open(chirouter_port_t *port)
+{
+    int rc = -1;
+
+    switch (port->type)
+    {
+    case PORT_PACKET:
+        rc = chirouter_packet_open(&port->packet, port->ifname);
+        break;
+    case PORT_XDP:
+        rc = chirouter_xdp_open(&port->xdp, &port->dp->xdp_umem, port->ifname);
+        break;
+    case PORT_TAP:
+        rc = chirouter_tap_open(&port->tap, port->ifname);
+        break;
+    }
+
+    port->open = true;
+
+    return rc;
+}
+
+
+/*
+ * chirouter_dataplane_port_fd - Get the file descriptor to wait on for a port
+ *
+ * port: Port
+ *
+ * Returns: file descriptor
+ */
+static int chirouter_dataplane_port_fd(chirouter_port_t *port)
+{
+    switch (port->type)
+    {
+    case PORT_PACKET:
+        return port->packet.fd;
+    case PORT_XDP:
+        return port->xdp.fd;
+    case PORT_TAP:
+        return port->tap.fd;
+    }
+
+    return -1;
+}
+
+
+/*
+ * chirouter_dataplane_port_close - Close a port
+ *
+ * port: Port
+ *
+ * Returns: nothing
+ */
+static void chirouter_dataplane_port_close(chirouter_port_t *port)
+{
+    if (!port->open)
+        return;
+
+    switch (port->type)
+    {
+    case PORT_PACKET:
+        if (port->packet.tx_drops > 0 || port->packet.rx_truncated > 0)
+            chilog(INFO, "%s: %lu frames dropped (transmit ring full), %lu frames truncated",
+                   port->ifname, port->packet.tx_drops, port->packet.rx_truncated);
+        chirouter_packet_close(&port->packet);
+        break;
+    case PORT_XDP:
+        if (port->xdp.tx_drops > 0 || port->xdp.tx_zerocopy > 0)
+            chilog(INFO, "%s: %lu frames dropped (transmit ring full), %lu frames forwarded without copying",
+                   port->ifname, port->xdp.tx_drops, port->xdp.tx_zerocopy);
+        chirouter_xdp_close(&port->xdp);
+        break;
+    case PORT_TAP:
+        if (port->tap.tx_drops > 0 || port->tap.rx_truncated > 0)
+            chilog(INFO, "%s: %lu frames dropped (queue full), %lu frames truncated",
+                   port->ifname, port->tap.tx_drops, port->tap.rx_truncated);
+        chirouter_tap_close(&port->tap);
+        break;
+    }
+
+    port->open = false;
+}
+
+
+/*
+ * chirouter_dataplane_handle_frame - Process a frame received on a port
+ *
+ * arg: Port
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame
+ *
+ * Returns: 0 on success, -1 if a critical error happens
+ */
+static int chirouter_dataplane_handle_frame(void *arg, uint8_t *frame, size_t len)
+{
+    chirouter_port_t *port = arg;
+    ethhdr_t *hdr = (ethhdr_t *) frame;
+
+    /* Ports are in promiscuous mode, so they also receive the frames
+     * sent to other hosts on the link, which are none of our business */
+    if (len >= ETHER_HDR_LEN && !(hdr->dst[0] & 0x01) && !ethernet_addr_is_equal(hdr->dst, port->iface->mac))
+        return 0;
+
+    if (chirouter_server_process_ethernet_frame(port->router, port->iface, frame, len) == -1)
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * chirouter_dataplane_port_recv - Process the frames received on a port
+ *
+ * port: Port
+ *
+ * Returns: 0 on success, -1 if a critical error happens
+ */
+static int chirouter_dataplane_port_recv(chirouter_port_t *port)
+{
+    switch (port->type)
+    {
+    case PORT_PACKET:
+        return chirouter_packet_recv(&port->packet, chirouter_dataplane_handle_frame, port) == -1 ? -1 : 0;
+    case PORT_XDP:
+        return chirouter_xdp_recv(&port->xdp, chirouter_dataplane_handle_frame, port) == -1 ? -1 : 0;
+    case PORT_TAP:
+        return chirouter_tap_recv(&port->tap, chirouter_dataplane_handle_frame, port) == -1 ? -1 : 0;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_dataplane_port_flush - Send the frames queued on a port
+ *
+ * port: Port
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+static int chirouter_dataplane_port_flush(chirouter_port_t *port)
+{
+    switch (port->type)
+    {
+    case PORT_PACKET:
+        return chirouter_packet_flush(&port->packet);
+    case PORT_XDP:
+        return chirouter_xdp_flush(&port->xdp);
+    case PORT_TAP:
+        /* Frames are written right away */
+        return 0;
+    }
+
+    return 0;
+}
+
+
+/* See dataplane.h */
+int chirouter_dataplane_send(chirouter_port_t *port, uint8_t *frame, size_t len)
+{
+    bool flush = !pthread_equal(pthread_self(), port->dp->server->server_thread);
+    int rc = 0;
+
+    switch (port->type)
+    {
+    case PORT_PACKET:
+        rc = chirouter_packet_send(&port->packet, frame, len, flush);
+        break;
+    case PORT_XDP:
+        rc = chirouter_xdp_send(&port->xdp, frame, len, flush);
+        break;
+    case PORT_TAP:
+        rc = chirouter_tap_send(&port->tap, frame, len);
+        break;
+    }
+
+    if (rc == -1)
+    {
+        chilog(ERROR, "Frame of %zu bytes does not fit in the transmit ring of %s", len, port->ifname);
+        return 1;
+    }
+    else if (rc == 1)
+    {
+        chilog(DEBUG, "Could not queue frame on %s. Dropping frame.", port->ifname);
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_dataplane_destroy - Free a data plane
+ *
+ * Stops the routers' ARP threads, and closes all the ports (and
+ * frees the UMEM they share, if they are AF_XDP sockets).
+ *
+ * dp: Data plane
+ *
+ * Returns: nothing
+ */
+static void chirouter_dataplane_destroy(chirouter_dataplane_t *dp)
+{
+    /* The ARP threads send frames on the ports, so they
+     * must be stopped before the ports are closed */
+    for (int i = 0; i < dp->num_routers; i++)
+        chirouter_ctx_destroy(&dp->routers[i]);
+
+    for (unsigned int i = 0; i < dp->num_ports; i++)
+        chirouter_dataplane_port_close(&dp->ports[i]);
+
+    if (dp->xdp_umem_init)
+        chirouter_xdp_umem_destroy(&dp->xdp_umem);
+
+    if (dp->epoll_fd != -1)
+        close(dp->epoll_fd);
+
+    chirouter_free(dp->ports);
+    chirouter_free(dp->routers);
+    chirouter_free(dp);
+}
+
+
+/* See dataplane.h */
+int chirouter_dataplane_run(server_ctx_t *ctx, const char *config_file, chirouter_port_type_t type)
+{
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    chirouter_dataplane_t *dp;
+    int nevents, rc;
+
+    dp = chirouter_calloc(1, sizeof(chirouter_dataplane_t));
+    if (dp == NULL)
+        return -1;
+    dp->server = ctx;
+    dp->epoll_fd = -1;
+
+    /* The server thread processes all the frames, and
+     * is the only thread that can delay sending them */
+    ctx->server_thread = pthread_self();
+    ctx->writer_thread = ctx->server_thread;
+
+    if (chirouter_dataplane_load(dp, config_file))
+    {
+        chilog(CRITICAL, "Could not load configuration file %s", config_file);
+        chirouter_dataplane_destroy(dp);
+        return -1;
+    }
+
+    chilog(INFO, "Loaded %i routers from %s", dp->num_routers, config_file);
+    chilog(INFO, "--------------------------------------------------------------------------------");
+    for (int i = 0; i < dp->num_routers; i++)
+    {
+        chirouter_ctx_t *r = &dp->routers[i];
+
+        if (ctx->neighbors_file && chirouter_ctx_load_neighbors(r, ctx->neighbors_file))
+        {
+            chilog(CRITICAL, "Could not load neighbor file %s", ctx->neighbors_file);
+            chirouter_dataplane_destroy(dp);
+            return -1;
+        }
+
+        chirouter_ctx_log(r, INFO);
+        chilog(INFO, "--------------------------------------------------------------------------------");
+    }
+
+    if (ctx->pcap)
+        chirouter_pcap_write_interfaces(ctx, dp->routers, dp->num_routers);
+
+    dp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (dp->epoll_fd == -1)
+    {
+        chilog(CRITICAL, "Could not create epoll instance");
+        chirouter_dataplane_destroy(dp);
+        return -1;
+    }
+
+    /* AF_XDP sockets need kernel (and kernel header) support that AF_PACKET
+     * sockets don't, so we fall back to AF_PACKET sockets if we can't use
+     * them (we can only find out when binding the first port, since XDP
+     * programs can only be attached by privileged users) */
+    if (type == PORT_XDP)
+    {
+        if (chirouter_xdp_umem_init(&dp->xdp_umem, dp->num_ports) == 0)
+        {
+            dp->xdp_umem_init = true;
+        }
+        else
+        {
+            chilog(WARNING, "AF_XDP sockets are not available (%s). Using AF_PACKET sockets instead.", strerror(errno));
+            chirouter_xdp_umem_destroy(&dp->xdp_umem);
+            type = PORT_PACKET;
+        }
+    }
+
+    for (unsigned int i = 0; i < dp->num_ports; i++)
+    {
+        chirouter_port_t *port = &dp->ports[i];
+        struct epoll_event ev;
+
+        port->type = type;
+        rc = chirouter_dataplane_port_open(port);
+        if (rc == -1 && i == 0 && type == PORT_XDP)
+        {
+            chilog(WARNING, "Could not bind AF_XDP socket to Linux interface %s (%s). "
+                            "Using AF_PACKET sockets instead.", port->ifname, strerror(errno));
+            chirouter_dataplane_port_close(port);
+            chirouter_xdp_umem_destroy(&dp->xdp_umem);
+            dp->xdp_umem_init = false;
+            port->type = type = PORT_PACKET;
+            rc = chirouter_dataplane_port_open(port);
+        }
+
+        if (rc == -1)
+        {
+            chilog(CRITICAL, "Could not bind %s-%s to Linux interface %s: %s", port->router->name,
+                   port->iface->name, port->ifname, strerror(errno));
+            chirouter_dataplane_destroy(dp);
+            return -1;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = port;
+        if (epoll_ctl(dp->epoll_fd, EPOLL_CTL_ADD, chirouter_dataplane_port_fd(port), &ev) == -1)
+        {
+            chilog(CRITICAL, "Could not add Linux interface %s to epoll instance", port->ifname);
+            chirouter_dataplane_destroy(dp);
+            return -1;
+        }
+
+        chilog(INFO, "Bound %s-%s to Linux interface %s (%s)", port->router->name, port->iface->name,
+               port->ifname, port->type == PORT_XDP ? "AF_XDP socket" :
+               port->type == PORT_TAP ? "TAP device" : "AF_PACKET socket");
+    }
+
+    /* The ARP threads start resolving the gateways right away,
+     * so they can only be started once the ports are open */
+    for (int i = 0; i < dp->num_routers; i++)
+    {
+        chirouter_ctx_t *r = &dp->routers[i];
+
+        pthread_create(&r->arp_thread, NULL, chirouter_arp_process, r);
+        r->arp_thread_started = true;
+    }
+
+    while (1)
+    {
+        nevents = epoll_wait(dp->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (nevents == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            chilog(CRITICAL, "epoll_wait() failed");
+            break;
+        }
+
+        for (int i = 0; i < nevents; i++)
+        {
+            chirouter_port_t *port = events[i].data.ptr;
+
+            if (chirouter_dataplane_port_recv(port) == -1)
+            {
+                chilog(CRITICAL, "Error when processing Ethernet frame received on %s", port->ifname);
+                chirouter_dataplane_destroy(dp);
+                return -1;
+            }
+        }
+
+        /* The frames received on one port are usually sent on
+         * another, so all the ports may have frames to send */
+        for (unsigned int i = 0; i < dp->num_ports; i++)
+        {
+            if (chirouter_dataplane_port_flush(&dp->ports[i]) == -1)
+                chilog(WARNING, "Could not send frames on %s: %s", dp->ports[i].ifname, strerror(errno));
+        }
+    }
+
+    chirouter_dataplane_destroy(dp);
+
+    return -1;
+}
@@ -0,0 +1,210 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module lets chirouter route Linux interfaces itself, without
+ *  a controller (see the -i option in main.c).
+ *
+ *  The routers are loaded from a configuration file, and each of their
+ *  interfaces is bound to a Linux interface (e.g., one end of a veth
+ *  pair, with the other end in a network namespace), which is accessed
+ *  through a "port" (an AF_PACKET socket, see packet.h, or an AF_XDP
+ *  socket, see xdp.h). Alternatively, each interface can be bound to a
+ *  TAP device (see tap.h), which is then the host's end of the link to
+ *  the router. The frames received on a port are processed by the same
+ *  code that processes the frames sent by a controller
+ *  (chirouter_server_process_ethernet_frame), and chirouter_send_frame
+ *  sends the frames of an interface that is bound to a port on that port.
+ *  With AF_XDP sockets, the frames are processed where the kernel put
+ *  them (in the UMEM), and the frames that are forwarded are rewritten
+ *  in place and sent from there, without copying them.
+ *
+ *  All the ports are handled by the server thread, which waits for
+ *  frames on all of them with epoll, processes all the frames it can,
+ *  and then tells the kernel to send all the frames that were queued on
+ *  each port while doing so. The ARP threads (see arp.h) send their
+ *  frames right away.
+ *
+ *  The configuration file describes each router with a "router" line,
+ *  followed by lines that describe its interfaces and its routing table:
+ *
+ *      # Router with two interfaces, bound to Linux interfaces veth1
+ *      # and veth2, and a default route through 10.0.2.254
+ *      router r1
+ *      interface eth1 02:00:00:00:01:01 10.0.1.1 veth1
+ *      interface eth2 02:00:00:00:01:02 10.0.2.1 veth2
+ *      route 10.0.1.0 255.255.255.0 0.0.0.0 eth1
+ *      route 10.0.2.0 255.255.255.0 0.0.0.0 eth2
+ *      route 0.0.0.0 0.0.0.0 10.0.2.254 eth2 10
+ *
+ *  An interface line contains the name, MAC address, and IP address of
+ *  the interface, and the name of the Linux interface it is bound to
+ *  (with TAP devices, the name of the TAP device).
+ *  A route line contains the destination, mask, gateway, and interface
+ *  of the entry, and optionally its metric (0 by default), and can only
+ *  refer to an interface defined above it. Blank lines and lines starting
+ *  with '#' are ignored.
+ *
+ *  The Linux interfaces should not be used by the host's network stack
+ *  (e.g., they should have no IP addresses), and should not use segmentation
+ *  or receive offloads (see ethtool -K), which could hand chirouter frames
+ *  that are larger than an Ethernet frame. With AF_XDP sockets, the hosts
+ *  on the other end of veth pairs should also not use checksum offload
+ *  (ethtool -K IFACE tx off): XDP programs see frames before the kernel
+ *  computes their checksums, and, unlike AF_PACKET sockets, AF_XDP sockets
+ *  don't tell chirouter which frames are missing them. TAP devices, on
+ *  the other hand, are meant to be used by the host's network stack
+ *  (e.g., after moving each of them to a different network namespace,
+ *  and giving them an IP address in the router interface's subnet).
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DATAPLANE_H
+#define DATAPLANE_H
+
+#include <net/if.h>
+
+#include "chirouter.h"
+#include "server.h"
+#include "packet.h"
+#include "xdp.h"
+#include "tap.h"
+
+/* How the Linux interfaces are accessed */
+typedef enum
+{
+    PORT_PACKET = 1,   // AF_PACKET socket with TPACKET_V3 rings
+    PORT_XDP = 2,      // AF_XDP socket (all the sockets share one UMEM)
+    PORT_TAP = 3       // TAP device (created if it doesn't exist)
+} chirouter_port_type_t;
+
+typedef struct chirouter_dataplane chirouter_dataplane_t;
+
+/* A router interface bound to a Linux interface */
+struct chirouter_port
+{
+    /* Data plane the port belongs to */
+    chirouter_dataplane_t *dp;
+
+    /* Name of the Linux interface */
+    char ifname[IFNAMSIZ];
+
+    /* Router, and router interface, the port is bound to */
+    chirouter_ctx_t *router;
+    chirouter_interface_t *iface;
+
+    /* How the Linux interface is accessed */
+    chirouter_port_type_t type;
+    chirouter_packet_t packet;
+    chirouter_xdp_t xdp;
+    chirouter_tap_t tap;
+
+    /* Whether the port has been opened (and must be closed) */
+    bool open;
+};
+
+/* The routers loaded from a configuration file, and their ports */
+struct chirouter_dataplane
+{
+    /* Server context (which has all the options that affect the routers) */
+    server_ctx_t *server;
+
+    /* Routers */
+    chirouter_ctx_t *routers;
+    uint16_t num_routers;
+
+    /* Ports (one for each interface of each router) */
+    chirouter_port_t *ports;
+    unsigned int num_ports;
+
+    /* UMEM shared by the AF_XDP sockets, if the ports use them */
+    chirouter_xdp_umem_t xdp_umem;
+    bool xdp_umem_init;
+
+    /* epoll instance used to wait for frames on all the ports */
+    int epoll_fd;
+};
+
+
+/*
+ * chirouter_dataplane_run - Route Linux interfaces
+ *
+ * Loads the routers from a configuration file, binds their interfaces to
+ * Linux interfaces, and processes the frames received on them forever.
+ *
+ * ctx: Server context
+ *
+ * config_file: Path to the configuration file
+ *
+ * type: How the Linux interfaces are accessed
+ *
+ * Returns: only returns if an error happens (-1)
+ */
+int chirouter_dataplane_run(server_ctx_t *ctx, const char *config_file, chirouter_port_type_t type);
+
+
+/*
+ * chirouter_dataplane_send - Send a frame on a port
+ *
+ * Called by chirouter_send_frame, from any thread. Frames sent by the
+ * server thread are only sent once it is done processing the frames it
+ * received (see chirouter_dataplane_run). If the port cannot take the
+ * frame right now, the frame is dropped, just like a Linux interface
+ * drops the frames that don't fit in its queue.
+ *
+ * port: Port
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame
+ *
+ * Returns: 0 on success (including if the frame was dropped), 1 if
+ *          the frame cannot be sent on the port
+ */
+int chirouter_dataplane_send(chirouter_port_t *port, uint8_t *frame, size_t len);
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the deficit round robin (DRR) scheduler
+ *  used to process the frames received for the routers fairly.
+ *
+ *  See drr.h for more details
+ *
+ */
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#include "drr.h"
+#include "server.h"
+#include "alloc.h"
+#include "log.h"
+
+_Static_assert(DRR_QUANTUM >= ETHER_FRAME_MAX_LEN, "DRR_QUANTUM must fit a whole frame");
+
+/*
+ * Each frame in an input queue is stored right after a header, and the
+ * frame is padded so the next header is aligned. A frame is never split
+ * between the end and the start of the ring: if it doesn't fit at the
+ * end, a header with iface == NULL (or the lack of room for a header)
+ * tells the consumer to go back to the start.
+ */
+typedef struct chirouter_drr_entry
+{
+    chirouter_interface_t *iface;
+    uint16_t len;
+    alignas(8) uint8_t frame[];
+} chirouter_drr_entry_t;
+
+#define DRR_ENTRY_SIZE(len) (sizeof(chirouter_drr_entry_t) + (((len) + 7u) & ~7u))
+
+
+/* See drr.h */
+int chirouter_drr_parse_weights(const char *str, chirouter_drr_weight_t *weights, unsigned int *len)
+{
+    const char *p = str;
+    unsigned int n = 0;
+
+    while (true)
+    {
+        const char *eq = strchr(p, '=');
+        char *end;
+        long weight;
+
+        if (eq == NULL || eq == p || eq - p > MAX_ROUTER_NAMELEN || n == DRR_MAX_WEIGHTS)
+        {
+            return 1;
+        }
+
+        weight = strtol(eq + 1, &end, 10);
+        if (end == eq + 1 || weight <= 0 || weight > DRR_MAX_WEIGHT)
+        {
+            return 1;
+        }
+
+        memcpy(weights[n].router, p, eq - p);
+        weights[n].router[eq - p] = '\0';
+        weights[n].weight = (unsigned int) weight;
+        n++;
+
+        if (*end == '\0')
+        {
+            break;
+        }
+        else if (*end != ',')
+        {
+            return 1;
+        }
+        p = end + 1;
+    }
+
+    *len = n;
+    return 0;
+}
+
+
+/* See drr.h */
+int chirouter_drr_init(server_conn_t *conn)
+{
+    server_ctx_t *server = conn->server;
+
+    for (int i = 0; i < conn->num_routers; i++)
+    {
+        chirouter_ctx_t *r = &conn->routers[i];
+
+        r->drr_weight = 1;
+        r->drr_deficit = 0;
+        for (unsigned int j = 0; j < server->drr_num_weights; j++)
+        {
+            if (!strcmp(server->drr_weights[j].router, r->name))
+            {
+                r->drr_weight = server->drr_weights[j].weight;
+            }
+        }
+
+        r->inq = chirouter_calloc(1, sizeof(chirouter_drr_queue_t));
+        if (r->inq == NULL)
+        {
+            return -1;
+        }
+        r->inq->buf = chirouter_aligned_calloc(_Alignof(chirouter_drr_entry_t), DRR_QUEUE_SIZE, 1);
+        if (r->inq->buf == NULL)
+        {
+            return -1;
+        }
+
+        chilog(DEBUG, "Router %s: scheduling weight %u", r->name, r->drr_weight);
+    }
+
+    conn->drr_next = 0;
+    conn->drr_in_turn = false;
+    conn->drr_queued = 0;
+    conn->drr_drops = 0;
+
+    return 0;
+}
+
+
+/* See drr.h */
+void chirouter_drr_destroy(chirouter_ctx_t *ctx)
+{
+    if (ctx->inq == NULL)
+    {
+        return;
+    }
+
+    ctx->conn->drr_queued -= ctx->inq->count;
+    chirouter_free(ctx->inq->buf);
+    chirouter_free(ctx->inq);
+    ctx->inq = NULL;
+}
+
+
+/* See drr.h */
+int chirouter_drr_enqueue(chirouter_ctx_t *ctx, chirouter_interface_t *iface, const uint8_t *frame, size_t len)
+{
+    chirouter_drr_queue_t *q = ctx->inq;
+    size_t size = DRR_ENTRY_SIZE(len);
+    chirouter_drr_entry_t *entry;
+
+    if (q->count > 0 && q->tail <= q->head)
+    {
+        /* The queue has wrapped around: the free space is [tail, head) */
+        if (q->head - q->tail < size)
+        {
+            ctx->conn->drr_drops++;
+            return 1;
+        }
+    }
+    else if (DRR_QUEUE_SIZE - q->tail < size)
+    {
+        /* The free space is [tail, end) and [0, head) */
+        if (q->head < size)
+        {
+            ctx->conn->drr_drops++;
+            return 1;
+        }
+        if (DRR_QUEUE_SIZE - q->tail >= sizeof(chirouter_drr_entry_t))
+        {
+            ((chirouter_drr_entry_t *) (q->buf + q->tail))->iface = NULL;
+        }
+        q->tail = 0;
+    }
+
+    entry = (chirouter_drr_entry_t *) (q->buf + q->tail);
+    entry->iface = iface;
+    entry->len = (uint16_t) len;
+    memcpy(entry->frame, frame, len);
+
+    q->tail += size;
+    q->count++;
+    ctx->conn->drr_queued++;
+
+    return 0;
+}
+
+
+/*
+ * chirouter_drr_peek - Get the oldest frame in an input queue
+ *
+ * q: Input queue
+ *
+ * Returns: the oldest frame, or NULL if the queue is empty
+ */
+static chirouter_drr_entry_t *chirouter_drr_peek(chirouter_drr_queue_t *q)
+{
+    chirouter_drr_entry_t *entry;
+
+    if (q->count == 0)
+    {
+        return NULL;
+    }
+
+    entry = (chirouter_drr_entry_t *) (q->buf + q->head);
+    if (DRR_QUEUE_SIZE - q->head < sizeof(chirouter_drr_entry_t) || entry->iface == NULL)
+    {
+        q->head = 0;
+        entry = (chirouter_drr_entry_t *) q->buf;
+    }
+
+    return entry;
+}
+
+
+/*
+ * chirouter_drr_pop - Remove the oldest frame from an input queue
+ *
+ * Must be called right after chirouter_drr_peek
+ *
+ * ctx: Router context
+ *
+ * entry: Oldest frame (as returned by chirouter_drr_peek)
+ *
+ * Returns: nothing
+ */
+static void chirouter_drr_pop(chirouter_ctx_t *ctx, chirouter_drr_entry_t *entry)
+{
+    chirouter_drr_queue_t *q = ctx->inq;
+
+    q->head += DRR_ENTRY_SIZE(entry->len);
+    q->count--;
+    ctx->conn->drr_queued--;
+
+    if (q->count == 0)
+    {
+        q->head = q->tail = 0;
+    }
+}
+
+
+/* See drr.h */
+int chirouter_drr_serve(server_conn_t *conn, size_t budget)
+{
+    unsigned int idle = 0;
+    int served = 0;
+
+    while (conn->drr_queued > 0 && idle < conn->num_routers)
+    {
+        chirouter_ctx_t *r = &conn->routers[conn->drr_next];
+        chirouter_drr_entry_t *entry = chirouter_drr_peek(r->inq);
+
+        if (entry == NULL)
+        {
+            /* A router can't save up its deficit while it has nothing to send */
+            r->drr_deficit = 0;
+            idle++;
+        }
+        else
+        {
+            idle = 0;
+
+            /* The router's turn can be split across several calls,
+             * but it only gets its quantum once per turn */
+            if (!conn->drr_in_turn)
+            {
+                r->drr_deficit += (size_t) DRR_QUANTUM * r->drr_weight;
+                conn->drr_in_turn = true;
+            }
+
+            while (entry != NULL && entry->len <= r->drr_deficit)
+            {
+                if (budget == 0)
+                {
+                    return served;
+                }
+
+                r->drr_deficit -= entry->len;
+                budget = budget > entry->len ? budget - entry->len : 0;
+
+                /* The frame is removed from the queue right after it is
+                 * processed, since anything that needs it afterwards
+                 * makes its own copy */
+                if (chirouter_server_handle_frame(r, entry->iface, entry->frame, entry->len) == -1)
+                {
+                    return -1;
+                }
+                chirouter_drr_pop(r, entry);
+                served++;
+
+                entry = chirouter_drr_peek(r->inq);
+            }
+
+            if (entry == NULL)
+            {
+                r->drr_deficit = 0;
+            }
+        }
+
+        conn->drr_in_turn = false;
+        conn->drr_next = (conn->drr_next + 1) % conn->num_routers;
+    }
+
+    return served;
+}
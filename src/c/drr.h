@@ -0,0 +1,200 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the deficit round robin (DRR) scheduler used to
+ *  process the Ethernet frames received for the routers of a controller
+ *  fairly (see the -s and -W options in main.c).
+ *
+ *  Without it, the frames of all the routers of a controller are processed
+ *  in the order they are received, so a router that is flooded with frames
+ *  delays the frames of every other router (head-of-line blocking). Since
+ *  all the frames arrive on the same connection, the frames of the other
+ *  routers can only get ahead of the flood if the server reads frames
+ *  faster than it processes them. So, with fair scheduling:
+ *
+ *  - The frames are copied into the input queue of their router as soon
+ *    as they are received, and a router whose queue is full drops them
+ *    (the flooded router loses frames, instead of the other routers
+ *    waiting behind it).
+ *
+ *  - The queues are served with deficit round robin, a bounded number of
+ *    bytes at a time (see chirouter_server_drr_serve): when it is its turn,
+ *    a router with queued frames can be served DRR_QUANTUM bytes of frames
+ *    per unit of weight (any bytes it could not use carry over to its next
+ *    turn, as long as it still has frames queued).
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DRR_H
+#define DRR_H
+
+#include "chirouter.h"
+
+/* Size (in bytes) of each router's input queue. As large as the receive
+ * buffer (see server.h), so a single recv() call can't make it overflow
+ * unless the router already has a backlog of frames. */
+#define DRR_QUEUE_SIZE (256u * 1024u)
+
+/* Number of bytes of frames a router with weight 1 can be served in each
+ * turn (must be at least ETHER_FRAME_MAX_LEN, so that every router with
+ * queued frames is served at least one frame in every turn) */
+#define DRR_QUANTUM (16u * 1024u)
+
+/* Number of bytes of frames served at a time, before the server goes
+ * back to receiving frames (and sends the replies) */
+#define DRR_BUDGET (64u * 1024u)
+
+/* Maximum weight of a router, and maximum number of routers
+ * that can be given a weight (see chirouter_drr_parse_weights) */
+#define DRR_MAX_WEIGHT (64u)
+#define DRR_MAX_WEIGHTS (64u)
+
+/* The weight of a router (identified by its name) */
+typedef struct chirouter_drr_weight
+{
+    char router[MAX_ROUTER_NAMELEN + 1];
+    unsigned int weight;
+} chirouter_drr_weight_t;
+
+/* The input queue of a router: a ring of DRR_QUEUE_SIZE bytes, with the
+ * frames stored back to back, each one after a header (see drr.c). It is
+ * only used by the server thread. */
+struct chirouter_drr_queue
+{
+    uint8_t *buf;
+
+    /* Offsets of the oldest frame, and of where the next frame goes */
+    size_t head;
+    size_t tail;
+
+    /* Number of frames in the queue */
+    unsigned int count;
+};
+
+
+/*
+ * chirouter_drr_parse_weights - Parse the weights of the routers
+ *
+ * The weights are given as a comma-separated list of ROUTER=WEIGHT
+ * pairs (e.g., "r1=4,r2=2"). Routers that are not in the list have
+ * weight 1.
+ *
+ * str: String to parse
+ *
+ * weights: Array of at least DRR_MAX_WEIGHTS weights to fill in
+ *
+ * len: Pointer to where the number of weights will be stored
+ *
+ * Returns: 0 on success, 1 if the string is not a valid list of weights.
+ */
+int chirouter_drr_parse_weights(const char *str, chirouter_drr_weight_t *weights, unsigned int *len);
+
+
+/*
+ * chirouter_drr_init - Create the input queues of the routers of a controller
+ *
+ * Called once the controller has configured all its routers.
+ *
+ * conn: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if the queues could not be allocated (the
+ *          queues that were allocated are freed by chirouter_drr_destroy)
+ */
+int chirouter_drr_init(server_conn_t *conn);
+
+
+/*
+ * chirouter_drr_destroy - Free the input queue of a router
+ *
+ * Any frames still in the queue are discarded.
+ *
+ * ctx: Router context
+ *
+ * Returns: nothing
+ */
+void chirouter_drr_destroy(chirouter_ctx_t *ctx);
+
+
+/*
+ * chirouter_drr_enqueue - Add a frame to the input queue of a router
+ *
+ * The frame is copied into the queue (the receive buffer it comes from
+ * is reused once all the messages in it have been parsed). If the queue
+ * is full, the frame is dropped.
+ *
+ * ctx: Router context
+ *
+ * iface: Interface the frame was received on
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame (at most ETHER_FRAME_MAX_LEN bytes)
+ *
+ * Returns: 0 if the frame was queued, 1 if it was dropped.
+ */
+int chirouter_drr_enqueue(chirouter_ctx_t *ctx, chirouter_interface_t *iface, const uint8_t *frame, size_t len);
+
+
+/*
+ * chirouter_drr_serve - Serve the input queues of the routers of a controller
+ *
+ * Processes the frames in the input queues, in deficit round robin
+ * order, until budget bytes of frames have been processed (or until
+ * the queues are empty). The next call picks up where this one left
+ * off. Must only be called from the server thread.
+ *
+ * conn: Connection to the controller
+ *
+ * budget: Number of bytes of frames to serve (the last frame
+ *         served can take it over budget)
+ *
+ * Returns: number of frames served, or -1 if a critical error happens.
+ */
+int chirouter_drr_serve(server_conn_t *conn, size_t budget);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the per-router pool of frame buffers.
+ *
+ *  See framepool.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "framepool.h"
+#include "log.h"
+
+
+/*
+ * chirouter_frame_buf_reset - Prepare a buffer to be handed out
+ *
+ * buf: Frame buffer
+ *
+ * Returns: nothing
+ */
+static void chirouter_frame_buf_reset(chirouter_frame_buf_t *buf)
+{
+    atomic_init(&buf->refcount, 1);
+    buf->next_free = NULL;
+    buf->frame.raw = buf->data;
+    buf->frame.length = 0;
+    buf->frame.in_interface = NULL;
+    buf->frame.buf = buf;
+    buf->withheld.frame = &buf->frame;
+    buf->withheld.prev = NULL;
+    buf->withheld.next = NULL;
+}
+
+
+/*
+ * chirouter_framepool_grow - Add buffers to a frame pool
+ *
+ * Note: The pool's lock must be held (or the pool must not be
+ *       in use yet) when calling this function
+ *
+ * pool: Frame pool
+ *
+ * n: Number of buffers to add
+ *
+ * Returns: 0 on success, 1 if the buffers could not be allocated
+ */
+static int chirouter_framepool_grow(chirouter_framepool_t *pool, unsigned int n)
+{
+    chirouter_frame_buf_t *bufs;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    bufs = chirouter_arena_alloc(pool->arena, n, sizeof(chirouter_frame_buf_t), FRAME_BUF_ALIGN);
+    if (bufs == NULL)
+    {
+        return 1;
+    }
+
+    for (int i = n - 1; i >= 0; i--)
+    {
+        bufs[i].pool = pool;
+        bufs[i].next_free = pool->free_list;
+        pool->free_list = &bufs[i];
+    }
+    pool->size += n;
+    pool->num_free += n;
+
+    return 0;
+}
+
+
+/* See framepool.h */
+void chirouter_framepool_init(chirouter_framepool_t *pool, chirouter_arena_t *arena)
+{
+    pool->arena = arena;
+    pool->size = 0;
+    pool->free_list = NULL;
+    pool->num_free = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+
+/* See framepool.h */
+int chirouter_framepool_reserve(chirouter_framepool_t *pool, unsigned int n)
+{
+    int rc;
+
+    pthread_mutex_lock(&pool->lock);
+    rc = chirouter_framepool_grow(pool, n);
+    pthread_mutex_unlock(&pool->lock);
+
+    return rc;
+}
+
+
+/* See framepool.h */
+void chirouter_framepool_destroy(chirouter_framepool_t *pool)
+{
+    if (pool->num_free != pool->size)
+    {
+        chilog(DEBUG, "Destroying frame pool with %u buffers still in use",
+               pool->size - pool->num_free);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pool->free_list = NULL;
+    pool->size = pool->num_free = 0;
+}
+
+
+/* See framepool.h */
+chirouter_frame_buf_t *chirouter_frame_buf_get(chirouter_framepool_t *pool)
+{
+    chirouter_frame_buf_t *buf;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_list == NULL)
+    {
+        /* Grow the pool by half its current size */
+        unsigned int n = pool->size / 2 > FRAMEPOOL_MIN_GROW ? pool->size / 2 : FRAMEPOOL_MIN_GROW;
+
+        chilog(DEBUG, "Frame pool exhausted, adding %u buffers", n);
+        if (chirouter_framepool_grow(pool, n))
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+    }
+
+    buf = pool->free_list;
+    pool->free_list = buf->next_free;
+    pool->num_free--;
+    pthread_mutex_unlock(&pool->lock);
+
+    chirouter_frame_buf_reset(buf);
+
+    return buf;
+}
+
+
+/* See framepool.h */
+chirouter_frame_buf_t *chirouter_frame_buf_copy(chirouter_framepool_t *pool, ethernet_frame_t *frame)
+{
+    chirouter_frame_buf_t *buf = chirouter_frame_buf_get(pool);
+
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(buf->data, frame->raw, frame->length);
+    buf->frame.length = frame->length;
+    buf->frame.in_interface = frame->in_interface;
+
+    return buf;
+}
+
+
+/* See framepool.h */
+chirouter_frame_buf_t *chirouter_frame_buf_ref(chirouter_frame_buf_t *buf)
+{
+    atomic_fetch_add_explicit(&buf->refcount, 1, memory_order_relaxed);
+    return buf;
+}
+
+
+/* See framepool.h */
+void chirouter_frame_buf_put(chirouter_frame_buf_t *buf)
+{
+    if (atomic_fetch_sub_explicit(&buf->refcount, 1, memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    chirouter_framepool_t *pool = buf->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    buf->next_free = pool->free_list;
+    pool->free_list = buf;
+    pool->num_free++;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,169 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the per-router pool of frame buffers.
+ *
+ *  Frames are normally processed in place, straight from the buffer
+ *  where the server received them. When a frame has to be kept after
+ *  chirouter_process_ethernet_frame returns (e.g., because it has to be
+ *  withheld until an ARP reply arrives), it is copied once into a buffer
+ *  from the router's pool, and from then on it is passed around by
+ *  reference: every holder of the frame takes a reference with
+ *  chirouter_frame_buf_ref and drops it with chirouter_frame_buf_put,
+ *  and the buffer returns to the pool when the last reference is dropped.
+ *
+ *  The buffers are carved out of the router's arena (see arena.h). A pool
+ *  starts out with a few buffers per interface of its router (see
+ *  chirouter_framepool_reserve), so the memory used by the pools of a
+ *  large topology is proportional to its number of interfaces. If the
+ *  pool is exhausted, it grows by allocating more buffers from the arena,
+ *  so running out of buffers does not cause frames to be dropped. Buffers
+ *  are never given back to the arena: they are freed all at once when the
+ *  router's arena is released.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include "chirouter.h"
+
+/*
+ * chirouter_framepool_init - Initialize a frame pool
+ *
+ * The pool starts out empty (see chirouter_framepool_reserve)
+ *
+ * pool: Frame pool
+ *
+ * arena: Arena the buffers will be allocated from
+ *
+ * Returns: nothing
+ */
+void chirouter_framepool_init(chirouter_framepool_t *pool, chirouter_arena_t *arena);
+
+
+/*
+ * chirouter_framepool_reserve - Add buffers to a frame pool ahead of time
+ *
+ * Called once the router's interfaces are known, with
+ * FRAMEPOOL_BUFS_PER_INTERFACE buffers for each of them, so that
+ * the pool rarely has to grow while frames are being forwarded.
+ *
+ * pool: Frame pool
+ *
+ * n: Number of buffers to add
+ *
+ * Returns: 0 on success, 1 if the buffers could not be allocated
+ */
+int chirouter_framepool_reserve(chirouter_framepool_t *pool, unsigned int n);
+
+
+/*
+ * chirouter_framepool_destroy - Free a frame pool
+ *
+ * The memory of the buffers belongs to the arena, and is only
+ * freed when the arena is released. None of the buffers can be
+ * used after calling this function.
+ *
+ * pool: Frame pool
+ *
+ * Returns: nothing
+ */
+void chirouter_framepool_destroy(chirouter_framepool_t *pool);
+
+
+/*
+ * chirouter_frame_buf_get - Get a buffer from a frame pool
+ *
+ * The buffer is returned with a reference count of 1, and with its
+ * frame's raw field pointing to the buffer's data (the caller is
+ * responsible for setting the frame's length and interface)
+ *
+ * pool: Frame pool
+ *
+ * Returns: pointer to the buffer, or NULL if the pool was exhausted
+ *          and it could not be grown.
+ */
+chirouter_frame_buf_t *chirouter_frame_buf_get(chirouter_framepool_t *pool);
+
+
+/*
+ * chirouter_frame_buf_copy - Copy a frame into a buffer from a frame pool
+ *
+ * pool: Frame pool
+ *
+ * frame: Frame to copy
+ *
+ * Returns: pointer to a buffer (with a reference count of 1) holding
+ *          a copy of the frame, or NULL if no buffer could be obtained.
+ */
+chirouter_frame_buf_t *chirouter_frame_buf_copy(chirouter_framepool_t *pool, ethernet_frame_t *frame);
+
+
+/*
+ * chirouter_frame_buf_ref - Take a reference to a frame buffer
+ *
+ * buf: Frame buffer
+ *
+ * Returns: buf
+ */
+chirouter_frame_buf_t *chirouter_frame_buf_ref(chirouter_frame_buf_t *buf);
+
+
+/*
+ * chirouter_frame_buf_put - Drop a reference to a frame buffer
+ *
+ * If this was the last reference, the buffer is returned to its pool
+ *
+ * buf: Frame buffer
+ *
+ * Returns: nothing
+ */
+void chirouter_frame_buf_put(chirouter_frame_buf_t *buf);
+
+#endif
@@ -3,11 +3,80 @@
  *
  *  main() function for the router
  *
- *  The chirouter executable accepts three command-line arguments:
+ *  The chirouter executable accepts the following command-line arguments:
  *
  *  -p PORT: Port on which chirouter will listen (default: 23300)
+ *  -u PATH: Listen on a Unix domain (stream) socket at PATH instead of
+ *           on a TCP port (-p is ignored). The controller can then ask
+ *           to exchange the Ethernet frames through shared memory
+ *           instead of the socket (see server.h).
+ *  -U PATH: Like -u, but with a SOCK_SEQPACKET socket: each packet the
+ *           controller sends contains a single message, so chirouter
+ *           receives many of them at once, and doesn't have to find where
+ *           each message ends (see server.h). Messages larger than 4096
+ *           bytes (SERVER_SEQPACKET_SLOT_SIZE) are dropped.
+ *  -i FILE: Route Linux interfaces instead of waiting for controllers:
+ *           the routers are loaded from FILE, and each of their interfaces
+ *           is bound to a Linux interface with an AF_PACKET socket (see
+ *           dataplane.h for the format of the file). -p, -u, -U, and -e
+ *           are ignored, and -w, -t, -s, -W, and -V cannot be used.
+ *  -I TYPE: How -i accesses the Linux interfaces: "packet" uses AF_PACKET
+ *           sockets, "xdp" uses AF_XDP sockets, which hand the frames to
+ *           the routers without copying them, and forward them the same
+ *           way (see xdp.h). Falls back to AF_PACKET sockets if AF_XDP
+ *           sockets cannot be used. "tap" binds each interface to a TAP
+ *           device instead, creating it if needed (see tap.h)
+ *           (default: packet).
  *  -c FILE: If specified, will produce a pcapng capture file with all
  *           the Ethernet frames received/sent by the routers.
+ *  -g: Learn (and update) ARP cache entries from gratuitous ARP messages.
+ *  -n FILE: Load static ARP entries from FILE (see chirouter_ctx_load_neighbors
+ *           in ctx.c for the format of the file)
+ *  -r RATE: Maximum number of ARP requests per second sent on each
+ *           interface (default: 100; 0 means unlimited)
+ *  -b BURST: Maximum number of ARP requests that can be sent back-to-back
+ *            on each interface before -r applies (default: 20)
+ *  -a SCHEDULE: ARP retransmission schedule, as a comma-separated list of
+ *               waits in milliseconds (e.g., 50,100,200,400,800). An ARP
+ *               request is sent once per wait, and abandoned when the
+ *               last wait expires (default: 1000,1000,1000,1000,1000)
+ *  -q SIZE: Size (in KB) of the queue of messages that have been sent to
+ *           the controller but that it has not read yet (default: 4096).
+ *           The queue is congested once it is 75% full, and until it is
+ *           back down to 25% full. Must be at least 1024.
+ *  -o POLICY: What to do while the queue is congested: "block" stops
+ *             reading from the controller, "drop" drops the Ethernet frames
+ *             sent to the controller (default: block). Control messages
+ *             are never dropped.
+ *  -w WORKERS: Process the frames of the routers in parallel, with the
+ *              given number of worker threads (default: 0, i.e., all the
+ *              frames are processed by the server thread). Each router is
+ *              processed by a single worker at a time, and routers are
+ *              moved between workers based on how busy they are.
+ *  -t: Write to the controllers from a separate TX thread. Together with
+ *      -w 1, this runs the router as a three-stage pipeline: the server
+ *      thread receives and parses the messages, a worker thread processes
+ *      the frames, and the TX thread sends the replies.
+ *  -s: Process the frames received for the routers of a controller
+ *      fairly: each router has its own input queue, and the queues are
+ *      served with deficit round robin, so a router that receives many
+ *      frames does not delay the frames of the other routers (when a
+ *      router's queue is full, its frames are dropped instead of being
+ *      subject to the -o policy).
+ *  -W WEIGHTS: Weights of the routers with -s, as a comma-separated list
+ *              of ROUTER=WEIGHT pairs (e.g., r1=4,r2=2). A router with
+ *              weight N is served up to N times as many bytes of frames
+ *              per round as a router with weight 1 (the default). Implies -s.
+ *  -V: Process the frames received for each router in batches (vectors)
+ *      of up to 256 frames, one step at a time, instead of processing
+ *      each frame from start to finish before the next one. Has no effect
+ *      on the frames processed by worker threads (-w).
+ *  -e BACKEND: How to send and receive messages: "epoll" uses non-blocking
+ *              system calls once epoll says they won't block, "io_uring"
+ *              submits them as asynchronous requests to io_uring (with
+ *              multishot receives into registered buffers, and all the
+ *              sends batched with a single system call). Falls back to
+ *              epoll if io_uring is not available (default: epoll).
  *  -v: Be verbose. Can be repeated up to three times for extra verbosity.
  *
  *  The main() function takes care of processing these command-line
@@ -74,8 +143,17 @@
 #include "arp.h"
 #include "log.h"
 #include "pcap.h"
+#include "dataplane.h"
 
-#define USAGE "Usage: chirouter [-p PORT] [-c CAP_FILE] [(-v|-vv|-vvv)]\n"
+#define DEFAULT_ARP_RATE (100)
+#define DEFAULT_ARP_BURST (20)
+#define DEFAULT_ARP_SCHEDULE "1000,1000,1000,1000,1000"
+#define DEFAULT_OUTQ_SIZE_KB (4096)
+#define OUTQ_HIGH_WATERMARK_PCT (75)
+#define OUTQ_LOW_WATERMARK_PCT (25)
+#define OUTQ_MIN_SIZE (4 * SERVER_RX_BUFFER_SIZE)
+
+#define USAGE "Usage: chirouter [-p PORT | -u SOCKET_PATH | -U SOCKET_PATH | -i CONFIG_FILE] [-I packet|xdp|tap] [-c CAP_FILE] [-g] [-n NEIGHBOR_FILE] [-r ARP_RATE] [-b ARP_BURST] [-a ARP_SCHEDULE] [-q QUEUE_SIZE] [-o block|drop] [-w WORKERS] [-t] [-s] [-W WEIGHTS] [-V] [-e epoll|io_uring] [(-v|-vv|-vvv)]\n"
 
 
 /* Unfortunately required by signal handler */
@@ -92,6 +170,10 @@ void sig_handler(int signo)
       {
           fclose(ctx->pcap);
       }
+      if(ctx->unix_path)
+      {
+          unlink(ctx->unix_path);
+      }
       exit(0);
   }
 }
@@ -104,7 +186,24 @@ int main(int argc, char *argv[])
     sigset_t new;
     int opt;
     char *port = "23300";
+    char *unix_path = NULL;
+    bool seqpacket = false;
+    char *config_file = NULL;
+    chirouter_port_type_t port_type = PORT_PACKET;
     char *cap_file = NULL;
+    bool arp_gratuitous = false;
+    char *neighbors_file = NULL;
+    int arp_rate = DEFAULT_ARP_RATE;
+    int arp_burst = DEFAULT_ARP_BURST;
+    char *arp_schedule = DEFAULT_ARP_SCHEDULE;
+    int outq_size_kb = DEFAULT_OUTQ_SIZE_KB;
+    outq_policy_t outq_policy = OUTQ_BLOCK;
+    int num_workers = 0;
+    bool tx_thread = false;
+    bool drr = false;
+    char *drr_weights = NULL;
+    bool vector = false;
+    server_backend_t backend = BACKEND_EPOLL;
     int verbosity = 0;
 
     /* Stop SIGPIPE from messing with our sockets */
@@ -124,15 +223,98 @@ int main(int argc, char *argv[])
     }
 
     /* Process command-line arguments */
-    while ((opt = getopt(argc, argv, "p:c:vdh")) != -1)
+    while ((opt = getopt(argc, argv, "p:u:U:i:I:c:gn:r:b:a:q:o:w:tsW:Ve:vdh")) != -1)
         switch (opt)
         {
         case 'p':
             port = strdup(optarg);
             break;
+        case 'u':
+            unix_path = strdup(optarg);
+            seqpacket = false;
+            break;
+        case 'U':
+            unix_path = strdup(optarg);
+            seqpacket = true;
+            break;
+        case 'i':
+            config_file = strdup(optarg);
+            break;
+        case 'I':
+            if (!strcmp(optarg, "packet"))
+                port_type = PORT_PACKET;
+            else if (!strcmp(optarg, "xdp"))
+                port_type = PORT_XDP;
+            else if (!strcmp(optarg, "tap"))
+                port_type = PORT_TAP;
+            else
+            {
+                fprintf(stderr, USAGE);
+                fprintf(stderr, "ERROR: Unknown interface type %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'c':
             cap_file = strdup(optarg);
             break;
+        case 'g':
+            arp_gratuitous = true;
+            break;
+        case 'n':
+            neighbors_file = strdup(optarg);
+            break;
+        case 'r':
+            arp_rate = atoi(optarg);
+            break;
+        case 'b':
+            arp_burst = atoi(optarg);
+            break;
+        case 'a':
+            arp_schedule = strdup(optarg);
+            break;
+        case 'q':
+            outq_size_kb = atoi(optarg);
+            break;
+        case 'o':
+            if (!strcmp(optarg, "block"))
+                outq_policy = OUTQ_BLOCK;
+            else if (!strcmp(optarg, "drop"))
+                outq_policy = OUTQ_DROP;
+            else
+            {
+                fprintf(stderr, USAGE);
+                fprintf(stderr, "ERROR: Unknown queue policy %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            num_workers = atoi(optarg);
+            break;
+        case 't':
+            tx_thread = true;
+            break;
+        case 's':
+            drr = true;
+            break;
+        case 'W':
+            drr = true;
+            drr_weights = strdup(optarg);
+            break;
+        case 'V':
+            vector = true;
+            break;
+        case 'e':
+            if (!strcmp(optarg, "epoll"))
+                backend = BACKEND_EPOLL;
+            else if (!strcmp(optarg, "io_uring"))
+                backend = BACKEND_URING;
+            else
+            {
+                fprintf(stderr, USAGE);
+                fprintf(stderr, "ERROR: Unknown backend %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'v':
             verbosity++;
             break;
@@ -145,6 +327,41 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
 
+    if (arp_rate < 0 || arp_burst < 1)
+    {
+        fprintf(stderr, USAGE);
+        fprintf(stderr, "ERROR: ARP rate must be >= 0 and ARP burst must be >= 1\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Reading from the controller is only paused in between receive
+     * buffers, and processing a full receive buffer can queue about as
+     * many bytes as it contains, so there must be at least that much
+     * room above the high watermark (this is what keeps the TX thread
+     * from having to wait for a controller, see chirouter_server_rx_limit) */
+    if ((size_t) outq_size_kb * 1024 < OUTQ_MIN_SIZE)
+    {
+        fprintf(stderr, USAGE);
+        fprintf(stderr, "ERROR: Queue size must be >= %u KB\n", OUTQ_MIN_SIZE / 1024);
+        return EXIT_FAILURE;
+    }
+
+    if (num_workers < 0 || num_workers > (int) WORKER_MAX_WORKERS)
+    {
+        fprintf(stderr, USAGE);
+        fprintf(stderr, "ERROR: Number of workers must be between 0 and %u\n", WORKER_MAX_WORKERS);
+        return EXIT_FAILURE;
+    }
+
+    /* Frames received on Linux interfaces are all processed
+     * by the server thread (see dataplane.h) */
+    if (config_file && (num_workers > 0 || tx_thread || drr || vector))
+    {
+        fprintf(stderr, USAGE);
+        fprintf(stderr, "ERROR: -i cannot be used with -w, -t, -s, -W, or -V\n");
+        return EXIT_FAILURE;
+    }
+
     /* Set logging level based on verbosity */
     switch(verbosity)
     {
@@ -173,6 +390,36 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    ctx->arp_gratuitous = arp_gratuitous;
+    ctx->neighbors_file = neighbors_file;
+    ctx->arp_rate = arp_rate;
+    ctx->arp_burst = arp_burst;
+    ctx->outq_policy = outq_policy;
+    ctx->outq_size = (size_t) outq_size_kb * 1024;
+    ctx->outq_high = ctx->outq_size * OUTQ_HIGH_WATERMARK_PCT / 100;
+    ctx->outq_low = ctx->outq_size * OUTQ_LOW_WATERMARK_PCT / 100;
+
+    if (chirouter_arp_parse_schedule(arp_schedule, ctx->arp_schedule, &ctx->arp_schedule_len))
+    {
+        fprintf(stderr, USAGE);
+        fprintf(stderr, "ERROR: Invalid ARP schedule %s (must be a comma-separated list of "
+                        "at most %u positive millisecond values)\n", arp_schedule, ARP_MAX_RETRIES);
+        return EXIT_FAILURE;
+    }
+
+    ctx->drr_enabled = drr;
+    ctx->vector_enabled = vector;
+    ctx->backend = backend;
+    ctx->unix_path = unix_path;
+    ctx->seqpacket = seqpacket;
+    if (drr_weights && chirouter_drr_parse_weights(drr_weights, ctx->drr_weights, &ctx->drr_num_weights))
+    {
+        fprintf(stderr, USAGE);
+        fprintf(stderr, "ERROR: Invalid router weights %s (must be a comma-separated list of at most %u "
+                        "ROUTER=WEIGHT pairs, with weights between 1 and %u)\n", drr_weights, DRR_MAX_WEIGHTS, DRR_MAX_WEIGHT);
+        return EXIT_FAILURE;
+    }
+
     /* Create capture file */
     if(cap_file)
     {
@@ -184,6 +431,17 @@ int main(int argc, char *argv[])
             perror("ERROR: Capture file could not be created.");
             return EXIT_FAILURE;
         }
+
+        /* All the controllers share a single section of the capture
+         * file (see chirouter_pcap_write_interfaces) */
+        chirouter_pcap_write_section_header(ctx);
+    }
+
+    if(config_file)
+    {
+        rc = chirouter_dataplane_run(ctx, config_file, port_type);
+        chirouter_server_ctx_destroy(ctx);
+        return rc ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
     rc = chirouter_server_setup(ctx, port);
@@ -193,6 +451,18 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if(tx_thread && chirouter_server_tx_start(ctx))
+    {
+        fprintf(stderr, "ERROR: Could not start TX thread.\n");
+        return EXIT_FAILURE;
+    }
+
+    if(num_workers > 0 && chirouter_workers_start(ctx, num_workers))
+    {
+        fprintf(stderr, "ERROR: Could not start worker threads.\n");
+        return EXIT_FAILURE;
+    }
+
     rc = chirouter_server_run(ctx);
 
     chirouter_server_ctx_destroy(ctx);
@@ -0,0 +1,334 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the AF_PACKET sockets used to send and receive
+ *  Ethernet frames on Linux interfaces.
+ *
+ *  See packet.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "packet.h"
+#include "utils.h"
+#include "protocols/ipv4.h"
+
+/* Where a frame starts in a slot of the transmit ring (the kernel
+ * expects it right after the header, see packet_mmap.rst) */
+#define PACKET_TX_DATA_OFFSET (TPACKET_ALIGN(sizeof(struct tpacket3_hdr)))
+
+
+/*
+ * chirouter_packet_complete_checksum - Compute the checksum the sender left to the interface
+ *
+ * Frames sent on an interface with checksum offloading (e.g., a veth
+ * interface) can reach us before the TCP or UDP checksum has been
+ * computed (the checksum field only has the checksum of the pseudo-header),
+ * and the router would otherwise forward them with an invalid checksum.
+ *
+ * frame: Frame (an IPv4 datagram that the kernel flagged with TP_STATUS_CSUMNOTREADY)
+ *
+ * len: Length of the frame
+ *
+ * Returns: nothing
+ */
+static void chirouter_packet_complete_checksum(uint8_t *frame, size_t len)
+{
+    struct ethhdr *eth = (struct ethhdr *) frame;
+    iphdr_t *ip = (iphdr_t *) (frame + ETH_HLEN);
+    size_t ihl, ip_len, cksum_offset;
+    uint16_t *field;
+
+    if (len < ETH_HLEN + sizeof(iphdr_t) || ntohs(eth->h_proto) != ETH_P_IP)
+        return;
+
+    ihl = ip->ihl * 4;
+    ip_len = ntohs(ip->len);
+    if (ihl < sizeof(iphdr_t) || ip_len < ihl || ETH_HLEN + ip_len > len)
+        return;
+
+    if (ip->proto == IPPROTO_UDP)
+        cksum_offset = 6;
+    else if (ip->proto == IPPROTO_TCP)
+        cksum_offset = 16;
+    else
+        return;
+
+    if (ip_len - ihl < cksum_offset + 2)
+        return;
+
+    field = (uint16_t *) (frame + ETH_HLEN + ihl + cksum_offset);
+    *field = cksum(frame + ETH_HLEN + ihl, ip_len - ihl);
+}
+
+
+/* See packet.h */
+int chirouter_packet_open(chirouter_packet_t *pkt, const char *ifname)
+{
+    struct tpacket_req3 req;
+    struct packet_mreq mreq;
+    struct sockaddr_ll addr;
+    int version = TPACKET_V3, one = 1;
+    size_t rx_size = PACKET_RX_BLOCK_SIZE * PACKET_RX_BLOCKS;
+    size_t tx_size = PACKET_TX_SLOT_SIZE * PACKET_TX_SLOTS;
+    unsigned int ifindex;
+    void *map;
+
+    pkt->fd = -1;
+    pkt->map = NULL;
+    pkt->rx_block = 0;
+    pkt->tx_slot = 0;
+    pkt->tx_pending = false;
+    pkt->tx_drops = 0;
+    pkt->rx_truncated = 0;
+    pthread_mutex_init(&pkt->tx_lock, NULL);
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+        return -1;
+
+    pkt->fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(ETH_P_ALL));
+    if (pkt->fd == -1)
+        return -1;
+
+    if (setsockopt(pkt->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+        return -1;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PACKET_RX_BLOCK_SIZE;
+    req.tp_block_nr = PACKET_RX_BLOCKS;
+    req.tp_frame_size = PACKET_TX_SLOT_SIZE;
+    req.tp_frame_nr = rx_size / PACKET_TX_SLOT_SIZE;
+    req.tp_retire_blk_tov = PACKET_RX_BLOCK_TIMEOUT_MS;
+    if (setsockopt(pkt->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+        return -1;
+
+    /* The transmit ring is a ring of slots, so a "block" is just a
+     * group of slots (the kernel rejects any of the receive-only
+     * settings, like the block timeout) */
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PACKET_RX_BLOCK_SIZE;
+    req.tp_block_nr = tx_size / PACKET_RX_BLOCK_SIZE;
+    req.tp_frame_size = PACKET_TX_SLOT_SIZE;
+    req.tp_frame_nr = PACKET_TX_SLOTS;
+    if (setsockopt(pkt->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1)
+        return -1;
+
+    /* Frames don't need to go through the interface's queueing discipline,
+     * and we don't want to receive the frames we send (both are optional,
+     * and the frames we send are skipped anyway if the kernel is too old
+     * to ignore them, see chirouter_packet_recv) */
+    setsockopt(pkt->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#ifdef PACKET_IGNORE_OUTGOING
+    setsockopt(pkt->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    map = mmap(NULL, rx_size + tx_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pkt->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    pkt->map = map;
+    pkt->map_size = rx_size + tx_size;
+    pkt->rx_ring = pkt->map;
+    pkt->tx_ring = pkt->map + rx_size;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(pkt->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+        return -1;
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(pkt->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+        return -1;
+
+    return 0;
+}
+
+
+/* See packet.h */
+void chirouter_packet_close(chirouter_packet_t *pkt)
+{
+    if (pkt->map != NULL)
+    {
+        munmap(pkt->map, pkt->map_size);
+        pkt->map = NULL;
+    }
+    if (pkt->fd != -1)
+    {
+        close(pkt->fd);
+        pkt->fd = -1;
+    }
+    pthread_mutex_destroy(&pkt->tx_lock);
+}
+
+
+/* See packet.h */
+int chirouter_packet_recv(chirouter_packet_t *pkt, chirouter_packet_handler_t handler, void *arg)
+{
+    int nframes = 0;
+
+    while (1)
+    {
+        struct tpacket_block_desc *block =
+            (struct tpacket_block_desc *) (pkt->rx_ring + (size_t) pkt->rx_block * PACKET_RX_BLOCK_SIZE);
+        uint8_t *pos;
+
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            break;
+
+        pos = (uint8_t *) block + block->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; i++)
+        {
+            struct tpacket3_hdr *hdr = (struct tpacket3_hdr *) pos;
+            struct sockaddr_ll *addr = (struct sockaddr_ll *) (pos + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+            pos += hdr->tp_next_offset;
+
+            if (addr->sll_pkttype == PACKET_OUTGOING)
+                continue;
+
+            if (hdr->tp_snaplen != hdr->tp_len)
+            {
+                pkt->rx_truncated++;
+                continue;
+            }
+
+            if (hdr->tp_status & TP_STATUS_CSUMNOTREADY)
+                chirouter_packet_complete_checksum((uint8_t *) hdr + hdr->tp_mac, hdr->tp_snaplen);
+
+            if (handler(arg, (uint8_t *) hdr + hdr->tp_mac, hdr->tp_snaplen) == -1)
+                return -1;
+            nframes++;
+        }
+
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        pkt->rx_block = (pkt->rx_block + 1) % PACKET_RX_BLOCKS;
+    }
+
+    return nframes;
+}
+
+
+/* See packet.h */
+int chirouter_packet_send(chirouter_packet_t *pkt, const uint8_t *frame, size_t len, bool flush)
+{
+    struct tpacket3_hdr *hdr;
+    uint32_t status;
+    int rc = 0;
+
+    if (len > PACKET_TX_SLOT_SIZE - PACKET_TX_DATA_OFFSET)
+        return -1;
+
+    pthread_mutex_lock(&pkt->tx_lock);
+
+    hdr = (struct tpacket3_hdr *) (pkt->tx_ring + (size_t) pkt->tx_slot * PACKET_TX_SLOT_SIZE);
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+
+    /* A slot the kernel rejected can be reused (the frame
+     * in it is lost, but it was never valid to begin with) */
+    if (status == TP_STATUS_AVAILABLE || (status & TP_STATUS_WRONG_FORMAT))
+    {
+        memcpy((uint8_t *) hdr + PACKET_TX_DATA_OFFSET, frame, len);
+        hdr->tp_len = len;
+        hdr->tp_snaplen = len;
+        hdr->tp_next_offset = 0;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+        pkt->tx_slot = (pkt->tx_slot + 1) % PACKET_TX_SLOTS;
+        pkt->tx_pending = true;
+    }
+    else
+    {
+        /* The ring is full: make sure the kernel is sending it (it
+         * stops sending if the interface's queue fills up) */
+        pkt->tx_drops++;
+        pkt->tx_pending = true;
+        flush = true;
+        rc = 1;
+    }
+
+    if (flush && pkt->tx_pending)
+    {
+        pkt->tx_pending = false;
+        send(pkt->fd, NULL, 0, MSG_DONTWAIT);
+    }
+
+    pthread_mutex_unlock(&pkt->tx_lock);
+
+    return rc;
+}
+
+
+/* See packet.h */
+int chirouter_packet_flush(chirouter_packet_t *pkt)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&pkt->tx_lock);
+    if (pkt->tx_pending)
+    {
+        pkt->tx_pending = false;
+        if (send(pkt->fd, NULL, 0, MSG_DONTWAIT) == -1 && errno != EAGAIN && errno != ENOBUFS)
+            rc = -1;
+    }
+    pthread_mutex_unlock(&pkt->tx_lock);
+
+    return rc;
+}
@@ -0,0 +1,199 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the AF_PACKET sockets used to send and receive
+ *  Ethernet frames on Linux interfaces, when chirouter routes Linux
+ *  interfaces itself instead of relaying frames for a controller (see
+ *  dataplane.h).
+ *
+ *  Each socket is bound to a single Linux interface, and has a
+ *  TPACKET_V3 receive ring and transmit ring, both mapped into
+ *  chirouter's memory:
+ *
+ *  - The receive ring is made up of blocks, which the kernel fills with
+ *    as many frames as fit in them, and hands over to chirouter once
+ *    they are full (or once they have been open for PACKET_RX_BLOCK_TIMEOUT_MS).
+ *    The frames are processed in place, straight from the ring, and the
+ *    block is handed back to the kernel once all its frames have been
+ *    processed.
+ *
+ *  - The transmit ring is made up of fixed-size slots, each holding a
+ *    single frame. Frames are copied into the next free slot, and the
+ *    kernel is told to send all the slots that are ready with a single
+ *    system call (see chirouter_packet_flush).
+ *
+ *  The socket is put in promiscuous mode, since the routers' interfaces
+ *  do not have the MAC address of the Linux interface they are bound to.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Receive ring: number and size of the blocks, and how long the kernel
+ * can keep a block that is not full before handing it over */
+#define PACKET_RX_BLOCK_SIZE (256u * 1024u)
+#define PACKET_RX_BLOCKS (32u)
+#define PACKET_RX_BLOCK_TIMEOUT_MS (1u)
+
+/* Transmit ring: number and size of the slots (each slot holds the
+ * frame and the header the kernel needs in front of it) */
+#define PACKET_TX_SLOT_SIZE (2048u)
+#define PACKET_TX_SLOTS (1024u)
+
+/* Called for each frame received on a socket. The frame can be modified
+ * in place, but is only valid until the function returns. Returns 0
+ * on success, -1 if a critical error happens. */
+typedef int (*chirouter_packet_handler_t)(void *arg, uint8_t *frame, size_t len);
+
+/* An AF_PACKET socket bound to a Linux interface */
+typedef struct chirouter_packet
+{
+    /* Socket */
+    int fd;
+
+    /* Both rings are mapped with a single mmap (the receive ring
+     * first), and rx_block is the next block we will process */
+    uint8_t *map;
+    size_t map_size;
+    uint8_t *rx_ring;
+    uint8_t *tx_ring;
+    unsigned int rx_block;
+
+    /* Transmit ring: the next slot we will copy a frame into, and whether
+     * there are frames that the kernel hasn't been told to send yet.
+     * Several threads send frames (e.g., the ARP threads), so the
+     * transmit ring is protected by tx_lock. */
+    unsigned int tx_slot;
+    bool tx_pending;
+    pthread_mutex_t tx_lock;
+
+    /* Statistics: frames dropped because the transmit ring was full,
+     * and frames received truncated (and dropped) */
+    uint64_t tx_drops;
+    uint64_t rx_truncated;
+} chirouter_packet_t;
+
+
+/*
+ * chirouter_packet_open - Create an AF_PACKET socket bound to a Linux interface
+ *
+ * pkt: Socket
+ *
+ * ifname: Name of the Linux interface
+ *
+ * Returns: 0 on success, -1 if an error happens (the socket must
+ *          still be freed with chirouter_packet_close)
+ */
+int chirouter_packet_open(chirouter_packet_t *pkt, const char *ifname);
+
+
+/*
+ * chirouter_packet_close - Free an AF_PACKET socket
+ *
+ * pkt: Socket
+ *
+ * Returns: nothing
+ */
+void chirouter_packet_close(chirouter_packet_t *pkt);
+
+
+/*
+ * chirouter_packet_recv - Process the frames received on a socket
+ *
+ * Processes all the blocks that the kernel has handed over, one frame
+ * at a time. The frames sent by chirouter itself are skipped.
+ *
+ * pkt: Socket
+ *
+ * handler: Function called for each frame
+ *
+ * arg: Argument passed to the handler
+ *
+ * Returns: number of frames processed, or -1 if the handler
+ *          returned -1 (in which case the block is not handed back)
+ */
+int chirouter_packet_recv(chirouter_packet_t *pkt, chirouter_packet_handler_t handler, void *arg);
+
+
+/*
+ * chirouter_packet_send - Queue a frame for transmission
+ *
+ * The frame is copied into the transmit ring, and is only sent once
+ * chirouter_packet_flush is called (or right away, if flush is true).
+ * If the transmit ring is full, the frame is dropped.
+ *
+ * pkt: Socket
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame
+ *
+ * flush: Whether to tell the kernel to send the frame right away
+ *
+ * Returns: 0 on success, 1 if the frame was dropped, -1 if the
+ *          frame does not fit in a slot
+ */
+int chirouter_packet_send(chirouter_packet_t *pkt, const uint8_t *frame, size_t len, bool flush);
+
+
+/*
+ * chirouter_packet_flush - Send the frames queued for transmission
+ *
+ * pkt: Socket
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+int chirouter_packet_flush(chirouter_packet_t *pkt);
+
+#endif
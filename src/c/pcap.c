@@ -139,14 +139,17 @@ int chirouter_pcap_write_option(server_ctx_t *ctx, uint16_t option_code, uint16_
 }
 
 
-/* See pcap.h */
-int chirouter_pcap_write_interfaces(server_ctx_t *ctx)
+/*
+ * chirouter_pcap_write_interfaces_locked - Writes the interface description blocks
+ *
+ * Same as chirouter_pcap_write_interfaces, but the caller must hold
+ * the server's pcap_lock.
+ */
+static int chirouter_pcap_write_interfaces_locked(server_ctx_t *ctx, chirouter_ctx_t *routers, uint16_t num_routers)
 {
-    uint32_t interface_id = 0;
-
-    for(int i=0; i < ctx->num_routers; i++)
+    for(int i=0; i < num_routers; i++)
     {
-        chirouter_ctx_t *r = &ctx->routers[i];
+        chirouter_ctx_t *r = &routers[i];
 
         for(int i=0; i < r->num_interfaces; i++)
         {
@@ -156,7 +159,7 @@ int chirouter_pcap_write_interfaces(server_ctx_t *ctx)
 
             snprintf(iface_name, MAX_ROUTER_NAMELEN + MAX_IFACE_NAMELEN + 2, "%s-%s", r->name, iface->name);
 
-            iface->pcap_iface_id = interface_id++;
+            iface->pcap_iface_id = ctx->pcap_num_ifaces++;
 
             hdr.block_type = BLOCK_TYPE_IDB;
             hdr.link_type = LINKTYPE_ETHERNET;
@@ -194,9 +197,27 @@ int chirouter_pcap_write_interfaces(server_ctx_t *ctx)
     return EXIT_SUCCESS;
 }
 
+/* See pcap.h */
+int chirouter_pcap_write_interfaces(server_ctx_t *ctx, chirouter_ctx_t *routers, uint16_t num_routers)
+{
+    int rc;
+
+    pthread_mutex_lock(&ctx->pcap_lock);
+    rc = chirouter_pcap_write_interfaces_locked(ctx, routers, num_routers);
+    pthread_mutex_unlock(&ctx->pcap_lock);
+
+    return rc;
+}
+
 #define BILLION 1000000000L
 
-int chirouter_pcap_write_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *msg, size_t len, pcap_packet_direction_t dir)
+/*
+ * chirouter_pcap_write_frame_locked - Writes an Ethernet frame to the capture file
+ *
+ * Same as chirouter_pcap_write_frame, but the caller must hold
+ * the server's pcap_lock.
+ */
+static int chirouter_pcap_write_frame_locked(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *msg, size_t len, pcap_packet_direction_t dir)
 {
     struct pcapng_epb hdr;
 
@@ -269,3 +290,14 @@ int chirouter_pcap_write_frame(chirouter_ctx_t *ctx, chirouter_interface_t *ifac
 }
 
 
+/* See pcap.h */
+int chirouter_pcap_write_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *msg, size_t len, pcap_packet_direction_t dir)
+{
+    int rc;
+
+    pthread_mutex_lock(&ctx->server->pcap_lock);
+    rc = chirouter_pcap_write_frame_locked(ctx, iface, msg, len, dir);
+    pthread_mutex_unlock(&ctx->server->pcap_lock);
+
+    return rc;
+}
@@ -81,19 +81,27 @@ int chirouter_pcap_write_section_header(server_ctx_t *ctx);
  * chirouter_pcap_write_interfaces
  *
  * Writes the interface description blocks for all the interfaces
- * from all the routers.
+ * from the given routers. Since routers from several controllers
+ * can be running at the same time, interfaces are numbered across
+ * all the routers that have been written to the capture file.
  *
  * ctx: Server context
  *
+ * routers: Array of routers
+ *
+ * num_routers: Number of routers
+ *
  * Returns: 0 on success, -1 if an error happens.
  *
  */
-int chirouter_pcap_write_interfaces(server_ctx_t *ctx);
+int chirouter_pcap_write_interfaces(server_ctx_t *ctx, chirouter_ctx_t *routers, uint16_t num_routers);
 
 
 /*
  * chirouter_pcap_write_frame - Writes an Ethernet frame to the capture file
  *
+ * Can be called from any thread (frames are written one at a time)
+ *
  * ctx: Server context
  *
  * iface: Interface the frame was sent on
@@ -60,8 +60,10 @@
 #include <stdbool.h>
 
 #include "chirouter.h"
+#include "server.h"
 #include "arp.h"
 #include "utils.h"
+#include "alloc.h"
 #include "utlist.h"
 
 /* Helper function to get the correct forward IP destination.
@@ -80,15 +82,14 @@ uint32_t get_forward_ip (chirouter_rtable_entry_t *routing_entry,
     return dst_ip;
 }
 
-/* Helper function to get appropriate routing entry for ethernet frame
+/* Helper function to get appropriate routing entry for an IP address
  * with longest-prefix matching.
- * @Params: pointer to router's context struct, pointer to ethernet frame
- * Return: routing entry corresponding to the dst ip of the frame
+ * @Params: pointer to router's context struct, IP address (network order)
+ * Return: routing entry corresponding to the ip, or NULL if there is none
  */
-chirouter_rtable_entry_t* chirouter_get_matching_entry(chirouter_ctx_t *ctx,
-                                                    ethernet_frame_t *frame)
+chirouter_rtable_entry_t* chirouter_rtable_lookup(chirouter_ctx_t *ctx,
+                                                  uint32_t ip)
 {
-    iphdr_t *ip_hdr = (iphdr_t *)(frame->raw + sizeof(ethhdr_t));
     chirouter_rtable_entry_t *result = NULL;
     
     for (int i = 0; i < ctx->num_rtable_entries; i++)
@@ -96,7 +97,7 @@ chirouter_rtable_entry_t* chirouter_get_matching_entry(chirouter_ctx_t *ctx,
         /* Loop through each entry in router's routing table */
         uint32_t entry_mask = in_addr_to_uint32(ctx->routing_table[i].mask);
         uint32_t entry_dst = in_addr_to_uint32(ctx->routing_table[i].dest);
-        if ((ip_hdr->dst & entry_mask) == entry_dst)
+        if ((ip & entry_mask) == entry_dst)
         {
             // Found matching entry
             if (result != NULL)
@@ -118,6 +119,19 @@ chirouter_rtable_entry_t* chirouter_get_matching_entry(chirouter_ctx_t *ctx,
     return result;
 }
 
+/* Helper function to get appropriate routing entry for ethernet frame
+ * with longest-prefix matching.
+ * @Params: pointer to router's context struct, pointer to ethernet frame
+ * Return: routing entry corresponding to the dst ip of the frame
+ */
+chirouter_rtable_entry_t* chirouter_get_matching_entry(chirouter_ctx_t *ctx,
+                                                    ethernet_frame_t *frame)
+{
+    iphdr_t *ip_hdr = (iphdr_t *)(frame->raw + sizeof(ethhdr_t));
+
+    return chirouter_rtable_lookup(ctx, ip_hdr->dst);
+}
+
 /* Helper function to forward IP datagram
  * @Params: pointer to chirouter_ctx_t, pointer to ethernet_frame_t, 
  * destination MAC address
@@ -125,34 +139,27 @@ chirouter_rtable_entry_t* chirouter_get_matching_entry(chirouter_ctx_t *ctx,
  */
 void forward_ip_datagram(chirouter_ctx_t *ctx, ethernet_frame_t *frame, uint8_t *dst_mac)
 {
-    // From original frame
-    ethhdr_t *frame_ethhdr = (ethhdr_t *)frame->raw;
-    iphdr_t *frame_iphdr = (iphdr_t *)(frame->raw + sizeof(ethhdr_t));
     // Routing entry based on frame
     chirouter_rtable_entry_t *rentry = chirouter_get_matching_entry(ctx, frame);
 
-    /* Construct new frame */
-    int msg_len = frame->length;
-    uint8_t msg[msg_len];
-    memset(msg, 0, msg_len);
+    /* The frame is rewritten in place (the frame is not used
+     * after it has been forwarded) */
 
     /* Ethernet header */
-    ethhdr_t *ether_hdr = (ethhdr_t *) msg;
+    ethhdr_t *ether_hdr = (ethhdr_t *) frame->raw;
     memcpy(ether_hdr->dst, dst_mac, ETHER_ADDR_LEN);
     memcpy(ether_hdr->src, rentry->interface->mac, ETHER_ADDR_LEN);
     ether_hdr->type = htons(ETHERTYPE_IP);
 
     /* IP header */
-    iphdr_t *ip_hdr = (iphdr_t *)(msg + sizeof(ethhdr_t));
-    // Copy frame's ip header over
-    memcpy(ip_hdr, frame_iphdr, ntohs(frame_iphdr->len));
+    iphdr_t *ip_hdr = (iphdr_t *)(frame->raw + sizeof(ethhdr_t));
     // Update TTL and checksum
-    ip_hdr->ttl = frame_iphdr->ttl - 1;
+    ip_hdr->ttl = ip_hdr->ttl - 1;
     ip_hdr->cksum = htons(0);
     ip_hdr->cksum = cksum(ip_hdr, sizeof(iphdr_t));
 
-    // Forward newly constructed IP datagram
-    chirouter_send_frame(ctx, rentry->interface, msg, msg_len);
+    // Forward the rewritten IP datagram
+    chirouter_send_frame(ctx, rentry->interface, frame->raw, frame->length);
     return;
 }
 
@@ -271,6 +278,64 @@ void chirouter_send_icmp(chirouter_ctx_t *ctx, uint8_t type,
     return;
 }
 
+/* Helper function to learn an IP/MAC mapping from an ARP message.
+ * Updates the ARP cache and, if there is a pending ARP request for
+ * the IP address, forwards the withheld frames and removes the request.
+ * @Params: pointer to router's context struct, sender IP and MAC,
+ * whether to create a new entry if there isn't one already
+ * Return nothing
+ */
+void chirouter_arp_learn(chirouter_ctx_t *ctx, uint32_t ip, uint8_t *mac,
+                                                            bool create)
+{
+    struct in_addr addr;
+    addr.s_addr = ip;
+
+    pthread_mutex_lock(&(ctx->lock_arp));
+    if (chirouter_arp_cache_lookup(ctx, &addr) == NULL && !create)
+    {
+        pthread_mutex_unlock(&(ctx->lock_arp));
+        return;
+    }
+
+    // add (or update) ip and corresponding mac address in arp cache
+    if (chirouter_arp_cache_add(ctx, &addr, mac) != 0)
+    {
+        chilog(WARNING, "[ARP MESSAGE]: COULD NOT ADD ENTRY TO ARP CACHE");
+    }
+
+    // forward withheld frames - decrement TTL - checksum
+    chirouter_pending_arp_req_t *arp_req = chirouter_arp_pending_req_lookup(ctx, &addr);
+    if (arp_req == NULL)
+    {
+        chilog(DEBUG, "[ARP MESSAGE]: NO PENDING ARP FOUND");
+    }
+    else
+    {
+        chilog(DEBUG, "[ARP MESSAGE] PENDING ARP FOUND");
+        withheld_frame_t *elt;
+        DL_FOREACH(arp_req->withheld_frames, elt)
+        {
+            iphdr_t *ip_hdr = (iphdr_t *)(elt->frame->raw + sizeof(ethhdr_t));
+            if (ip_hdr->ttl == 1) 
+            {
+                // Time exceeded
+                chirouter_send_icmp(ctx, ICMPTYPE_TIME_EXCEEDED,
+                                    0, elt->frame);
+            }
+            else
+            {
+                // Forward withheld frame
+                forward_ip_datagram(ctx, elt->frame, mac);
+            }
+        }
+        // Free withheld frames and remove the pending ARP request
+        // from the pending ARP request list
+        chirouter_arp_pending_req_remove(ctx, arp_req);
+    }
+    pthread_mutex_unlock(&(ctx->lock_arp));
+}
+
 /*
  * chirouter_process_ethernet_frame - Process a single inbound Ethernet frame
  *
@@ -283,12 +348,19 @@ void chirouter_send_icmp(chirouter_ctx_t *ctx, uint8_t type,
  * adding it to a list of withheld frames in the pending ARP request list)
  * you must make a deep copy of the frame.
  *
- * chirouter can manage multiple routers at once, but does so in a single
- * thread. i.e., it is guaranteed that this function is always called
- * sequentially, and that there will not be concurrent calls to this
- * function. If two routers receive Ethernet frames "at the same time",
- * they will be ordered arbitrarily and processed sequentially, not
- * concurrently (and with each call receiving a different router context)
+ * chirouter can manage multiple routers at once. By default, it does so in
+ * a single thread. i.e., this function is always called sequentially, and
+ * there will not be concurrent calls to this function. If two routers
+ * receive Ethernet frames "at the same time", they will be ordered
+ * arbitrarily and processed sequentially, not concurrently (and with
+ * each call receiving a different router context)
+ *
+ * In worker-pool mode (the -w option), different routers can be processed
+ * concurrently by different threads. However, it is still guaranteed that
+ * there will not be concurrent calls for the same router context, and that
+ * the frames of each router are processed in the order they were received.
+ * Since routers don't share any state, this function doesn't need any
+ * additional locking in either mode.
  *
  * ctx: Router context
  *
@@ -370,54 +442,52 @@ int chirouter_process_ethernet_frame(chirouter_ctx_t *ctx, ethernet_frame_t *fra
             if (forward_entry != NULL)
             {
                 chilog(DEBUG, "[IP FORWARDING]: ROUTING ENTRY FOUND");
-                uint32_t forward_ip = get_forward_ip(forward_entry, ip_hdr->dst);
+                struct in_addr forward_ip = uint32_to_in_addr(get_forward_ip(forward_entry, ip_hdr->dst));
+                uint8_t forward_mac[ETHER_ADDR_LEN];
                 pthread_mutex_lock(&(ctx->lock_arp));
-                chirouter_arpcache_entry_t* arpcache_entry = chirouter_arp_cache_lookup(ctx, uint32_to_in_addr(forward_ip));
+                chirouter_arpcache_entry_t* arpcache_entry = chirouter_arp_cache_lookup(ctx, &forward_ip);
+                if (arpcache_entry != NULL)
+                {
+                    // copy the MAC while holding the lock, and mark the
+                    // entry as in use so it gets refreshed before expiring
+                    memcpy(forward_mac, arpcache_entry->mac, ETHER_ADDR_LEN);
+                    arpcache_entry->time_used = time(NULL);
+                }
                 pthread_mutex_unlock(&(ctx->lock_arp));
                 if (arpcache_entry == NULL)
                 {
                     chilog(DEBUG, "[IP FORWARDING]: ARP CACHE ENTRY NOT FOUND");
                     pthread_mutex_lock(&(ctx->lock_arp));
-                    chirouter_pending_arp_req_t* pending_req = chirouter_arp_pending_req_lookup(ctx, uint32_to_in_addr(forward_ip));
-                    pthread_mutex_unlock(&(ctx->lock_arp));
+                    chirouter_pending_arp_req_t* pending_req = chirouter_arp_pending_req_lookup(ctx, &forward_ip);
                     if (pending_req == NULL)
                     {
-                        
                         chilog(DEBUG, "[IP FORWARDING]: NOT IN PENDING REQUEST LIST");
-                        pthread_mutex_lock(&(ctx->lock_arp));
-                        chilog(DEBUG, "[ARP MESSAGE]: SEND ARP REQUEST");
-                        chirouter_send_arp_message(ctx, 
-                                                    forward_entry->interface, 
-                                                    NULL, forward_ip, 
-                                                    ARP_OP_REQUEST);
-                        // add IP address to pending arp request list
+                        // add IP address to pending arp request list, and send
+                        // the request now if the interface's ARP rate allows it
+                        // (otherwise, the ARP thread will send it shortly)
                         pending_req = chirouter_arp_pending_req_add(ctx, 
-                                                uint32_to_in_addr(forward_ip), 
+                                                &forward_ip, 
                                                 forward_entry->interface);
-                        pending_req->times_sent++;
-                        pending_req->last_sent = time(NULL);
-                        // add frame to the newly created pending arp request item
-                        int result = chirouter_arp_pending_req_add_frame(ctx, 
-                                                        pending_req, frame);
-                        if (result == 1) {
-                            /* An error occurred when adding withheld frames */
+                        if (pending_req == NULL)
+                        {
+                            pthread_mutex_unlock(&(ctx->lock_arp));
+                            chilog(ERROR, "Could not allocate pending ARP request");
                             return -1;
                         }
-                        pthread_mutex_unlock(&(ctx->lock_arp));
+                        chirouter_arp_pending_req_send(ctx, pending_req);
                     }
                     else
                     {
                         chilog(DEBUG, "[IP FORWARDING]: ALREADY IN PENDING REQUEST LIST");
-                        pthread_mutex_lock(&(ctx->lock_arp));
-                        // add frame to the already created pending arp request item
-                        int result = chirouter_arp_pending_req_add_frame(ctx, 
-                                                        pending_req, frame);
-                        if (result == 1)
-                        {
-                            /* An error occurred when adding withheld frames */
-                            return -1;
-                        }
-                        pthread_mutex_unlock(&(ctx->lock_arp));
+                    }
+                    // add frame to the pending arp request item
+                    int result = chirouter_arp_pending_req_add_frame(ctx, 
+                                                    pending_req, frame);
+                    pthread_mutex_unlock(&(ctx->lock_arp));
+                    if (result == 1)
+                    {
+                        /* An error occurred when adding withheld frames */
+                        return -1;
                     }
                 }
                 else
@@ -433,7 +503,7 @@ int chirouter_process_ethernet_frame(chirouter_ctx_t *ctx, ethernet_frame_t *fra
                     else
                     {
                         // Forward IP datagram
-                        forward_ip_datagram(ctx, frame, arpcache_entry->mac);
+                        forward_ip_datagram(ctx, frame, forward_mac);
                     }
                 }
             }
@@ -452,88 +522,52 @@ int chirouter_process_ethernet_frame(chirouter_ctx_t *ctx, ethernet_frame_t *fra
         /* Accessing an ARP message */
         chilog(DEBUG, "[ETHERNET TYPE]: ARP MESSAGES");
         arp_packet_t* arp = (arp_packet_t*) (frame->raw + sizeof(ethhdr_t));
-        if (arp->tpa == in_addr_to_uint32(frame->in_interface->ip))
+        uint16_t arp_op = ntohs(arp->op);
+        bool for_me = (arp->tpa == in_addr_to_uint32(frame->in_interface->ip));
+        bool gratuitous = (arp->spa == arp->tpa);
+
+        if (arp_op != ARP_OP_REQUEST && arp_op != ARP_OP_REPLY)
         {
-            chilog(DEBUG, "[ARP MESSAGE]: IT'S FOR ME");
-            if (ntohs(arp->op) == ARP_OP_REPLY)
-            {
-                chilog(DEBUG, "[ARP MESSAGE]: ARP REPLY");
-                pthread_mutex_lock(&(ctx->lock_arp));
-                // add ip and corresponding mac address to arp cache
-                int result = chirouter_arp_cache_add(ctx, 
-                                                uint32_to_in_addr(arp->spa),
-                                                arp->sha); 
-                pthread_mutex_unlock(&(ctx->lock_arp));
-                if (result != 0)
-                {
-                    /* An error occurred when adding to ARP cache */
-                    return -1;
-                }
-                // forward withheld frames - decrement TTL - checksum
-                pthread_mutex_lock(&(ctx->lock_arp));
-                chirouter_pending_arp_req_t *arp_req = chirouter_arp_pending_req_lookup(ctx, uint32_to_in_addr(arp->spa));
-                if (arp_req == NULL)
-                {
-                    chilog(DEBUG, "[ARP MESSAGE]: NO PENDING ARP FOUND");
-                }
-                else
-                {
-                    chilog(DEBUG, "[ARP MESSAGE] PENDING ARP FOUND");
-                    withheld_frame_t *elt;
-                    DL_FOREACH(arp_req->withheld_frames, elt)
-                    {
-                        // Forward IP datagram
-                        if (elt != NULL)
-                        {
-                            iphdr_t *ip_hdr = (iphdr_t *)(elt->frame->raw + sizeof(ethhdr_t));
-                            if (ip_hdr->ttl == 1) 
-                            {
-                                // Time exceeded
-                                chirouter_send_icmp(ctx, 
-                                                    ICMPTYPE_TIME_EXCEEDED,
-                                                    0, elt->frame);
-                            }
-                            else
-                            {
-                                // Forward withheld frame
-                                forward_ip_datagram(ctx, elt->frame, arp->sha);
-                            }
-                            
-                        }
-                    }
-                    // Free withheld frames
-                    int result = chirouter_arp_pending_req_free_frames(arp_req);
-                    if (result == 1) {
-                        /* An error occurred */
-                        return result;
-                    }
-                    // remove the pending ARP request from the pending ARP request list
-                    DL_DELETE(ctx->pending_arp_reqs, arp_req);
-                    free(arp_req);
-                }
-                pthread_mutex_unlock(&(ctx->lock_arp));
-                
-            } 
-            else if (ntohs(arp->op) == ARP_OP_REQUEST)
-            {
-                // send arp reply
-                chilog(DEBUG, "[ARP MESSAGE]: ARP REQUEST");
-                chirouter_send_arp_message(ctx, frame->in_interface, 
-                                    arp->sha, arp->spa,
-                                    ARP_OP_REPLY);
-            }
-            else
-            {
-                chilog(DEBUG, "[ARP MESSAGE]: ARP CODE NOT VALID");
-            }
+            chilog(DEBUG, "[ARP MESSAGE]: ARP CODE NOT VALID");
+            return 0;
         }
-        else
+
+        if (gratuitous && !ctx->server->arp_gratuitous)
+        {
+            chilog(DEBUG, "[ARP MESSAGE]: IGNORING GRATUITOUS ARP");
+            return 0;
+        }
+
+        // RFC 826: update the sender's entry if we already have one,
+        // and only create a new entry if the message was meant for us
+        if (arp->spa != 0 && arp->spa != in_addr_to_uint32(frame->in_interface->ip))
+        {
+            chirouter_arp_learn(ctx, arp->spa, arp->sha, for_me || gratuitous);
+        }
+
+        if (!for_me)
         {
             chilog(DEBUG, "[ARP MESSAGE]: IT'S NOT FOR ME");
             return 0;
         }
+
+        chilog(DEBUG, "[ARP MESSAGE]: IT'S FOR ME");
+        if (arp_op == ARP_OP_REQUEST)
+        {
+            // send arp reply
+            chilog(DEBUG, "[ARP MESSAGE]: ARP REQUEST");
+            chirouter_send_arp_message(ctx, frame->in_interface, 
+                                arp->sha, arp->spa,
+                                ARP_OP_REPLY);
+        }
+        else
+        {
+            chilog(DEBUG, "[ARP MESSAGE]: ARP REPLY");
+        }
         return 0;
     }
+
+    return 0;
 }
 
 
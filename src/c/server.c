@@ -1,11 +1,13 @@
 /*
  *  chirouter - A simple, testable IP router
  *
- *  This server listens on connections from the POX controller.
- *  Once established, this connection starts with the POX
+ *  This server listens on connections from POX controllers.
+ *  Once established, a connection starts with the POX
  *  controller sending information about all the routers
  *  we have to run and, after that, is used to send/receive
- *  Ethernet frames from/to those routers.
+ *  Ethernet frames from/to those routers. Several controllers
+ *  can be connected at the same time, each with its own routers,
+ *  and they are all served from a single epoll event loop.
  *
  */
 
@@ -55,329 +57,2384 @@
  *
  */
 
+/* For recvmmsg() */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sched.h>
 
 #include "server.h"
 #include "log.h"
 #include "utils.h"
 #include "pcap.h"
+#include "dataplane.h"
 #include "arp.h"
+#include "alloc.h"
+#include "framepool.h"
+#include "utlist.h"
+
+
+/* Forward declarations */
+int chirouter_server_accept(server_ctx_t *ctx);
+int chirouter_server_conn_create(server_ctx_t *ctx, int client_socket, const char *name);
+int chirouter_server_conn_handle_event(server_conn_t *conn, server_event_source_t *src, uint32_t events);
+int chirouter_server_conn_update_events(server_conn_t *conn);
+void chirouter_server_conn_close(server_conn_t *conn, int rc);
+void chirouter_server_conn_destroy(server_conn_t *conn);
+int chirouter_server_process_messages(server_conn_t *conn);
+int chirouter_server_process_rx_buffer(server_conn_t *conn);
+int chirouter_server_process_packets(server_conn_t *conn);
+int chirouter_server_check_packet(server_conn_t *conn, const uint8_t *packet, size_t len, bool truncated);
+int chirouter_server_send_replies(server_conn_t *conn);
+int chirouter_server_listen_tcp(server_ctx_t *ctx, char *port);
+int chirouter_server_listen_unix(server_ctx_t *ctx);
+bool chirouter_server_rx_paused(server_conn_t *conn);
+int chirouter_server_process_single_message(server_conn_t *conn, chirouter_msg_t *msg);
+int chirouter_server_process_frame(server_conn_t *conn, uint8_t r_id, uint8_t iface_id, uint8_t *frame, uint16_t frame_len);
+int chirouter_server_process_ethernet_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *msg, size_t len);
+int chirouter_server_handle_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *frame, size_t len);
+int chirouter_server_conn_free_routers(server_conn_t *conn);
+int chirouter_server_send_iov(server_conn_t *conn, struct iovec *iov, int iovcnt);
+int chirouter_server_send_batched(server_conn_t *conn, struct iovec *iov, int iovcnt);
+int chirouter_server_flush(server_conn_t *conn);
+bool chirouter_server_outq_congested(server_conn_t *conn);
+int chirouter_server_send_failed(server_conn_t *conn);
+size_t chirouter_server_rx_limit(server_conn_t *conn);
+size_t chirouter_server_drr_budget(server_conn_t *conn);
+int chirouter_server_drr_serve(server_conn_t *conn);
+void chirouter_server_wait_for_workers(server_ctx_t *ctx);
+void *chirouter_server_tx_run(void *arg);
+void chirouter_server_notified(server_ctx_t *ctx);
+void chirouter_server_tx_handle_event(server_conn_t *conn, server_event_source_t *src, uint32_t events);
+void chirouter_server_tx_detach(server_conn_t *conn);
+void chirouter_server_tx_stop(server_ctx_t *ctx);
+int chirouter_server_next_timeout(server_ctx_t *ctx);
+int chirouter_server_handle_events(server_ctx_t *ctx, struct epoll_event *events, int nevents);
+void chirouter_server_end_batch(server_ctx_t *ctx);
+int chirouter_server_uring_run(server_ctx_t *ctx);
+int chirouter_server_uring_submit_all(server_ctx_t *ctx);
+int chirouter_server_uring_recv(server_conn_t *conn);
+int chirouter_server_uring_send(server_conn_t *conn);
+void chirouter_server_uring_cancel(server_conn_t *conn);
+void chirouter_server_uring_reap(server_ctx_t *ctx);
+int chirouter_server_uring_wait(void *arg);
+int chirouter_server_uring_process(server_conn_t *conn);
+int chirouter_server_shm_start(server_conn_t *conn);
+int chirouter_server_shm_process(server_conn_t *conn);
+int chirouter_server_shm_check_socket(server_conn_t *conn);
+size_t chirouter_server_shm_send(void *arg, const struct iovec *iov, int iovcnt);
+int chirouter_server_shm_wait(void *arg);
+
+
+/*
+ * chirouter_server_ctx_init - Initializes a server context
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ */
+int chirouter_server_ctx_init(server_ctx_t **ctx)
+{
+    /* Initialize all pointers and sizes to zero */
+    *ctx = chirouter_calloc(1, sizeof(server_ctx_t));
+
+    if(*ctx == NULL)
+        return -1;
+
+    (*ctx)->server_socket = -1;
+    (*ctx)->epoll_fd = -1;
+    (*ctx)->tx_epoll_fd = -1;
+    (*ctx)->tx_wakeup_fd = -1;
+    (*ctx)->notify_fd = -1;
+    (*ctx)->backend = BACKEND_EPOLL;
+    (*ctx)->uring.fd = -1;
+    pthread_mutex_init(&(*ctx)->pcap_lock, NULL);
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_setup - Sets up the chirouter server socket
+ *
+ * The server listens on a Unix domain socket if ctx->unix_path is set,
+ * and on a TCP port otherwise.
+ *
+ * If the server is supposed to use io_uring but the kernel doesn't support
+ * it (or everything we need from it), it falls back to epoll.
+ *
+ * ctx: Server context
+ *
+ * port: TCP port to listen on (ignored if ctx->unix_path is set)
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_setup(server_ctx_t *ctx, char *port)
+{
+    struct epoll_event ev;
+
+    if (ctx->unix_path != NULL)
+    {
+        if (chirouter_server_listen_unix(ctx) == -1)
+            return -1;
+    }
+    else if (chirouter_server_listen_tcp(ctx, port) == -1)
+    {
+        return -1;
+    }
+
+    /* Connections are accepted from the server's event loop,
+     * which must never block (see chirouter_server_run) */
+    fcntl(ctx->server_socket, F_SETFL, fcntl(ctx->server_socket, F_GETFL) | O_NONBLOCK);
+
+    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctx->epoll_fd == -1)
+    {
+        chilog(CRITICAL, "Could not create epoll instance");
+        return -1;
+    }
+
+    ctx->server_src.conn = NULL;
+    ctx->server_src.fd = ctx->server_socket;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &ctx->server_src;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->server_socket, &ev) == -1)
+    {
+        chilog(CRITICAL, "Could not add server socket to epoll instance");
+        return -1;
+    }
+
+    if (ctx->backend == BACKEND_URING &&
+        chirouter_uring_init(&ctx->uring, SERVER_URING_ENTRIES) == -1)
+    {
+        chilog(WARNING, "io_uring is not available (%s). Falling back to epoll.", strerror(errno));
+        ctx->backend = BACKEND_EPOLL;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_listen_tcp - Creates the server socket, listening on a TCP port
+ *
+ * ctx: Server context
+ *
+ * port: TCP port to listen on
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_listen_tcp(server_ctx_t *ctx, char *port)
+{
+    struct addrinfo hints, *res, *p;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int yes = 1;
+
+    if (getaddrinfo(NULL, port, &hints, &res) != 0)
+    {
+        chilog(CRITICAL, NULL, "getaddrinfo() failed");
+        return -1;
+    }
+
+    for(p = res; p != NULL; p = p->ai_next)
+    {
+        if ((ctx->server_socket = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+        {
+            chilog(WARNING, NULL, "Could not open socket");
+            continue;
+        }
+
+        if (setsockopt(ctx->server_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1)
+        {
+            chilog(WARNING, NULL, "Socket setsockopt() failed");
+            close(ctx->server_socket);
+            continue;
+        }
+
+        if (bind(ctx->server_socket, p->ai_addr, p->ai_addrlen) == -1)
+        {
+            chilog(WARNING, NULL, "Socket bind() failed");
+            close(ctx->server_socket);
+            continue;
+        }
+
+        if (listen(ctx->server_socket, 5) == -1)
+        {
+            chilog(WARNING, NULL, "Socket listen() failed");
+            close(ctx->server_socket);
+            continue;
+        }
+
+        break;
+    }
+
+    freeaddrinfo(res);
+
+    if (p == NULL)
+    {
+        chilog(CRITICAL, NULL, "Could not find a socket to bind to.");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_listen_unix - Creates the server socket, listening on a Unix domain socket
+ *
+ * The socket is bound to ctx->unix_path (replacing the socket left there by
+ * a previous run of chirouter, if any), and is a SOCK_SEQPACKET
+ * socket if ctx->seqpacket is set (and a SOCK_STREAM socket otherwise).
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_listen_unix(server_ctx_t *ctx)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(ctx->unix_path) >= sizeof(addr.sun_path))
+    {
+        chilog(CRITICAL, "Socket path %s is too long", ctx->unix_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, ctx->unix_path);
+
+    ctx->server_socket = socket(AF_UNIX, ctx->seqpacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
+    if (ctx->server_socket == -1)
+    {
+        chilog(CRITICAL, "Could not open socket");
+        return -1;
+    }
+
+    if (stat(ctx->unix_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(ctx->unix_path);
+    if (bind(ctx->server_socket, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+        chilog(CRITICAL, "Could not bind socket to %s", ctx->unix_path);
+        close(ctx->server_socket);
+        ctx->server_socket = -1;
+        return -1;
+    }
+
+    if (listen(ctx->server_socket, 5) == -1)
+    {
+        chilog(CRITICAL, "Socket listen() failed");
+        close(ctx->server_socket);
+        ctx->server_socket = -1;
+        unlink(ctx->unix_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_send_msg - Sends a message to a controller
+ *
+ * conn: Connection to the controller
+ *
+ * msg: Message to send
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_send_msg(server_conn_t *conn, chirouter_msg_t *msg)
+{
+    struct iovec iov;
+
+    iov.iov_base = msg;
+    iov.iov_len = MSG_HDR_LEN + ntohs(msg->payload_length);
+
+    return chirouter_server_send_iov(conn, &iov, 1);
+}
+
+
+/*
+ * chirouter_server_send_iov - Sends a message made up of several buffers to a controller
+ *
+ * Only the writer thread (the server thread or, in pipeline mode, the
+ * TX thread) writes to the controller sockets.
+ *
+ * If called from the writer thread, the message is added to the connection's
+ * transmit queue, which is flushed once all the messages received with a
+ * single recv() call have been processed (see chirouter_server_process_messages)
+ * or, with fair scheduling, once a batch of queued frames has been processed
+ * (see chirouter_server_drr_serve).
+ * Buffers that are inside the connection's receive buffer (e.g., a frame that
+ * is being forwarded) are queued by reference, since the receive buffer is
+ * not reused until the queue has been flushed. Other buffers are copied.
+ *
+ * If called from any other thread (e.g., an ARP thread), the message is
+ * copied into the connection's transmit ring (see txring.h), and the
+ * writer thread is woken up to send it. Worker threads (see worker.h)
+ * wait for room in the ring if it is full, instead of dropping the
+ * message, since they send most of the frames in worker-pool mode. So
+ * does the server thread in pipeline mode, since it sends all the
+ * control messages.
+ *
+ * If the outbound queue is congested and the overflow policy is OUTQ_DROP,
+ * Ethernet frames are silently dropped (the message has to start with
+ * its header in the first buffer, so we can check its type). If the
+ * controller asked for FRAME BATCH messages, the Ethernet frames sent
+ * by the writer thread are added to a batch instead of being sent in
+ * their own message (see chirouter_server_send_batched).
+ *
+ * conn: Connection to the controller
+ *
+ * iov: Array of buffers
+ *
+ * iovcnt: Number of buffers
+ *
+ * Returns: 0 on success, -1 if an error happens (or if the message
+ *          had to be dropped because the transmit ring was full)
+ *
+ */
+int chirouter_server_send_iov(server_conn_t *conn, struct iovec *iov, int iovcnt)
+{
+    server_ctx_t *ctx = conn->server;
+    uint8_t type = ((uint8_t *) iov[0].iov_base)[0];
+    int rc = 0;
+
+    if (!pthread_equal(pthread_self(), ctx->writer_thread))
+    {
+        chirouter_worker_t *worker = chirouter_worker_current();
+
+        if (worker != NULL)
+            return chirouter_txring_enqueue_wait(&conn->txring, iov, iovcnt, &worker->stop);
+        if (pthread_equal(pthread_self(), ctx->server_thread))
+            return chirouter_txring_enqueue_wait(&conn->txring, iov, iovcnt, &ctx->tx_stop);
+        return chirouter_txring_enqueue(&conn->txring, iov, iovcnt);
+    }
+
+    if (type == MSG_TYPE_ETHERNET_FRAME && ctx->outq_policy == OUTQ_DROP &&
+        chirouter_server_outq_congested(conn))
+    {
+        conn->outq_drops++;
+        return 0;
+    }
+
+    if (type == MSG_TYPE_ETHERNET_FRAME && conn->frame_batch)
+        return chirouter_server_send_batched(conn, iov, iovcnt);
+
+    /* Any frames sent after this message can't be added to the batch before it */
+    conn->batch_hdr = NULL;
+
+    for (int i = 0; i < iovcnt && rc == 0; i++)
+    {
+        uint8_t *base = iov[i].iov_base;
+        bool in_rx_buffer = base >= conn->rx_buffer &&
+                            base + iov[i].iov_len <= conn->rx_buffer + SERVER_RX_BUFFER_SIZE;
+
+        rc = chirouter_txq_add(&conn->txq, conn->client_socket, base, iov[i].iov_len, !in_rx_buffer);
+    }
+
+    return rc;
+}
+
+
+/*
+ * chirouter_server_send_batched - Adds an Ethernet frame to a FRAME BATCH message
+ *
+ * Only called from the writer thread, when the controller asked for FRAME
+ * BATCH messages (see chirouter_server_send_iov). The frame is added to
+ * the FRAME BATCH message that is still in the transmit queue, if there
+ * is one and the frame fits in it, by extending the message's payload
+ * length. Otherwise, a new FRAME BATCH message is started. Either way,
+ * only the ETHERNET FRAME message's payload (i.e., without its header)
+ * is queued.
+ *
+ * If the transmit queue has to be flushed to make room for the frame,
+ * the header of the batch goes out with the new payload length, and
+ * the frame right after it, so the controller still gets a valid
+ * message (and the next frame starts a new batch).
+ *
+ * conn: Connection to the controller
+ *
+ * iov: Array of buffers with an ETHERNET FRAME message (the first
+ *      buffer must hold at least the message header)
+ *
+ * iovcnt: Number of buffers
+ *
+ * Returns: 0 on success, -1 if an error happens
+ *
+ */
+int chirouter_server_send_batched(server_conn_t *conn, struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    int rc = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    len -= MSG_HDR_LEN;
+
+    if (conn->batch_hdr != NULL && conn->batch_generation == conn->txq.generation &&
+        ntohs(conn->batch_hdr->payload_length) + len <= UINT16_MAX)
+    {
+        conn->batch_hdr->payload_length = htons(ntohs(conn->batch_hdr->payload_length) + len);
+    }
+    else
+    {
+        chirouter_msg_t hdr;
+
+        hdr.type = MSG_TYPE_FRAME_BATCH;
+        hdr.subtype = FROM_ROUTER;
+        hdr.payload_length = htons(len);
+
+        conn->batch_hdr = chirouter_txq_stage(&conn->txq, conn->client_socket, &hdr, MSG_HDR_LEN);
+        if (conn->batch_hdr == NULL)
+            return -1;
+        conn->batch_generation = conn->txq.generation;
+    }
+
+    for (int i = 0; i < iovcnt && rc == 0; i++)
+    {
+        uint8_t *base = iov[i].iov_base;
+        size_t buf_len = iov[i].iov_len;
+        bool in_rx_buffer;
+
+        if (i == 0)
+        {
+            base += MSG_HDR_LEN;
+            buf_len -= MSG_HDR_LEN;
+        }
+
+        in_rx_buffer = base >= conn->rx_buffer && base + buf_len <= conn->rx_buffer + SERVER_RX_BUFFER_SIZE;
+        if (buf_len > 0)
+            rc = chirouter_txq_add(&conn->txq, conn->client_socket, base, buf_len, !in_rx_buffer);
+    }
+
+    return rc;
+}
+
+
+/*
+ * chirouter_server_flush - Sends all the queued messages to a controller
+ *
+ * Sends the messages in the connection's transmit queue, along with any
+ * messages that other threads have added to its transmit ring. Only the
+ * messages that fit in the transmit queue's backlog are taken from the
+ * ring (the rest are sent once the socket has drained the backlog), so
+ * this never has to wait for the controller. Must only be called from
+ * the writer thread.
+ *
+ * conn: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_flush(server_conn_t *conn)
+{
+    server_ctx_t *ctx = conn->server;
+    const uint8_t *data;
+    size_t n = 0, len, room;
+    int rc = 0;
+
+    if (atomic_exchange(&conn->reset_tx_stats, false))
+    {
+        conn->txq.bufs_sent = conn->txq.bytes_sent = conn->txq.writes = 0;
+        conn->txq.backlog_peak = conn->txq.stalls = 0;
+        conn->outq_congestions = conn->outq_drops = 0;
+    }
+
+    room = conn->txq.backlog_size - chirouter_txq_backlog(&conn->txq);
+    room = room > conn->txq.bytes ? room - conn->txq.bytes : 0;
+
+    /* The messages in the ring go after the current batch */
+    conn->batch_hdr = NULL;
+
+    /* The messages in the ring are queued by reference, and only
+     * released once they have been flushed */
+    while (rc == 0 && (data = chirouter_txring_peek(&conn->txring, n, &len)) != NULL)
+    {
+        if (data[0] == MSG_TYPE_ETHERNET_FRAME && ctx->outq_policy == OUTQ_DROP &&
+            chirouter_server_outq_congested(conn))
+        {
+            conn->outq_drops++;
+        }
+        else if (len > room)
+        {
+            break;
+        }
+        else
+        {
+            rc = chirouter_txq_add(&conn->txq, conn->client_socket, data, len, false);
+            room -= len;
+        }
+        n++;
+    }
+
+    if (rc == 0)
+    {
+        rc = chirouter_txq_flush(&conn->txq, conn->client_socket);
+    }
+
+    chirouter_txring_release(&conn->txring, n);
+
+    chirouter_server_outq_congested(conn);
+
+    return rc;
+}
+
+
+/*
+ * chirouter_server_outq_congested - Checks whether an outbound queue is congested
+ *
+ * Updates the congestion state of a connection's outbound queue, based
+ * on the size of its transmit queue's backlog and the server's outq_high
+ * and outq_low watermarks (see server_conn_t). Must only be called from
+ * the writer thread (in pipeline mode, the server thread is notified
+ * whenever the state changes, see chirouter_server_notified)
+ *
+ * conn: Connection to a controller
+ *
+ * Returns: true if the outbound queue is congested, false otherwise.
+ *
+ */
+bool chirouter_server_outq_congested(server_conn_t *conn)
+{
+    server_ctx_t *ctx = conn->server;
+    size_t backlog = chirouter_txq_backlog(&conn->txq);
+
+    if (!conn->outq_congested && backlog >= ctx->outq_high)
+    {
+        conn->outq_congested = true;
+        conn->outq_congestions++;
+        chilog(DEBUG, "Outbound queue to %s congested (%zu bytes waiting to be sent)", conn->name, backlog);
+        if (ctx->tx_thread_enabled)
+            chirouter_server_notify(ctx);
+    }
+    else if (conn->outq_congested && backlog <= ctx->outq_low)
+    {
+        conn->outq_congested = false;
+        chilog(DEBUG, "Outbound queue to %s no longer congested (%zu bytes waiting to be sent)", conn->name, backlog);
+        if (ctx->tx_thread_enabled)
+            chirouter_server_notify(ctx);
+    }
+
+    return conn->outq_congested;
+}
+
+
+/*
+ * chirouter_server_rx_limit - Gets how much can be received from a controller
+ *
+ * Processing the messages received from a controller queues about as
+ * many bytes to send back to it (and never more than twice as many), so
+ * we never receive more than half of the free space in the transmit
+ * queue's backlog at once. Otherwise, the server thread would have to
+ * wait for this controller to make room in the backlog, which would
+ * stop it from serving all the other controllers.
+ *
+ * In pipeline mode, the backlog belongs to the TX thread, which is the
+ * one that would have to wait, and we stop reading from the controller
+ * once its outbound queue is congested instead (see main.c for why the
+ * queue is large enough for that to work). With fair scheduling, the
+ * frames we receive are only queued, and it is serving them that is
+ * limited instead (see chirouter_server_drr_budget).
+ *
+ * conn: Connection to a controller
+ *
+ * Returns: maximum number of bytes to receive (0 if the
+ *          backlog is full and we should stop reading)
+ *
+ */
+size_t chirouter_server_rx_limit(server_conn_t *conn)
+{
+    size_t limit = SERVER_RX_BUFFER_SIZE - conn->rx_tail;
+    size_t backlog_free;
+
+    if (conn->server->tx_thread_enabled || conn->server->drr_enabled)
+        return limit;
+
+    backlog_free = conn->txq.backlog_size - chirouter_txq_backlog(&conn->txq);
+    if (limit > backlog_free / 2)
+        limit = backlog_free / 2;
+
+    return limit;
+}
+
+
+/*
+ * chirouter_server_drr_budget - Gets how many bytes of queued frames can be served
+ *
+ * Fair scheduling only. Like receiving in chirouter_server_rx_limit,
+ * serving frames queues about as many bytes to send back to the
+ * controller (and never more than twice as many), so we never serve
+ * more than half of the free space in the transmit queue's backlog at
+ * once (unless the TX thread takes care of the backlog).
+ *
+ * conn: Connection to a controller
+ *
+ * Returns: maximum number of bytes of frames to serve (0 if there are no
+ *          frames to serve, or if we have to wait for the controller to
+ *          read what we already sent)
+ *
+ */
+size_t chirouter_server_drr_budget(server_conn_t *conn)
+{
+    size_t budget = DRR_BUDGET;
+    size_t backlog_free;
+
+    if (conn->closed || conn->drr_queued == 0)
+        return 0;
+
+    if (conn->server->tx_thread_enabled)
+        return budget;
+
+    backlog_free = conn->txq.backlog_size - chirouter_txq_backlog(&conn->txq);
+    if (budget > backlog_free / 2)
+        budget = backlog_free / 2;
+
+    return budget >= ETHER_FRAME_MAX_LEN ? budget : 0;
+}
+
+
+/*
+ * chirouter_server_drr_serve - Serves the frames queued for the routers of a controller
+ *
+ * Fair scheduling only. Processes as many of the frames in the input
+ * queues of the routers as chirouter_server_drr_budget allows (see
+ * drr.h), and sends the replies. The server keeps calling this function
+ * (in between checking for new messages) until the queues are empty.
+ *
+ * conn: Connection to a controller
+ *
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
+ *
+ */
+int chirouter_server_drr_serve(server_conn_t *conn)
+{
+    size_t budget = chirouter_server_drr_budget(conn);
+
+    if (budget == 0)
+        return 0;
+
+    /* In vector mode, the frames that were served are only processed
+     * by chirouter_vector_flush (serving a frame removes it from its
+     * input queue, but it stays where it is until the next frame is
+     * added to the queue) */
+    if (chirouter_drr_serve(conn, budget) == -1 ||
+        (conn->server->vector_enabled && chirouter_vector_flush(conn) == -1))
+    {
+        chilog(CRITICAL, "Error while processing queued frames.");
+        return -1;
+    }
+
+    if (!conn->server->tx_thread_enabled && chirouter_server_flush(conn) == -1)
+        return chirouter_server_send_failed(conn);
+
+    return chirouter_server_conn_update_events(conn);
+}
+
+
+/*
+ * chirouter_server_send_failed - Handles an error sending to a controller
+ *
+ * A controller that goes away while we are sending to it is treated
+ * as a normal disconnection.
+ *
+ * conn: Connection to the controller
+ *
+ * Returns:
+ *  1 if the controller closed the connection
+ *  -1 if any other error occurred
+ *
+ */
+int chirouter_server_send_failed(server_conn_t *conn)
+{
+    if (errno == EPIPE || errno == ECONNRESET)
+    {
+        chilog(DEBUG, "Controller %s closed connection", conn->name);
+        return 1;
+    }
+
+    chilog(CRITICAL, "Could not send message to controller %s", conn->name);
+    return -1;
+}
+
+
+/*
+ * chirouter_server_wait_for_workers - Waits for the worker threads to make progress
+ *
+ * Called by the server thread whenever it has to wait for the workers.
+ * The workers could themselves be waiting for room in a transmit ring
+ * (see chirouter_server_send_iov), so we send the messages in the rings
+ * of all the connections while we wait (unless the TX thread takes care
+ * of that). If sending fails, the socket will report an error, and the
+ * connection will be closed once the server thread gets to it. With
+ * io_uring, we also have to send the backlogs, and check whether the
+ * previous sends have completed (without waiting).
+ *
+ * ctx: Server context
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_wait_for_workers(server_ctx_t *ctx)
+{
+    server_conn_t *conn;
+
+    if (!ctx->tx_thread_enabled)
+    {
+        DL_FOREACH(ctx->conns, conn)
+        {
+            if (!conn->closed)
+                chirouter_server_flush(conn);
+        }
+    }
+
+    if (ctx->backend == BACKEND_URING &&
+        chirouter_server_uring_submit_all(ctx) == 0 &&
+        chirouter_uring_submit(&ctx->uring, false, 0) == 0)
+    {
+        chirouter_server_uring_reap(ctx);
+    }
+
+    sched_yield();
+}
+
+
+/*
+ * chirouter_server_run - Run the chirouter server
+ *
+ * The server waits for events on the server socket (new controllers)
+ * and on all the connections to controllers with a single epoll
+ * instance, and handles them all on the calling thread. A connection
+ * that fails (e.g., because its controller sent an invalid message)
+ * is closed without affecting the other connections.
+ *
+ * In worker-pool mode, the server thread also rebalances the routers
+ * across the workers every WORKER_REBALANCE_INTERVAL_MS milliseconds.
+ * With fair scheduling, it serves the frames queued for the routers after
+ * every batch of events, and doesn't wait for new events while there are
+ * frames it can serve.
+ *
+ * With the io_uring backend, the server runs chirouter_server_uring_run instead.
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_run(server_ctx_t *ctx)
+{
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int nevents;
+
+    ctx->server_thread = pthread_self();
+    if (!ctx->tx_thread_enabled)
+        ctx->writer_thread = ctx->server_thread;
+
+    if (ctx->backend == BACKEND_URING)
+        return chirouter_server_uring_run(ctx);
+
+    chilog(INFO, "Waiting for connections from controllers...");
+    while (1)
+    {
+        nevents = epoll_wait(ctx->epoll_fd, events, SERVER_MAX_EVENTS, chirouter_server_next_timeout(ctx));
+        if (nevents == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            chilog(CRITICAL, "epoll_wait() failed");
+            return -1;
+        }
+
+        if (chirouter_server_handle_events(ctx, events, nevents) == -1)
+            return -1;
+
+        chirouter_server_end_batch(ctx);
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_next_timeout - Gets how long the server can wait for events
+ *
+ * In worker-pool mode, the server has to wake up to rebalance the routers
+ * (and does so if it is time to). With fair scheduling, it must not wait
+ * at all while there are frames it can serve. Neither can it while there
+ * is data it can read from shared memory and, otherwise, it must not
+ * wait for more than SERVER_SHM_RECHECK_MS (see shm.h).
+ *
+ * ctx: Server context
+ *
+ * Returns: timeout in milliseconds (-1 to wait for as long as it takes)
+ *
+ */
+int chirouter_server_next_timeout(server_ctx_t *ctx)
+{
+    server_conn_t *conn;
+    int timeout = -1;
+
+    if (ctx->num_workers > 0)
+    {
+        uint64_t now = chirouter_now_ms();
+
+        if (now >= ctx->next_rebalance)
+            chirouter_workers_rebalance(ctx);
+        timeout = ctx->next_rebalance > now ? ctx->next_rebalance - now : 0;
+    }
+
+    if (ctx->drr_enabled)
+    {
+        DL_FOREACH(ctx->conns, conn)
+        {
+            if (chirouter_server_drr_budget(conn) > 0)
+                timeout = 0;
+        }
+    }
+
+    DL_FOREACH(ctx->conns, conn)
+    {
+        if (conn->shm == NULL || conn->closed)
+            continue;
+
+        if (conn->state == RUNNING && !chirouter_server_rx_paused(conn) &&
+            !chirouter_shm_prepare_wait(conn->shm))
+            timeout = 0;
+        else if (timeout == -1 || timeout > SERVER_SHM_RECHECK_MS)
+            timeout = SERVER_SHM_RECHECK_MS;
+    }
+
+    return timeout;
+}
+
+
+/*
+ * chirouter_server_handle_events - Handles a batch of events from the epoll instance
+ *
+ * ctx: Server context
+ *
+ * events: Events returned by epoll_wait
+ *
+ * nevents: Number of events
+ *
+ * Returns: 0 on success, -1 if an error happens (that is not
+ *          specific to one of the connections)
+ *
+ */
+int chirouter_server_handle_events(server_ctx_t *ctx, struct epoll_event *events, int nevents)
+{
+    server_conn_t *conn;
+    int rc;
+
+    for (int i = 0; i < nevents; i++)
+    {
+        server_event_source_t *src = events[i].data.ptr;
+
+        if (src == &ctx->notify_src)
+        {
+            chirouter_server_notified(ctx);
+            continue;
+        }
+        else if (src->conn == NULL)
+        {
+            if (chirouter_server_accept(ctx) == -1)
+                return -1;
+            continue;
+        }
+
+        conn = src->conn;
+        if (conn->closed)
+            continue;
+
+        rc = chirouter_server_conn_handle_event(conn, src, events[i].events);
+        if (rc != 0)
+            chirouter_server_conn_close(conn, rc);
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_end_batch - Finishes handling a batch of events
+ *
+ * With fair scheduling, serves the frames queued for the routers, and
+ * exchanges frames with the controllers that use shared memory. Then
+ * frees the connections that were closed (since no event in this batch
+ * can refer to them anymore), unless io_uring still has requests in
+ * progress for them.
+ *
+ * ctx: Server context
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_end_batch(server_ctx_t *ctx)
+{
+    server_conn_t *conn, *tmp;
+    int rc;
+
+    if (ctx->drr_enabled)
+    {
+        DL_FOREACH(ctx->conns, conn)
+        {
+            if (conn->closed)
+                continue;
+
+            rc = chirouter_server_drr_serve(conn);
+            if (rc != 0)
+                chirouter_server_conn_close(conn, rc);
+        }
+    }
+
+    DL_FOREACH(ctx->conns, conn)
+    {
+        if (conn->shm == NULL || conn->closed)
+            continue;
+
+        rc = chirouter_server_shm_process(conn);
+        if (rc != 0)
+            chirouter_server_conn_close(conn, rc);
+    }
+
+    DL_FOREACH_SAFE(ctx->conns, conn, tmp)
+    {
+        if (conn->closed && conn->uring_ops == 0)
+        {
+            DL_DELETE(ctx->conns, conn);
+            ctx->num_conns--;
+            chirouter_server_conn_destroy(conn);
+        }
+    }
+}
+
+
+/*
+ * chirouter_server_accept - Accepts connections from controllers
+ *
+ * Accepts all the pending connections on the server socket.
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_accept(server_ctx_t *ctx)
+{
+    struct sockaddr_storage client_addr;
+    socklen_t sa_size;
+    int client_socket, rc;
+    char ip[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    char name[NI_MAXHOST + NI_MAXSERV + 1];
+
+    while (1)
+    {
+        sa_size = sizeof(client_addr);
+        client_socket = accept(ctx->server_socket, (struct sockaddr *) &client_addr, &sa_size);
+        if (client_socket == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            chilog(CRITICAL, "Could not accept() connection");
+            return -1;
+        }
+
+        rc = getnameinfo((struct sockaddr *) &client_addr, sa_size,
+                         ip, NI_MAXHOST, port, NI_MAXSERV, NI_NUMERICHOST | NI_NUMERICSERV);
+
+        /* Controllers connected to a Unix domain socket have no address */
+        if(ctx->unix_path)
+            snprintf(name, sizeof(name), "%s#%d", ctx->unix_path, client_socket);
+        else if(rc)
+            snprintf(name, sizeof(name), "(unknown)");
+        else
+            snprintf(name, sizeof(name), "%s:%s", ip, port);
+
+        chilog(INFO, "Controller connected from %s", name);
+
+        /* We batch outgoing messages ourselves (see chirouter_server_send_iov),
+         * so Nagle's algorithm would only delay them. Note that the socket is
+         * non-blocking: the server thread must never block on a controller
+         * socket, since that would stop it from serving everything else */
+        int one = 1;
+        if (!ctx->unix_path)
+            setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+
+        if (chirouter_server_conn_create(ctx, client_socket, name) == -1)
+        {
+            chilog(ERROR, "Could not allocate resources for controller %s", name);
+            close(client_socket);
+        }
+    }
+}
+
+
+/*
+ * chirouter_server_conn_create - Creates a connection to a controller
+ *
+ * Allocates the connection's buffers and adds it to the server's list of
+ * connections and to its epoll instance (in pipeline mode, the transmit
+ * ring and the socket are also added to the TX thread's epoll instance,
+ * so it can send the messages in the ring, and wait for the socket to
+ * be writable). With io_uring, the socket is not added to the server's
+ * epoll instance, and the connection gets its own buffer group instead
+ * (its messages start being received once the server gets back to
+ * chirouter_server_uring_run).
+ *
+ * ctx: Server context
+ *
+ * client_socket: Socket connected to the controller
+ *
+ * name: Address of the controller
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_conn_create(server_ctx_t *ctx, int client_socket, const char *name)
+{
+    /* The transmit ring has fields aligned to cache lines */
+    server_conn_t *conn = chirouter_aligned_calloc(_Alignof(server_conn_t), 1, sizeof(server_conn_t));
+    struct epoll_event ev;
+    int ring_epoll_fd = ctx->tx_thread_enabled ? ctx->tx_epoll_fd : ctx->epoll_fd;
+
+    if (conn == NULL)
+        return -1;
+
+    conn->server = ctx;
+    conn->client_socket = client_socket;
+    snprintf(conn->name, sizeof(conn->name), "%s", name);
+    conn->state = HELLO_WAIT;
+    conn->txring.eventfd = -1;
+
+    conn->rx_buffer = chirouter_calloc(SERVER_RX_BUFFER_SIZE, 1);
+    if (conn->rx_buffer == NULL ||
+        chirouter_txq_init(&conn->txq) ||
+        chirouter_txq_set_backlog_size(&conn->txq, ctx->outq_size) ||
+        chirouter_txring_init(&conn->txring))
+    {
+        chirouter_server_conn_destroy(conn);
+        return -1;
+    }
+
+    if (ctx->seqpacket)
+        conn->txq.max_write = SERVER_SEQPACKET_MAX_WRITE;
+
+    if (ctx->backend == BACKEND_URING)
+    {
+        server_conn_t *other;
+
+        /* Buffer group IDs only have to be unique among the open connections */
+        for (other = ctx->conns; other != NULL; other = other->next)
+        {
+            if (other->rx_bufs.group == ctx->uring_next_group)
+            {
+                ctx->uring_next_group++;
+                other = ctx->conns;
+            }
+        }
+
+        if (chirouter_uring_bufs_init(&ctx->uring, &conn->rx_bufs, ctx->uring_next_group++,
+                                      SERVER_URING_RX_BUFS, SERVER_URING_RX_BUF_SIZE) == -1)
+        {
+            chirouter_server_conn_destroy(conn);
+            return -1;
+        }
+
+        /* The backlog is sent by chirouter_server_uring_send */
+        if (!ctx->tx_thread_enabled)
+            chirouter_txq_set_async(&conn->txq, chirouter_server_uring_wait, conn);
+    }
+
+    conn->socket_src.conn = conn;
+    conn->socket_src.fd = client_socket;
+    conn->txring_src.conn = conn;
+    conn->txring_src.fd = conn->txring.eventfd;
+    conn->tx_socket_src.conn = conn;
+    conn->tx_socket_src.fd = client_socket;
+
+    conn->socket_events = EPOLLIN;
+    ev.events = conn->socket_events;
+    ev.data.ptr = &conn->socket_src;
+    if (ctx->backend == BACKEND_EPOLL && epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == -1)
+    {
+        chirouter_server_conn_destroy(conn);
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &conn->txring_src;
+    if (epoll_ctl(ring_epoll_fd, EPOLL_CTL_ADD, conn->txring.eventfd, &ev) == -1)
+    {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
+        chirouter_server_conn_destroy(conn);
+        return -1;
+    }
+
+    /* The TX thread only waits for the socket to be writable
+     * when there is something in the backlog */
+    conn->tx_socket_events = 0;
+    ev.events = conn->tx_socket_events;
+    ev.data.ptr = &conn->tx_socket_src;
+    if (ctx->tx_thread_enabled && epoll_ctl(ctx->tx_epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == -1)
+    {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
+        epoll_ctl(ctx->tx_epoll_fd, EPOLL_CTL_DEL, conn->txring.eventfd, NULL);
+        chirouter_server_conn_destroy(conn);
+        return -1;
+    }
+
+    DL_APPEND(ctx->conns, conn);
+    ctx->num_conns++;
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_conn_handle_event - Handles an event on a connection
+ *
+ * conn: Connection to a controller
+ *
+ * src: Event source (the connection's socket or its transmit ring)
+ *
+ * events: epoll events
+ *
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
+ *
+ */
+int chirouter_server_conn_handle_event(server_conn_t *conn, server_event_source_t *src, uint32_t events)
+{
+    int rc = 0;
+
+    if (src == &conn->txring_src)
+    {
+        /* Messages from other threads to send */
+        chirouter_txring_ack_wakeup(&conn->txring);
+        if (chirouter_server_flush(conn) == -1)
+            return chirouter_server_send_failed(conn);
+    }
+    else if (src == &conn->shm_src)
+    {
+        /* The controller wrote to the ring to chirouter, or made room
+         * in the ring to the controller */
+        chirouter_shm_ack_wakeup(conn->shm);
+        return chirouter_server_shm_process(conn);
+    }
+    else
+    {
+        /* Sending the backlog can make room for messages
+         * that are still waiting in the transmit ring */
+        if (events & EPOLLOUT)
+        {
+            if (chirouter_server_flush(conn) == -1)
+                return chirouter_server_send_failed(conn);
+        }
+
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            rc = chirouter_server_process_messages(conn);
+            if (rc != 0)
+                return rc;
+        }
+    }
+
+    return chirouter_server_conn_update_events(conn);
+}
+
+
+/*
+ * chirouter_server_conn_update_events - Updates the events we wait for on a connection
+ *
+ * We stop reading from the controller while chirouter_server_rx_paused
+ * says so. We also need to know when the socket is writable if there is
+ * anything waiting to be sent in the backlog (unless the TX thread is
+ * the one sending it, see chirouter_server_tx_handle_event, or the
+ * backlog is sent to shared memory, see chirouter_server_shm_process). With
+ * io_uring, the socket is not in the epoll instance, and there is
+ * nothing to update.
+ *
+ * conn: Connection to a controller
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_conn_update_events(server_conn_t *conn)
+{
+    struct epoll_event ev;
+
+    if (conn->server->backend == BACKEND_URING)
+        return 0;
+
+    ev.events = chirouter_server_rx_paused(conn) ? 0 : EPOLLIN;
+    if (!conn->server->tx_thread_enabled && conn->shm == NULL && chirouter_txq_backlog(&conn->txq) > 0)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = &conn->socket_src;
+
+    if (ev.events == conn->socket_events)
+        return 0;
+
+    if (epoll_ctl(conn->server->epoll_fd, EPOLL_CTL_MOD, conn->client_socket, &ev) == -1)
+    {
+        chilog(CRITICAL, "Could not update events for controller %s", conn->name);
+        return -1;
+    }
+    conn->socket_events = ev.events;
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_rx_paused - Checks whether to stop reading from a controller
+ *
+ * While the outbound queue is congested (and the overflow policy is
+ * OUTQ_BLOCK) we stop reading from the controller, so it has to slow
+ * down (regardless of the policy, we also stop if the backlog fills up,
+ * see chirouter_server_rx_limit).
+ *
+ * conn: Connection to a controller
+ *
+ * Returns: true if we must not read from the controller, false otherwise.
+ *
+ */
+bool chirouter_server_rx_paused(server_conn_t *conn)
+{
+    return (conn->outq_congested && conn->server->outq_policy == OUTQ_BLOCK) ||
+           chirouter_server_rx_limit(conn) == 0;
+}
+
+
+/*
+ * chirouter_server_conn_close - Closes a connection to a controller
+ *
+ * Frees the routers configured by the controller and closes the socket.
+ * The connection itself is freed later by chirouter_server_end_batch
+ * (with io_uring, once its requests have been cancelled).
+ *
+ * conn: Connection to a controller
+ *
+ * rc: Why the connection is closed (1 if the controller closed
+ *     the connection, -1 if an error happened)
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_conn_close(server_conn_t *conn, int rc)
+{
+    server_ctx_t *ctx = conn->server;
+    uint64_t allocs, frees;
+
+    if (rc == -1)
+        chilog(CRITICAL, "Error while processing messages from controller %s. Closing connection.", conn->name);
+    else
+        chilog(INFO, "Controller %s has disconnected.", conn->name);
+
+    if (chirouter_server_conn_free_routers(conn) == -1)
+        chilog(CRITICAL, "Error while freeing router resources");
+
+    /* Once the routers (and their threads) are gone, nothing else can
+     * be added to the transmit ring, and we can stop sending */
+    if (ctx->tx_thread_enabled)
+        chirouter_server_tx_detach(conn);
+    else
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, conn->txring.eventfd, NULL);
+    chirouter_txring_discard(&conn->txring);
+
+    chirouter_alloc_stats(&allocs, &frees);
+    chilog(INFO, "Processed %lu frames with %lu heap allocations (%lu frees) since routers started",
+           conn->frames_processed, allocs - conn->allocs_at_start, frees - conn->frees_at_start);
+    chilog(INFO, "Sent %lu bytes (%lu buffers) to the controller with %lu batched writes since routers started",
+           conn->txq.bytes_sent, conn->txq.bufs_sent, conn->txq.writes);
+    chilog(INFO, "Dropped %lu messages because the transmit ring was full",
+           atomic_load(&conn->txring.drops));
+    chilog(INFO, "Outbound queue peaked at %lu of %zu bytes, was congested %lu times "
+                 "(dropped %lu frames), and filled up %lu times",
+           conn->txq.backlog_peak, conn->txq.backlog_size, conn->outq_congestions,
+           conn->outq_drops, conn->txq.stalls);
+    if (ctx->drr_enabled)
+        chilog(INFO, "Dropped %lu frames because the input queue of their router was full", conn->drr_drops);
+
+    if (ctx->backend == BACKEND_URING)
+        chirouter_server_uring_cancel(conn);
+
+    /* The controller has the eventfd too, so closing it
+     * wouldn't remove it from the epoll instance */
+    if (conn->shm != NULL)
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, conn->shm->router_eventfd, NULL);
+
+    close(conn->client_socket);
+    conn->closed = true;
+}
+
+
+/*
+ * chirouter_server_conn_destroy - Frees a connection to a controller
+ *
+ * conn: Connection to a controller (that has no routers, and, with
+ *       io_uring, no requests in progress)
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_conn_destroy(server_conn_t *conn)
+{
+    if (conn->server->backend == BACKEND_URING)
+        chirouter_uring_bufs_destroy(&conn->server->uring, &conn->rx_bufs);
+    chirouter_free(conn->rx_buffer);
+    chirouter_txq_destroy(&conn->txq);
+    if (conn->txring.eventfd != -1)
+        chirouter_txring_destroy(&conn->txring);
+    if (conn->shm != NULL)
+    {
+        chirouter_shm_destroy(conn->shm);
+        chirouter_free(conn->shm);
+    }
+    chirouter_free(conn);
+}
+
+
+/*
+ * chirouter_server_process_messages - Processes messages received from a controller
+ *
+ * Receives whatever the controller has sent (with a single recv() call),
+ * processes all the complete messages, and sends the replies (see
+ * chirouter_server_process_rx_buffer). On a SOCK_SEQPACKET socket,
+ * chirouter_server_process_packets does all this instead. Controllers
+ * that use shared memory only send the configuration over the socket
+ * (see chirouter_server_shm_process).
+ *
+ * conn: Connection to the controller
+ *
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
+ *
+ */
+int chirouter_server_process_messages(server_conn_t *conn)
+{
+    uint8_t *rx_buffer = conn->rx_buffer;
+    size_t limit = chirouter_server_rx_limit(conn);
+    int nbytes;
+
+    if (conn->shm != NULL && conn->state == RUNNING)
+        return chirouter_server_shm_check_socket(conn);
+
+    if (conn->server->seqpacket)
+        return chirouter_server_process_packets(conn);
+
+    if (limit == 0)
+        return 0;
+
+    nbytes = recv(conn->client_socket, rx_buffer + conn->rx_tail, limit, 0);
+    if (nbytes == 0 || (nbytes == -1 && errno == ECONNRESET))
+    {
+        chilog(DEBUG, "Controller %s closed connection", conn->name);
+        return 1;
+    }
+    else if (nbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    else if (nbytes == -1)
+    {
+        chilog(CRITICAL, "recv() from controller %s failed", conn->name);
+        return -1;
+    }
+
+    chilog(TRACE, "recv() from controller %s (%i bytes)", conn->name, nbytes);
+    chilog_hex(TRACE, rx_buffer + conn->rx_tail, nbytes);
+
+    conn->rx_tail += nbytes;
+
+    return chirouter_server_process_rx_buffer(conn);
+}
+
+
+/*
+ * chirouter_server_process_rx_buffer - Processes the messages in a connection's receive buffer
+ *
+ * Processes all the complete messages that have been received from
+ * the controller, and sends the replies.
+ *
+ * conn: Connection to the controller
+ *
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
+ *
+ */
+int chirouter_server_process_rx_buffer(server_conn_t *conn)
+{
+    /* Messages are parsed and processed in place in the receive buffer:
+     * [rx_head, rx_tail) holds the bytes we have received but not
+     * processed yet, and only the tail end of a partially received
+     * message is ever moved (to the front of the buffer, to make
+     * room for the rest of it). */
+    uint8_t *rx_buffer = conn->rx_buffer;
+    int rc;
+
+    /* Process all the complete messages in the buffer */
+    while(conn->rx_tail - conn->rx_head >= MSG_HDR_LEN)
+    {
+        chirouter_msg_t *msg = (chirouter_msg_t *) (rx_buffer + conn->rx_head);
+        size_t msg_len = MSG_HDR_LEN + ntohs(msg->payload_length);
+
+        if(conn->rx_tail - conn->rx_head < msg_len)
+            break;
+
+        rc = chirouter_server_process_single_message(conn, msg);
+        if(rc)
+        {
+            chilog(CRITICAL, "Error while processing message.");
+            return -1;
+        }
+
+        conn->rx_head += msg_len;
+    }
+
+    /* This has to be done before the receive buffer is modified */
+    rc = chirouter_server_send_replies(conn);
+    if(rc)
+        return rc;
+
+    if(conn->rx_head == conn->rx_tail)
+    {
+        conn->rx_head = conn->rx_tail = 0;
+    }
+    else if(SERVER_RX_BUFFER_SIZE - conn->rx_tail < MSG_MAX_LEN)
+    {
+        /* Not enough room left for the rest of a message:
+         * move the partial message to the front */
+        memmove(rx_buffer, rx_buffer + conn->rx_head, conn->rx_tail - conn->rx_head);
+        conn->rx_tail -= conn->rx_head;
+        conn->rx_head = 0;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_process_packets - Processes packets received from a controller
+ *
+ * SOCK_SEQPACKET only. Receives as many of the packets the controller
+ * has sent as fit in the receive buffer (with a single recvmmsg() call),
+ * each into its own slot of the buffer. Since each packet contains a
+ * single message, each message is processed where it is, without
+ * having to find where it ends. Then sends the replies.
+ *
+ * conn: Connection to the controller
+ *
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
+ *
+ */
+int chirouter_server_process_packets(server_conn_t *conn)
+{
+    struct mmsghdr msgs[SERVER_RX_BUFFER_SIZE / SERVER_SEQPACKET_SLOT_SIZE];
+    struct iovec iovs[SERVER_RX_BUFFER_SIZE / SERVER_SEQPACKET_SLOT_SIZE];
+    unsigned int nslots = chirouter_server_rx_limit(conn) / SERVER_SEQPACKET_SLOT_SIZE;
+    int npackets, rc = 0;
+
+    if (nslots == 0)
+        return 0;
+
+    for (unsigned int i = 0; i < nslots; i++)
+    {
+        iovs[i].iov_base = conn->rx_buffer + i * SERVER_SEQPACKET_SLOT_SIZE;
+        iovs[i].iov_len = SERVER_SEQPACKET_SLOT_SIZE;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    npackets = recvmmsg(conn->client_socket, msgs, nslots, MSG_DONTWAIT, NULL);
+    if (npackets == -1 && errno == ECONNRESET)
+    {
+        chilog(DEBUG, "Controller %s closed connection", conn->name);
+        return 1;
+    }
+    else if (npackets == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    else if (npackets == -1)
+    {
+        chilog(CRITICAL, "recvmmsg() from controller %s failed", conn->name);
+        return -1;
+    }
+
+    chilog(TRACE, "recvmmsg() from controller %s (%i packets)", conn->name, npackets);
+
+    for (int i = 0; i < npackets && rc == 0; i++)
+    {
+        uint8_t *packet = iovs[i].iov_base;
+        int check;
+
+        /* An empty packet means the controller closed the connection
+         * (after sending all the packets before it) */
+        if (msgs[i].msg_len == 0)
+        {
+            chilog(DEBUG, "Controller %s closed connection", conn->name);
+            rc = 1;
+            break;
+        }
+
+        chilog_hex(TRACE, packet, msgs[i].msg_len);
+
+        check = chirouter_server_check_packet(conn, packet, msgs[i].msg_len,
+                                              msgs[i].msg_hdr.msg_flags & MSG_TRUNC);
+        if (check == -1)
+            return -1;
+        else if (check == 1)
+            continue;
+
+        if (chirouter_server_process_single_message(conn, (chirouter_msg_t *) packet))
+        {
+            chilog(CRITICAL, "Error while processing message.");
+            return -1;
+        }
+    }
+
+    if (rc == 0)
+        rc = chirouter_server_send_replies(conn);
+
+    return rc;
+}
+
+
+/*
+ * chirouter_server_check_packet - Checks that a packet from a controller holds a single message
+ *
+ * SOCK_SEQPACKET only. Messages larger than SERVER_SEQPACKET_SLOT_SIZE
+ * bytes (which may not have been received whole) are dropped, like the
+ * Ethernet frames that are too large to be valid, without closing the
+ * connection.
+ *
+ * conn: Connection to the controller
+ *
+ * packet: Packet
+ *
+ * len: Number of bytes of the packet that were received
+ *
+ * truncated: Whether the rest of the packet was discarded because
+ *            it did not fit in the buffer it was received into
+ *
+ * Returns: 0 if the packet holds a single message, 1 if the message
+ *          has to be dropped, -1 if the packet is invalid
+ *
+ */
+int chirouter_server_check_packet(server_conn_t *conn, const uint8_t *packet, size_t len, bool truncated)
+{
+    const chirouter_msg_t *msg = (const chirouter_msg_t *) packet;
+
+    if (len >= MSG_HDR_LEN && (truncated || len > SERVER_SEQPACKET_SLOT_SIZE))
+    {
+        chilog(WARNING, "Controller %s sent a message that is %u bytes long (larger than the maximum "
+               "size of a message on a SOCK_SEQPACKET socket: %u). Dropping it.",
+               conn->name, MSG_HDR_LEN + ntohs(msg->payload_length), SERVER_SEQPACKET_SLOT_SIZE);
+        return 1;
+    }
+
+    if (len < MSG_HDR_LEN || len != MSG_HDR_LEN + ntohs(msg->payload_length))
+    {
+        chilog(CRITICAL, "Controller %s sent a packet that does not contain exactly one message (%zu bytes)",
+               conn->name, len);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_send_replies - Sends the replies to the messages received from a controller
+ *
+ * Called once all the messages received at once have been processed, and
+ * before the receive buffer is modified, since the transmit queue can
+ * point to frames in the receive buffer (in pipeline mode, the replies
+ * are already in the transmit ring). In vector mode, the frames that
+ * were received are only processed now (see chirouter_vector_add).
+ *
+ * conn: Connection to the controller
+ *
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
+ *
+ */
+int chirouter_server_send_replies(server_conn_t *conn)
+{
+    if(conn->server->vector_enabled && chirouter_vector_flush(conn) == -1)
+    {
+        chilog(CRITICAL, "Error while processing Ethernet frames.");
+        return -1;
+    }
+
+    if(!conn->server->tx_thread_enabled && chirouter_server_flush(conn) == -1)
+        return chirouter_server_send_failed(conn);
+
+    return 0;
+}
+
+
+/*
+ * With the io_uring backend, the requests submitted to io_uring are
+ * identified by the connection they are for, and what they do (stored
+ * in the lower bits of the connection's address, which is aligned)
+ */
+#define URING_OP_RECV    (1u)
+#define URING_OP_SEND    (2u)
+#define URING_OP_EPOLL   (3u)
+#define URING_OP_CANCEL  (4u)
+#define URING_OP_MASK    (7u)
+
+
+/*
+ * chirouter_server_uring_run - Run the chirouter server with io_uring
+ *
+ * The io_uring backend sends and receives all the messages with
+ * asynchronous requests, and does all its system calls (submitting
+ * requests and waiting for the ones in progress) with a single
+ * io_uring_enter() call per iteration of the server loop:
+ *
+ *  - Each connection receives with a multishot receive, which keeps
+ *    receiving into the connection's buffer group (registered with the
+ *    kernel, see uring.h). The data is copied into the receive buffer
+ *    (as much of it as chirouter_server_rx_limit allows), and processed
+ *    like with epoll. While chirouter_server_rx_paused says so, or while
+ *    there is data we haven't copied yet, we don't receive again if the
+ *    kernel runs out of buffers (so the controller has to slow down).
+ *
+ *  - The transmit queues are in asynchronous mode (see txq.h): flushing
+ *    a queue only copies the messages into its backlog, and the backlog
+ *    of every connection is sent with a single send request, submitted
+ *    along with all the others.
+ *
+ *  - The server socket and the eventfds are still in the epoll instance,
+ *    which is itself polled with io_uring (with a multishot poll request),
+ *    and checked whenever it has events.
+ *
+ * In pipeline mode, only receiving is done with io_uring, since the TX
+ * thread still sends the messages (waiting for events with its own
+ * epoll instance).
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_uring_run(server_ctx_t *ctx)
+{
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    server_conn_t *conn;
+    int nevents, rc, timeout;
+
+    chilog(INFO, "Waiting for connections from controllers (with io_uring)...");
+    while (1)
+    {
+        timeout = ctx->uring_epoll_ready ? 0 : chirouter_server_next_timeout(ctx);
+
+        if (chirouter_server_uring_submit_all(ctx) == -1 ||
+            chirouter_uring_submit(&ctx->uring, timeout != 0, timeout) == -1)
+        {
+            chilog(CRITICAL, "Could not submit requests to io_uring");
+            return -1;
+        }
+
+        chirouter_server_uring_reap(ctx);
+
+        /* The epoll instance could have more events than we can get at once */
+        if (ctx->uring_epoll_ready)
+        {
+            nevents = epoll_wait(ctx->epoll_fd, events, SERVER_MAX_EVENTS, 0);
+            if (nevents == -1 && errno != EINTR)
+            {
+                chilog(CRITICAL, "epoll_wait() failed");
+                return -1;
+            }
+            ctx->uring_epoll_ready = nevents == SERVER_MAX_EVENTS;
+
+            if (nevents > 0 && chirouter_server_handle_events(ctx, events, nevents) == -1)
+                return -1;
+        }
+
+        DL_FOREACH(ctx->conns, conn)
+        {
+            if (conn->closed)
+                continue;
+
+            rc = chirouter_server_uring_process(conn);
+            if (rc != 0)
+                chirouter_server_conn_close(conn, rc);
+        }
+
+        chirouter_server_end_batch(ctx);
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_uring_submit_all - Queues all the io_uring requests the server needs
+ *
+ * Polls the epoll instance, receives on the connections that are not
+ * receiving, and sends the backlogs that are not being sent (the
+ * requests are only submitted by the next call to chirouter_uring_submit).
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_uring_submit_all(server_ctx_t *ctx)
+{
+    server_conn_t *conn;
+
+    if (!ctx->uring_epoll_polled)
+    {
+        if (chirouter_uring_poll_multishot(&ctx->uring, ctx->epoll_fd, URING_OP_EPOLL) == -1)
+            return -1;
+        ctx->uring_epoll_polled = true;
+    }
+
+    DL_FOREACH(ctx->conns, conn)
+    {
+        if (conn->closed)
+            continue;
+
+        if (chirouter_server_uring_recv(conn) == -1 ||
+            chirouter_server_uring_send(conn) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_uring_recv - Starts receiving from a controller
+ *
+ * Does nothing if the connection is already receiving, or if it
+ * still has received data that hasn't been copied into the receive
+ * buffer (see chirouter_server_uring_run).
+ *
+ * conn: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_uring_recv(server_conn_t *conn)
+{
+    if (conn->recv_in_progress || conn->rx_pending_count > 0 || conn->rx_rc != 0)
+        return 0;
+
+    if (chirouter_uring_recv_multishot(&conn->server->uring, conn->client_socket, &conn->rx_bufs,
+                                       (uintptr_t) conn | URING_OP_RECV) == -1)
+        return -1;
+    conn->recv_in_progress = true;
+    conn->uring_ops++;
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_uring_send - Starts sending the backlog to a controller
+ *
+ * Does nothing if the backlog is empty, or if it is already being sent
+ * (it is sent again once the send completes, if there is anything left).
+ *
+ * conn: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_uring_send(server_conn_t *conn)
+{
+    void *data;
+    size_t len;
+
+    if (conn->server->tx_thread_enabled || conn->send_in_progress || conn->send_errno != 0 ||
+        chirouter_txq_backlog(&conn->txq) == 0)
+        return 0;
+
+    len = chirouter_txq_backlog_claim(&conn->txq, &data);
+    if (chirouter_uring_send(&conn->server->uring, conn->client_socket, data, len,
+                             (uintptr_t) conn | URING_OP_SEND) == -1)
+    {
+        chirouter_txq_backlog_sent(&conn->txq, 0);
+        return -1;
+    }
+    conn->send_in_progress = true;
+    conn->uring_ops++;
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_uring_cancel - Cancels the io_uring requests of a connection
+ *
+ * Called when the connection is closed. The connection is only freed
+ * once the requests have completed (see chirouter_server_end_batch).
+ *
+ * conn: Connection to a controller
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_uring_cancel(server_conn_t *conn)
+{
+    chirouter_uring_t *ring = &conn->server->uring;
+
+    /* Shutting the socket down ends the requests (in case they
+     * could not be cancelled because they already started) */
+    shutdown(conn->client_socket, SHUT_RDWR);
+
+    if (conn->recv_in_progress)
+        chirouter_uring_cancel(ring, (uintptr_t) conn | URING_OP_RECV, URING_OP_CANCEL);
+    if (conn->send_in_progress)
+        chirouter_uring_cancel(ring, (uintptr_t) conn | URING_OP_SEND, URING_OP_CANCEL);
+}
+
+
+/*
+ * chirouter_server_uring_reap - Reaps the completed io_uring requests
+ *
+ * Only keeps track of what has completed (the server loop then acts on
+ * it), so it can also be called while waiting for a backlog to drain
+ * (see chirouter_server_uring_wait) in the middle of processing messages.
+ *
+ * ctx: Server context
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_uring_reap(server_ctx_t *ctx)
+{
+    chirouter_uring_completion_t c;
+
+    while (chirouter_uring_next_completion(&ctx->uring, &c))
+    {
+        server_conn_t *conn = (server_conn_t *) (uintptr_t) (c.user_data & ~(uint64_t) URING_OP_MASK);
+        unsigned int op = c.user_data & URING_OP_MASK;
+        uint16_t id = c.buf_id;
+        bool more = c.more;
+        int res = c.res;
+
+        if (op == URING_OP_EPOLL)
+        {
+            ctx->uring_epoll_ready = true;
+            ctx->uring_epoll_polled = more;
+        }
+        else if (op == URING_OP_RECV)
+        {
+            int check;
+
+            if (!more)
+            {
+                conn->recv_in_progress = false;
+                conn->uring_ops--;
+            }
+
+            /* On a SOCK_SEQPACKET socket, the packets are copied into
+             * the receive buffer like a stream, so we check here that
+             * each of them holds a single message (a packet that fills
+             * a whole buffer may have been truncated) */
+            if (res > 0 && ctx->seqpacket && !conn->closed && conn->rx_rc == 0)
+                check = chirouter_server_check_packet(conn, chirouter_uring_bufs_get(&conn->rx_bufs, id), res,
+                                                      res >= (int) SERVER_URING_RX_BUF_SIZE);
+            else
+                check = 0;
+
+            if (res > 0 && (conn->closed || conn->rx_rc != 0 || check == 1))
+            {
+                chirouter_uring_bufs_recycle(&conn->rx_bufs, id);
+            }
+            else if (res > 0 && check == -1)
+            {
+                chirouter_uring_bufs_recycle(&conn->rx_bufs, id);
+                conn->rx_rc = -1;
+            }
+            else if (res > 0)
+            {
+                unsigned int i = (conn->rx_pending_head + conn->rx_pending_count) % SERVER_URING_RX_BUFS;
 
+                conn->rx_pending_id[i] = id;
+                conn->rx_pending_len[i] = res;
+                conn->rx_pending_count++;
+            }
+            else if (res == 0 || res == -ECONNRESET)
+            {
+                conn->rx_rc = 1;
+            }
+            else if (res != -ENOBUFS && res != -ECANCELED && res != -EINTR && res != -EAGAIN)
+            {
+                conn->rx_rc = -1;
+                errno = -res;
+                chilog(CRITICAL, "recv() from controller %s failed", conn->name);
+            }
+        }
+        else if (op == URING_OP_SEND)
+        {
+            conn->send_in_progress = false;
+            conn->send_done = true;
+            conn->uring_ops--;
+            chirouter_txq_backlog_sent(&conn->txq, res > 0 ? res : 0);
 
-/* Forward declarations */
-int chirouter_server_process_messages(server_ctx_t *ctx);
-int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *msg);
-int chirouter_server_process_ethernet_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *msg, size_t len);
-int chirouter_server_ctx_free_routers(server_ctx_t *ctx);
+            if (res < 0 && res != -EAGAIN && res != -EINTR && res != -ECANCELED)
+                conn->send_errno = -res;
+        }
+    }
+}
 
 
 /*
- * chirouter_server_ctx_init - Initializes a server context
+ * chirouter_server_uring_wait - Waits for the backlog to a controller to drain
  *
- * ctx: Server context
+ * Called by the transmit queue of a connection (see chirouter_txq_set_async)
+ * when there is no room left in its backlog.
+ *
+ * arg: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if an error happens (errno is set to
+ *          why sending to the controller failed)
  *
- * Returns: 0 on success, -1 if an error happens.
  */
-int chirouter_server_ctx_init(server_ctx_t **ctx)
+int chirouter_server_uring_wait(void *arg)
 {
-    /* Initialize all pointers and sizes to zero */
-    *ctx = calloc(1, sizeof(server_ctx_t));
+    server_conn_t *conn = arg;
+    server_ctx_t *ctx = conn->server;
 
-    if(*ctx == NULL)
+    if (chirouter_server_uring_send(conn) == -1 ||
+        chirouter_uring_submit(&ctx->uring, true, -1) == -1)
+        return -1;
+
+    chirouter_server_uring_reap(ctx);
+
+    if (conn->send_errno != 0)
+    {
+        errno = conn->send_errno;
         return -1;
+    }
 
     return 0;
 }
 
 
 /*
- * chirouter_server_setup - Sets up the chirouter server socket
+ * chirouter_server_uring_process - Acts on the completed io_uring requests of a connection
  *
- * ctx: Server context
+ * Once a send has completed, sends the messages in the transmit ring
+ * that did not fit in the backlog. Then processes the messages received
+ * since the last time (see chirouter_server_uring_run).
  *
- * port: TCP port to listen on
+ * conn: Connection to a controller
  *
- * Returns: 0 on success, -1 if an error happens.
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
  *
  */
-int chirouter_server_setup(server_ctx_t *ctx, char *port)
+int chirouter_server_uring_process(server_conn_t *conn)
 {
-    struct addrinfo hints, *res, *p;
-
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-    int yes = 1;
+    int rc;
 
-    if (getaddrinfo(NULL, port, &hints, &res) != 0)
+    if (conn->send_errno != 0)
     {
-        chilog(CRITICAL, NULL, "getaddrinfo() failed");
-        return -1;
+        errno = conn->send_errno;
+        return chirouter_server_send_failed(conn);
     }
 
-    for(p = res; p != NULL; p = p->ai_next)
+    if (conn->send_done)
     {
-        if ((ctx->server_socket = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
-        {
-            chilog(WARNING, NULL, "Could not open socket");
-            continue;
-        }
+        conn->send_done = false;
+        if (chirouter_server_flush(conn) == -1)
+            return chirouter_server_send_failed(conn);
+    }
 
-        if (setsockopt(ctx->server_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1)
-        {
-            chilog(WARNING, NULL, "Socket setsockopt() failed");
-            close(ctx->server_socket);
-            continue;
-        }
+    while (conn->rx_pending_count > 0 && !chirouter_server_rx_paused(conn))
+    {
+        size_t limit = chirouter_server_rx_limit(conn);
+        size_t start = conn->rx_tail;
 
-        if (bind(ctx->server_socket, p->ai_addr, p->ai_addrlen) == -1)
+        while (limit > 0 && conn->rx_pending_count > 0)
         {
-            chilog(WARNING, NULL, "Socket bind() failed");
-            close(ctx->server_socket);
-            continue;
+            uint16_t id = conn->rx_pending_id[conn->rx_pending_head];
+            size_t len = conn->rx_pending_len[conn->rx_pending_head] - conn->rx_pending_offset;
+
+            if (len > limit)
+                len = limit;
+            memcpy(conn->rx_buffer + conn->rx_tail,
+                   chirouter_uring_bufs_get(&conn->rx_bufs, id) + conn->rx_pending_offset, len);
+            conn->rx_tail += len;
+            conn->rx_pending_offset += len;
+            limit -= len;
+
+            if (conn->rx_pending_offset == conn->rx_pending_len[conn->rx_pending_head])
+            {
+                chirouter_uring_bufs_recycle(&conn->rx_bufs, id);
+                conn->rx_pending_head = (conn->rx_pending_head + 1) % SERVER_URING_RX_BUFS;
+                conn->rx_pending_count--;
+                conn->rx_pending_offset = 0;
+            }
         }
 
-        if (listen(ctx->server_socket, 5) == -1)
-        {
-            chilog(WARNING, NULL, "Socket listen() failed");
-            close(ctx->server_socket);
-            continue;
-        }
+        chilog(TRACE, "Received from controller %s (%zu bytes)", conn->name, conn->rx_tail - start);
+        chilog_hex(TRACE, conn->rx_buffer + start, conn->rx_tail - start);
 
-        break;
+        rc = chirouter_server_process_rx_buffer(conn);
+        if (rc != 0)
+            return rc;
     }
 
-    freeaddrinfo(res);
-
-    if (p == NULL)
-    {
-        chilog(CRITICAL, NULL, "Could not find a socket to bind to.");
-        return -1;
-    }
+    /* Everything the controller sent before closing the connection
+     * has to be processed before we close it */
+    if (conn->rx_pending_count == 0 && conn->rx_rc == 1)
+        chilog(DEBUG, "Controller %s closed connection", conn->name);
 
-    return 0;
+    return conn->rx_pending_count == 0 ? conn->rx_rc : 0;
 }
 
 
 /*
- * chirouter_server_send_msg - Sends a message to the controller
+ * chirouter_server_shm_start - Starts exchanging frames with a controller through shared memory
  *
- * ctx: Server context
+ * Called once we have queued our HELLO for a controller that asked for
+ * shared memory (see the protocol description in server.h). Sends the
+ * HELLO, followed by the file descriptors of the shared memory, and from
+ * then on sends everything through the ring to the controller (the
+ * routers are not running yet, so nothing else has been sent before).
  *
- * msg: Message to send
+ * conn: Connection to the controller
  *
  * Returns: 0 on success, -1 if an error happens.
  *
  */
-int chirouter_server_send_msg(server_ctx_t *ctx, chirouter_msg_t *msg)
+int chirouter_server_shm_start(server_conn_t *conn)
 {
-    int sent = 0;
-    int totallen = 4 + ntohs(msg->payload_length);
-    char *buf = (char *) msg;
+    server_ctx_t *ctx = conn->server;
+    struct epoll_event ev;
+
+    conn->shm = chirouter_calloc(1, sizeof(chirouter_shm_t));
+    if (conn->shm == NULL || chirouter_shm_create(conn->shm, SERVER_SHM_RING_SIZE) == -1)
+    {
+        chirouter_free(conn->shm);
+        conn->shm = NULL;
+        chilog(CRITICAL, "Could not create shared memory for controller %s", conn->name);
+        return -1;
+    }
+
+    /* The file descriptors have to follow the HELLO, so it can't stay
+     * in the backlog (a new connection's send buffer is empty, though) */
+    if (chirouter_server_flush(conn) == -1 || chirouter_txq_backlog(&conn->txq) > 0)
+    {
+        chilog(CRITICAL, "Could not send HELLO message to controller %s", conn->name);
+        return -1;
+    }
 
-    while (sent < totallen) {
-        int cur = send(ctx->client_socket, buf+sent, totallen-sent, 0);
-        sent = sent + cur;
-        if (cur == -1) {
-            chilog(CRITICAL, "Could not send message to controller");
+    int fds[] = { conn->shm->memfd, conn->shm->router_eventfd, conn->shm->controller_eventfd };
+    for (int i = 0; i < 3; i++)
+    {
+        char cbuf[CMSG_SPACE(sizeof(int))];
+        uint8_t zero = 0;
+        struct iovec iov = { .iov_base = &zero, .iov_len = 1 };
+        struct msghdr mh;
+        struct cmsghdr *cmsg;
+
+        /* One file descriptor per message, since some controllers can
+         * only receive one at a time (e.g., Python 2's multiprocessing) */
+        memset(&mh, 0, sizeof(mh));
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fds[i], sizeof(int));
+
+        if (sendmsg(conn->client_socket, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) != 1)
+        {
+            chilog(CRITICAL, "Could not send shared memory to controller %s", conn->name);
             return -1;
         }
     }
 
+    chirouter_txq_set_sink(&conn->txq, chirouter_server_shm_send, chirouter_server_shm_wait, conn);
+
+    conn->shm_src.conn = conn;
+    conn->shm_src.fd = conn->shm->router_eventfd;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &conn->shm_src;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, conn->shm->router_eventfd, &ev) == -1)
+    {
+        chilog(CRITICAL, "Could not wait for events from controller %s", conn->name);
+        return -1;
+    }
+
+    chilog(INFO, "Controller %s will exchange frames through shared memory", conn->name);
+
     return 0;
 }
 
 
 /*
- * chirouter_server_run - Run the chirouter server
+ * chirouter_server_shm_process - Exchanges frames with a controller through shared memory
  *
- * The chirouter server is designed to handle only one connection at a time,
- * since it should only be associated with one controller at any given point.
+ * Sends as much of the backlog as fits in the ring to the controller
+ * and then, once the routers are running, reads whatever the controller
+ * has written to the ring to chirouter (no more than chirouter_server_rx_limit
+ * allows, like a recv() call would) into the receive buffer, processes
+ * all the complete messages, and sends the replies. Called whenever the
+ * controller wakes up the server, and after every batch of events (since
+ * we don't always get woken up, see shm.h).
  *
- * ctx: Server context
+ * conn: Connection to the controller
  *
- * Returns: 0 on success, -1 if an error happens.
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred
  *
  */
-int chirouter_server_run(server_ctx_t *ctx)
+int chirouter_server_shm_process(server_conn_t *conn)
 {
-    struct sockaddr_storage *client_addr;
-    int client_socket, rc;
-    char ip[NI_MAXHOST];
-    char port[NI_MAXSERV];
-    socklen_t sa_size = sizeof(struct sockaddr_storage);
+    size_t nbytes;
+    int rc;
 
-    client_addr = calloc(1, sa_size);
-    while (1)
+    if (chirouter_txq_backlog(&conn->txq) > 0 && chirouter_server_flush(conn) == -1)
+        return chirouter_server_send_failed(conn);
+
+    if (conn->state == RUNNING && !chirouter_server_rx_paused(conn))
     {
-        chilog(INFO, "Waiting for connection from controller...");
-        if ((client_socket = accept(ctx->server_socket, (struct sockaddr *) client_addr, &sa_size)) == -1)
+        nbytes = chirouter_shm_read(conn->shm, conn->rx_buffer + conn->rx_tail,
+                                    chirouter_server_rx_limit(conn));
+        if (nbytes > 0)
         {
-            free(client_addr);
-            chilog(CRITICAL, "Could not accept() connection");
-            return -1;
-        }
-
-        rc = getnameinfo((struct sockaddr *) client_addr, sa_size,
-                         ip, NI_MAXHOST, port, NI_MAXSERV, NI_NUMERICHOST | NI_NUMERICSERV);
+            chilog(TRACE, "Read from shared memory of controller %s (%zu bytes)", conn->name, nbytes);
+            chilog_hex(TRACE, conn->rx_buffer + conn->rx_tail, nbytes);
 
-        if(rc)
-            chilog(INFO, "Controller connected");
-        else
-            chilog(INFO, "Controller connected from %s:%s", ip, port);
+            conn->rx_tail += nbytes;
 
+            rc = chirouter_server_process_rx_buffer(conn);
+            if (rc != 0)
+                return rc;
+        }
+    }
 
-        ctx->state = HELLO_WAIT;
-        ctx->client_socket = client_socket;
+    return chirouter_server_conn_update_events(conn);
+}
 
-        rc = chirouter_server_process_messages(ctx);
 
-        if(rc == -1)
-        {
-            chilog(CRITICAL, "Error while processing messages");
-            return -1;
-        }
-        else if (rc == 0)
-        {
-            chilog(INFO, "Controller has disconnected.");
+/*
+ * chirouter_server_shm_check_socket - Checks the socket of a controller that uses shared memory
+ *
+ * Once the routers are running, the controller only uses its socket to
+ * close the connection.
+ *
+ * conn: Connection to the controller
+ *
+ * Returns:
+ *  0 on success
+ *  1 if the controller closed the connection
+ *  -1 if an error occurred (or if the controller sent something)
+ *
+ */
+int chirouter_server_shm_check_socket(server_conn_t *conn)
+{
+    uint8_t byte;
+    ssize_t nbytes = recv(conn->client_socket, &byte, 1, MSG_DONTWAIT);
 
-            ctx->state = HELLO_WAIT;
-            rc = chirouter_server_ctx_free_routers(ctx);
-            if(rc == -1)
-            {
-                chilog(CRITICAL, "Error while freeing router resources");
-                return -1;
-            }
-        }
+    if (nbytes == 0 || (nbytes == -1 && errno == ECONNRESET))
+    {
+        chilog(DEBUG, "Controller %s closed connection", conn->name);
+        return 1;
     }
-    free(client_addr);
-    return 0;
+    else if (nbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    else if (nbytes == -1)
+    {
+        chilog(CRITICAL, "recv() from controller %s failed", conn->name);
+        return -1;
+    }
+
+    chilog(CRITICAL, "Controller %s sent a message over its socket instead of shared memory", conn->name);
+    return -1;
 }
 
 
 /*
- * chirouter_server_process_messages - Processes messages received by the server
+ * chirouter_server_shm_send - Sends data to a controller through shared memory
  *
- * ctx: Server context
+ * Sink of the transmit queue of a connection that uses shared memory
+ * (see chirouter_txq_set_sink).
  *
- * Returns:
- *  0 if the client closed the connection normally
- *  -1 if an error occurred
+ * arg: Connection to the controller
+ *
+ * iov: Array of buffers
+ *
+ * iovcnt: Number of buffers
+ *
+ * Returns: number of bytes sent (0 if the ring is full)
  *
  */
-int chirouter_server_process_messages(server_ctx_t *ctx)
+size_t chirouter_server_shm_send(void *arg, const struct iovec *iov, int iovcnt)
 {
-    char recv_buffer[4096], msg_buffer[4096];
-    chirouter_msg_t *msg;
-    int nbytes, rc;
-    bool reading_header = true;
-    size_t len;
-    int i, bufpos = 0;
+    server_conn_t *conn = arg;
 
-    while(1)
-    {
-        nbytes = recv(ctx->client_socket, recv_buffer, sizeof(recv_buffer), 0);
-        if (nbytes == 0)
-        {
-            chilog(DEBUG, "Controller closed connection");
-            close(ctx->client_socket);
-            return 0;
-        }
-        else if (nbytes == -1)
-        {
-            chilog(CRITICAL, "recv() from controller failed");
-            close(ctx->client_socket);
-            return -1;
-        }
+    return chirouter_shm_writev(conn->shm, iov, iovcnt);
+}
 
-        chilog(TRACE, "recv() from controller (%i bytes)", nbytes);
-        chilog_hex(TRACE, recv_buffer, nbytes);
 
-        i = 0;
-        len = 0;
-        while(i < nbytes)
-        {
-            msg_buffer[bufpos++] = recv_buffer[i++];
+/*
+ * chirouter_server_shm_wait - Waits for room in the ring to a controller
+ *
+ * Called by the transmit queue of a connection that uses shared memory
+ * when its backlog is full (see chirouter_txq_set_sink). Waits until the
+ * controller wakes us up, or for SERVER_SHM_RECHECK_MS at most (since the
+ * wake-up can be missed, see shm.h). Being woken up can also mean that
+ * there is data to read, which chirouter_server_end_batch takes care of.
+ *
+ * arg: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_shm_wait(void *arg)
+{
+    server_conn_t *conn = arg;
+    struct pollfd pfd = { .fd = conn->shm->router_eventfd, .events = POLLIN };
 
-            if(reading_header && bufpos==4)
-            {
-                /* We have a header */
-                msg = (chirouter_msg_t *) msg_buffer;
-                len = ntohs(msg->payload_length);
-                reading_header = false;
-            }
+    if (poll(&pfd, 1, SERVER_SHM_RECHECK_MS) == -1 && errno != EINTR)
+        return -1;
 
-            if(!reading_header && bufpos == (4+len))
-            {
-                /* We have a complete message */
-                rc = chirouter_server_process_single_message(ctx, msg);
-                if(rc)
-                {
-                    chilog(CRITICAL, "Error while processing message.");
-                    close(ctx->client_socket);
-                    return -1;
-                }
-                reading_header = true;
-                bufpos = 0;
-                len = 0;
-            }
-        }
+    chirouter_shm_ack_wakeup(conn->shm);
 
-    }
+    return 0;
 }
 
 
 /*
  * chirouter_server_process_single_message - Process a single message
  *
- * ctx: Server context
+ * conn: Connection to the controller that sent the message
+ *
+ * msg: Message
  *
  * Returns: 0 on success, -1 if an error happens.
  *
  */
-int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *msg)
+int chirouter_server_process_single_message(server_conn_t *conn, chirouter_msg_t *msg)
 {
     int rc;
     chirouter_msg_t reply_msg;
     uint16_t payload_len = ntohs(msg->payload_length);
 
+    /* In vector mode, the frames received before this message
+     * have to be processed before it */
+    if(msg->type != MSG_TYPE_ETHERNET_FRAME && msg->type != MSG_TYPE_FRAME_BATCH && conn->server->vector_enabled &&
+       chirouter_vector_flush(conn) == -1)
+    {
+        chilog(CRITICAL, "Error while processing Ethernet frames.");
+        return -1;
+    }
+
     switch(msg->type)
     {
     case MSG_TYPE_HELLO:
     {
-        if(ctx->state != HELLO_WAIT)
+        if(conn->state != HELLO_WAIT)
         {
             chilog(CRITICAL, "Received a HELLO message but not in the HELLO_WAIT state");
             return -1;
         }
 
-        /* Send back HELLO message */
+        /* Shared memory requires passing file descriptors over the
+         * socket, and the server thread sending to the controller */
+        uint8_t flags = payload_len >= 1 ? msg->hello.flags : 0;
+        bool shm = (flags & HELLO_FLAG_SHM) && conn->server->unix_path != NULL &&
+                   conn->server->backend == BACKEND_EPOLL && !conn->server->tx_thread_enabled;
+
+        if((flags & HELLO_FLAG_SHM) && !shm)
+            chilog(INFO, "Controller %s asked for shared memory, which requires -u or -U, "
+                         "and no -t or -e io_uring", conn->name);
+
+        /* Frame batches work with every transport */
+        conn->frame_batch = (flags & HELLO_FLAG_FRAME_BATCH);
+
+        /* Send back HELLO message (with the flags we accept, if the
+         * controller sent any) */
         reply_msg.type = MSG_TYPE_HELLO;
         reply_msg.subtype = FROM_ROUTER;
-        reply_msg.payload_length = 0;
+        reply_msg.payload_length = htons(payload_len >= 1 ? 1 : 0);
+        reply_msg.hello.flags = (shm ? HELLO_FLAG_SHM : 0) | (conn->frame_batch ? HELLO_FLAG_FRAME_BATCH : 0);
 
-        rc = chirouter_server_send_msg(ctx, &reply_msg);
+        rc = chirouter_server_send_msg(conn, &reply_msg);
         if(rc)
         {
             chilog(CRITICAL, "Could not send HELLO message");
             return -1;
         }
 
-        ctx->state = CONFIG;
+        if(shm && chirouter_server_shm_start(conn) == -1)
+            return -1;
+
+        conn->state = CONFIG;
         break;
     }
     case MSG_TYPE_ROUTERS:
     {
-        if(ctx->state != CONFIG)
+        if(conn->state != CONFIG)
         {
             chilog(CRITICAL, "Received a ROUTERS message but not in the CONFIG state");
             return -1;
@@ -385,27 +2442,32 @@ int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *
 
         uint8_t nrouters = msg->routers.nrouters;
 
-        ctx->max_routers = nrouters;
-        ctx->num_routers = 0;
-        ctx->routers = calloc(nrouters, sizeof(chirouter_ctx_t));
+        conn->max_routers = nrouters;
+        conn->num_routers = 0;
+        conn->routers = chirouter_calloc(nrouters, sizeof(chirouter_ctx_t));
 
         for(int i=0; i < nrouters; i++)
         {
-            chirouter_ctx_init(&ctx->routers[i]);
-            ctx->routers[i].server = ctx;
+            if(chirouter_ctx_init(&conn->routers[i]))
+            {
+                chilog(CRITICAL, "Could not initialize router %d", i);
+                return -1;
+            }
+            conn->routers[i].server = conn->server;
+            conn->routers[i].conn = conn;
         }
 
         break;
     }
     case MSG_TYPE_ROUTER:
     {
-        if(ctx->state != CONFIG)
+        if(conn->state != CONFIG)
         {
             chilog(CRITICAL, "Received a ROUTER message but not in the CONFIG state");
             return -1;
         }
 
-        if(msg->router.r_id != ctx->num_routers)
+        if(msg->router.r_id != conn->num_routers)
         {
             chilog(CRITICAL, "Received unexpected ROUTER message (Router ID: %d)", msg->router.r_id);
             return -1;
@@ -413,7 +2475,7 @@ int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *
 
         chilog(TRACE, "Processing Router ID %d", msg->router.r_id);
 
-        chirouter_ctx_t *r = &ctx->routers[msg->router.r_id];
+        chirouter_ctx_t *r = &conn->routers[msg->router.r_id];
 
         r->r_id = msg->router.r_id;
 
@@ -423,31 +2485,40 @@ int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *
 
         r->max_interfaces = msg->router.num_interfaces;
         r->num_interfaces = 0;
-        r->interfaces = calloc(r->max_interfaces, sizeof(chirouter_interface_t));
+        r->interfaces = chirouter_arena_alloc(&r->arena, r->max_interfaces, sizeof(chirouter_interface_t),
+                                              _Alignof(chirouter_interface_t));
 
         r->max_rtable_entries = msg->router.len_rtable;
         r->num_rtable_entries = 0;
-        r->routing_table = calloc(r->max_rtable_entries, sizeof(chirouter_rtable_entry_t));
+        r->routing_table = chirouter_arena_alloc(&r->arena, r->max_rtable_entries, sizeof(chirouter_rtable_entry_t),
+                                                 _Alignof(chirouter_rtable_entry_t));
+
+        if(r->interfaces == NULL || r->routing_table == NULL ||
+           chirouter_framepool_reserve(&r->framepool, FRAMEPOOL_BUFS_PER_INTERFACE * r->max_interfaces))
+        {
+            chilog(CRITICAL, "Could not allocate memory for router %s", r->name);
+            return -1;
+        }
 
-        ctx->num_routers++;
+        conn->num_routers++;
 
         break;
     }
     case MSG_TYPE_INTERFACE:
     {
-        if(ctx->state != CONFIG)
+        if(conn->state != CONFIG)
         {
             chilog(CRITICAL, "Received an INTERFACE message but not in the CONFIG state");
             return -1;
         }
 
-        if(msg->interface.r_id >= ctx->num_routers)
+        if(msg->interface.r_id >= conn->num_routers)
         {
             chilog(CRITICAL, "Received invalid Router ID: %d", msg->interface.r_id);
             return -1;
         }
 
-        chirouter_ctx_t *r = &ctx->routers[msg->interface.r_id];
+        chirouter_ctx_t *r = &conn->routers[msg->interface.r_id];
 
         if(msg->interface.iface_id != r->num_interfaces)
         {
@@ -473,19 +2544,19 @@ int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *
     }
     case MSG_TYPE_RTABLE_ENTRY:
     {
-        if(ctx->state != CONFIG)
+        if(conn->state != CONFIG)
         {
             chilog(CRITICAL, "Received a ROUTING TABLE ENTRY message but not in the CONFIG state");
             return -1;
         }
 
-        if(msg->rtable_entry.r_id >= ctx->num_routers)
+        if(msg->rtable_entry.r_id >= conn->num_routers)
         {
             chilog(CRITICAL, "Received invalid Router ID: %d", msg->rtable_entry.r_id);
             return -1;
         }
 
-        chirouter_ctx_t *r = &ctx->routers[msg->rtable_entry.r_id];
+        chirouter_ctx_t *r = &conn->routers[msg->rtable_entry.r_id];
 
         if(msg->rtable_entry.iface_id >= r->num_interfaces)
         {
@@ -513,72 +2584,179 @@ int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *
         r->num_rtable_entries++;
         break;
     }
+    case MSG_TYPE_NEIGHBORS:
+    {
+        if(conn->state != CONFIG)
+        {
+            chilog(CRITICAL, "Received a NEIGHBORS message but not in the CONFIG state");
+            return -1;
+        }
+
+        if(msg->neighbors.r_id >= conn->num_routers)
+        {
+            chilog(CRITICAL, "Received invalid Router ID: %d", msg->neighbors.r_id);
+            return -1;
+        }
+
+        uint8_t num_neighbors = msg->neighbors.num_neighbors;
+
+        if(payload_len != 2 + num_neighbors * sizeof(msg->neighbors.neighbor[0]))
+        {
+            chilog(CRITICAL, "Received NEIGHBORS message with %d neighbors but payload length %d", num_neighbors, payload_len);
+            return -1;
+        }
+
+        chilog(TRACE, "Processing %d neighbors in Router ID %d", num_neighbors, msg->neighbors.r_id);
+
+        chirouter_ctx_t *r = &conn->routers[msg->neighbors.r_id];
+
+        pthread_mutex_lock(&r->lock_arp);
+        for(int i=0; i < num_neighbors; i++)
+        {
+            struct in_addr ip;
+            ip.s_addr = msg->neighbors.neighbor[i].ipaddr;
+
+            if(chirouter_arp_cache_add_permanent(r, &ip, msg->neighbors.neighbor[i].hwaddr))
+            {
+                chilog(WARNING, "Router %s: Could not allocate static ARP entry for %s", r->name, inet_ntoa(ip));
+            }
+        }
+        pthread_mutex_unlock(&r->lock_arp);
+
+        break;
+    }
     case MSG_TYPE_END_CONFIG:
     {
-        if(ctx->num_routers != ctx->max_routers)
+        if(conn->state != CONFIG)
+        {
+            chilog(CRITICAL, "Received an END CONFIG message but not in the CONFIG state");
+            return -1;
+        }
+
+        if(conn->num_routers != conn->max_routers)
+        {
+            chilog(CRITICAL, "Expected %d routers but received only %d", conn->max_routers, conn->num_routers);
+            return -1;
+        }
+
+        chilog(INFO, "Received %i routers from controller %s", conn->num_routers, conn->name);
+
+        chilog(INFO, "--------------------------------------------------------------------------------");
+        for(int i=0; i < conn->num_routers; i++)
+        {
+            chirouter_ctx_t *r = &conn->routers[i];
+
+            if(r->num_interfaces != r->max_interfaces)
+            {
+                chilog(CRITICAL, "Router %d: Expected %d interfaces but received only %d", i, r->max_interfaces, r->num_interfaces);
+                return -1;
+            }
+
+            if(conn->server->neighbors_file && chirouter_ctx_load_neighbors(r, conn->server->neighbors_file))
+            {
+                chilog(CRITICAL, "Could not load neighbor file %s", conn->server->neighbors_file);
+                return -1;
+            }
+
+            chirouter_ctx_log(&conn->routers[i], INFO);
+            chilog(INFO, "--------------------------------------------------------------------------------");
+        }
+
+        if(conn->server->pcap)
+        {
+            chirouter_pcap_write_interfaces(conn->server, conn->routers, conn->num_routers);
+        }
+
+        conn->state = RUNNING;
+
+        if(conn->server->drr_enabled && chirouter_drr_init(conn))
+        {
+            chilog(CRITICAL, "Could not allocate input queues for the routers");
+            return -1;
+        }
+
+        if(conn->server->vector_enabled && chirouter_vector_init(conn))
         {
-            chilog(CRITICAL, "Expected %d routers but received only %d", ctx->max_routers, ctx->num_routers);
+            chilog(CRITICAL, "Could not allocate vectors for the routers");
             return -1;
         }
 
-        chilog(INFO, "Received %i routers", ctx->num_routers);
+        conn->frames_processed = 0;
+        atomic_store(&conn->reset_tx_stats, true);
+        chirouter_alloc_stats(&conn->allocs_at_start, &conn->frees_at_start);
 
-        chilog(INFO, "--------------------------------------------------------------------------------");
-        for(int i=0; i < ctx->num_routers; i++)
+        /* The ARP threads start resolving the gateways right away,
+         * so they can only be started once we are ready to send frames */
+        for(int i=0; i < conn->num_routers; i++)
         {
-            chirouter_ctx_t *r = &ctx->routers[i];
+            chirouter_ctx_t *r = &conn->routers[i];
 
-            if(r->num_interfaces != r->max_interfaces)
+            /* Overwriting a running thread's handle would leave it
+             * running after the router is freed */
+            if(!r->arp_thread_started)
             {
-                chilog(CRITICAL, "Router %d: Expected %d interfaces but received only %d", i, r->max_interfaces, r->num_interfaces);
-                return -1;
+                if(pthread_create(&r->arp_thread, NULL, chirouter_arp_process, r) != 0)
+                {
+                    chilog(CRITICAL, "Could not start the ARP thread of router %s", r->name);
+                    return -1;
+                }
+                r->arp_thread_started = true;
             }
 
-            chirouter_ctx_log(&ctx->routers[i], INFO);
-            pthread_create(&r->arp_thread, NULL, chirouter_arp_process, r);
-            chilog(INFO, "--------------------------------------------------------------------------------");
-        }
-
-        if(ctx->pcap)
-        {
-            chirouter_pcap_write_section_header(ctx);
-            chirouter_pcap_write_interfaces(ctx);
+            if(conn->server->num_workers > 0)
+                chirouter_workers_assign(conn->server, r);
         }
-
-        ctx->state = RUNNING;
         break;
     }
     case MSG_TYPE_ETHERNET_FRAME:
     {
-        if(ctx->state != RUNNING)
+        if(conn->state != RUNNING)
         {
             chilog(CRITICAL, "Received an ETHERNET FRAME message but not in the RUNNING state");
             return -1;
         }
 
-        if(msg->ethernet.r_id >= ctx->num_routers)
+        return chirouter_server_process_frame(conn, msg->ethernet.r_id, msg->ethernet.iface_id,
+                                              msg->ethernet.frame, ntohs(msg->ethernet.frame_len));
+    }
+    case MSG_TYPE_FRAME_BATCH:
+    {
+        if(conn->state != RUNNING)
         {
-            chilog(CRITICAL, "Received invalid Router ID: %d", msg->ethernet.r_id);
+            chilog(CRITICAL, "Received a FRAME BATCH message but not in the RUNNING state");
             return -1;
         }
 
-        chirouter_ctx_t *r = &ctx->routers[msg->ethernet.r_id];
-
-        if(msg->ethernet.iface_id >= r->num_interfaces)
+        if(!conn->frame_batch)
         {
-            chilog(CRITICAL, "Received invalid Interface ID: %d", msg->ethernet.iface_id);
+            chilog(CRITICAL, "Received a FRAME BATCH message, but the controller did not ask for them");
             return -1;
         }
 
-        chirouter_interface_t *iface = &r->interfaces[msg->ethernet.iface_id];
+        /* Each frame has the same format as the payload
+         * of an ETHERNET FRAME message */
+        uint8_t *pos = (uint8_t *) msg + MSG_HDR_LEN;
+        uint8_t *end = pos + payload_len;
 
-        rc = chirouter_server_process_ethernet_frame(r, iface, msg->ethernet.frame, ntohs(msg->ethernet.frame_len));
-        if(rc == -1)
+        while(pos < end)
         {
-            chilog(CRITICAL, "Error when processing Ethernet frame received from controller.");
-            return -1;
-        }
+            uint16_t frame_len;
+
+            /* Frames can have any length, so the length of the next
+             * one may not be aligned: it is read one byte at a time */
+            if(end - pos < 4 || end - pos - 4 < (frame_len = (pos[2] << 8) | pos[3]))
+            {
+                chilog(CRITICAL, "Received a FRAME BATCH message with a truncated frame");
+                return -1;
+            }
+
+            rc = chirouter_server_process_frame(conn, pos[0], pos[1], pos + 4, frame_len);
+            if(rc)
+                return rc;
 
+            pos += 4 + frame_len;
+        }
+        break;
     }
 
     }
@@ -587,9 +2765,66 @@ int chirouter_server_process_single_message(server_ctx_t *ctx, chirouter_msg_t *
 }
 
 
+/*
+ * chirouter_server_process_frame - Process an Ethernet frame received from a controller
+ *
+ * Called for the frame in an ETHERNET FRAME message, and for each
+ * of the frames in a FRAME BATCH message.
+ *
+ * conn: Connection to the controller that sent the frame
+ *
+ * r_id: Router ID
+ *
+ * iface_id: Interface ID
+ *
+ * frame: Frame (in the receive buffer)
+ *
+ * frame_len: Length of the frame
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_process_frame(server_conn_t *conn, uint8_t r_id, uint8_t iface_id, uint8_t *frame, uint16_t frame_len)
+{
+    if(r_id >= conn->num_routers)
+    {
+        chilog(CRITICAL, "Received invalid Router ID: %d", r_id);
+        return -1;
+    }
+
+    chirouter_ctx_t *r = &conn->routers[r_id];
+
+    if(iface_id >= r->num_interfaces)
+    {
+        chilog(CRITICAL, "Received invalid Interface ID: %d", iface_id);
+        return -1;
+    }
+
+    chirouter_interface_t *iface = &r->interfaces[iface_id];
+
+    conn->frames_processed++;
+
+    /* With fair scheduling, the frame is added to the router's input
+     * queue (or dropped, if the queue is full), and processed once it
+     * is the router's turn (see chirouter_server_drr_serve). Frames
+     * that are too large are rejected right away by
+     * chirouter_server_handle_frame. */
+    if(conn->server->drr_enabled && frame_len <= ETHER_FRAME_MAX_LEN)
+    {
+        chirouter_drr_enqueue(r, iface, frame, frame_len);
+        return 0;
+    }
+
+    return chirouter_server_handle_frame(r, iface, frame, frame_len);
+}
+
+
 /*
  * chirouter_server_process_ethernet_frame - Process an Ethernet frame received in an ETHERNET FRAME message
  *
+ * Called from the server thread or, in worker-pool mode, from the
+ * worker thread the router is assigned to.
+ *
  * ctx: Router context
  *
  * iface: Interface to send the frame on.
@@ -664,21 +2899,21 @@ int chirouter_server_process_ethernet_frame(chirouter_ctx_t *ctx, chirouter_inte
         return 1;
     }
 
-    /* Create Ethernet frame struct */
-    ethernet_frame_t *frame = calloc(1, sizeof(ethernet_frame_t));
+    /* Create Ethernet frame struct. The frame is processed in place,
+     * straight from the message buffer, so that processing a frame does
+     * not require any heap allocations (the router code copies the frame
+     * if it needs it after chirouter_process_ethernet_frame returns) */
+    ethernet_frame_t frame;
 
-    frame->raw = calloc(len, 1);
-    memcpy(frame->raw, msg, len);
-    frame->length = len;
-    frame->in_interface = iface;
+    frame.raw = msg;
+    frame.length = len;
+    frame.in_interface = iface;
+    frame.buf = NULL;
 
     if(ctx->server->pcap)
         chirouter_pcap_write_frame(ctx, iface, msg, len, PCAP_INBOUND);
 
-    rc = chirouter_process_ethernet_frame(ctx, frame);
-
-    free(frame->raw);
-    free(frame);
+    rc = chirouter_process_ethernet_frame(ctx, &frame);
 
     if (rc == -1)
     {
@@ -690,6 +2925,56 @@ int chirouter_server_process_ethernet_frame(chirouter_ctx_t *ctx, chirouter_inte
 }
 
 
+/*
+ * chirouter_server_handle_frame - Hands an Ethernet frame over to its router
+ *
+ * Called from the server thread, once it is time to process a frame
+ * (right after it is received or, with fair scheduling, once it is the
+ * router's turn, see drr.h)
+ *
+ * In worker-pool mode, the frame is copied into the ring of the router's
+ * worker (the buffer the frame is in is reused once this function
+ * returns). Frames that are too large are rejected without touching
+ * the router's state. In vector mode, the frame is added to the
+ * router's vector (see vector.h). Otherwise, the frame is processed
+ * right away.
+ *
+ * ctx: Router context
+ *
+ * iface: Interface the frame was received on
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame
+ *
+ * Returns: 0 on success, -1 if a critical error happens.
+ *
+ */
+int chirouter_server_handle_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *frame, size_t len)
+{
+    int rc;
+
+    if(ctx->server->num_workers > 0 && len <= ETHER_FRAME_MAX_LEN)
+    {
+        while(!chirouter_workers_dispatch(ctx->server, ctx, iface, frame, len))
+            chirouter_server_wait_for_workers(ctx->server);
+        return 0;
+    }
+
+    if(ctx->server->vector_enabled)
+        return chirouter_vector_add(ctx, iface, frame, len);
+
+    rc = chirouter_server_process_ethernet_frame(ctx, iface, frame, len);
+    if(rc == -1)
+    {
+        chilog(CRITICAL, "Error when processing Ethernet frame received from controller.");
+        return -1;
+    }
+
+    return 0;
+}
+
+
 /* See chirouter.h */
 int chirouter_send_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *frame, size_t frame_len)
 {
@@ -719,7 +3004,13 @@ int chirouter_send_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uin
     if(ctx->server->pcap)
         chirouter_pcap_write_frame(ctx, iface, frame, frame_len, PCAP_OUTBOUND);
 
+    if(iface->port != NULL)
+        return chirouter_dataplane_send(iface->port, frame, frame_len);
+
+    /* Send the message header and the frame straight from the
+     * caller's buffer, without copying the frame into the message */
     chirouter_msg_t msg;
+    struct iovec iov[2];
 
     msg.type = MSG_TYPE_ETHERNET_FRAME;
     msg.subtype = FROM_ROUTER;
@@ -727,26 +3018,52 @@ int chirouter_send_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uin
     msg.ethernet.r_id = ctx->r_id;
     msg.ethernet.iface_id = iface->pox_iface_id;
     msg.ethernet.frame_len = htons(frame_len);
-    memcpy(msg.ethernet.frame, frame, frame_len);
 
-    return chirouter_server_send_msg(ctx->server, &msg);
+    iov[0].iov_base = &msg;
+    iov[0].iov_len = offsetof(chirouter_msg_t, ethernet.frame);
+    iov[1].iov_base = frame;
+    iov[1].iov_len = frame_len;
+
+    return chirouter_server_send_iov(ctx->conn, iov, 2);
 }
 
 /*
- * chirouter_server_ctx_free_routers - Frees router resources
+ * chirouter_server_conn_free_routers - Frees the routers of a connection
  *
- * ctx: Server context
+ * conn: Connection to a controller
  *
  * Returns: 0 on success, -1 if an error happens.
  *
  */
-int chirouter_server_ctx_free_routers(server_ctx_t *ctx)
+int chirouter_server_conn_free_routers(server_conn_t *conn)
 {
     int rc;
 
-    for(int i=0; i < ctx->num_routers; i++)
+    /* Tell all the ARP threads to stop, so they can all
+     * exit concurrently while we destroy the routers */
+    for(int i=0; i < conn->num_routers; i++)
+    {
+        atomic_store(&conn->routers[i].arp_thread_stop, true);
+    }
+
+    /* The workers must be done with all the frames of a router before
+     * we can free it (routers are only assigned to workers once they
+     * are running, see MSG_TYPE_END_CONFIG) */
+    if(conn->server->num_workers > 0 && conn->state == RUNNING)
+    {
+        for(int i=0; i < conn->num_routers; i++)
+        {
+            while(!chirouter_workers_idle(&conn->routers[i]))
+                chirouter_server_wait_for_workers(conn->server);
+            chirouter_workers_unassign(conn->server, &conn->routers[i]);
+        }
+    }
+
+    for(int i=0; i < conn->num_routers; i++)
     {
-        rc = chirouter_ctx_destroy(&ctx->routers[i]);
+        chirouter_drr_destroy(&conn->routers[i]);
+        chirouter_vector_destroy(&conn->routers[i]);
+        rc = chirouter_ctx_destroy(&conn->routers[i]);
         if(rc)
         {
             chilog(CRITICAL, "Could not free router resource");
@@ -754,35 +3071,385 @@ int chirouter_server_ctx_free_routers(server_ctx_t *ctx)
         }
     }
 
-    free(ctx->routers);
+    chirouter_free(conn->routers);
 
-    ctx->routers = NULL;
-    ctx->num_routers = 0;
-    ctx->max_routers = 0;
+    conn->routers = NULL;
+    conn->num_routers = 0;
+    conn->max_routers = 0;
 
     return 0;
 }
 
 
 /*
- * chirouter_server_ctx_destroy - Frees server resources
+ * chirouter_server_tx_run - TX thread function (pipeline mode only)
+ *
+ * The TX thread waits for messages in the transmit rings of all the
+ * connections, and for their sockets to be writable, and sends the
+ * messages. Any thread (including the server thread) sends messages
+ * by adding them to a transmit ring (see chirouter_server_send_iov).
+ *
+ * arg: Server context
+ *
+ * Returns: NULL
+ *
+ */
+void *chirouter_server_tx_run(void *arg)
+{
+    server_ctx_t *ctx = arg;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int nevents;
+
+    while (!atomic_load(&ctx->tx_stop))
+    {
+        nevents = epoll_wait(ctx->tx_epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (nevents == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            chilog(CRITICAL, "epoll_wait() failed in TX thread");
+            break;
+        }
+
+        for (int i = 0; i < nevents; i++)
+        {
+            server_event_source_t *src = events[i].data.ptr;
+
+            if (src == &ctx->tx_wakeup_src)
+            {
+                uint64_t count;
+                ssize_t rc = read(ctx->tx_wakeup_fd, &count, sizeof(count));
+                (void) rc;
+                continue;
+            }
+
+            chirouter_server_tx_handle_event(src->conn, src, events[i].events);
+        }
+
+        atomic_fetch_add(&ctx->tx_batches, 1);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * chirouter_server_tx_start - Starts the TX thread
+ *
+ * Puts the server in pipeline mode: the server thread receives and
+ * parses the messages from the controllers, the routers process the
+ * frames (on the server thread, or on the worker threads, see
+ * worker.h), and the TX thread writes to the controller sockets. Must
+ * be called after chirouter_server_setup, and before any controller
+ * connects.
  *
  * ctx: Server context
  *
  * Returns: 0 on success, -1 if an error happens.
  *
  */
-int chirouter_server_ctx_destroy(server_ctx_t *ctx)
+int chirouter_server_tx_start(server_ctx_t *ctx)
 {
-    int rc;
+    struct epoll_event ev;
 
-    rc = chirouter_server_ctx_free_routers(ctx);
-    if(rc)
+    ctx->tx_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ctx->tx_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->tx_epoll_fd == -1 || ctx->tx_wakeup_fd == -1)
+    {
+        chilog(CRITICAL, "Could not create TX thread file descriptors");
+        return -1;
+    }
+
+    ctx->tx_wakeup_src.conn = NULL;
+    ctx->tx_wakeup_src.fd = ctx->tx_wakeup_fd;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &ctx->tx_wakeup_src;
+    if (epoll_ctl(ctx->tx_epoll_fd, EPOLL_CTL_ADD, ctx->tx_wakeup_fd, &ev) == -1)
+    {
+        chilog(CRITICAL, "Could not add TX wake-up eventfd to epoll instance");
+        return -1;
+    }
+
+    if (chirouter_server_notify_start(ctx))
+        return -1;
+
+    atomic_init(&ctx->tx_stop, false);
+    atomic_init(&ctx->tx_batches, 0);
+    ctx->tx_thread_enabled = true;
+
+    if (pthread_create(&ctx->tx_thread, NULL, chirouter_server_tx_run, ctx) != 0)
+    {
+        chilog(CRITICAL, "Could not create TX thread");
+        return -1;
+    }
+    ctx->tx_thread_started = true;
+    ctx->writer_thread = ctx->tx_thread;
+
+    chilog(INFO, "Sending messages to the controllers from a separate TX thread");
+
+    return 0;
+}
+
+
+/*
+ * chirouter_server_tx_stop - Stops the TX thread
+ *
+ * ctx: Server context (with no connections left)
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_tx_stop(server_ctx_t *ctx)
+{
+    if (ctx->tx_thread_started)
+    {
+        uint64_t one = 1;
+        ssize_t rc;
+
+        atomic_store(&ctx->tx_stop, true);
+        rc = write(ctx->tx_wakeup_fd, &one, sizeof(one));
+        (void) rc;
+        pthread_join(ctx->tx_thread, NULL);
+        ctx->tx_thread_started = false;
+    }
+
+    if (ctx->tx_epoll_fd != -1)
+        close(ctx->tx_epoll_fd);
+    if (ctx->tx_wakeup_fd != -1)
+        close(ctx->tx_wakeup_fd);
+    ctx->tx_epoll_fd = ctx->tx_wakeup_fd = -1;
+}
+
+
+/*
+ * chirouter_server_tx_handle_event - Handles an event in the TX thread
+ *
+ * Sends whatever can be sent without waiting (from the backlog and from
+ * the transmit ring), and waits for the socket to be writable if anything
+ * is left in the backlog. If sending fails, the TX thread stops sending
+ * to the controller (and just empties the ring from then on, so no thread
+ * waits for room in it forever), and tells the server thread, which
+ * closes the connection.
+ *
+ * conn: Connection to a controller
+ *
+ * src: Event source (the connection's socket or its transmit ring)
+ *
+ * events: epoll events
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_tx_handle_event(server_conn_t *conn, server_event_source_t *src, uint32_t events)
+{
+    server_ctx_t *ctx = conn->server;
+    struct epoll_event ev;
+
+    if (src == &conn->txring_src)
+        chirouter_txring_ack_wakeup(&conn->txring);
+
+    if (atomic_load(&conn->tx_failed))
+    {
+        chirouter_txring_discard(&conn->txring);
+        return;
+    }
+
+    /* Errors are always reported, so we stop watching the socket
+     * (the server thread finds out about the error on its own) */
+    if (src == &conn->tx_socket_src && (events & (EPOLLERR | EPOLLHUP)))
+    {
+        epoll_ctl(ctx->tx_epoll_fd, EPOLL_CTL_DEL, conn->client_socket, NULL);
+        return;
+    }
+
+    if (chirouter_server_flush(conn) == -1)
+    {
+        atomic_store(&conn->tx_rc, chirouter_server_send_failed(conn));
+        atomic_store(&conn->tx_failed, true);
+        chirouter_txring_discard(&conn->txring);
+        chirouter_server_notify(ctx);
+        return;
+    }
+
+    ev.events = chirouter_txq_backlog(&conn->txq) > 0 ? EPOLLOUT : 0;
+    ev.data.ptr = &conn->tx_socket_src;
+    if (ev.events != conn->tx_socket_events &&
+        epoll_ctl(ctx->tx_epoll_fd, EPOLL_CTL_MOD, conn->client_socket, &ev) == 0)
+    {
+        conn->tx_socket_events = ev.events;
+    }
+}
+
+
+/*
+ * chirouter_server_notify_start - Creates the eventfd the server thread is notified through
+ *
+ * Used by the TX thread and by the workers (see chirouter_server_notify).
+ * Does nothing if the eventfd already exists.
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_notify_start(server_ctx_t *ctx)
+{
+    struct epoll_event ev;
+
+    if (ctx->notify_fd != -1)
+        return 0;
+
+    ctx->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->notify_fd == -1)
+    {
+        chilog(CRITICAL, "Could not create notification eventfd");
+        return -1;
+    }
+
+    ctx->notify_src.conn = NULL;
+    ctx->notify_src.fd = ctx->notify_fd;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &ctx->notify_src;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->notify_fd, &ev) == -1)
     {
-        chilog(CRITICAL, "Could not free router resources");
+        chilog(CRITICAL, "Could not add notification eventfd to epoll instance");
         return -1;
     }
 
     return 0;
 }
 
+
+/*
+ * chirouter_server_notify - Wakes up the server thread (TX thread and workers only)
+ *
+ * ctx: Server context
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_notify(server_ctx_t *ctx)
+{
+    uint64_t one = 1;
+    ssize_t rc = write(ctx->notify_fd, &one, sizeof(one));
+    (void) rc;
+}
+
+
+/*
+ * chirouter_server_notified - Handles a notification from the TX thread or a worker
+ *
+ * Closes the connections the TX thread could not send to, or whose
+ * routers had a critical error on a worker, and updates the events we
+ * wait for on the rest (in case their outbound queue became congested,
+ * or stopped being congested).
+ *
+ * ctx: Server context
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_notified(server_ctx_t *ctx)
+{
+    server_conn_t *conn;
+    uint64_t count;
+    ssize_t rc = read(ctx->notify_fd, &count, sizeof(count));
+    (void) rc;
+
+    DL_FOREACH(ctx->conns, conn)
+    {
+        if (conn->closed)
+            continue;
+
+        if (atomic_load(&conn->tx_failed))
+            chirouter_server_conn_close(conn, atomic_load(&conn->tx_rc));
+        else if (atomic_load(&conn->worker_failed))
+            chirouter_server_conn_close(conn, -1);
+        else if (chirouter_server_conn_update_events(conn) == -1)
+            chirouter_server_conn_close(conn, -1);
+    }
+}
+
+
+/*
+ * chirouter_server_tx_detach - Stops the TX thread from using a connection
+ *
+ * Removes the connection from the TX thread's epoll instance, and waits
+ * until the TX thread is done with the batch of events it was handling
+ * (which could include events for this connection). After that, the
+ * TX thread won't touch the connection again.
+ *
+ * conn: Connection to a controller
+ *
+ * Returns: nothing
+ *
+ */
+void chirouter_server_tx_detach(server_conn_t *conn)
+{
+    server_ctx_t *ctx = conn->server;
+    uint64_t one = 1, batches;
+    ssize_t rc;
+
+    /* The socket may already have been removed (if it reported an error) */
+    epoll_ctl(ctx->tx_epoll_fd, EPOLL_CTL_DEL, conn->client_socket, NULL);
+    epoll_ctl(ctx->tx_epoll_fd, EPOLL_CTL_DEL, conn->txring.eventfd, NULL);
+
+    batches = atomic_load(&ctx->tx_batches);
+    rc = write(ctx->tx_wakeup_fd, &one, sizeof(one));
+    (void) rc;
+    while (atomic_load(&ctx->tx_batches) == batches)
+        sched_yield();
+}
+
+
+/*
+ * chirouter_server_ctx_destroy - Frees server resources
+ *
+ * Closes all the connections to controllers (freeing their routers).
+ *
+ * ctx: Server context
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ *
+ */
+int chirouter_server_ctx_destroy(server_ctx_t *ctx)
+{
+    server_conn_t *conn, *tmp;
+
+    DL_FOREACH(ctx->conns, conn)
+    {
+        if (!conn->closed)
+            chirouter_server_conn_close(conn, 1);
+    }
+
+    /* Destroying the io_uring instance cancels all its requests,
+     * so none of them can use the connections once they are freed */
+    if (ctx->uring.fd != -1)
+        chirouter_uring_destroy(&ctx->uring);
+
+    DL_FOREACH_SAFE(ctx->conns, conn, tmp)
+    {
+        DL_DELETE(ctx->conns, conn);
+        chirouter_server_conn_destroy(conn);
+    }
+    ctx->num_conns = 0;
+
+    if (ctx->workers != NULL)
+        chirouter_workers_stop(ctx);
+
+    if (ctx->tx_thread_enabled)
+        chirouter_server_tx_stop(ctx);
+
+    if (ctx->notify_fd != -1)
+        close(ctx->notify_fd);
+    if (ctx->epoll_fd != -1)
+        close(ctx->epoll_fd);
+    if (ctx->server_socket != -1)
+        close(ctx->server_socket);
+    if (ctx->server_socket != -1 && ctx->unix_path != NULL)
+        unlink(ctx->unix_path);
+
+    chirouter_free(ctx);
+
+    return 0;
+}
@@ -66,9 +66,18 @@
 #ifndef SERVER_H_
 #define SERVER_H_
 
+#include <stdio.h>
 #include <stdbool.h>
+#include <netdb.h>
 
 #include "chirouter.h"
+#include "txq.h"
+#include "txring.h"
+#include "worker.h"
+#include "drr.h"
+#include "vector.h"
+#include "uring.h"
+#include "shm.h"
 
 
 /* The POX controller and chirouter communicate using a simple message-based
@@ -91,13 +100,31 @@
  *
  *  Subtypes: 1 (From Router) and 2 (To Router)
  *
- *  Payload: None (Payload Length = 0)
+ *  Payload: None, or
+ *
+ *   ------------
+ *  |   Flags    |
+ *  |  (1 byte)  |
+ *   ------------
+ *
+ *  Payload Length: 0 or 1
  *
  *  Used to perform a simple handshake with the POX controller. When
  *  the POX controller connects to chirouter, it must send a HELLO
  *  message with Subtype = 2 (To Router). chirouter will respond
  *  with a HELLO message with Subtype = 1 (From Router)
  *
+ *  The controller can include a Flags byte to ask for optional features,
+ *  in which case chirouter's HELLO also includes a Flags byte with the
+ *  features it accepted (a controller that doesn't send any flags gets
+ *  a HELLO without a payload). The flags are:
+ *
+ *    0x01: Shared memory. Exchange the ETHERNET FRAME messages through
+ *          shared memory instead of the socket (see below).
+ *    0x02: Frame batches. Both sides can send FRAME BATCH messages (see
+ *          below) in addition to ETHERNET FRAME messages. chirouter always
+ *          accepts this flag.
+ *
  *
  *
  *  ROUTERS (Type = 2)
@@ -207,41 +234,164 @@
  *  (of the specified router)
  *
  *
- *  Protocol Description
+ *  FRAME BATCH (Type = 9)
+ *  ======================
+ *
+ *  Subtypes: 1 (From Router) and 2 (To Router)
+ *
+ *  Payload:
+ *
+ *   ---------------------------------------------------------------------------
+ *  |   Router ID  |  Interface ID  |  Frame Length  |   Frame   |  ...
+ *  |   (1 byte)   |    (1 byte)    |    (2 bytes)   | (N bytes) |
+ *   ---------------------------------------------------------------------------
+ *
+ *  Payload Length: sum of (4 + Frame Length) over all the frames
+ *
+ *  Used like ETHERNET FRAME, but carries several Ethernet frames, each
+ *  of them in the same format as the payload of an ETHERNET FRAME message
+ *  (the Router ID, Interface ID, Frame Length, and Frame are repeated once
+ *  per frame), so that sending and parsing many frames takes fewer
+ *  system calls and less work per frame. The frames are processed in
+ *  order, as if they had been sent in separate ETHERNET FRAME messages.
+ *  Can only be sent if the controller set the 0x02 flag in its HELLO
+ *  (and, like ETHERNET FRAME, only in the RUNNING state).
+ *
+ *
+ *  NEIGHBORS (Type = 8)
  *  ====================
  *
- *  The chirouter server has three states: HELLO_WAIT, CONFIG, RUNNING
+ *  Subtype: Always 0 (None)
+ *
+ *  Payload:
+ *
+ *   -----------------------------------------------------------------------------
+ *  |   Router ID  |  Number of Neighbors  |  Hardware Address  |  IPv4 Address  |  ...
+ *  |   (1 byte)   |       (1 byte)        |      (6 bytes)     |    (4 bytes)   |
+ *   -----------------------------------------------------------------------------
+ *
+ *  Payload Length: 2 + 10 * (Number of Neighbors)
+ *
+ *  This optional message provides static ARP entries for the given router: the
+ *  (Hardware Address, IPv4 Address) pair is repeated once per neighbor. These
+ *  entries never expire and are never evicted from the router's ARP cache.
+ *  It can be sent any number of times after the router's ROUTER message
+ *  and before END CONFIG.
+ *
  *
- *  The server starts in the HELLO_WAIT state. Once it receives a HELLO message from
+ *  Protocol Description
+ *  ====================
+ *
+ *  The controller connects to chirouter over TCP, or over a Unix domain
+ *  socket when both run on the same host (see the -u and -U options in
+ *  main.c). On a stream socket (TCP, or SOCK_STREAM), the messages are
+ *  sent back to back, and the receiver has to find where each of them
+ *  ends. On a SOCK_SEQPACKET socket, each message the controller sends
+ *  must be sent as a single packet (and chirouter closes the connection
+ *  if a packet does not contain exactly one message). chirouter, on the
+ *  other hand, batches the messages it sends, so the packets it sends
+ *  can contain several messages, or only part of one, and the controller
+ *  must read them like a stream.
+ *
+ *  A controller connected over a Unix domain socket can ask to exchange
+ *  the ETHERNET FRAME messages through shared memory (see shm.h), with
+ *  the 0x01 flag in its HELLO. If chirouter accepts, its HELLO is
+ *  followed on the socket by three file descriptors (the memfd with the
+ *  rings, the eventfd that wakes up chirouter, and the eventfd that
+ *  wakes up the controller, in that order), each sent as ancillary data
+ *  (SCM_RIGHTS) along with a single zero byte. The configuration
+ *  messages are still sent over the socket, but once the controller has
+ *  sent END CONFIG, all the messages in both directions go through the
+ *  rings, and the controller must not send anything else over the
+ *  socket (closing it still closes the connection). chirouter only
+ *  accepts with the epoll backend and without a TX thread.
+ *
+ *  Several POX controllers can be connected to the chirouter server at the
+ *  same time. Each controller manages its own routers (router IDs are local
+ *  to each connection), and everything described below applies to each
+ *  connection separately.
+ *
+ *  A connection has three states: HELLO_WAIT, CONFIG, RUNNING
+ *
+ *  A connection starts in the HELLO_WAIT state. Once it receives a HELLO message from
  *  the POX controller, it sends back a HELLO message and transitions to the CONFIG
  *  state.
  *
  *  The next message from the POX controller must be a ROUTERS message specifying the
  *  number N of routers that chirouter will manage. This must be followed by N router
  *  specifications using the following messages: one ROUTER, one or more INTERFACE
- *  messages, and one or more ROUTING TABLE ENTRY messages.
+ *  messages, one or more ROUTING TABLE ENTRY messages and, optionally, one or
+ *  more NEIGHBORS messages.
  *
  *  The router ID numbers must start from zero and be numbered consecutively. For
  *  a given router, the interface ID numbers must start from zero and be numbered
  *  consecutively.
  *
  *  If there are any errors in the configuration data, the server must close the
- *  connection and exit immediately.
+ *  connection immediately.
  *
  *  After all the configuration data has been sent, the POX controller must send
  *  an END CONFIG message, and the server will transition to the RUNNING state.
  *
  *  In the RUNNING state both the server and the POX controller can send/receive
- *  ETHERNET messages. If the server receives an Ethernet frame with an invalid
+ *  ETHERNET messages (and FRAME BATCH messages, if the controller asked for
+ *  them: each side can send any mix of both). chirouter batches the frames
+ *  it sends from the server thread, but frames sent by other threads (e.g.,
+ *  the ARP threads, or the workers) are still sent in ETHERNET FRAME messages.
+ *  On a SOCK_SEQPACKET socket, a message from the controller (including a
+ *  FRAME BATCH message) must fit in a single packet of at most
+ *  SERVER_SEQPACKET_SLOT_SIZE bytes: the server logs and drops any larger
+ *  message (without closing the connection). If the server receives an Ethernet frame with an invalid
  *  Router ID and/or Interface ID, it must log this occurrence and drop that frame.
  *
- *  If the POX controller closes the connection while the server is in the RUNNING
- *  state, the server must reset the chirouter data structures and return to
- *  the HELLO_WAIT state.
+ *  If the POX controller closes the connection, the server must free the
+ *  routers it configured. The routers of other controllers are not affected.
  *
  */
 
 
+/* Size of the message header, and maximum size of a message */
+#define MSG_HDR_LEN (4u)
+#define MSG_MAX_LEN (MSG_HDR_LEN + UINT16_MAX)
+
+/* Size of the buffer used to receive messages from the controller.
+ * Must be at least MSG_MAX_LEN, and large enough to receive many
+ * Ethernet frames with a single recv() call */
+#define SERVER_RX_BUFFER_SIZE (256u * 1024u)
+
+/* SOCK_SEQPACKET only: size of the slots of the receive buffer that
+ * packets from the controller are received into (each packet has to hold
+ * a single message, and must fit in a slot: larger messages are dropped),
+ * and maximum size of the packets sent to the controller (which must be
+ * smaller than the socket's send buffer) */
+#define SERVER_SEQPACKET_SLOT_SIZE (4096u)
+#define SERVER_SEQPACKET_MAX_WRITE (64u * 1024u)
+
+/* Maximum number of events the server handles with a single epoll_wait() call */
+#define SERVER_MAX_EVENTS (64)
+
+/* io_uring backend only: size of the submission queue, and number and
+ * size of the buffers each connection receives messages into (see
+ * chirouter_server_uring_run). Like the receive buffer, the buffers of
+ * a connection must be large enough to receive many Ethernet frames
+ * before the server gets to copy them into the receive buffer. */
+#define SERVER_URING_ENTRIES (256u)
+#define SERVER_URING_RX_BUFS (16u)
+#define SERVER_URING_RX_BUF_SIZE (16u * 1024u)
+
+/* Shared memory only: size of each of the rings shared with a
+ * controller, and how often (in milliseconds) the rings are checked
+ * when chirouter is not woken up (see shm.h) */
+#define SERVER_SHM_RING_SIZE (4u * 1024u * 1024u)
+#define SERVER_SHM_RECHECK_MS (10)
+
+/* Flags in a HELLO message */
+#define HELLO_FLAG_SHM (0x01u)
+#define HELLO_FLAG_FRAME_BATCH (0x02u)
+
+/* Maximum number of neighbors in a NEIGHBORS message */
+#define MAX_NEIGHBORS_PER_MSG (255u)
+
 /* chirouter server messages */
 struct chirouter_msg {
   uint8_t type;
@@ -249,6 +399,10 @@ struct chirouter_msg {
   uint16_t payload_length;
   union
   {
+      struct
+      {
+          uint8_t flags;
+      } hello;
       struct
       {
           uint8_t nrouters;
@@ -284,6 +438,16 @@ struct chirouter_msg {
           uint16_t frame_len;
           uint8_t frame[ETHER_FRAME_MAX_LEN];
       } ethernet;
+      struct
+      {
+          uint8_t r_id;
+          uint8_t num_neighbors;
+          struct
+          {
+              uint8_t hwaddr[ETHER_ADDR_LEN];
+              uint32_t ipaddr;
+          } __attribute__ ((packed)) neighbor[MAX_NEIGHBORS_PER_MSG];
+      } neighbors;
   };
 } __attribute__ ((packed));
 typedef struct chirouter_msg chirouter_msg_t;
@@ -298,7 +462,9 @@ typedef enum
     MSG_TYPE_INTERFACE = 4,
     MSG_TYPE_RTABLE_ENTRY = 5,
     MSG_TYPE_END_CONFIG = 6,
-    MSG_TYPE_ETHERNET_FRAME = 7
+    MSG_TYPE_ETHERNET_FRAME = 7,
+    MSG_TYPE_NEIGHBORS = 8,
+    MSG_TYPE_FRAME_BATCH = 9
 } chirouter_msg_type_t;
 
 
@@ -311,7 +477,7 @@ typedef enum
 } chirouter_msg_subtype_t;
 
 
-/* Server state */
+/* Connection state */
 typedef enum
 {
     HELLO_WAIT = 1,  // Waiting for hello from client
@@ -320,19 +486,118 @@ typedef enum
 } server_state_t;
 
 
-/* The server context. Contains all the information needed
- * to run the server, as well as the router data structures. */
-typedef struct server_ctx
+/* What to do while the outbound queue is congested, i.e., while the
+ * controller is not reading the messages we send it fast enough */
+typedef enum
 {
-    /* Server (passive) socket */
-    int server_socket;
+    OUTQ_BLOCK = 1,  // Stop reading from the controller (never drop messages)
+    OUTQ_DROP = 2    // Drop the Ethernet frames sent to the controller
+} outq_policy_t;
+
+
+/* How the server waits for events and sends and receives messages */
+typedef enum
+{
+    BACKEND_EPOLL = 1,   // Non-blocking system calls, once epoll says they won't block
+    BACKEND_URING = 2    // Asynchronous requests submitted to io_uring
+} server_backend_t;
+
+
+/* Something the server waits on with epoll. The server socket (and the
+ * eventfds used by the TX thread in pipeline mode) have no connection,
+ * and each connection has two event sources: its socket, and the eventfd
+ * of its transmit ring (see chirouter_server_run) */
+typedef struct server_event_source
+{
+    server_conn_t *conn;
+    int fd;
+} server_event_source_t;
+
+
+/* A connection to a controller. Each controller configures its own
+ * set of routers, which are completely independent from the routers
+ * of any other controller connected to the server. */
+struct server_conn
+{
+    /* Server this connection was accepted by */
+    server_ctx_t *server;
 
     /* Client (active) socket */
     int client_socket;
 
-    /* Server state */
+    /* Address of the controller (used in log messages) */
+    char name[NI_MAXHOST + NI_MAXSERV + 1];
+
+    /* Connection state */
     server_state_t state;
 
+    /* Buffer used to receive messages from the controller (of size
+     * SERVER_RX_BUFFER_SIZE). [rx_head, rx_tail) holds the bytes we
+     * have received but not processed yet. */
+    uint8_t *rx_buffer;
+    size_t rx_head;
+    size_t rx_tail;
+
+    /* Queue of messages to be sent to the controller. Only the writer
+     * thread (the server thread, or the TX thread in pipeline mode)
+     * writes to the controller socket, and uses this queue. */
+    chirouter_txq_t txq;
+
+    /* Ring used by other threads to send messages to the controller
+     * through the writer thread (see txring.h) */
+    chirouter_txring_t txring;
+
+    /* Event sources for the socket and the transmit ring, and
+     * the events we are currently waiting for on the socket */
+    server_event_source_t socket_src;
+    server_event_source_t txring_src;
+    uint32_t socket_events;
+
+    /* Set once the connection has been closed. The connection is
+     * only freed once the server is done with the current batch of
+     * events, since some of them could refer to it. */
+    bool closed;
+
+    /* Backpressure on the messages sent to the controller: once the
+     * transmit queue's backlog (see txq.h) reaches the server's outq_high
+     * bytes, the outbound queue is congested until the backlog drops
+     * to outq_low bytes. What we do while it is congested depends on
+     * the server's outq_policy. Control messages are never dropped.
+     * Only updated by the writer thread. */
+    atomic_bool outq_congested;
+
+    /* Statistics: number of times the outbound queue became congested, and
+     * number of Ethernet frames to the controller dropped because of it.
+     * These, and the transmit queue's statistics, belong to the writer
+     * thread, which resets them when reset_tx_stats is set. */
+    uint64_t outq_congestions;
+    uint64_t outq_drops;
+    atomic_bool reset_tx_stats;
+
+    /* Whether the controller asked for FRAME BATCH messages and, if so,
+     * the header of the FRAME BATCH message the writer thread is adding
+     * frames to (which is staged in the transmit queue, and can only be
+     * extended until the transmit queue is flushed, i.e., while its
+     * generation is still batch_generation), or NULL if there is none
+     * (see chirouter_server_send_batched) */
+    bool frame_batch;
+    chirouter_msg_t *batch_hdr;
+    uint64_t batch_generation;
+
+    /* Pipeline mode only: event source for the socket in the TX thread's
+     * epoll instance, the events the TX thread waits for on it, and
+     * whether the TX thread failed to send to the controller (and the
+     * return value of chirouter_server_send_failed when it did) */
+    server_event_source_t tx_socket_src;
+    uint32_t tx_socket_events;
+    atomic_bool tx_failed;
+    atomic_int tx_rc;
+
+    /* Workers only: whether a worker had a critical error processing a
+     * frame for one of the routers (the server thread then closes the
+     * connection) */
+    atomic_bool worker_failed;
+
     /* Number of routers */
     uint16_t max_routers;
     uint16_t num_routers;
@@ -341,14 +606,179 @@ typedef struct server_ctx
      * be of size "num_routers" */
     chirouter_ctx_t* routers;
 
-    /* PCAP file to dump to */
+    /* Number of Ethernet frames processed since the routers started,
+     * and values of the allocation counters (see alloc.h) when they
+     * started. Used to check that frame processing doesn't allocate. */
+    uint64_t frames_processed;
+    uint64_t allocs_at_start;
+    uint64_t frees_at_start;
+
+    /* Fair scheduling only (see drr.h): the router whose turn it is,
+     * whether it has already been given its quantum for this turn, the
+     * number of frames in the input queues of all the routers, and the
+     * number of frames dropped because their router's queue was full */
+    uint16_t drr_next;
+    bool drr_in_turn;
+    uint64_t drr_queued;
+    uint64_t drr_drops;
+
+    /* io_uring backend only (see chirouter_server_uring_run): the buffers
+     * the controller's messages are received into, and the ones that
+     * have been received into but not copied into the receive buffer
+     * yet (a FIFO of buffer IDs and lengths, of which the first
+     * rx_pending_offset bytes have already been copied). rx_rc is set
+     * once nothing else can be received (to what chirouter_server_process_messages
+     * would return), and send_errno once a send fails. Sending makes
+     * progress (send_done) whenever a send completes. The connection
+     * cannot be freed until none of its requests are in progress. */
+    chirouter_uring_bufs_t rx_bufs;
+    uint16_t rx_pending_id[SERVER_URING_RX_BUFS];
+    uint32_t rx_pending_len[SERVER_URING_RX_BUFS];
+    unsigned int rx_pending_head;
+    unsigned int rx_pending_count;
+    size_t rx_pending_offset;
+    int rx_rc;
+    int send_errno;
+    bool recv_in_progress;
+    bool send_in_progress;
+    bool send_done;
+    unsigned int uring_ops;
+
+    /* Shared memory only (NULL if the controller didn't ask for it): the
+     * rings the Ethernet frames are exchanged through once the routers
+     * are running, and the event source for the eventfd that the
+     * controller uses to wake up the server. The transmit queue sends
+     * its data to the ring (see chirouter_server_shm_start). */
+    chirouter_shm_t *shm;
+    server_event_source_t shm_src;
+
+    /* Connections are kept in a doubly-linked list */
+    struct server_conn *prev;
+    struct server_conn *next;
+};
+
+
+/* The server context. Contains all the information needed to run
+ * the server, and the connections to the controllers (each with
+ * its own router data structures). */
+typedef struct server_ctx
+{
+    /* Server (passive) socket, and the path it is bound to if it is
+     * a Unix domain socket (NULL if it is a TCP socket), in which case
+     * the socket is a SOCK_SEQPACKET socket if seqpacket is set */
+    int server_socket;
+    server_event_source_t server_src;
+    char *unix_path;
+    bool seqpacket;
+
+    /* epoll instance used to wait for events on all the connections */
+    int epoll_fd;
+
+    /* Backend used to wait for events and to send and receive messages.
+     * With io_uring, the epoll instance only has the server socket and
+     * the eventfds (the server waits for it with io_uring, and checks it
+     * whenever epoll_ready is set), and each connection is given its own
+     * buffer group ID (see chirouter_server_uring_run). */
+    server_backend_t backend;
+    chirouter_uring_t uring;
+    bool uring_epoll_polled;
+    bool uring_epoll_ready;
+    uint16_t uring_next_group;
+
+    /* The thread that runs the server, and the only thread that
+     * writes to the controller sockets (the server thread itself,
+     * unless the server runs in pipeline mode) */
+    pthread_t server_thread;
+    pthread_t writer_thread;
+
+    /* Connections to controllers */
+    server_conn_t *conns;
+    unsigned int num_conns;
+
+    /* PCAP file to dump to, and number of interfaces
+     * described in it so far. Frames are written from several
+     * threads, so writing a frame requires locking pcap_lock. */
     FILE *pcap;
+    uint32_t pcap_num_ifaces;
+    pthread_mutex_t pcap_lock;
+
+    /* Learn from gratuitous ARP messages */
+    bool arp_gratuitous;
+
+    /* File with static ARP entries (NULL if none) */
+    char *neighbors_file;
+
+    /* Maximum rate (requests per second) and burst size of the
+     * ARP requests sent on each interface. A rate of 0 means
+     * ARP requests are not paced. */
+    unsigned int arp_rate;
+    unsigned int arp_burst;
+
+    /* ARP retransmission schedule: the i-th entry is how long (in
+     * milliseconds) we wait for a reply after sending an ARP request
+     * for the (i+1)-th time. Once the last wait expires without a
+     * reply, the request is abandoned (see chirouter_arp_process_pending_req) */
+    uint32_t arp_schedule[ARP_MAX_RETRIES];
+    unsigned int arp_schedule_len;
+
+    /* Size of the outbound queue of each connection (i.e., of the
+     * backlog of its transmit queue), its watermarks, and what to do
+     * when it is congested (see server_conn_t) */
+    size_t outq_size;
+    size_t outq_high;
+    size_t outq_low;
+    outq_policy_t outq_policy;
+
+    /* Worker threads (none if the frames are processed by the server
+     * thread itself), when the routers are next rebalanced across them
+     * (see chirouter_workers_rebalance), and how many times a router
+     * has been moved to a different worker */
+    chirouter_worker_t *workers;
+    unsigned int num_workers;
+    uint64_t next_rebalance;
+    uint64_t worker_migrations;
+
+    /* Fair scheduling: the frames received for the routers of a
+     * controller are served from per-router input queues with deficit
+     * round robin, instead of in the order they are received (see drr.h),
+     * and the weights given to some of the routers */
+    bool drr_enabled;
+    chirouter_drr_weight_t drr_weights[DRR_MAX_WEIGHTS];
+    unsigned int drr_num_weights;
+
+    /* Vector mode: the frames received for a router are processed in
+     * batches, one step at a time (see vector.h) */
+    bool vector_enabled;
+
+    /* Pipeline mode: a separate TX thread writes to the controller
+     * sockets (see chirouter_server_tx_run), with its own epoll instance.
+     * tx_wakeup_fd is used to wake up the TX thread, which counts the
+     * batches of events it handles (see chirouter_server_tx_detach). */
+    bool tx_thread_enabled;
+    pthread_t tx_thread;
+    bool tx_thread_started;
+    int tx_epoll_fd;
+    int tx_wakeup_fd;
+    server_event_source_t tx_wakeup_src;
+    atomic_bool tx_stop;
+    atomic_uint_fast64_t tx_batches;
+
+    /* Used by the TX thread and the workers to tell the server thread
+     * that a connection's outbound queue changed state, or that a
+     * connection has to be closed (see chirouter_server_notified) */
+    int notify_fd;
+    server_event_source_t notify_src;
 } server_ctx_t;
 
 /* See server.c for documentation */
 int chirouter_server_ctx_init(server_ctx_t **ctx);
 int chirouter_server_setup(server_ctx_t *ctx, char *port);
 int chirouter_server_run(server_ctx_t *ctx);
+int chirouter_server_tx_start(server_ctx_t *ctx);
+int chirouter_server_notify_start(server_ctx_t *ctx);
+void chirouter_server_notify(server_ctx_t *ctx);
 int chirouter_server_ctx_destroy(server_ctx_t *ctx);
+int chirouter_server_process_ethernet_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *msg, size_t len);
+int chirouter_server_handle_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *frame, size_t len);
 
 #endif /* SERVER_H_ */
@@ -0,0 +1,282 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the shared-memory rings used to exchange
+ *  Ethernet frames with a controller that runs on the same host.
+ *
+ *  See shm.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#define _GNU_SOURCE  /* For memfd_create() */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "shm.h"
+
+/* The controller relies on these offsets (see shm.h) */
+_Static_assert(offsetof(chirouter_shm_hdr_t, ring_size) == 8, "Unexpected shared-memory layout");
+_Static_assert(offsetof(chirouter_shm_hdr_t, rings) == 64, "Unexpected shared-memory layout");
+_Static_assert(sizeof(chirouter_shm_ring_t) == 256, "Unexpected shared-memory layout");
+_Static_assert(offsetof(chirouter_shm_ring_t, tail) == 64, "Unexpected shared-memory layout");
+_Static_assert(offsetof(chirouter_shm_ring_t, reader_waiting) == 128, "Unexpected shared-memory layout");
+_Static_assert(offsetof(chirouter_shm_ring_t, writer_waiting) == 192, "Unexpected shared-memory layout");
+_Static_assert(sizeof(chirouter_shm_hdr_t) <= SHM_HDR_SIZE, "Unexpected shared-memory layout");
+
+
+/* See shm.h */
+int chirouter_shm_create(chirouter_shm_t *shm, size_t ring_size)
+{
+    void *map;
+
+    shm->memfd = shm->router_eventfd = shm->controller_eventfd = -1;
+    shm->hdr = NULL;
+    shm->map_size = SHM_HDR_SIZE + 2 * ring_size;
+
+    shm->memfd = memfd_create("chirouter", MFD_CLOEXEC);
+    if (shm->memfd == -1 || ftruncate(shm->memfd, shm->map_size) == -1)
+    {
+        chirouter_shm_destroy(shm);
+        return -1;
+    }
+
+    map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->memfd, 0);
+    if (map == MAP_FAILED)
+    {
+        chirouter_shm_destroy(shm);
+        return -1;
+    }
+    shm->hdr = map;
+
+    shm->router_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->controller_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shm->router_eventfd == -1 || shm->controller_eventfd == -1)
+    {
+        chirouter_shm_destroy(shm);
+        return -1;
+    }
+
+    /* The memfd is zero-filled, so the rings start out empty */
+    shm->hdr->magic = SHM_MAGIC;
+    shm->hdr->version = SHM_VERSION;
+    shm->hdr->ring_size = ring_size;
+    shm->ring_size = ring_size;
+    shm->data[SHM_RING_TO_ROUTER] = (uint8_t *) map + SHM_HDR_SIZE;
+    shm->data[SHM_RING_FROM_ROUTER] = (uint8_t *) map + SHM_HDR_SIZE + ring_size;
+
+    return 0;
+}
+
+
+/* See shm.h */
+void chirouter_shm_destroy(chirouter_shm_t *shm)
+{
+    if (shm->hdr != NULL)
+    {
+        munmap(shm->hdr, shm->map_size);
+    }
+    if (shm->memfd != -1)
+    {
+        close(shm->memfd);
+    }
+    if (shm->router_eventfd != -1)
+    {
+        close(shm->router_eventfd);
+    }
+    if (shm->controller_eventfd != -1)
+    {
+        close(shm->controller_eventfd);
+    }
+    shm->hdr = NULL;
+    shm->memfd = shm->router_eventfd = shm->controller_eventfd = -1;
+}
+
+
+/*
+ * chirouter_shm_wake_controller - Wake up the controller if it is waiting for a ring
+ *
+ * The caller must have just updated the ring (the fence orders that
+ * update before checking the flag, which the controller sets before
+ * checking the ring, see shm.h)
+ *
+ * shm: Shared memory
+ *
+ * flag: Waiting flag of the ring
+ *
+ * Returns: nothing
+ */
+static void chirouter_shm_wake_controller(chirouter_shm_t *shm, _Atomic uint32_t *flag)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(flag, memory_order_relaxed) &&
+        atomic_exchange(flag, 0))
+    {
+        uint64_t one = 1;
+        ssize_t rc = write(shm->controller_eventfd, &one, sizeof(one));
+        (void) rc;
+    }
+}
+
+
+/* See shm.h */
+size_t chirouter_shm_read(chirouter_shm_t *shm, void *buf, size_t len)
+{
+    chirouter_shm_ring_t *ring = &shm->hdr->rings[SHM_RING_TO_ROUTER];
+    uint8_t *data = shm->data[SHM_RING_TO_ROUTER];
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t pos = head & (shm->ring_size - 1);
+    size_t n, first;
+
+    /* A tail further than the whole ring can only be one the controller
+     * is still writing (or a broken controller): there is nothing we
+     * can read yet, and the periodic recheck will try again */
+    n = tail - head;
+    if (n > shm->ring_size)
+    {
+        return 0;
+    }
+    if (n > len)
+    {
+        n = len;
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    first = shm->ring_size - pos < n ? shm->ring_size - pos : n;
+    memcpy(buf, data + pos, first);
+    memcpy((uint8_t *) buf + first, data, n - first);
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+
+    chirouter_shm_wake_controller(shm, &ring->writer_waiting);
+
+    return n;
+}
+
+
+/* See shm.h */
+size_t chirouter_shm_writev(chirouter_shm_t *shm, const struct iovec *iov, int iovcnt)
+{
+    chirouter_shm_ring_t *ring = &shm->hdr->rings[SHM_RING_FROM_ROUTER];
+    uint8_t *data = shm->data[SHM_RING_FROM_ROUTER];
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t room = tail - head <= shm->ring_size ? shm->ring_size - (tail - head) : 0;
+    size_t written = 0;
+
+    if (room == 0)
+    {
+        /* Ask the controller to wake us up once it makes room (it
+         * may have done so before it could see the flag) */
+        atomic_store(&ring->writer_waiting, 1);
+        head = atomic_load(&ring->head);
+        room = tail - head <= shm->ring_size ? shm->ring_size - (tail - head) : 0;
+        if (room == 0)
+        {
+            return 0;
+        }
+        atomic_store_explicit(&ring->writer_waiting, 0, memory_order_relaxed);
+    }
+
+    for (int i = 0; i < iovcnt && room > 0; i++)
+    {
+        const uint8_t *src = iov[i].iov_base;
+        size_t len = iov[i].iov_len < room ? iov[i].iov_len : room;
+
+        while (len > 0)
+        {
+            size_t pos = (tail + written) & (shm->ring_size - 1);
+            size_t n = shm->ring_size - pos < len ? shm->ring_size - pos : len;
+
+            memcpy(data + pos, src, n);
+            src += n;
+            len -= n;
+            room -= n;
+            written += n;
+        }
+    }
+
+    atomic_store_explicit(&ring->tail, tail + written, memory_order_release);
+
+    chirouter_shm_wake_controller(shm, &ring->reader_waiting);
+
+    return written;
+}
+
+
+/* See shm.h */
+bool chirouter_shm_prepare_wait(chirouter_shm_t *shm)
+{
+    chirouter_shm_ring_t *ring = &shm->hdr->rings[SHM_RING_TO_ROUTER];
+
+    atomic_store(&ring->reader_waiting, 1);
+
+    if (atomic_load(&ring->tail) != atomic_load_explicit(&ring->head, memory_order_relaxed))
+    {
+        atomic_store_explicit(&ring->reader_waiting, 0, memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+
+/* See shm.h */
+void chirouter_shm_ack_wakeup(chirouter_shm_t *shm)
+{
+    uint64_t value;
+    ssize_t rc = read(shm->router_eventfd, &value, sizeof(value));
+    (void) rc;
+}
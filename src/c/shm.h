@@ -0,0 +1,243 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the shared-memory rings used to exchange
+ *  Ethernet frames with a controller that runs on the same host.
+ *
+ *  A controller connected over a Unix domain socket can ask (in its
+ *  HELLO message, see server.h) to send and receive the ETHERNET FRAME
+ *  messages through shared memory instead of the socket. chirouter then
+ *  creates a memfd with two rings (one in each direction) and two
+ *  eventfds (one to wake up chirouter, and one to wake up the
+ *  controller), and passes them to the controller over the socket.
+ *  Messages then go from one process to the other with a single copy
+ *  into (and out of) the ring, without any system calls, as long as
+ *  neither of them has to wait for the other.
+ *
+ *  Each ring is a single-producer/single-consumer byte ring, which
+ *  carries a stream of messages in the same format as the socket (so
+ *  a message can wrap around the end of the ring). The memfd starts
+ *  with a header (see chirouter_shm_hdr_t) followed by the data of the
+ *  rings, and the controller must access it with the offsets given
+ *  below (all integers are in host order):
+ *
+ *    Offset             Size  Field
+ *    0                  4     Magic number (SHM_MAGIC)
+ *    4                  4     Version (SHM_VERSION)
+ *    8                  8     Size of each ring (a power of two)
+ *    64 + 256*r         8     Ring r: bytes read by the consumer (head)
+ *    64 + 256*r + 64    8     Ring r: bytes written by the producer (tail)
+ *    64 + 256*r + 128   4     Ring r: the consumer is waiting for data
+ *    64 + 256*r + 192   4     Ring r: the producer is waiting for room
+ *    SHM_HDR_SIZE       size  Data of ring 0 (to chirouter)
+ *    SHM_HDR_SIZE+size  size  Data of ring 1 (to the controller)
+ *
+ *  The head and tail only ever grow (the position of a byte in the
+ *  ring is its offset in the stream modulo the size of the ring). The
+ *  producer of a ring only writes its tail, and the consumer its head.
+ *
+ *  Before waiting on its eventfd, each side sets the waiting flag of
+ *  the ring it waits for, and checks the ring once more. After updating
+ *  a ring, each side checks whether the other side is waiting for it
+ *  and, if it is, clears the flag and writes to the other side's
+ *  eventfd. The controller might not be able to order its accesses to
+ *  the shared memory (e.g., a controller written in Python), so a
+ *  wake-up can still be missed: neither side should wait for longer
+ *  than a few milliseconds without checking the rings.
+ *
+ *  The controller must still never let chirouter see a partially
+ *  written head or tail, or a tail before the data it covers. The
+ *  Python controller (client.py) relies on x86-64 for both, and does
+ *  not ask for shared memory on other architectures.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Magic number and version of the shared-memory layout */
+#define SHM_MAGIC (0x43485348u)
+#define SHM_VERSION (1u)
+
+/* Size of the header at the start of the shared memory */
+#define SHM_HDR_SIZE (4096u)
+
+/* Rings */
+#define SHM_RING_TO_ROUTER (0)
+#define SHM_RING_FROM_ROUTER (1)
+
+/* The control fields of a ring, each in its own cache line */
+typedef struct chirouter_shm_ring
+{
+    alignas(64) _Atomic uint64_t head;
+    alignas(64) _Atomic uint64_t tail;
+    alignas(64) _Atomic uint32_t reader_waiting;
+    alignas(64) _Atomic uint32_t writer_waiting;
+} chirouter_shm_ring_t;
+
+/* The header at the start of the shared memory */
+typedef struct chirouter_shm_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    chirouter_shm_ring_t rings[2];
+} chirouter_shm_hdr_t;
+
+/* Shared memory for a controller (chirouter's side) */
+typedef struct chirouter_shm
+{
+    /* memfd, and where it is mapped */
+    int memfd;
+    chirouter_shm_hdr_t *hdr;
+    size_t map_size;
+
+    /* Data of each ring, and size of the rings */
+    uint8_t *data[2];
+    uint64_t ring_size;
+
+    /* eventfds used to wake up chirouter and the controller */
+    int router_eventfd;
+    int controller_eventfd;
+} chirouter_shm_t;
+
+
+/*
+ * chirouter_shm_create - Create the shared memory for a controller
+ *
+ * shm: Shared memory
+ *
+ * ring_size: Size of each ring (must be a power of two)
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ */
+int chirouter_shm_create(chirouter_shm_t *shm, size_t ring_size);
+
+
+/*
+ * chirouter_shm_destroy - Free the shared memory for a controller
+ *
+ * The controller can keep using its mapping of the memory.
+ *
+ * shm: Shared memory
+ *
+ * Returns: nothing
+ */
+void chirouter_shm_destroy(chirouter_shm_t *shm);
+
+
+/*
+ * chirouter_shm_read - Read from the ring to chirouter
+ *
+ * Wakes up the controller if it is waiting for room in the ring.
+ *
+ * shm: Shared memory
+ *
+ * buf: Buffer to read into
+ *
+ * len: Maximum number of bytes to read
+ *
+ * Returns: number of bytes read (0 if the ring is empty)
+ */
+size_t chirouter_shm_read(chirouter_shm_t *shm, void *buf, size_t len);
+
+
+/*
+ * chirouter_shm_writev - Write to the ring to the controller
+ *
+ * Writes as much of the buffers as fits in the ring, and wakes up the
+ * controller if it is waiting for data. If nothing fits, chirouter's
+ * eventfd is written to once the controller makes room.
+ *
+ * shm: Shared memory
+ *
+ * iov: Array of buffers
+ *
+ * iovcnt: Number of buffers
+ *
+ * Returns: number of bytes written (0 if the ring is full)
+ */
+size_t chirouter_shm_writev(chirouter_shm_t *shm, const struct iovec *iov, int iovcnt);
+
+
+/*
+ * chirouter_shm_prepare_wait - Tell the controller chirouter is about to wait
+ *
+ * Must be called before waiting on chirouter's eventfd for data
+ * in the ring to chirouter.
+ *
+ * shm: Shared memory
+ *
+ * Returns: true if chirouter can wait, false if the ring already
+ *          has data in it.
+ */
+bool chirouter_shm_prepare_wait(chirouter_shm_t *shm);
+
+
+/*
+ * chirouter_shm_ack_wakeup - Acknowledge a wake-up
+ *
+ * Must be called when chirouter's eventfd becomes readable,
+ * before reading from the ring.
+ *
+ * shm: Shared memory
+ *
+ * Returns: nothing
+ */
+void chirouter_shm_ack_wakeup(chirouter_shm_t *shm);
+
+#endif
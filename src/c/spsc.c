@@ -0,0 +1,147 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a single-producer/single-consumer ring.
+ *
+ *  See spsc.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "spsc.h"
+#include "alloc.h"
+
+/*
+ * head and tail only ever increase (the slot at position pos is slot
+ * pos % num_slots), so the ring holds head - tail slots, and it is
+ * full when head - tail == num_slots.
+ */
+
+
+/* See spsc.h */
+int chirouter_spsc_init(chirouter_spsc_t *ring, size_t num_slots, size_t slot_size)
+{
+    slot_size = (slot_size + SPSC_CACHE_LINE - 1) & ~((size_t) SPSC_CACHE_LINE - 1);
+
+    ring->slots = chirouter_aligned_calloc(SPSC_CACHE_LINE, num_slots, slot_size);
+    if (ring->slots == NULL)
+    {
+        return -1;
+    }
+
+    ring->num_slots = num_slots;
+    ring->slot_size = slot_size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->tail_cache = 0;
+    ring->head_cache = 0;
+
+    return 0;
+}
+
+
+/* See spsc.h */
+void chirouter_spsc_destroy(chirouter_spsc_t *ring)
+{
+    chirouter_free(ring->slots);
+    ring->slots = NULL;
+}
+
+
+/* See spsc.h */
+void *chirouter_spsc_reserve(chirouter_spsc_t *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head - ring->tail_cache == ring->num_slots)
+    {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->tail_cache == ring->num_slots)
+        {
+            return NULL;
+        }
+    }
+
+    return ring->slots + (head & (ring->num_slots - 1)) * ring->slot_size;
+}
+
+
+/* See spsc.h */
+void chirouter_spsc_commit(chirouter_spsc_t *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+/* See spsc.h */
+void *chirouter_spsc_peek(chirouter_spsc_t *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail == ring->head_cache)
+    {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->head_cache)
+        {
+            return NULL;
+        }
+    }
+
+    return ring->slots + (tail & (ring->num_slots - 1)) * ring->slot_size;
+}
+
+
+/* See spsc.h */
+void chirouter_spsc_release(chirouter_spsc_t *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
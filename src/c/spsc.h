@@ -0,0 +1,165 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a bounded, lock-free, single-producer/single-
+ *  consumer ring of fixed-size slots, used to hand work from one thread
+ *  to another (e.g., Ethernet frames from the server thread to a worker
+ *  thread, see worker.h).
+ *
+ *  The producer and the consumer each own a cache line with their own
+ *  position in the ring, and keep a copy of the other side's position,
+ *  so they only touch each other's cache line when the ring looks full
+ *  (to the producer) or empty (to the consumer).
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+/* Size of a cache line (positions that are written by different
+ * threads are kept on different cache lines) */
+#define SPSC_CACHE_LINE (64u)
+
+/* A ring */
+typedef struct chirouter_spsc
+{
+    /* Position of the next slot to be filled (written by the producer),
+     * and the producer's copy of tail */
+    alignas(SPSC_CACHE_LINE) atomic_size_t head;
+    size_t tail_cache;
+
+    /* Position of the next slot to be read (written by the consumer),
+     * and the consumer's copy of head */
+    alignas(SPSC_CACHE_LINE) atomic_size_t tail;
+    size_t head_cache;
+
+    /* Slots (num_slots of them, each slot_size bytes long).
+     * These fields don't change once the ring is initialized. */
+    alignas(SPSC_CACHE_LINE) uint8_t *slots;
+    size_t num_slots;
+    size_t slot_size;
+} chirouter_spsc_t;
+
+
+/*
+ * chirouter_spsc_init - Initialize a ring
+ *
+ * ring: Ring
+ *
+ * num_slots: Number of slots (must be a power of two)
+ *
+ * slot_size: Size of each slot (rounded up to a whole number of
+ *            cache lines, so that slots don't share cache lines)
+ *
+ * Returns: 0 on success, -1 if the ring could not be allocated
+ */
+int chirouter_spsc_init(chirouter_spsc_t *ring, size_t num_slots, size_t slot_size);
+
+
+/*
+ * chirouter_spsc_destroy - Free a ring
+ *
+ * ring: Ring
+ *
+ * Returns: nothing
+ */
+void chirouter_spsc_destroy(chirouter_spsc_t *ring);
+
+
+/*
+ * chirouter_spsc_reserve - Get a free slot (producer side)
+ *
+ * The slot is not visible to the consumer until it is committed
+ * (see chirouter_spsc_commit). Calling this function again before
+ * committing the slot returns the same slot.
+ *
+ * ring: Ring
+ *
+ * Returns: pointer to the slot, or NULL if the ring is full
+ */
+void *chirouter_spsc_reserve(chirouter_spsc_t *ring);
+
+
+/*
+ * chirouter_spsc_commit - Hand the reserved slot over to the consumer (producer side)
+ *
+ * ring: Ring
+ *
+ * Returns: nothing
+ */
+void chirouter_spsc_commit(chirouter_spsc_t *ring);
+
+
+/*
+ * chirouter_spsc_peek - Get the oldest slot in a ring (consumer side)
+ *
+ * The slot remains valid until it is released (see chirouter_spsc_release)
+ *
+ * ring: Ring
+ *
+ * Returns: pointer to the slot, or NULL if the ring is empty
+ */
+void *chirouter_spsc_peek(chirouter_spsc_t *ring);
+
+
+/*
+ * chirouter_spsc_release - Give the oldest slot back to the producer (consumer side)
+ *
+ * ring: Ring
+ *
+ * Returns: nothing
+ */
+void chirouter_spsc_release(chirouter_spsc_t *ring);
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the TAP devices used to send and receive
+ *  Ethernet frames.
+ *
+ *  See tap.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+#include "tap.h"
+#include "alloc.h"
+
+
+/*
+ * chirouter_tap_up - Bring a Linux interface up
+ *
+ * ifname: Name of the interface
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+static int chirouter_tap_up(const char *ifname)
+{
+    struct ifreq ifr;
+    int fd, rc = -1;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == 0)
+    {
+        ifr.ifr_flags |= IFF_UP;
+        rc = ioctl(fd, SIOCSIFFLAGS, &ifr);
+    }
+
+    close(fd);
+
+    return rc;
+}
+
+
+/* See tap.h */
+int chirouter_tap_open(chirouter_tap_t *tap, const char *ifname)
+{
+    struct ifreq ifr;
+
+    tap->tx_drops = 0;
+    tap->rx_truncated = 0;
+
+    tap->rx_bufs = chirouter_calloc(TAP_RX_BATCH, TAP_FRAME_SIZE);
+    tap->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (tap->rx_bufs == NULL || tap->fd == -1)
+        return -1;
+
+    /* Without IFF_NO_PI, each frame would come after a 4-byte header
+     * (and the kernel computes the checksums the host leaves to the
+     * interface, since we don't ask for offloads with TUNSETOFFLOAD) */
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(tap->fd, TUNSETIFF, &ifr) == -1)
+        return -1;
+
+    return chirouter_tap_up(ifname);
+}
+
+
+/* See tap.h */
+void chirouter_tap_close(chirouter_tap_t *tap)
+{
+    if (tap->fd != -1)
+    {
+        close(tap->fd);
+        tap->fd = -1;
+    }
+    chirouter_free(tap->rx_bufs);
+    tap->rx_bufs = NULL;
+}
+
+
+/* See tap.h */
+int chirouter_tap_recv(chirouter_tap_t *tap, chirouter_packet_handler_t handler, void *arg)
+{
+    size_t lens[TAP_RX_BATCH];
+    unsigned int nframes = 0;
+
+    while (nframes < TAP_RX_BATCH)
+    {
+        ssize_t n = read(tap->fd, tap->rx_bufs + (size_t) nframes * TAP_FRAME_SIZE, TAP_FRAME_SIZE);
+
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                break;
+            return -1;
+        }
+
+        /* The kernel returns the length of the whole frame,
+         * even if it doesn't fit in the buffer */
+        if (n > TAP_FRAME_SIZE)
+        {
+            tap->rx_truncated++;
+            continue;
+        }
+
+        lens[nframes++] = n;
+    }
+
+    for (unsigned int i = 0; i < nframes; i++)
+    {
+        if (handler(arg, tap->rx_bufs + (size_t) i * TAP_FRAME_SIZE, lens[i]) == -1)
+            return -1;
+    }
+
+    return nframes;
+}
+
+
+/* See tap.h */
+int chirouter_tap_send(chirouter_tap_t *tap, const uint8_t *frame, size_t len)
+{
+    /* Writing a frame hands it to the host's network stack right away,
+     * and only fails if the frame can't be queued (or if the device is
+     * down), so the frame is lost either way */
+    if (write(tap->fd, frame, len) == -1)
+    {
+        __atomic_add_fetch(&tap->tx_drops, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
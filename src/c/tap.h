@@ -0,0 +1,162 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the TAP devices used to send and receive
+ *  Ethernet frames, when chirouter routes Linux interfaces itself (see
+ *  dataplane.h), as an alternative to binding to existing interfaces
+ *  with AF_PACKET or AF_XDP sockets.
+ *
+ *  A TAP device is a Linux interface whose "wire" is a file descriptor:
+ *  the frames the host sends on the interface are read from it, and
+ *  the frames written to it are received by the host on the interface.
+ *  So, each router interface gets its own TAP device (which is created
+ *  if it doesn't exist, and is removed when chirouter exits, unless it
+ *  was made persistent with "ip tuntap add"), and the host (or a network
+ *  namespace the device is moved to) uses it as if it were connected
+ *  to the router with a cable. No controller, and no veth pairs, are
+ *  needed.
+ *
+ *  Each read() or write() on a TAP device transfers exactly one frame,
+ *  so frames can't be batched into fewer system calls. Instead, the frames
+ *  that are ready are read into a set of buffers (up to TAP_RX_BATCH at a
+ *  time), and then processed in place, straight from the buffers. Frames
+ *  are written right away, also without copying them.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef TAP_H
+#define TAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+
+/* Number of frames read from a TAP device before processing them,
+ * and size of the buffer each frame is read into */
+#define TAP_RX_BATCH (64u)
+#define TAP_FRAME_SIZE (2048u)
+
+/* A TAP device */
+typedef struct chirouter_tap
+{
+    /* File descriptor (the TAP device exists as long as it is open) */
+    int fd;
+
+    /* Buffers the frames are read into (TAP_RX_BATCH buffers
+     * of TAP_FRAME_SIZE bytes each) */
+    uint8_t *rx_bufs;
+
+    /* Statistics: frames dropped because the device's queue was full,
+     * and frames received truncated (and dropped). The ARP threads
+     * also write frames, so tx_drops is updated atomically. */
+    uint64_t tx_drops;
+    uint64_t rx_truncated;
+} chirouter_tap_t;
+
+
+/*
+ * chirouter_tap_open - Open (or create) a TAP device
+ *
+ * The device is brought up, since the host can't use it otherwise.
+ *
+ * tap: TAP device
+ *
+ * ifname: Name of the TAP device
+ *
+ * Returns: 0 on success, -1 if an error happens (the device must
+ *          still be freed with chirouter_tap_close)
+ */
+int chirouter_tap_open(chirouter_tap_t *tap, const char *ifname);
+
+
+/*
+ * chirouter_tap_close - Close a TAP device
+ *
+ * tap: TAP device
+ *
+ * Returns: nothing
+ */
+void chirouter_tap_close(chirouter_tap_t *tap);
+
+
+/*
+ * chirouter_tap_recv - Process the frames received on a TAP device
+ *
+ * Reads up to TAP_RX_BATCH frames, and then processes them one at a
+ * time (any other frames are left for the next call).
+ *
+ * tap: TAP device
+ *
+ * handler: Function called for each frame
+ *
+ * arg: Argument passed to the handler
+ *
+ * Returns: number of frames processed, or -1 if the handler returned
+ *          -1 or if the frames could not be read
+ */
+int chirouter_tap_recv(chirouter_tap_t *tap, chirouter_packet_handler_t handler, void *arg);
+
+
+/*
+ * chirouter_tap_send - Send a frame on a TAP device
+ *
+ * If the device's queue is full, the frame is dropped.
+ *
+ * tap: TAP device
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame
+ *
+ * Returns: 0 on success, 1 if the frame was dropped
+ */
+int chirouter_tap_send(chirouter_tap_t *tap, const uint8_t *frame, size_t len);
+
+#endif
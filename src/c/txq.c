@@ -0,0 +1,499 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the transmit queue used to batch the messages
+ *  sent to the controller.
+ *
+ *  See txq.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "chirouter.h"
+#include "txq.h"
+#include "alloc.h"
+#include "log.h"
+
+
+/* See txq.h */
+int chirouter_txq_init(chirouter_txq_t *txq)
+{
+    memset(txq, 0, sizeof(chirouter_txq_t));
+
+    txq->staging = chirouter_calloc(TXQ_STAGING_SIZE, 1);
+    if (txq->staging == NULL)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/* See txq.h */
+int chirouter_txq_set_backlog_size(chirouter_txq_t *txq, size_t size)
+{
+    uint8_t *backlog = chirouter_calloc(size, 1);
+
+    if (backlog == NULL)
+    {
+        return -1;
+    }
+
+    chirouter_free(txq->backlog);
+    txq->backlog = backlog;
+    txq->backlog_size = size;
+    txq->backlog_head = txq->backlog_tail = 0;
+
+    return 0;
+}
+
+
+/* See txq.h */
+void chirouter_txq_set_async(chirouter_txq_t *txq, int (*wait)(void *arg), void *arg)
+{
+    txq->wait = wait;
+    txq->wait_arg = arg;
+}
+
+
+/* See txq.h */
+void chirouter_txq_set_sink(chirouter_txq_t *txq, size_t (*sink)(void *arg, const struct iovec *iov, int iovcnt),
+                            int (*wait)(void *arg), void *arg)
+{
+    txq->sink = sink;
+    txq->sink_wait = wait;
+    txq->sink_arg = arg;
+}
+
+
+/* See txq.h */
+size_t chirouter_txq_backlog_claim(chirouter_txq_t *txq, void **data)
+{
+    if (txq->backlog_busy > 0)
+    {
+        return 0;
+    }
+
+    *data = txq->backlog + txq->backlog_head;
+    txq->backlog_busy = txq->backlog_tail - txq->backlog_head;
+    if (txq->max_write > 0 && txq->backlog_busy > txq->max_write)
+    {
+        txq->backlog_busy = txq->max_write;
+    }
+
+    return txq->backlog_busy;
+}
+
+
+/* See txq.h */
+void chirouter_txq_backlog_sent(chirouter_txq_t *txq, size_t sent)
+{
+    txq->backlog_busy = 0;
+    txq->backlog_head += sent;
+    txq->writes++;
+    txq->bytes_sent += sent;
+
+    if (txq->backlog_head == txq->backlog_tail)
+    {
+        txq->backlog_head = txq->backlog_tail = 0;
+    }
+}
+
+
+/* See txq.h */
+void chirouter_txq_destroy(chirouter_txq_t *txq)
+{
+    chirouter_free(txq->staging);
+    chirouter_free(txq->backlog);
+    txq->staging = NULL;
+    txq->backlog = NULL;
+    txq->iovcnt = 0;
+    txq->bytes = 0;
+    txq->staging_used = 0;
+    txq->backlog_size = 0;
+    txq->backlog_head = txq->backlog_tail = 0;
+}
+
+
+/*
+ * chirouter_txq_sendmsg - Send as many bytes as possible without blocking
+ *
+ * Never sends more than the queue's max_write bytes. If the queue
+ * has a sink, sends to the sink instead of the socket.
+ *
+ * txq: Transmit queue (only used to update the statistics)
+ *
+ * fd: Socket
+ *
+ * iov: Array of buffers
+ *
+ * iovcnt: Number of buffers
+ *
+ * Returns: number of bytes sent (0 if the socket's send buffer is full),
+ *          or -1 if an error happens.
+ */
+static ssize_t chirouter_txq_sendmsg(chirouter_txq_t *txq, int fd, struct iovec *iov, int iovcnt)
+{
+    struct msghdr mh;
+    ssize_t sent;
+    size_t total = 0, last_len = 0;
+    int n = iovcnt;
+
+    /* Only send the buffers that fit in max_write (the last
+     * of them is shortened, and restored afterwards) */
+    if (txq->max_write > 0)
+    {
+        for (n = 0; n < iovcnt && total + iov[n].iov_len <= txq->max_write; n++)
+        {
+            total += iov[n].iov_len;
+        }
+        if (n < iovcnt && total < txq->max_write)
+        {
+            last_len = iov[n].iov_len;
+            iov[n].iov_len = txq->max_write - total;
+            n++;
+        }
+    }
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = n;
+
+    if (txq->sink != NULL)
+    {
+        sent = txq->sink(txq->sink_arg, iov, n);
+    }
+    else
+    {
+        do
+        {
+            sent = sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } while (sent == -1 && errno == EINTR);
+    }
+
+    if (last_len > 0)
+    {
+        iov[n - 1].iov_len = last_len;
+    }
+
+    if (sent == -1)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    txq->writes++;
+    txq->bytes_sent += sent;
+
+    return sent;
+}
+
+
+/*
+ * chirouter_txq_backlog_append - Copy data to the end of the backlog
+ *
+ * If the backlog is full, waits until the socket has accepted
+ * enough of the backlog to make room for the data (in asynchronous
+ * mode, the queue's wait function does the waiting).
+ *
+ * txq: Transmit queue
+ *
+ * fd: Socket the backlog is sent on
+ *
+ * buf: Data
+ *
+ * len: Length of the data
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ */
+static int chirouter_txq_backlog_append(chirouter_txq_t *txq, int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0)
+    {
+        size_t room;
+
+        if (txq->backlog_head == txq->backlog_tail)
+        {
+            txq->backlog_head = txq->backlog_tail = 0;
+        }
+        else if (txq->backlog_size - txq->backlog_tail < len && txq->backlog_head > 0 &&
+                 txq->backlog_busy == 0)
+        {
+            /* Move the unsent data to the front to make room */
+            memmove(txq->backlog, txq->backlog + txq->backlog_head, txq->backlog_tail - txq->backlog_head);
+            txq->backlog_tail -= txq->backlog_head;
+            txq->backlog_head = 0;
+        }
+
+        room = txq->backlog_size - txq->backlog_tail;
+        if (room == 0 && txq->wait != NULL)
+        {
+            txq->stalls++;
+            if (txq->wait(txq->wait_arg) == -1)
+            {
+                return -1;
+            }
+            continue;
+        }
+        else if (room == 0)
+        {
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+            /* The backlog is full: the only thing we can
+             * do is wait for the socket (or sink) to drain it */
+            txq->stalls++;
+            if (txq->sink_wait != NULL && txq->sink_wait(txq->sink_arg) == -1)
+            {
+                return -1;
+            }
+            else if (txq->sink_wait == NULL && poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            {
+                return -1;
+            }
+            if (chirouter_txq_write_backlog(txq, fd) == -1)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        if (room > len)
+        {
+            room = len;
+        }
+
+        memcpy(txq->backlog + txq->backlog_tail, buf, room);
+        txq->backlog_tail += room;
+        buf += room;
+        len -= room;
+
+        if (txq->backlog_tail - txq->backlog_head > txq->backlog_peak)
+        {
+            txq->backlog_peak = txq->backlog_tail - txq->backlog_head;
+        }
+    }
+
+    return 0;
+}
+
+
+/* See txq.h */
+int chirouter_txq_add(chirouter_txq_t *txq, int fd, const void *buf, size_t len, bool copy)
+{
+    if (txq->iovcnt == TXQ_MAX_IOV ||
+        (copy && txq->staging_used + len > TXQ_STAGING_SIZE))
+    {
+        if (chirouter_txq_flush(txq, fd) == -1)
+        {
+            return -1;
+        }
+    }
+
+    /* Buffers larger than the staging area are sent right away */
+    if (copy && len > TXQ_STAGING_SIZE)
+    {
+        txq->iov[0].iov_base = (void *) buf;
+        txq->iov[0].iov_len = len;
+        txq->iovcnt = 1;
+        txq->bytes = len;
+
+        return chirouter_txq_flush(txq, fd);
+    }
+
+    if (copy)
+    {
+        uint8_t *staged = txq->staging + txq->staging_used;
+
+        memcpy(staged, buf, len);
+        txq->staging_used += len;
+
+        /* Coalesce with the previous buffer if it was
+         * staged right before this one */
+        struct iovec *last = txq->iovcnt > 0 ? &txq->iov[txq->iovcnt - 1] : NULL;
+        if (last != NULL && (uint8_t *) last->iov_base + last->iov_len == staged)
+        {
+            last->iov_len += len;
+            txq->bytes += len;
+            return 0;
+        }
+
+        buf = staged;
+    }
+
+    txq->iov[txq->iovcnt].iov_base = (void *) buf;
+    txq->iov[txq->iovcnt].iov_len = len;
+    txq->iovcnt++;
+    txq->bytes += len;
+
+    return 0;
+}
+
+
+/* See txq.h */
+void *chirouter_txq_stage(chirouter_txq_t *txq, int fd, const void *buf, size_t len)
+{
+    if (chirouter_txq_add(txq, fd, buf, len, true) == -1)
+    {
+        return NULL;
+    }
+
+    /* Whether or not the queue was flushed, the buffer
+     * was the last thing copied into the staging area */
+    return txq->staging + txq->staging_used - len;
+}
+
+
+/* See txq.h */
+int chirouter_txq_flush(chirouter_txq_t *txq, int fd)
+{
+    unsigned int i = 0;
+    ssize_t sent = 0;
+    int rc = 0;
+
+    if (txq->iovcnt == 0)
+    {
+        return chirouter_txq_write_backlog(txq, fd);
+    }
+
+    /* Only send the queue directly if there is nothing in the
+     * backlog, since the backlog has to be sent first */
+    if (txq->backlog_head == txq->backlog_tail && txq->wait == NULL)
+    {
+        sent = chirouter_txq_sendmsg(txq, fd, txq->iov, txq->iovcnt);
+        if (sent == -1)
+        {
+            rc = -1;
+        }
+    }
+
+    if (rc == 0)
+    {
+        txq->bufs_sent += txq->iovcnt;
+
+        /* Skip over whatever was sent, and copy the rest into the backlog */
+        while (i < txq->iovcnt && (size_t) sent >= txq->iov[i].iov_len)
+        {
+            sent -= txq->iov[i].iov_len;
+            i++;
+        }
+        for (; i < txq->iovcnt && rc == 0; i++)
+        {
+            rc = chirouter_txq_backlog_append(txq, fd, (uint8_t *) txq->iov[i].iov_base + sent,
+                                              txq->iov[i].iov_len - sent);
+            sent = 0;
+        }
+
+        if (rc == 0)
+        {
+            rc = chirouter_txq_write_backlog(txq, fd);
+        }
+    }
+
+    txq->iovcnt = 0;
+    txq->bytes = 0;
+    txq->staging_used = 0;
+    txq->generation++;
+
+    return rc;
+}
+
+
+/* See txq.h */
+int chirouter_txq_write_backlog(chirouter_txq_t *txq, int fd)
+{
+    if (txq->wait != NULL)
+    {
+        return 0;
+    }
+
+    while (txq->backlog_head < txq->backlog_tail)
+    {
+        struct iovec iov;
+        ssize_t sent;
+
+        iov.iov_base = txq->backlog + txq->backlog_head;
+        iov.iov_len = txq->backlog_tail - txq->backlog_head;
+
+        sent = chirouter_txq_sendmsg(txq, fd, &iov, 1);
+        if (sent == -1)
+        {
+            return -1;
+        }
+        else if (sent == 0)
+        {
+            break;
+        }
+
+        txq->backlog_head += sent;
+    }
+
+    if (txq->backlog_head == txq->backlog_tail)
+    {
+        txq->backlog_head = txq->backlog_tail = 0;
+    }
+
+    return 0;
+}
+
+
+/* See txq.h */
+size_t chirouter_txq_backlog(chirouter_txq_t *txq)
+{
+    return txq->backlog_tail - txq->backlog_head;
+}
+
+
+/* See txq.h */
+void chirouter_txq_discard_backlog(chirouter_txq_t *txq)
+{
+    txq->backlog_head = txq->backlog_tail = 0;
+}
@@ -0,0 +1,364 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the transmit queue used to batch the messages
+ *  sent to the controller.
+ *
+ *  Instead of sending each message with its own system call, messages
+ *  are added to a transmit queue as a list of buffers (an iovec array),
+ *  and the whole queue is sent with a single sendmsg() call when it is
+ *  flushed. A buffer that will remain valid until the queue is flushed
+ *  (e.g., a frame that is being forwarded straight out of the server's
+ *  receive buffer) is added by reference. Any other buffer is copied into
+ *  the queue's staging area.
+ *
+ *  Flushing a queue never blocks: whatever the socket does not accept
+ *  right away is copied into the queue's backlog, a bounded buffer that
+ *  is sent once the socket becomes writable again. Once the backlog is
+ *  not empty, all flushed data goes through it, so that the data is
+ *  still sent in order. The size of the backlog (which can be checked
+ *  with chirouter_txq_backlog) is what the server uses to apply
+ *  backpressure to the controller.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef TXQ_H
+#define TXQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+/* Maximum number of buffers in a transmit queue (must
+ * not be larger than IOV_MAX, which is usually 1024) */
+#define TXQ_MAX_IOV (512u)
+
+/* Size of the staging area of a transmit queue */
+#define TXQ_STAGING_SIZE (256u * 1024u)
+
+/* A transmit queue */
+typedef struct chirouter_txq
+{
+    /* Queued buffers */
+    struct iovec iov[TXQ_MAX_IOV];
+    unsigned int iovcnt;
+
+    /* Number of bytes queued */
+    size_t bytes;
+
+    /* Number of times the queue has been flushed (a buffer returned
+     * by chirouter_txq_stage can only be modified until then) */
+    uint64_t generation;
+
+    /* Staging area for buffers that have to be copied
+     * (of size TXQ_STAGING_SIZE) */
+    uint8_t *staging;
+    size_t staging_used;
+
+    /* Data that has been flushed but that the socket has not
+     * accepted yet: [backlog_head, backlog_tail) holds the bytes
+     * that still have to be sent (of size backlog_size) */
+    uint8_t *backlog;
+    size_t backlog_size;
+    size_t backlog_head;
+    size_t backlog_tail;
+
+    /* Statistics: number of buffers and bytes sent, and
+     * number of system calls used to send them */
+    uint64_t bufs_sent;
+    uint64_t bytes_sent;
+    uint64_t writes;
+
+    /* Statistics: largest size the backlog has reached, and number
+     * of times we had to wait for the socket because the backlog
+     * was full */
+    uint64_t backlog_peak;
+    uint64_t stalls;
+
+    /* Maximum number of bytes sent with a single system call (0 if
+     * there is no maximum). Needed on sockets that send each write as a
+     * single datagram, which can't be larger than the send buffer. */
+    size_t max_write;
+
+    /* Asynchronous mode only (see chirouter_txq_set_async): function
+     * called to wait for the backlog to drain, and the number of bytes
+     * at the start of the backlog that are being sent (which cannot
+     * be moved until they have been sent) */
+    int (*wait)(void *arg);
+    void *wait_arg;
+    size_t backlog_busy;
+
+    /* Function the queue sends its data with instead of a socket (NULL
+     * if it sends on a socket), the function called to wait for it to
+     * accept more data when the backlog is full, and their argument
+     * (see chirouter_txq_set_sink) */
+    size_t (*sink)(void *arg, const struct iovec *iov, int iovcnt);
+    int (*sink_wait)(void *arg);
+    void *sink_arg;
+} chirouter_txq_t;
+
+
+/*
+ * chirouter_txq_init - Initialize a transmit queue
+ *
+ * txq: Transmit queue
+ *
+ * Returns: 0 on success, 1 if the staging area could not be allocated
+ */
+int chirouter_txq_init(chirouter_txq_t *txq);
+
+
+/*
+ * chirouter_txq_set_backlog_size - Allocate the backlog of a transmit queue
+ *
+ * txq: Transmit queue (with an empty backlog)
+ *
+ * size: Size of the backlog in bytes
+ *
+ * Returns: 0 on success, -1 if the backlog could not be allocated
+ */
+int chirouter_txq_set_backlog_size(chirouter_txq_t *txq, size_t size);
+
+
+/*
+ * chirouter_txq_set_async - Put a transmit queue in asynchronous mode
+ *
+ * In asynchronous mode, the queue never writes to the socket itself:
+ * flushing the queue only copies the queued data into the backlog, and
+ * whoever owns the queue sends the backlog (e.g., with io_uring), using
+ * chirouter_txq_backlog_claim and chirouter_txq_backlog_sent. If the
+ * backlog does not have room for the data, the queue calls the given
+ * function, which must wait until some of the backlog has been sent.
+ *
+ * txq: Transmit queue
+ *
+ * wait: Function called to wait for the backlog to drain (it
+ *       must return 0 on success, and -1 if an error happens)
+ *
+ * arg: Argument passed to the function
+ *
+ * Returns: nothing
+ */
+void chirouter_txq_set_async(chirouter_txq_t *txq, int (*wait)(void *arg), void *arg);
+
+
+/*
+ * chirouter_txq_set_sink - Send the data in a transmit queue with a function, instead of on a socket
+ *
+ * The function is called wherever the queue would otherwise send on
+ * the socket (the fd passed to the other functions is ignored), and
+ * behaves like a non-blocking socket: it accepts as much of the data
+ * as it can (possibly none of it). Everything else works just like on
+ * a socket, so whoever owns the queue has to write the backlog once the
+ * function can accept more data.
+ *
+ * txq: Transmit queue
+ *
+ * sink: Function that sends the data, which returns how many bytes
+ *       it sent (0 if it can't send anything right now)
+ *
+ * wait: Function called to wait until the sink can accept more data,
+ *       when the backlog is full (it must return 0 on success, and -1
+ *       if an error happens)
+ *
+ * arg: Argument passed to both functions
+ *
+ * Returns: nothing
+ */
+void chirouter_txq_set_sink(chirouter_txq_t *txq, size_t (*sink)(void *arg, const struct iovec *iov, int iovcnt),
+                            int (*wait)(void *arg), void *arg);
+
+
+/*
+ * chirouter_txq_backlog_claim - Claim the backlog of a transmit queue to send it
+ *
+ * Asynchronous mode only. The claimed data stays where it is until
+ * it is released with chirouter_txq_backlog_sent.
+ *
+ * txq: Transmit queue
+ *
+ * data: Set to the start of the claimed data
+ *
+ * Returns: number of bytes claimed (0 if the backlog is empty, or if
+ *          part of it is still claimed). No more than max_write bytes
+ *          are claimed at once.
+ */
+size_t chirouter_txq_backlog_claim(chirouter_txq_t *txq, void **data);
+
+
+/*
+ * chirouter_txq_backlog_sent - Release the claimed backlog of a transmit queue
+ *
+ * Asynchronous mode only.
+ *
+ * txq: Transmit queue
+ *
+ * sent: How many of the claimed bytes have been sent (the rest
+ *       can be claimed again)
+ *
+ * Returns: nothing
+ */
+void chirouter_txq_backlog_sent(chirouter_txq_t *txq, size_t sent);
+
+
+/*
+ * chirouter_txq_destroy - Free a transmit queue
+ *
+ * Any queued data is discarded.
+ *
+ * txq: Transmit queue
+ *
+ * Returns: nothing
+ */
+void chirouter_txq_destroy(chirouter_txq_t *txq);
+
+
+/*
+ * chirouter_txq_add - Add a buffer to a transmit queue
+ *
+ * If the queue does not have room for the buffer, it is
+ * flushed first.
+ *
+ * txq: Transmit queue
+ *
+ * fd: Socket the queue is sent on (used if the queue has to be flushed)
+ *
+ * buf: Buffer
+ *
+ * len: Length of the buffer
+ *
+ * copy: If true, the buffer is copied into the queue's staging area.
+ *       If false, the buffer is added by reference, and must remain
+ *       valid (and unmodified) until the queue is flushed.
+ *
+ * Returns: 0 on success, -1 if the queue had to be flushed and
+ *          the flush failed.
+ */
+int chirouter_txq_add(chirouter_txq_t *txq, int fd, const void *buf, size_t len, bool copy);
+
+
+/*
+ * chirouter_txq_stage - Copy a buffer into a transmit queue, and get the copy
+ *
+ * Same as chirouter_txq_add with copy set to true, but the caller can
+ * keep modifying the copy until the queue is flushed (e.g., to update
+ * the length of a message as more data is added after it). The queue
+ * has been flushed once its generation changes.
+ *
+ * txq: Transmit queue
+ *
+ * fd: Socket the queue is sent on (used if the queue has to be flushed)
+ *
+ * buf: Buffer (no larger than TXQ_STAGING_SIZE)
+ *
+ * len: Length of the buffer
+ *
+ * Returns: pointer to the copy, or NULL if the queue had to be flushed
+ *          and the flush failed.
+ */
+void *chirouter_txq_stage(chirouter_txq_t *txq, int fd, const void *buf, size_t len);
+
+
+/*
+ * chirouter_txq_flush - Send all the buffers in a transmit queue
+ *
+ * Sends as much of the queued data as the socket will accept without
+ * blocking, and copies the rest into the backlog (in asynchronous mode,
+ * everything is copied into the backlog). Afterwards, the queue no
+ * longer refers to any of the buffers that were added by reference.
+ *
+ * If the backlog does not have room for the data, this function waits
+ * until the socket has accepted enough of the backlog to make room.
+ *
+ * txq: Transmit queue
+ *
+ * fd: Socket to send the queued data on
+ *
+ * Returns: 0 on success, -1 if an error happens (the queued data
+ *          is discarded, and errno is set by the failed system call)
+ */
+int chirouter_txq_flush(chirouter_txq_t *txq, int fd);
+
+
+/*
+ * chirouter_txq_write_backlog - Send the backlog of a transmit queue
+ *
+ * Sends as much of the backlog as the socket will accept without blocking
+ * (in asynchronous mode, this does nothing).
+ *
+ * txq: Transmit queue
+ *
+ * fd: Socket to send the backlog on
+ *
+ * Returns: 0 on success, -1 if an error happens (errno is set
+ *          by the failed system call)
+ */
+int chirouter_txq_write_backlog(chirouter_txq_t *txq, int fd);
+
+
+/*
+ * chirouter_txq_backlog - Get the size of the backlog of a transmit queue
+ *
+ * txq: Transmit queue
+ *
+ * Returns: number of bytes waiting to be sent in the backlog
+ */
+size_t chirouter_txq_backlog(chirouter_txq_t *txq);
+
+
+/*
+ * chirouter_txq_discard_backlog - Discard the backlog of a transmit queue
+ *
+ * txq: Transmit queue
+ *
+ * Returns: nothing
+ */
+void chirouter_txq_discard_backlog(chirouter_txq_t *txq);
+
+#endif
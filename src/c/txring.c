@@ -0,0 +1,287 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the ring used by threads other than the server
+ *  thread to send messages to the controller.
+ *
+ *  See txring.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "txring.h"
+#include "alloc.h"
+
+/*
+ * Each slot's sequence number tells whose turn it is to use the slot.
+ * For the slot at position pos (i.e., slot pos % TXRING_SIZE):
+ *
+ *  - seq == pos: the slot is free, and can be taken by the producer
+ *    that claims position pos (by incrementing enqueue_pos)
+ *  - seq == pos + 1: the slot holds a message, and can be read by
+ *    the consumer
+ *
+ * When the consumer releases the slot, it sets seq to pos + TXRING_SIZE,
+ * making the slot free for the producer that will claim that position
+ * the next time around the ring.
+ */
+
+
+/* See txring.h */
+int chirouter_txring_init(chirouter_txring_t *ring)
+{
+    ring->slots = chirouter_aligned_calloc(64, TXRING_SIZE, sizeof(chirouter_txring_slot_t));
+    if (ring->slots == NULL)
+    {
+        return -1;
+    }
+
+    ring->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->eventfd == -1)
+    {
+        chirouter_free(ring->slots);
+        return -1;
+    }
+
+    for (size_t i = 0; i < TXRING_SIZE; i++)
+    {
+        atomic_init(&ring->slots[i].seq, i);
+    }
+    atomic_init(&ring->enqueue_pos, 0);
+    ring->dequeue_pos = 0;
+    atomic_init(&ring->wakeup_pending, false);
+    atomic_init(&ring->drops, 0);
+
+    return 0;
+}
+
+
+/* See txring.h */
+void chirouter_txring_destroy(chirouter_txring_t *ring)
+{
+    close(ring->eventfd);
+    chirouter_free(ring->slots);
+    ring->slots = NULL;
+}
+
+
+/*
+ * chirouter_txring_try_enqueue - Add a message to a ring, if there is room for it
+ *
+ * ring: Ring
+ *
+ * iov: Array of buffers
+ *
+ * iovcnt: Number of buffers
+ *
+ * Returns: 0 on success, 1 if the ring is full, -1 if
+ *          the message is too large to fit in a slot
+ */
+static int chirouter_txring_try_enqueue(chirouter_txring_t *ring, const struct iovec *iov, int iovcnt)
+{
+    chirouter_txring_slot_t *slot;
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        len += iov[i].iov_len;
+    }
+
+    if (len > TXRING_SLOT_SIZE)
+    {
+        return -1;
+    }
+
+    /* Claim a position */
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    while (true)
+    {
+        slot = &ring->slots[pos & (TXRING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+
+        if (dif == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+        {
+            /* The ring is full */
+            return 1;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    /* Fill in the slot, and hand it over to the consumer */
+    size_t off = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        memcpy(slot->data + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    slot->len = len;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    /* Wake up the consumer (unless a wake-up is already pending) */
+    if (!atomic_exchange(&ring->wakeup_pending, true))
+    {
+        uint64_t one = 1;
+        ssize_t rc = write(ring->eventfd, &one, sizeof(one));
+        (void) rc;
+    }
+
+    return 0;
+}
+
+
+/* See txring.h */
+int chirouter_txring_enqueue(chirouter_txring_t *ring, const struct iovec *iov, int iovcnt)
+{
+    if (chirouter_txring_try_enqueue(ring, iov, iovcnt) != 0)
+    {
+        atomic_fetch_add_explicit(&ring->drops, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* See txring.h */
+int chirouter_txring_enqueue_wait(chirouter_txring_t *ring, const struct iovec *iov, int iovcnt,
+                                  const atomic_bool *cancel)
+{
+    int rc;
+
+    while ((rc = chirouter_txring_try_enqueue(ring, iov, iovcnt)) == 1 && !atomic_load(cancel))
+    {
+        sched_yield();
+    }
+
+    if (rc != 0)
+    {
+        atomic_fetch_add_explicit(&ring->drops, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* See txring.h */
+void chirouter_txring_ack_wakeup(chirouter_txring_t *ring)
+{
+    uint64_t count;
+    ssize_t rc = read(ring->eventfd, &count, sizeof(count));
+    (void) rc;
+
+    /* Clear the flag *before* the consumer reads the ring, so that
+     * a message added after the consumer has read the ring always
+     * results in a new wake-up */
+    atomic_store(&ring->wakeup_pending, false);
+}
+
+
+/* See txring.h */
+const uint8_t *chirouter_txring_peek(chirouter_txring_t *ring, size_t n, size_t *len)
+{
+    if (n >= TXRING_SIZE)
+    {
+        return NULL;
+    }
+
+    size_t pos = ring->dequeue_pos + n;
+    chirouter_txring_slot_t *slot = &ring->slots[pos & (TXRING_SIZE - 1)];
+
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+    {
+        return NULL;
+    }
+
+    *len = slot->len;
+    return slot->data;
+}
+
+
+/* See txring.h */
+void chirouter_txring_release(chirouter_txring_t *ring, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t pos = ring->dequeue_pos + i;
+        chirouter_txring_slot_t *slot = &ring->slots[pos & (TXRING_SIZE - 1)];
+
+        atomic_store_explicit(&slot->seq, pos + TXRING_SIZE, memory_order_release);
+    }
+
+    ring->dequeue_pos += n;
+}
+
+
+/* See txring.h */
+size_t chirouter_txring_discard(chirouter_txring_t *ring)
+{
+    size_t n = 0, len;
+
+    while (chirouter_txring_peek(ring, 0, &len) != NULL)
+    {
+        chirouter_txring_release(ring, 1);
+        n++;
+    }
+
+    return n;
+}
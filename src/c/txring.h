@@ -0,0 +1,237 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the ring used by threads other than the server
+ *  thread (e.g., the ARP threads) to send messages to the controller.
+ *
+ *  Only the server thread writes to the controller socket. Other threads
+ *  copy their messages into a bounded, lock-free, multi-producer/single-
+ *  consumer ring, and wake up the server thread through an eventfd. The
+ *  server thread then adds the messages in the ring to its transmit queue
+ *  (see txq.h) and sends them along with its own messages.
+ *
+ *  The ring is based on Dmitry Vyukov's bounded MPMC queue: each slot has
+ *  a sequence number that tells producers and the consumer whether the slot
+ *  is free or holds a message, so producers only contend on a single atomic
+ *  counter and never block. If the ring is full, the message is dropped
+ *  (and counted), since the only messages sent from other threads are
+ *  ARP requests and ICMP messages, which can be safely lost.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef TXRING_H
+#define TXRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#include "protocols/ethernet.h"
+
+/* Number of slots in the ring (must be a power of two) */
+#define TXRING_SIZE (256u)
+
+/* Maximum size of a message in the ring (large enough
+ * for an ETHERNET_FRAME message with a maximum-size frame) */
+#define TXRING_SLOT_SIZE (8u + ETHER_FRAME_MAX_LEN)
+
+/* A slot in the ring */
+typedef struct chirouter_txring_slot
+{
+    /* Sequence number (see txring.c) */
+    atomic_size_t seq;
+
+    /* Message */
+    uint16_t len;
+    uint8_t data[TXRING_SLOT_SIZE];
+} chirouter_txring_slot_t;
+
+/* A ring */
+typedef struct chirouter_txring
+{
+    /* Slots (TXRING_SIZE of them) */
+    chirouter_txring_slot_t *slots;
+
+    /* Position of the next slot to be taken by a producer */
+    atomic_size_t enqueue_pos;
+
+    /* Position of the next slot to be read by the consumer (only used
+     * by the consumer, so it is kept on a different cache line) */
+    alignas(64) size_t dequeue_pos;
+
+    /* eventfd used to wake up the consumer, and whether a wake-up
+     * is already pending (so producers don't write to the eventfd
+     * more than needed) */
+    int eventfd;
+    atomic_bool wakeup_pending;
+
+    /* Number of messages dropped because the ring was full */
+    atomic_uint_fast64_t drops;
+} chirouter_txring_t;
+
+
+/*
+ * chirouter_txring_init - Initialize a ring
+ *
+ * ring: Ring
+ *
+ * Returns: 0 on success, -1 if the ring could not be allocated
+ */
+int chirouter_txring_init(chirouter_txring_t *ring);
+
+
+/*
+ * chirouter_txring_destroy - Free a ring
+ *
+ * ring: Ring
+ *
+ * Returns: nothing
+ */
+void chirouter_txring_destroy(chirouter_txring_t *ring);
+
+
+/*
+ * chirouter_txring_enqueue - Add a message to a ring (producer side)
+ *
+ * Copies a message, made up of several buffers, into a slot of the
+ * ring, and wakes up the consumer. Can be called from any thread.
+ *
+ * ring: Ring
+ *
+ * iov: Array of buffers
+ *
+ * iovcnt: Number of buffers
+ *
+ * Returns: 0 on success, -1 if the message was dropped (because
+ *          the ring is full or the message is too large)
+ */
+int chirouter_txring_enqueue(chirouter_txring_t *ring, const struct iovec *iov, int iovcnt);
+
+
+/*
+ * chirouter_txring_enqueue_wait - Add a message to a ring, waiting for room (producer side)
+ *
+ * Same as chirouter_txring_enqueue, but if the ring is full, waits
+ * until the consumer makes room for the message (instead of dropping
+ * it). Only safe to use if the consumer keeps reading from the ring
+ * whenever it has to wait for the caller.
+ *
+ * ring: Ring
+ *
+ * iov: Array of buffers
+ *
+ * iovcnt: Number of buffers
+ *
+ * cancel: Stop waiting (and drop the message) once this is set
+ *
+ * Returns: 0 on success, -1 if the message was dropped (because it
+ *          is too large, or because waiting was cancelled)
+ */
+int chirouter_txring_enqueue_wait(chirouter_txring_t *ring, const struct iovec *iov, int iovcnt,
+                                  const atomic_bool *cancel);
+
+
+/*
+ * chirouter_txring_ack_wakeup - Acknowledge a wake-up (consumer side)
+ *
+ * Must be called when the ring's eventfd becomes readable,
+ * before reading messages from the ring.
+ *
+ * ring: Ring
+ *
+ * Returns: nothing
+ */
+void chirouter_txring_ack_wakeup(chirouter_txring_t *ring);
+
+
+/*
+ * chirouter_txring_peek - Get a message from a ring (consumer side)
+ *
+ * Returns the n-th message after the last released message (see
+ * chirouter_txring_release), without removing it from the ring. The
+ * message remains valid until it is released. Only one thread can
+ * read from the ring.
+ *
+ * ring: Ring
+ *
+ * n: Index of the message (0 is the oldest message in the ring)
+ *
+ * len: Pointer to where the length of the message will be stored
+ *
+ * Returns: pointer to the message, or NULL if there are fewer than
+ *          n+1 messages in the ring.
+ */
+const uint8_t *chirouter_txring_peek(chirouter_txring_t *ring, size_t n, size_t *len);
+
+
+/*
+ * chirouter_txring_release - Remove messages from a ring (consumer side)
+ *
+ * ring: Ring
+ *
+ * n: Number of messages to remove (the n oldest messages, which
+ *    must have been obtained with chirouter_txring_peek)
+ *
+ * Returns: nothing
+ */
+void chirouter_txring_release(chirouter_txring_t *ring, size_t n);
+
+
+/*
+ * chirouter_txring_discard - Remove all messages from a ring (consumer side)
+ *
+ * ring: Ring
+ *
+ * Returns: number of messages removed
+ */
+size_t chirouter_txring_discard(chirouter_txring_t *ring);
+
+#endif
@@ -0,0 +1,602 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a minimal interface to io_uring, which
+ *  uses the io_uring system calls directly.
+ *
+ *  See uring.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "alloc.h"
+
+#if CHIROUTER_HAVE_URING
+
+/* The features chirouter_uring_submit relies on */
+#define URING_REQUIRED_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+/* How long we wait for the completions of the requests used to check
+ * that the kernel supports multishot receives (see chirouter_uring_probe) */
+#define URING_PROBE_TIMEOUT_MS (1000)
+
+
+/*
+ * chirouter_uring_enter - Wrapper for the io_uring_enter system call
+ *
+ * Returns: same as io_uring_enter
+ */
+static int chirouter_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                                 unsigned flags, void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+
+/*
+ * chirouter_uring_get_sqe - Get a submission queue entry for a new request
+ *
+ * The entry is zeroed, and is submitted by the next call to
+ * chirouter_uring_submit (if the submission queue is full, the
+ * requests in it are submitted first, to make room).
+ *
+ * ring: io_uring instance
+ *
+ * Returns: the entry, or NULL if the queued requests could not be submitted
+ */
+static struct io_uring_sqe *chirouter_uring_get_sqe(chirouter_uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    if (ring->sq_next - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+    {
+        if (chirouter_uring_submit(ring, false, 0) == -1 ||
+            ring->sq_next - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+        {
+            return NULL;
+        }
+    }
+
+    sqe = &ring->sqes[ring->sq_next & ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_next++;
+
+    return sqe;
+}
+
+
+/*
+ * chirouter_uring_peek_cqe - Get the next completion queue entry
+ *
+ * ring: io_uring instance
+ *
+ * Returns: the next entry (which must be released with
+ *          chirouter_uring_cqe_seen), or NULL if there isn't one
+ */
+static struct io_uring_cqe *chirouter_uring_peek_cqe(chirouter_uring_t *ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+
+/*
+ * chirouter_uring_cqe_seen - Release the entry returned by chirouter_uring_peek_cqe
+ *
+ * ring: io_uring instance
+ *
+ * Returns: nothing
+ */
+static void chirouter_uring_cqe_seen(chirouter_uring_t *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * chirouter_uring_probe - Check that the kernel supports multishot receives
+ *
+ * There is no feature flag for multishot receives into provided buffers
+ * (and older kernels would reject them with EINVAL, but only once the
+ * request is submitted), so we try one out on a pair of sockets.
+ *
+ * ring: io_uring instance (with nothing in progress)
+ *
+ * Returns: 0 if multishot receives work, -1 otherwise
+ */
+static int chirouter_uring_probe(chirouter_uring_t *ring)
+{
+    chirouter_uring_bufs_t bufs;
+    chirouter_uring_completion_t c;
+    bool received = false, done = false;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+        return -1;
+
+    if (chirouter_uring_bufs_init(ring, &bufs, 0, 2, 64) == -1 ||
+        chirouter_uring_recv_multishot(ring, sv[0], &bufs, 1) == -1)
+    {
+        chirouter_uring_bufs_destroy(ring, &bufs);
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    /* Once the first byte has been received, closing the other end
+     * ends the receive (and it must not have ended before that) */
+    if (write(sv[1], "x", 1) == 1)
+    {
+        while (!done && chirouter_uring_submit(ring, true, URING_PROBE_TIMEOUT_MS) == 0 &&
+               chirouter_uring_next_completion(ring, &c))
+        {
+            if (!received)
+            {
+                received = c.res == 1 && c.has_buf && c.more;
+                if (received)
+                {
+                    close(sv[1]);
+                    sv[1] = -1;
+                }
+            }
+            done = !c.more;
+        }
+    }
+
+    if (sv[1] != -1)
+        close(sv[1]);
+    close(sv[0]);
+
+    /* The buffers can only be freed if the receive is over */
+    if (done)
+        chirouter_uring_bufs_destroy(ring, &bufs);
+
+    if (!received || !done)
+    {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* See uring.h */
+int chirouter_uring_init(chirouter_uring_t *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    uint8_t *sq, *cq;
+    unsigned *array;
+    int saved_errno;
+
+    memset(ring, 0, sizeof(chirouter_uring_t));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd == -1)
+        return -1;
+
+    if ((p.features & URING_REQUIRED_FEATURES) != URING_REQUIRED_FEATURES)
+    {
+        close(ring->fd);
+        ring->fd = -1;
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    /* With IORING_FEAT_SINGLE_MMAP, both queues are in the same mapping */
+    ring->rings_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    if (ring->rings_size < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe))
+        ring->rings_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->rings == MAP_FAILED)
+    {
+        ring->rings = NULL;
+        saved_errno = errno;
+        chirouter_uring_destroy(ring);
+        errno = saved_errno;
+        return -1;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        saved_errno = errno;
+        chirouter_uring_destroy(ring);
+        errno = saved_errno;
+        return -1;
+    }
+
+    sq = ring->rings;
+    ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_next = *ring->sq_tail;
+
+    /* The i-th entry of the submission queue is always the i-th SQE */
+    array = (unsigned *) (sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+
+    cq = ring->rings;
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    if (chirouter_uring_probe(ring) == -1)
+    {
+        saved_errno = errno;
+        chirouter_uring_destroy(ring);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* See uring.h */
+void chirouter_uring_destroy(chirouter_uring_t *ring)
+{
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->rings != NULL)
+        munmap(ring->rings, ring->rings_size);
+    if (ring->fd != -1)
+        close(ring->fd);
+
+    ring->sqes = NULL;
+    ring->rings = NULL;
+    ring->fd = -1;
+}
+
+
+/* See uring.h */
+int chirouter_uring_submit(chirouter_uring_t *ring, bool wait, int timeout_ms)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned to_submit;
+    int rc;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_next, __ATOMIC_RELEASE);
+    to_submit = ring->sq_next - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (wait && timeout_ms >= 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+
+    /* Even if we don't wait, IORING_ENTER_GETEVENTS makes the kernel
+     * move any completions that did not fit in the completion queue
+     * into it (see IORING_FEAT_NODROP) */
+    rc = chirouter_uring_enter(ring->fd, to_submit, wait ? 1 : 0,
+                               IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (rc == -1 && (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        return 0;
+
+    return rc == -1 ? -1 : 0;
+}
+
+
+/* See uring.h */
+bool chirouter_uring_next_completion(chirouter_uring_t *ring, chirouter_uring_completion_t *c)
+{
+    struct io_uring_cqe *cqe = chirouter_uring_peek_cqe(ring);
+
+    if (cqe == NULL)
+        return false;
+
+    c->user_data = cqe->user_data;
+    c->res = cqe->res;
+    c->more = cqe->flags & IORING_CQE_F_MORE;
+    c->has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+    c->buf_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    chirouter_uring_cqe_seen(ring);
+
+    return true;
+}
+
+
+/* See uring.h */
+int chirouter_uring_poll_multishot(chirouter_uring_t *ring, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = chirouter_uring_get_sqe(ring);
+
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+
+    return 0;
+}
+
+
+/* See uring.h */
+int chirouter_uring_recv_multishot(chirouter_uring_t *ring, int fd, chirouter_uring_bufs_t *bufs,
+                                   uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = chirouter_uring_get_sqe(ring);
+
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufs->group;
+    sqe->user_data = user_data;
+
+    return 0;
+}
+
+
+/* See uring.h */
+int chirouter_uring_send(chirouter_uring_t *ring, int fd, const void *buf, size_t len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = chirouter_uring_get_sqe(ring);
+
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+
+    return 0;
+}
+
+
+/* See uring.h */
+int chirouter_uring_cancel(chirouter_uring_t *ring, uint64_t target, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = chirouter_uring_get_sqe(ring);
+
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+
+    return 0;
+}
+
+
+/* See uring.h */
+int chirouter_uring_bufs_init(chirouter_uring_t *ring, chirouter_uring_bufs_t *bufs,
+                              uint16_t group, uint16_t num_bufs, uint32_t buf_size)
+{
+    struct io_uring_buf_reg reg;
+    void *mem;
+
+    memset(bufs, 0, sizeof(chirouter_uring_bufs_t));
+    bufs->num_bufs = num_bufs;
+    bufs->buf_size = buf_size;
+    bufs->group = group;
+
+    /* The ring itself has to be page-aligned */
+    mem = mmap(NULL, num_bufs * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return -1;
+    bufs->ring = mem;
+
+    bufs->bufs = chirouter_calloc(num_bufs, buf_size);
+    if (bufs->bufs == NULL)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) bufs->ring;
+    reg.ring_entries = num_bufs;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+        return -1;
+    bufs->registered = true;
+
+    for (uint16_t id = 0; id < num_bufs; id++)
+        chirouter_uring_bufs_recycle(bufs, id);
+
+    return 0;
+}
+
+
+/* See uring.h */
+uint8_t *chirouter_uring_bufs_get(chirouter_uring_bufs_t *bufs, uint16_t id)
+{
+    return bufs->bufs + (size_t) id * bufs->buf_size;
+}
+
+
+/* See uring.h */
+void chirouter_uring_bufs_recycle(chirouter_uring_bufs_t *bufs, uint16_t id)
+{
+    uint16_t tail = bufs->ring->tail;
+    struct io_uring_buf *buf = &bufs->ring->bufs[tail & (bufs->num_bufs - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) chirouter_uring_bufs_get(bufs, id);
+    buf->len = bufs->buf_size;
+    buf->bid = id;
+
+    __atomic_store_n(&bufs->ring->tail, (uint16_t) (tail + 1), __ATOMIC_RELEASE);
+}
+
+
+/* See uring.h */
+void chirouter_uring_bufs_destroy(chirouter_uring_t *ring, chirouter_uring_bufs_t *bufs)
+{
+    struct io_uring_buf_reg reg;
+
+    if (bufs->registered)
+    {
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = bufs->group;
+        syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    if (bufs->ring != NULL)
+        munmap(bufs->ring, bufs->num_bufs * sizeof(struct io_uring_buf));
+    chirouter_free(bufs->bufs);
+
+    memset(bufs, 0, sizeof(chirouter_uring_bufs_t));
+}
+
+#else
+
+/* Without io_uring support, the server always falls back to epoll */
+
+/* See uring.h */
+int chirouter_uring_init(chirouter_uring_t *ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(chirouter_uring_t));
+    ring->fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+/* See uring.h */
+void chirouter_uring_destroy(chirouter_uring_t *ring)
+{
+}
+
+/* See uring.h */
+int chirouter_uring_submit(chirouter_uring_t *ring, bool wait, int timeout_ms)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+/* See uring.h */
+bool chirouter_uring_next_completion(chirouter_uring_t *ring, chirouter_uring_completion_t *c)
+{
+    return false;
+}
+
+/* See uring.h */
+int chirouter_uring_poll_multishot(chirouter_uring_t *ring, int fd, uint64_t user_data)
+{
+    return -1;
+}
+
+/* See uring.h */
+int chirouter_uring_recv_multishot(chirouter_uring_t *ring, int fd, chirouter_uring_bufs_t *bufs,
+                                   uint64_t user_data)
+{
+    return -1;
+}
+
+/* See uring.h */
+int chirouter_uring_send(chirouter_uring_t *ring, int fd, const void *buf, size_t len, uint64_t user_data)
+{
+    return -1;
+}
+
+/* See uring.h */
+int chirouter_uring_cancel(chirouter_uring_t *ring, uint64_t target, uint64_t user_data)
+{
+    return -1;
+}
+
+/* See uring.h */
+int chirouter_uring_bufs_init(chirouter_uring_t *ring, chirouter_uring_bufs_t *bufs,
+                              uint16_t group, uint16_t num_bufs, uint32_t buf_size)
+{
+    memset(bufs, 0, sizeof(chirouter_uring_bufs_t));
+    errno = ENOSYS;
+    return -1;
+}
+
+/* See uring.h */
+uint8_t *chirouter_uring_bufs_get(chirouter_uring_bufs_t *bufs, uint16_t id)
+{
+    return NULL;
+}
+
+/* See uring.h */
+void chirouter_uring_bufs_recycle(chirouter_uring_bufs_t *bufs, uint16_t id)
+{
+}
+
+/* See uring.h */
+void chirouter_uring_bufs_destroy(chirouter_uring_t *ring, chirouter_uring_bufs_t *bufs)
+{
+}
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a minimal interface to io_uring, used by the
+ *  io_uring backend of the server (see the -e option in main.c).
+ *
+ *  chirouter does not depend on liburing: the ring is set up and used
+ *  with the raw system calls, and only provides what the server needs
+ *  (submitting requests and reaping their completions, waiting with
+ *  a timeout, and provided buffer rings for multishot receives). If the
+ *  kernel headers do not define everything we need, this module is
+ *  compiled without io_uring support, and chirouter_uring_init always
+ *  fails (so the server falls back to epoll).
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/* Multishot receives and provided buffer rings are the most recent
+ * features we rely on (multishot receives require Linux 6.0) */
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ENTER_EXT_ARG)
+#define CHIROUTER_HAVE_URING 1
+#else
+#define CHIROUTER_HAVE_URING 0
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+#endif
+
+/* An io_uring instance. Must only be used by one thread. */
+typedef struct chirouter_uring
+{
+    int fd;
+
+    /* Submission queue (shared with the kernel). Requests are queued
+     * at sq_next, and only submitted (by moving the tail to sq_next)
+     * by chirouter_uring_submit */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_next;
+    struct io_uring_sqe *sqes;
+
+    /* Completion queue (shared with the kernel) */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Memory mapped from the kernel (the submission and completion
+     * queues share a single mapping) */
+    void *rings;
+    size_t rings_size;
+    size_t sqes_size;
+} chirouter_uring_t;
+
+/* A ring of buffers provided to the kernel, which picks one of them
+ * whenever a request with IOSQE_BUFFER_SELECT (and this ring's group
+ * ID) needs one. The buffers are handed out in order. */
+typedef struct chirouter_uring_bufs
+{
+    struct io_uring_buf_ring *ring;
+    uint8_t *bufs;
+    uint16_t num_bufs;
+    uint32_t buf_size;
+    uint16_t group;
+    bool registered;
+} chirouter_uring_bufs_t;
+
+/* The completion of a request */
+typedef struct chirouter_uring_completion
+{
+    /* Value the request was tagged with */
+    uint64_t user_data;
+
+    /* Result of the request (a negative errno value if it failed) */
+    int32_t res;
+
+    /* Whether the (multishot) request will complete again */
+    bool more;
+
+    /* Whether data was received into a provided buffer, and its ID */
+    bool has_buf;
+    uint16_t buf_id;
+} chirouter_uring_completion_t;
+
+
+/*
+ * chirouter_uring_init - Create an io_uring instance
+ *
+ * Also checks that the kernel supports everything the server needs (in
+ * particular, multishot receives into provided buffers), since the
+ * server has to fall back to epoll otherwise.
+ *
+ * ring: io_uring instance
+ *
+ * entries: Size of the submission queue (a power of two)
+ *
+ * Returns: 0 on success, -1 if io_uring is not available (with errno
+ *          set to the reason)
+ */
+int chirouter_uring_init(chirouter_uring_t *ring, unsigned entries);
+
+
+/*
+ * chirouter_uring_destroy - Free an io_uring instance
+ *
+ * Any requests that are still in progress are cancelled.
+ *
+ * ring: io_uring instance
+ *
+ * Returns: nothing
+ */
+void chirouter_uring_destroy(chirouter_uring_t *ring);
+
+
+/*
+ * chirouter_uring_submit - Submit the queued requests and wait for completions
+ *
+ * All of this is done with a single system call.
+ *
+ * ring: io_uring instance
+ *
+ * wait: Whether to wait for at least one completion
+ *
+ * timeout_ms: How long to wait for (-1 to wait for as long as it takes)
+ *
+ * Returns: 0 on success (including if the timeout expired), -1 if an
+ *          error happens (with errno set by io_uring_enter)
+ */
+int chirouter_uring_submit(chirouter_uring_t *ring, bool wait, int timeout_ms);
+
+
+/*
+ * chirouter_uring_next_completion - Get the next completion
+ *
+ * ring: io_uring instance
+ *
+ * c: Set to the completion
+ *
+ * Returns: true if there was a completion, false otherwise
+ */
+bool chirouter_uring_next_completion(chirouter_uring_t *ring, chirouter_uring_completion_t *c);
+
+
+/*
+ * chirouter_uring_poll_multishot - Queue a multishot poll request
+ *
+ * The request completes whenever the file becomes readable,
+ * until it is cancelled (or fails).
+ *
+ * ring: io_uring instance
+ *
+ * fd: File to poll
+ *
+ * user_data: Value the completions of the request are tagged with
+ *
+ * Returns: 0 on success, -1 if the request could not be queued
+ */
+int chirouter_uring_poll_multishot(chirouter_uring_t *ring, int fd, uint64_t user_data);
+
+
+/*
+ * chirouter_uring_recv_multishot - Queue a multishot receive request
+ *
+ * The request completes whenever data is received (into one of the
+ * buffers of the given buffer ring, which must be given back to the
+ * kernel once the data has been used), until the socket is closed, or
+ * there are no buffers left (or the request is cancelled, or fails).
+ *
+ * ring: io_uring instance
+ *
+ * fd: Socket to receive from
+ *
+ * bufs: Buffer ring to receive into
+ *
+ * user_data: Value the completions of the request are tagged with
+ *
+ * Returns: 0 on success, -1 if the request could not be queued
+ */
+int chirouter_uring_recv_multishot(chirouter_uring_t *ring, int fd, chirouter_uring_bufs_t *bufs,
+                                   uint64_t user_data);
+
+
+/*
+ * chirouter_uring_send - Queue a send request
+ *
+ * ring: io_uring instance
+ *
+ * fd: Socket to send to
+ *
+ * buf: Data to send (which must remain valid until the request completes)
+ *
+ * len: Length of the data
+ *
+ * user_data: Value the completion of the request is tagged with
+ *
+ * Returns: 0 on success, -1 if the request could not be queued
+ */
+int chirouter_uring_send(chirouter_uring_t *ring, int fd, const void *buf, size_t len, uint64_t user_data);
+
+
+/*
+ * chirouter_uring_cancel - Queue a request that cancels another request
+ *
+ * ring: io_uring instance
+ *
+ * target: Value the request to cancel is tagged with
+ *
+ * user_data: Value the completion of this request is tagged with
+ *
+ * Returns: 0 on success, -1 if the request could not be queued
+ */
+int chirouter_uring_cancel(chirouter_uring_t *ring, uint64_t target, uint64_t user_data);
+
+
+/*
+ * chirouter_uring_bufs_init - Create and register a ring of provided buffers
+ *
+ * All the buffers are handed to the kernel right away.
+ *
+ * ring: io_uring instance
+ *
+ * bufs: Buffer ring
+ *
+ * group: Buffer group ID (must not be used by any other buffer ring)
+ *
+ * num_bufs: Number of buffers (a power of two)
+ *
+ * buf_size: Size of each buffer
+ *
+ * Returns: 0 on success, -1 if an error happens (the buffer ring
+ *          must still be freed with chirouter_uring_bufs_destroy)
+ */
+int chirouter_uring_bufs_init(chirouter_uring_t *ring, chirouter_uring_bufs_t *bufs,
+                              uint16_t group, uint16_t num_bufs, uint32_t buf_size);
+
+
+/*
+ * chirouter_uring_bufs_get - Get one of the buffers of a ring
+ *
+ * bufs: Buffer ring
+ *
+ * id: Buffer ID (from the completion it was used for)
+ *
+ * Returns: pointer to the buffer
+ */
+uint8_t *chirouter_uring_bufs_get(chirouter_uring_bufs_t *bufs, uint16_t id);
+
+
+/*
+ * chirouter_uring_bufs_recycle - Give a buffer back to the kernel
+ *
+ * Buffers must be given back in the order they were handed out in.
+ *
+ * bufs: Buffer ring
+ *
+ * id: Buffer ID
+ *
+ * Returns: nothing
+ */
+void chirouter_uring_bufs_recycle(chirouter_uring_bufs_t *bufs, uint16_t id);
+
+
+/*
+ * chirouter_uring_bufs_destroy - Unregister and free a ring of provided buffers
+ *
+ * Must only be called once no request can use the buffers anymore.
+ *
+ * ring: io_uring instance
+ *
+ * bufs: Buffer ring
+ *
+ * Returns: nothing
+ */
+void chirouter_uring_bufs_destroy(chirouter_uring_t *ring, chirouter_uring_bufs_t *bufs);
+
+#endif
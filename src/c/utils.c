@@ -55,6 +55,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include "protocols/ethernet.h"
@@ -104,9 +105,27 @@ uint32_t in_addr_to_uint32 (struct in_addr address)
 }
 
 /* See utils.h */
-struct in_addr *uint32_to_in_addr (uint32_t address)
+struct in_addr uint32_to_in_addr (uint32_t address)
 {
-    struct in_addr *result = calloc(1, sizeof (struct in_addr));
-    result->s_addr = (in_addr_t) address;
+    struct in_addr result;
+    result.s_addr = (in_addr_t) address;
     return result;
 }
+
+/* See utils.h */
+uint64_t chirouter_now_ms (void)
+{
+    struct timespec spec;
+
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000 + (uint64_t) spec.tv_nsec / 1000000;
+}
+
+/* See utils.h */
+uint64_t chirouter_now_ns (void)
+{
+    struct timespec spec;
+
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000000000 + (uint64_t) spec.tv_nsec;
+}
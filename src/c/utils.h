@@ -94,9 +94,29 @@ uint32_t in_addr_to_uint32 (struct in_addr address);
  *
  * @Param: ip address in uint32_t format
  *
- * Returns: pointer to struct in_addr that holds the ip address
+ * Returns: struct in_addr that holds the ip address
  *
  */
-struct in_addr *uint32_to_in_addr (uint32_t address);
+struct in_addr uint32_to_in_addr (uint32_t address);
+
+/*
+ * chirouter_now_ms - Current time in milliseconds
+ *
+ * Returns: milliseconds elapsed on a monotonic clock (only
+ *          meaningful when compared with other values returned
+ *          by this function)
+ *
+ */
+uint64_t chirouter_now_ms (void);
+
+/*
+ * chirouter_now_ns - Current time in nanoseconds
+ *
+ * Returns: nanoseconds elapsed on a monotonic clock (only
+ *          meaningful when compared with other values returned
+ *          by this function)
+ *
+ */
+uint64_t chirouter_now_ns (void);
 
 #endif
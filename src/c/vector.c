@@ -0,0 +1,448 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains vector mode, in which the frames received for a
+ *  router are processed in batches (see vector.h)
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vector.h"
+#include "server.h"
+#include "arp.h"
+#include "pcap.h"
+#include "utils.h"
+#include "alloc.h"
+#include "log.h"
+
+
+/*
+ * chirouter_vector_prefetch - Prefetch the headers of a frame further down the vector
+ *
+ * v: Vector
+ *
+ * k: Position (in v->next) of the frame the node is currently looking at
+ *
+ * Returns: nothing
+ */
+static inline void chirouter_vector_prefetch(chirouter_vector_t *v, unsigned int k)
+{
+    if (k + VECTOR_PREFETCH < v->num_next)
+    {
+        uint8_t *frame = v->frame[v->next[k + VECTOR_PREFETCH]];
+
+        /* The Ethernet and IP headers can straddle two cache lines */
+        __builtin_prefetch(frame, 1);
+        __builtin_prefetch(frame + sizeof(ethhdr_t) + sizeof(iphdr_t) - 1, 1);
+    }
+}
+
+
+/*
+ * chirouter_vector_node_parse - Keep only the unicast IPv4 frames for the interface
+ *
+ * Frames that are not addressed to the MAC address of the interface they
+ * were received on (including broadcast frames), that are not IPv4, or
+ * that are too short or too long, are punted (which also takes care of
+ * logging the frames that are not valid).
+ *
+ * ctx: Router context
+ *
+ * v: Vector
+ *
+ * Returns: nothing
+ */
+static void chirouter_vector_node_parse(chirouter_ctx_t *ctx, chirouter_vector_t *v)
+{
+    unsigned int kept = 0;
+
+    for (unsigned int k = 0; k < v->num_next; k++)
+    {
+        unsigned int i = v->next[k];
+        ethhdr_t *hdr = (ethhdr_t *) v->frame[i];
+        iphdr_t *ip_hdr = (iphdr_t *) (v->frame[i] + sizeof(ethhdr_t));
+
+        chirouter_vector_prefetch(v, k);
+
+        if (v->len[i] < sizeof(ethhdr_t) + sizeof(iphdr_t) || v->len[i] > ETHER_FRAME_MAX_LEN ||
+            !ethernet_addr_is_equal(hdr->dst, v->iface[i]->mac) ||
+            ntohs(hdr->type) != ETHERTYPE_IP || ip_hdr->version != 4 || ip_hdr->ihl != 5)
+        {
+            v->punt[i] = true;
+            continue;
+        }
+
+        chilog(DEBUG, "Received Ethernet frame on interface %s-%s", ctx->name, v->iface[i]->name);
+        chilog_ethernet(DEBUG, v->frame[i], v->len[i], LOG_INBOUND);
+
+        if (ctx->server->pcap)
+            chirouter_pcap_write_frame(ctx, v->iface[i], v->frame[i], v->len[i], PCAP_INBOUND);
+
+        v->next[kept++] = i;
+    }
+
+    v->num_next = kept;
+}
+
+
+/*
+ * chirouter_vector_node_classify - Keep only the datagrams that have to be forwarded
+ *
+ * Datagrams for any of the router's interfaces, and datagrams whose
+ * TTL would expire, are punted.
+ *
+ * ctx: Router context
+ *
+ * v: Vector
+ *
+ * Returns: nothing
+ */
+static void chirouter_vector_node_classify(chirouter_ctx_t *ctx, chirouter_vector_t *v)
+{
+    unsigned int kept = 0;
+
+    for (unsigned int k = 0; k < v->num_next; k++)
+    {
+        unsigned int i = v->next[k];
+        iphdr_t *ip_hdr = (iphdr_t *) (v->frame[i] + sizeof(ethhdr_t));
+        bool local = false;
+
+        chirouter_vector_prefetch(v, k);
+
+        for (int j = 0; j < ctx->num_interfaces && !local; j++)
+        {
+            local = (in_addr_to_uint32(ctx->interfaces[j].ip) == ip_hdr->dst);
+        }
+
+        if (local || ip_hdr->ttl <= 1)
+        {
+            v->punt[i] = true;
+            continue;
+        }
+
+        v->next[kept++] = i;
+    }
+
+    v->num_next = kept;
+}
+
+
+/*
+ * chirouter_vector_node_fib - Look up the routes to the destinations of the datagrams
+ *
+ * Consecutive datagrams usually go to the same destination, so the last
+ * lookup is remembered. Datagrams for which there is no route are punted.
+ *
+ * ctx: Router context
+ *
+ * v: Vector
+ *
+ * Returns: nothing
+ */
+static void chirouter_vector_node_fib(chirouter_ctx_t *ctx, chirouter_vector_t *v)
+{
+    unsigned int kept = 0;
+    chirouter_rtable_entry_t *route = NULL;
+    uint32_t last_dst = 0;
+
+    for (unsigned int k = 0; k < v->num_next; k++)
+    {
+        unsigned int i = v->next[k];
+        iphdr_t *ip_hdr = (iphdr_t *) (v->frame[i] + sizeof(ethhdr_t));
+
+        chirouter_vector_prefetch(v, k);
+
+        if (k == 0 || ip_hdr->dst != last_dst)
+        {
+            route = chirouter_rtable_lookup(ctx, ip_hdr->dst);
+            last_dst = ip_hdr->dst;
+        }
+
+        if (route == NULL)
+        {
+            v->punt[i] = true;
+            continue;
+        }
+
+        v->route[i] = route;
+        v->next_hop[i] = in_addr_to_uint32(route->gw) != 0 ? in_addr_to_uint32(route->gw) : ip_hdr->dst;
+        v->next[kept++] = i;
+    }
+
+    v->num_next = kept;
+}
+
+
+/*
+ * chirouter_vector_node_arp - Look up the MAC addresses of the next hops
+ *
+ * The ARP lock is only taken once for the whole vector. Datagrams whose
+ * next hop is not in the ARP cache are punted (so that the router sends
+ * an ARP request, or adds them to the pending request, as usual).
+ *
+ * ctx: Router context
+ *
+ * v: Vector
+ *
+ * Returns: nothing
+ */
+static void chirouter_vector_node_arp(chirouter_ctx_t *ctx, chirouter_vector_t *v)
+{
+    unsigned int kept = 0;
+    chirouter_arpcache_entry_t *entry = NULL;
+    uint32_t last_next_hop = 0;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&ctx->lock_arp);
+    for (unsigned int k = 0; k < v->num_next; k++)
+    {
+        unsigned int i = v->next[k];
+
+        if (k == 0 || v->next_hop[i] != last_next_hop)
+        {
+            struct in_addr ip = uint32_to_in_addr(v->next_hop[i]);
+
+            entry = chirouter_arp_cache_lookup(ctx, &ip);
+            last_next_hop = v->next_hop[i];
+
+            /* Mark the entry as in use, so it gets refreshed before expiring */
+            if (entry != NULL)
+                entry->time_used = now;
+        }
+
+        if (entry == NULL)
+        {
+            v->punt[i] = true;
+            continue;
+        }
+
+        memcpy(v->mac[i], entry->mac, ETHER_ADDR_LEN);
+        v->next[kept++] = i;
+    }
+    pthread_mutex_unlock(&ctx->lock_arp);
+
+    v->num_next = kept;
+}
+
+
+/*
+ * chirouter_vector_node_rewrite - Rewrite the frames to forward them
+ *
+ * Same as forward_ip_datagram in router.c: the frames are rewritten in
+ * place, with the MAC addresses of the next hop and of the outgoing
+ * interface, and the TTL is decremented (and the checksum recomputed).
+ *
+ * ctx: Router context
+ *
+ * v: Vector
+ *
+ * Returns: nothing
+ */
+static void chirouter_vector_node_rewrite(chirouter_ctx_t *ctx, chirouter_vector_t *v)
+{
+    (void) ctx;
+
+    for (unsigned int k = 0; k < v->num_next; k++)
+    {
+        unsigned int i = v->next[k];
+        ethhdr_t *hdr = (ethhdr_t *) v->frame[i];
+        iphdr_t *ip_hdr = (iphdr_t *) (v->frame[i] + sizeof(ethhdr_t));
+
+        chirouter_vector_prefetch(v, k);
+
+        memcpy(hdr->dst, v->mac[i], ETHER_ADDR_LEN);
+        memcpy(hdr->src, v->route[i]->interface->mac, ETHER_ADDR_LEN);
+
+        ip_hdr->ttl--;
+        ip_hdr->cksum = 0;
+        ip_hdr->cksum = cksum(ip_hdr, sizeof(iphdr_t));
+    }
+}
+
+
+/*
+ * chirouter_vector_node_tx - Send the rewritten frames
+ *
+ * ctx: Router context
+ *
+ * v: Vector
+ *
+ * Returns: nothing
+ */
+static void chirouter_vector_node_tx(chirouter_ctx_t *ctx, chirouter_vector_t *v)
+{
+    for (unsigned int k = 0; k < v->num_next; k++)
+    {
+        unsigned int i = v->next[k];
+
+        chirouter_send_frame(ctx, v->route[i]->interface, v->frame[i], v->len[i]);
+    }
+}
+
+
+/*
+ * chirouter_vector_node_punt - Process the punted frames one at a time
+ *
+ * ctx: Router context
+ *
+ * v: Vector
+ *
+ * Returns: 0 on success, -1 if a critical error happens.
+ */
+static int chirouter_vector_node_punt(chirouter_ctx_t *ctx, chirouter_vector_t *v)
+{
+    for (unsigned int i = 0; i < v->n; i++)
+    {
+        if (v->punt[i] &&
+            chirouter_server_process_ethernet_frame(ctx, v->iface[i], v->frame[i], v->len[i]) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * chirouter_vector_process - Process the vector of a router
+ *
+ * ctx: Router context
+ *
+ * Returns: 0 on success, -1 if a critical error happens.
+ */
+static int chirouter_vector_process(chirouter_ctx_t *ctx)
+{
+    chirouter_vector_t *v = ctx->vec;
+    int rc;
+
+    for (unsigned int i = 0; i < v->n; i++)
+    {
+        v->punt[i] = false;
+        v->next[i] = i;
+    }
+    v->num_next = v->n;
+
+    chirouter_vector_node_parse(ctx, v);
+    chirouter_vector_node_classify(ctx, v);
+    chirouter_vector_node_fib(ctx, v);
+    chirouter_vector_node_arp(ctx, v);
+    chirouter_vector_node_rewrite(ctx, v);
+    chirouter_vector_node_tx(ctx, v);
+
+    chilog(TRACE, "Router %s: forwarded %u of a vector of %u frames", ctx->name, v->num_next, v->n);
+
+    rc = chirouter_vector_node_punt(ctx, v);
+    v->n = 0;
+
+    return rc;
+}
+
+
+/* See vector.h */
+int chirouter_vector_init(server_conn_t *conn)
+{
+    for (int i = 0; i < conn->num_routers; i++)
+    {
+        conn->routers[i].vec = chirouter_calloc(1, sizeof(chirouter_vector_t));
+        if (conn->routers[i].vec == NULL)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* See vector.h */
+void chirouter_vector_destroy(chirouter_ctx_t *ctx)
+{
+    chirouter_free(ctx->vec);
+    ctx->vec = NULL;
+}
+
+
+/* See vector.h */
+int chirouter_vector_add(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *frame, size_t len)
+{
+    chirouter_vector_t *v = ctx->vec;
+
+    if (v->n == VECTOR_SIZE && chirouter_vector_process(ctx) == -1)
+    {
+        return -1;
+    }
+
+    v->iface[v->n] = iface;
+    v->frame[v->n] = frame;
+    v->len[v->n] = (uint16_t) len;
+    v->n++;
+
+    return 0;
+}
+
+
+/* See vector.h */
+int chirouter_vector_flush(server_conn_t *conn)
+{
+    for (int i = 0; i < conn->num_routers; i++)
+    {
+        chirouter_ctx_t *r = &conn->routers[i];
+
+        if (r->vec != NULL && r->vec->n > 0 && chirouter_vector_process(r) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
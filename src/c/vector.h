@@ -0,0 +1,194 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains vector mode (see the -V option in main.c), in
+ *  which the Ethernet frames received for a router are processed in
+ *  batches instead of one at a time.
+ *
+ *  Without it, each frame goes all the way through
+ *  chirouter_process_ethernet_frame() (from parsing it to sending it)
+ *  before the next one is looked at. In vector mode, the frames received
+ *  for a router are collected into a vector of up to VECTOR_SIZE frames,
+ *  and the vector is passed through a series of nodes, each of which
+ *  handles one step of forwarding a frame for all the frames in the
+ *  vector before the next node runs:
+ *
+ *  - parse: checks that the frame is a unicast IPv4 frame for the
+ *    interface it was received on
+ *  - classify: checks that the datagram is not for the router itself,
+ *    and that its TTL will not expire
+ *  - fib: looks up the route to the destination
+ *  - arp: looks up the MAC address of the next hop (taking the ARP
+ *    lock once for the whole vector)
+ *  - rewrite: rewrites the Ethernet header, and the TTL and checksum
+ *  - tx: sends the frame
+ *
+ *  Every frame that a node can't handle (e.g., ARP messages, datagrams
+ *  for the router, datagrams whose next hop is not in the ARP cache, ...)
+ *  is punted: it is taken out of the vector, and processed on its own by
+ *  chirouter_process_ethernet_frame() once the vector has gone through
+ *  all the nodes. Punted frames are processed in the order they were
+ *  received in, so a router makes the same decisions it would make
+ *  without vector mode (for example, a frame that arrives after the ARP
+ *  reply for its next hop is punted, since the next hop was not in the
+ *  ARP cache when the vector went through the arp node, and is then
+ *  forwarded after the ARP reply has been processed).
+ *
+ *  However, the order in which a router sends frames can be different:
+ *  all the frames that make it through the nodes are sent before any
+ *  punted frame of the same vector is processed. So, for example, the
+ *  ICMP error for a datagram whose TTL expires, the ARP request for an
+ *  unknown next hop, or a datagram with IP options (which the parse node
+ *  punts, but the router still forwards) can be sent after frames that
+ *  were received after that datagram.
+ *
+ *  Each node prefetches the frames it is going to look at a few frames
+ *  ahead (VECTOR_PREFETCH), so the frames are in the cache by the time
+ *  the node gets to them.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "chirouter.h"
+
+/* Maximum number of frames in a vector */
+#define VECTOR_SIZE (256u)
+
+/* How many frames ahead of the current one each node prefetches */
+#define VECTOR_PREFETCH (4u)
+
+/* Frames collected for a router. The frames are not copied into the
+ * vector: they must stay where they are until the vector is processed
+ * (see chirouter_vector_flush). Only used by the server thread. */
+struct chirouter_vector
+{
+    /* Number of frames in the vector */
+    unsigned int n;
+
+    chirouter_interface_t *iface[VECTOR_SIZE];
+    uint8_t *frame[VECTOR_SIZE];
+    uint16_t len[VECTOR_SIZE];
+
+    /* Whether each frame has been punted by one of the nodes */
+    bool punt[VECTOR_SIZE];
+
+    /* Indices of the frames that are still on their way through the
+     * nodes (i.e., that have not been punted) */
+    uint16_t next[VECTOR_SIZE];
+    unsigned int num_next;
+
+    /* Filled in by the fib and arp nodes: the route to each frame's
+     * destination, its next hop, and the next hop's MAC address */
+    chirouter_rtable_entry_t *route[VECTOR_SIZE];
+    uint32_t next_hop[VECTOR_SIZE];
+    uint8_t mac[VECTOR_SIZE][ETHER_ADDR_LEN];
+};
+
+
+/*
+ * chirouter_vector_init - Create the vectors of the routers of a controller
+ *
+ * Called once the controller has configured all its routers.
+ *
+ * conn: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if the vectors could not be allocated (the
+ *          vectors that were allocated are freed by chirouter_vector_destroy)
+ */
+int chirouter_vector_init(server_conn_t *conn);
+
+
+/*
+ * chirouter_vector_destroy - Free the vector of a router
+ *
+ * Any frames still in the vector are discarded.
+ *
+ * ctx: Router context
+ *
+ * Returns: nothing
+ */
+void chirouter_vector_destroy(chirouter_ctx_t *ctx);
+
+
+/*
+ * chirouter_vector_add - Add a frame to the vector of a router
+ *
+ * If the vector is full, it is processed first.
+ *
+ * ctx: Router context
+ *
+ * iface: Interface the frame was received on
+ *
+ * frame: Frame (which must not be modified or reused until the vector
+ *        is processed)
+ *
+ * len: Length of the frame
+ *
+ * Returns: 0 on success, -1 if a critical error happens.
+ */
+int chirouter_vector_add(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *frame, size_t len);
+
+
+/*
+ * chirouter_vector_flush - Process the vectors of the routers of a controller
+ *
+ * Must be called before the buffers that the frames in the vectors are
+ * in are reused, and before any message other than an Ethernet frame
+ * is processed (so that the frames are processed before anything that
+ * comes after them).
+ *
+ * conn: Connection to the controller
+ *
+ * Returns: 0 on success, -1 if a critical error happens.
+ */
+int chirouter_vector_flush(server_conn_t *conn);
+
+#endif
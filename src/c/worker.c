@@ -0,0 +1,388 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the worker threads that process Ethernet frames
+ *  in worker-pool mode.
+ *
+ *  See worker.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "worker.h"
+#include "server.h"
+#include "log.h"
+#include "utils.h"
+#include "alloc.h"
+#include "utlist.h"
+
+/* The worker running on the current thread (if any) */
+static _Thread_local chirouter_worker_t *current_worker = NULL;
+
+
+/*
+ * chirouter_worker_wakeup - Wake up a worker if it is asleep
+ *
+ * worker: Worker
+ *
+ * Returns: nothing
+ */
+static void chirouter_worker_wakeup(chirouter_worker_t *worker)
+{
+    /* Pairs with the fence in chirouter_worker_run: either the worker
+     * sees the frame we just added, or we see that it is asleep */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&worker->sleeping, memory_order_relaxed) &&
+        atomic_exchange(&worker->sleeping, false))
+    {
+        uint64_t one = 1;
+        ssize_t rc = write(worker->eventfd, &one, sizeof(one));
+        (void) rc;
+    }
+}
+
+
+/*
+ * chirouter_worker_run - Worker thread function
+ *
+ * Processes the frames in the worker's ring, sleeping
+ * whenever the ring is empty.
+ *
+ * arg: Worker
+ *
+ * Returns: NULL
+ */
+static void *chirouter_worker_run(void *arg)
+{
+    chirouter_worker_t *worker = arg;
+    chirouter_work_item_t *item;
+
+    current_worker = worker;
+
+    while (!atomic_load(&worker->stop))
+    {
+        item = chirouter_spsc_peek(&worker->ring);
+        if (item == NULL)
+        {
+            atomic_store_explicit(&worker->sleeping, true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+
+            if (chirouter_spsc_peek(&worker->ring) == NULL && !atomic_load(&worker->stop))
+            {
+                uint64_t count;
+                ssize_t rc = read(worker->eventfd, &count, sizeof(count));
+                (void) rc;
+            }
+
+            atomic_store(&worker->sleeping, false);
+            continue;
+        }
+
+        chirouter_ctx_t *router = item->router;
+
+        /* If the router was just moved to this worker, its previous
+         * worker could still be processing its earlier frames */
+        while (atomic_load_explicit(&router->frames_done, memory_order_acquire) != item->seq &&
+               !atomic_load(&worker->stop))
+            sched_yield();
+        if (atomic_load(&worker->stop))
+            break;
+
+        uint64_t start = chirouter_now_ns();
+
+        /* The server thread closes the controller's connection (the
+         * worker keeps going until it does) */
+        if (chirouter_server_process_ethernet_frame(router, item->iface, item->frame, item->len) == -1 &&
+            !atomic_exchange(&router->conn->worker_failed, true))
+        {
+            chilog(CRITICAL, "Error when processing Ethernet frame received from controller.");
+            chirouter_server_notify(router->server);
+        }
+
+        atomic_fetch_add_explicit(&router->busy_ns, chirouter_now_ns() - start, memory_order_relaxed);
+        chirouter_spsc_release(&worker->ring);
+
+        /* The router can be freed as soon as this is done */
+        atomic_fetch_add_explicit(&router->frames_done, 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+
+/* See worker.h */
+int chirouter_workers_start(server_ctx_t *ctx, unsigned int num_workers)
+{
+    if (chirouter_server_notify_start(ctx))
+    {
+        return -1;
+    }
+
+    ctx->workers = chirouter_aligned_calloc(SPSC_CACHE_LINE, num_workers, sizeof(chirouter_worker_t));
+    if (ctx->workers == NULL)
+    {
+        return -1;
+    }
+    ctx->num_workers = num_workers;
+
+    for (unsigned int i = 0; i < num_workers; i++)
+    {
+        chirouter_worker_t *worker = &ctx->workers[i];
+
+        worker->id = i;
+        worker->eventfd = -1;
+        atomic_init(&worker->sleeping, false);
+        atomic_init(&worker->stop, false);
+
+        if (chirouter_spsc_init(&worker->ring, WORKER_RING_SIZE, sizeof(chirouter_work_item_t)))
+        {
+            chilog(CRITICAL, "Could not allocate ring for worker %u", i);
+            return -1;
+        }
+
+        worker->eventfd = eventfd(0, EFD_CLOEXEC);
+        if (worker->eventfd == -1)
+        {
+            chilog(CRITICAL, "Could not create eventfd for worker %u", i);
+            return -1;
+        }
+
+        if (pthread_create(&worker->thread, NULL, chirouter_worker_run, worker) != 0)
+        {
+            chilog(CRITICAL, "Could not create thread for worker %u", i);
+            return -1;
+        }
+        worker->thread_started = true;
+    }
+
+    ctx->next_rebalance = chirouter_now_ms() + WORKER_REBALANCE_INTERVAL_MS;
+
+    chilog(INFO, "Processing frames with %u worker threads", num_workers);
+
+    return 0;
+}
+
+
+/* See worker.h */
+void chirouter_workers_stop(server_ctx_t *ctx)
+{
+    for (unsigned int i = 0; i < ctx->num_workers; i++)
+    {
+        chirouter_worker_t *worker = &ctx->workers[i];
+
+        if (worker->thread_started)
+        {
+            uint64_t one = 1;
+            ssize_t rc;
+
+            atomic_store(&worker->stop, true);
+            rc = write(worker->eventfd, &one, sizeof(one));
+            (void) rc;
+            pthread_join(worker->thread, NULL);
+        }
+
+        if (worker->eventfd != -1)
+            close(worker->eventfd);
+        if (worker->ring.slots != NULL)
+            chirouter_spsc_destroy(&worker->ring);
+    }
+
+    chirouter_free(ctx->workers);
+    ctx->workers = NULL;
+    ctx->num_workers = 0;
+}
+
+
+/* See worker.h */
+void chirouter_workers_assign(server_ctx_t *ctx, chirouter_ctx_t *router)
+{
+    unsigned int best = 0;
+
+    for (unsigned int i = 1; i < ctx->num_workers; i++)
+    {
+        if (ctx->workers[i].num_routers < ctx->workers[best].num_routers)
+            best = i;
+    }
+
+    router->worker = best;
+    router->busy_ns_last = atomic_load(&router->busy_ns);
+    ctx->workers[best].num_routers++;
+}
+
+
+/* See worker.h */
+void chirouter_workers_unassign(server_ctx_t *ctx, chirouter_ctx_t *router)
+{
+    ctx->workers[router->worker].num_routers--;
+}
+
+
+/* See worker.h */
+bool chirouter_workers_dispatch(server_ctx_t *ctx, chirouter_ctx_t *router, chirouter_interface_t *iface,
+                                const uint8_t *frame, size_t len)
+{
+    chirouter_worker_t *worker = &ctx->workers[router->worker];
+    chirouter_work_item_t *item = chirouter_spsc_reserve(&worker->ring);
+
+    if (item == NULL)
+    {
+        chirouter_worker_wakeup(worker);
+        return false;
+    }
+
+    item->router = router;
+    item->iface = iface;
+    item->seq = router->frames_dispatched++;
+    item->len = len;
+    memcpy(item->frame, frame, len);
+
+    chirouter_spsc_commit(&worker->ring);
+    chirouter_worker_wakeup(worker);
+
+    return true;
+}
+
+
+/* See worker.h */
+bool chirouter_workers_idle(chirouter_ctx_t *router)
+{
+    return atomic_load_explicit(&router->frames_done, memory_order_acquire) == router->frames_dispatched;
+}
+
+
+/* See worker.h */
+void chirouter_workers_rebalance(server_ctx_t *ctx)
+{
+    server_conn_t *conn;
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < ctx->num_workers; i++)
+        ctx->workers[i].load = 0;
+
+    DL_FOREACH(ctx->conns, conn)
+    {
+        if (conn->closed || conn->state != RUNNING)
+            continue;
+
+        for (int i = 0; i < conn->num_routers; i++)
+        {
+            chirouter_ctx_t *r = &conn->routers[i];
+            uint64_t busy_ns = atomic_load_explicit(&r->busy_ns, memory_order_relaxed);
+
+            r->load = busy_ns - r->busy_ns_last;
+            r->busy_ns_last = busy_ns;
+            ctx->workers[r->worker].load += r->load;
+            total += r->load;
+        }
+    }
+
+    /* Each move must make the difference between the busiest and
+     * least busy workers smaller, so this always terminates */
+    while (true)
+    {
+        chirouter_worker_t *busiest = &ctx->workers[0], *idlest = &ctx->workers[0];
+        chirouter_ctx_t *move = NULL;
+
+        for (unsigned int i = 1; i < ctx->num_workers; i++)
+        {
+            if (ctx->workers[i].load > busiest->load)
+                busiest = &ctx->workers[i];
+            if (ctx->workers[i].load < idlest->load)
+                idlest = &ctx->workers[i];
+        }
+
+        uint64_t gap = busiest->load - idlest->load;
+        if (gap * 100 <= total * WORKER_REBALANCE_THRESHOLD_PCT)
+            break;
+
+        /* Moving a router with a load smaller than the gap makes the gap
+         * smaller, and moving the busiest such router makes it smallest */
+        DL_FOREACH(ctx->conns, conn)
+        {
+            if (conn->closed || conn->state != RUNNING)
+                continue;
+
+            for (int i = 0; i < conn->num_routers; i++)
+            {
+                chirouter_ctx_t *r = &conn->routers[i];
+
+                if (&ctx->workers[r->worker] == busiest && r->load > 0 && r->load < gap &&
+                    (move == NULL || r->load > move->load))
+                    move = r;
+            }
+        }
+
+        if (move == NULL)
+            break;
+
+        chilog(DEBUG, "Moving router %s from worker %u to worker %u (load: %lu us of %lu us)",
+               move->name, busiest->id, idlest->id, move->load / 1000, busiest->load / 1000);
+
+        busiest->load -= move->load;
+        busiest->num_routers--;
+        idlest->load += move->load;
+        idlest->num_routers++;
+        move->worker = idlest->id;
+        ctx->worker_migrations++;
+    }
+
+    ctx->next_rebalance = chirouter_now_ms() + WORKER_REBALANCE_INTERVAL_MS;
+}
+
+
+/* See worker.h */
+chirouter_worker_t *chirouter_worker_current(void)
+{
+    return current_worker;
+}
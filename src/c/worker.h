@@ -0,0 +1,247 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the worker threads that process Ethernet frames
+ *  when the router runs in worker-pool mode (see the -w option).
+ *
+ *  The routers don't share any forwarding state, so the frames of
+ *  different routers can be processed in parallel. Each router is
+ *  assigned to a single worker at any given time, and the server thread
+ *  hands each frame to its router's worker through a single-producer/
+ *  single-consumer ring (see spsc.h). Since a worker processes the
+ *  frames in its ring in order, the frames of each router are still
+ *  processed in the order they were received.
+ *
+ *  The time each router spends processing frames is measured, and the
+ *  server thread periodically moves routers from the busiest workers to
+ *  the least busy ones (see chirouter_workers_rebalance). Every frame
+ *  carries its position in the sequence of frames received by its router,
+ *  and a worker doesn't start processing a frame until the router's
+ *  previous frame has been processed, so moving a router can't reorder
+ *  its frames (its new worker waits for the old one to catch up).
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "chirouter.h"
+#include "spsc.h"
+
+/* Maximum number of worker threads */
+#define WORKER_MAX_WORKERS (64u)
+
+/* Number of frames each worker's ring can hold (must be a power of two) */
+#define WORKER_RING_SIZE (1024u)
+
+/* How often (in milliseconds) the routers are rebalanced */
+#define WORKER_REBALANCE_INTERVAL_MS (1000u)
+
+/* Routers are only moved if the difference between the load of the
+ * busiest and least busy workers is more than this percentage of the
+ * total load (otherwise, routers would keep moving back and forth) */
+#define WORKER_REBALANCE_THRESHOLD_PCT (10u)
+
+/* A frame handed to a worker (the contents of a slot in its ring) */
+typedef struct chirouter_work_item
+{
+    chirouter_ctx_t *router;
+    chirouter_interface_t *iface;
+
+    /* Number of frames handed to the router before this one */
+    uint64_t seq;
+
+    uint16_t len;
+    uint8_t frame[ETHER_FRAME_MAX_LEN];
+} chirouter_work_item_t;
+
+/* A worker thread */
+typedef struct chirouter_worker
+{
+    /* Ring of frames to process (the server thread is the producer) */
+    chirouter_spsc_t ring;
+
+    unsigned int id;
+    pthread_t thread;
+    bool thread_started;
+
+    /* eventfd used to wake up the worker, and whether the worker
+     * is asleep (or about to be) because its ring is empty */
+    int eventfd;
+    atomic_bool sleeping;
+
+    atomic_bool stop;
+
+    /* Number of routers assigned to the worker, and their combined load
+     * (in nanoseconds) during the last rebalancing interval. Only used
+     * by the server thread. */
+    unsigned int num_routers;
+    uint64_t load;
+} chirouter_worker_t;
+
+
+/*
+ * chirouter_workers_start - Start the worker threads
+ *
+ * ctx: Server context
+ *
+ * num_workers: Number of worker threads (at most WORKER_MAX_WORKERS)
+ *
+ * Returns: 0 on success, -1 if an error happens.
+ */
+int chirouter_workers_start(server_ctx_t *ctx, unsigned int num_workers);
+
+
+/*
+ * chirouter_workers_stop - Stop the worker threads
+ *
+ * Any frames left in the rings are not processed, so this should
+ * only be called once all the routers have been freed.
+ *
+ * ctx: Server context
+ *
+ * Returns: nothing
+ */
+void chirouter_workers_stop(server_ctx_t *ctx);
+
+
+/*
+ * chirouter_workers_assign - Assign a router to a worker
+ *
+ * The router is assigned to the worker with the fewest routers (the
+ * routers will be rebalanced once we know how busy they are).
+ *
+ * ctx: Server context
+ *
+ * router: Router context
+ *
+ * Returns: nothing
+ */
+void chirouter_workers_assign(server_ctx_t *ctx, chirouter_ctx_t *router);
+
+
+/*
+ * chirouter_workers_unassign - Remove a router from its worker
+ *
+ * The router must be idle (see chirouter_workers_idle)
+ *
+ * ctx: Server context
+ *
+ * router: Router context
+ *
+ * Returns: nothing
+ */
+void chirouter_workers_unassign(server_ctx_t *ctx, chirouter_ctx_t *router);
+
+
+/*
+ * chirouter_workers_dispatch - Hand a frame to a router's worker
+ *
+ * Copies the frame into the worker's ring, and wakes up the worker
+ * if needed. Must only be called from the server thread.
+ *
+ * ctx: Server context
+ *
+ * router: Router that received the frame
+ *
+ * iface: Interface the frame was received on
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame (at most ETHER_FRAME_MAX_LEN)
+ *
+ * Returns: true if the frame was handed to the worker, false if
+ *          the worker's ring is full (and the frame wasn't copied)
+ */
+bool chirouter_workers_dispatch(server_ctx_t *ctx, chirouter_ctx_t *router, chirouter_interface_t *iface,
+                                const uint8_t *frame, size_t len);
+
+
+/*
+ * chirouter_workers_idle - Check whether a router has no frames left to process
+ *
+ * Since only the server thread hands frames to the workers, a router
+ * that is idle stays idle until the server thread dispatches another
+ * frame to it (e.g., it can be freed once it is idle).
+ *
+ * router: Router context
+ *
+ * Returns: true if the router's worker has processed all the
+ *          frames handed to it, false otherwise.
+ */
+bool chirouter_workers_idle(chirouter_ctx_t *router);
+
+
+/*
+ * chirouter_workers_rebalance - Rebalance the routers across the workers
+ *
+ * Computes the load of every router during the last interval, and moves
+ * routers from the busiest worker to the least busy one while that makes
+ * the load more even. Must only be called from the server thread.
+ *
+ * ctx: Server context
+ *
+ * Returns: nothing
+ */
+void chirouter_workers_rebalance(server_ctx_t *ctx);
+
+
+/*
+ * chirouter_worker_current - Get the worker running on the calling thread
+ *
+ * Returns: the worker, or NULL if the calling thread is not a worker thread.
+ */
+chirouter_worker_t *chirouter_worker_current(void);
+
+#endif
@@ -0,0 +1,653 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the AF_XDP sockets used to send and receive
+ *  Ethernet frames on Linux interfaces.
+ *
+ *  See xdp.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+
+#include "xdp.h"
+#include "alloc.h"
+
+#if CHIROUTER_HAVE_XDP
+
+#include <linux/if_link.h>
+
+/* The XSKMAP has one entry per queue of the interface, but we
+ * only bind a socket to queue 0 (which is all veth has by default) */
+#define XDP_MAX_QUEUES (64u)
+
+/* Frames taken from the free frames to fill the fill rings always
+ * leave at least this many for the frames that must be copied */
+#define XDP_FREE_RESERVE (XDP_RING_SIZE / 2)
+
+
+static int chirouter_xdp_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/*
+ * chirouter_xdp_attach - Attach an XDP program that redirects all frames to a socket
+ *
+ * The program is equivalent to:
+ *
+ *     return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ *
+ * (frames received on a queue without a socket are passed to the
+ * network stack)
+ *
+ * xsk: Socket
+ *
+ * ifindex: Index of the interface the socket is bound to
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+static int chirouter_xdp_attach(chirouter_xdp_t *xsk, unsigned int ifindex)
+{
+    union bpf_attr attr;
+    uint32_t key = 0, value = xsk->fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(key);
+    attr.value_size = sizeof(value);
+    attr.max_entries = XDP_MAX_QUEUES;
+    xsk->map_fd = chirouter_xdp_bpf(BPF_MAP_CREATE, &attr);
+    if (xsk->map_fd == -1)
+        return -1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xsk->map_fd;
+    attr.key = (uintptr_t) &key;
+    attr.value = (uintptr_t) &value;
+    if (chirouter_xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1)
+        return -1;
+
+    struct bpf_insn prog[] =
+    {
+        /* r2 = ctx->rx_queue_index */
+        { .code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+          .off = offsetof(struct xdp_md, rx_queue_index) },
+        /* r1 = xsks (a 64-bit immediate takes two instructions) */
+        { .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD,
+          .imm = xsk->map_fd },
+        { 0 },
+        /* r3 = XDP_PASS */
+        { .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS },
+        /* r0 = bpf_redirect_map(r1, r2, r3) */
+        { .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+        { .code = BPF_JMP | BPF_EXIT },
+    };
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insns = (uintptr_t) prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uintptr_t) "Dual BSD/GPL";
+    xsk->prog_fd = chirouter_xdp_bpf(BPF_PROG_LOAD, &attr);
+    if (xsk->prog_fd == -1)
+        return -1;
+
+    /* Native mode if the driver supports it, generic mode otherwise */
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xsk->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+    xsk->link_fd = chirouter_xdp_bpf(BPF_LINK_CREATE, &attr);
+    if (xsk->link_fd == -1)
+    {
+        attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+        xsk->link_fd = chirouter_xdp_bpf(BPF_LINK_CREATE, &attr);
+    }
+
+    return xsk->link_fd == -1 ? -1 : 0;
+}
+
+
+/*
+ * chirouter_xdp_map_ring - Map one of the rings of a socket
+ *
+ * fd: Socket
+ *
+ * ring: Ring
+ *
+ * off: Offsets of the ring's fields (from XDP_MMAP_OFFSETS)
+ *
+ * desc_size: Size of each entry of the ring
+ *
+ * pgoff: Which ring to map
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+static int chirouter_xdp_map_ring(int fd, chirouter_xdp_ring_t *ring, struct xdp_ring_offset *off,
+                                  size_t desc_size, off_t pgoff)
+{
+    uint8_t *map;
+
+    ring->map_size = off->desc + XDP_RING_SIZE * desc_size;
+    map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED)
+        return -1;
+
+    ring->map = map;
+    ring->producer = (uint32_t *) (map + off->producer);
+    ring->consumer = (uint32_t *) (map + off->consumer);
+    ring->flags = (uint32_t *) (map + off->flags);
+    ring->descs = map + off->desc;
+    ring->mask = XDP_RING_SIZE - 1;
+
+    return 0;
+}
+
+
+/*
+ * chirouter_xdp_get_frame - Take a free frame of the UMEM
+ *
+ * umem: UMEM
+ *
+ * reserve: Number of free frames that must be left
+ *
+ * addr: Set to the address of the frame
+ *
+ * Returns: true if there was a free frame, false otherwise
+ */
+static bool chirouter_xdp_get_frame(chirouter_xdp_umem_t *umem, unsigned int reserve, uint64_t *addr)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&umem->lock);
+    if (umem->num_free > reserve)
+    {
+        *addr = umem->free[--umem->num_free];
+        found = true;
+    }
+    pthread_mutex_unlock(&umem->lock);
+
+    return found;
+}
+
+
+/*
+ * chirouter_xdp_put_frame - Give back a frame of the UMEM
+ *
+ * umem: UMEM
+ *
+ * addr: Address of the frame (or of any byte in it)
+ *
+ * Returns: nothing
+ */
+static void chirouter_xdp_put_frame(chirouter_xdp_umem_t *umem, uint64_t addr)
+{
+    pthread_mutex_lock(&umem->lock);
+    umem->free[umem->num_free++] = addr & ~((uint64_t) XDP_FRAME_SIZE - 1);
+    pthread_mutex_unlock(&umem->lock);
+}
+
+
+/*
+ * chirouter_xdp_refill - Put free frames on the fill ring of a socket
+ *
+ * xsk: Socket
+ *
+ * Returns: nothing
+ */
+static void chirouter_xdp_refill(chirouter_xdp_t *xsk)
+{
+    uint32_t prod = *xsk->fill.producer;
+    uint32_t cons = __atomic_load_n(xsk->fill.consumer, __ATOMIC_ACQUIRE);
+    uint64_t *descs = xsk->fill.descs;
+    uint64_t addr;
+
+    while (prod - cons < XDP_RING_SIZE && chirouter_xdp_get_frame(xsk->umem, XDP_FREE_RESERVE, &addr))
+        descs[prod++ & xsk->fill.mask] = addr;
+
+    __atomic_store_n(xsk->fill.producer, prod, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(xsk->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+        recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+}
+
+
+/*
+ * chirouter_xdp_reap - Take back the frames the kernel is done sending
+ *
+ * The caller must hold the socket's tx_lock.
+ *
+ * xsk: Socket
+ *
+ * Returns: nothing
+ */
+static void chirouter_xdp_reap(chirouter_xdp_t *xsk)
+{
+    uint32_t cons = *xsk->comp.consumer;
+    uint32_t prod = __atomic_load_n(xsk->comp.producer, __ATOMIC_ACQUIRE);
+    uint64_t *descs = xsk->comp.descs;
+
+    for (; cons != prod; cons++)
+        chirouter_xdp_put_frame(xsk->umem, descs[cons & xsk->comp.mask]);
+
+    __atomic_store_n(xsk->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * chirouter_xdp_kick - Tell the kernel to send the frames on the transmit ring
+ *
+ * The caller must hold the socket's tx_lock.
+ *
+ * xsk: Socket
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+static int chirouter_xdp_kick(chirouter_xdp_t *xsk)
+{
+    xsk->tx_pending = false;
+
+    if (!(__atomic_load_n(xsk->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP))
+        return 0;
+
+    /* In copy mode, each sendto() only sends a few frames (and fails
+     * with EAGAIN if there are more on the ring) */
+    for (unsigned int i = 0; i < XDP_RING_SIZE; i++)
+    {
+        if (sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == 0)
+            return 0;
+        if (errno != EAGAIN)
+            break;
+        if (__atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE) == *xsk->tx.producer)
+            return 0;
+    }
+
+    if (errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+        return -1;
+
+    return 0;
+}
+
+
+/* See xdp.h */
+int chirouter_xdp_umem_init(chirouter_xdp_umem_t *umem, unsigned int num_sockets)
+{
+    unsigned int num_frames = num_sockets * XDP_FRAMES_PER_SOCKET;
+    void *area;
+
+    umem->size = (size_t) num_frames * XDP_FRAME_SIZE;
+    umem->free = NULL;
+    umem->owner_fd = -1;
+    umem->rx_frame = NULL;
+    pthread_mutex_init(&umem->lock, NULL);
+
+    area = mmap(NULL, umem->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        umem->area = NULL;
+        return -1;
+    }
+    umem->area = area;
+
+    umem->free = chirouter_calloc(num_frames, sizeof(uint64_t));
+    if (umem->free == NULL)
+        return -1;
+    for (unsigned int i = 0; i < num_frames; i++)
+        umem->free[i] = (uint64_t) i * XDP_FRAME_SIZE;
+    umem->num_free = num_frames;
+
+    return 0;
+}
+
+
+/* See xdp.h */
+void chirouter_xdp_umem_destroy(chirouter_xdp_umem_t *umem)
+{
+    if (umem->area != NULL)
+        munmap(umem->area, umem->size);
+    chirouter_free(umem->free);
+    pthread_mutex_destroy(&umem->lock);
+    umem->area = NULL;
+    umem->free = NULL;
+}
+
+
+/* See xdp.h */
+int chirouter_xdp_open(chirouter_xdp_t *xsk, chirouter_xdp_umem_t *umem, const char *ifname)
+{
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp addr;
+    socklen_t optlen = sizeof(off);
+    int ring_size = XDP_RING_SIZE;
+    unsigned int ifindex;
+
+    memset(xsk, 0, sizeof(*xsk));
+    xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+    xsk->umem = umem;
+    pthread_mutex_init(&xsk->tx_lock, NULL);
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+        return -1;
+
+    xsk->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (xsk->fd == -1)
+        return -1;
+
+    /* The first socket registers the UMEM, and the others share it
+     * (but each of them needs its own fill and completion rings,
+     * since they are bound to different interfaces) */
+    if (umem->owner_fd == -1)
+    {
+        struct xdp_umem_reg reg;
+
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = (uintptr_t) umem->area;
+        reg.len = umem->size;
+        reg.chunk_size = XDP_FRAME_SIZE;
+        reg.headroom = 0;
+        if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1)
+            return -1;
+    }
+
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) == -1)
+        return -1;
+
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1)
+        return -1;
+
+    if (chirouter_xdp_map_ring(xsk->fd, &xsk->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+        chirouter_xdp_map_ring(xsk->fd, &xsk->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+        chirouter_xdp_map_ring(xsk->fd, &xsk->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+        chirouter_xdp_map_ring(xsk->fd, &xsk->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+        return -1;
+
+    /* Without XDP_COPY or XDP_ZEROCOPY, the kernel uses zero-copy mode
+     * if it can (the sockets that share the UMEM use the same mode
+     * as the socket that registered it, and can't set any flags) */
+    memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifindex;
+    addr.sxdp_queue_id = 0;
+    if (umem->owner_fd == -1)
+    {
+        addr.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    }
+    else
+    {
+        addr.sxdp_flags = XDP_SHARED_UMEM;
+        addr.sxdp_shared_umem_fd = umem->owner_fd;
+    }
+    if (bind(xsk->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+        return -1;
+
+    if (umem->owner_fd == -1)
+        umem->owner_fd = xsk->fd;
+
+    chirouter_xdp_refill(xsk);
+
+    return chirouter_xdp_attach(xsk, ifindex);
+}
+
+
+/* See xdp.h */
+void chirouter_xdp_close(chirouter_xdp_t *xsk)
+{
+    chirouter_xdp_ring_t *rings[] = { &xsk->fill, &xsk->comp, &xsk->rx, &xsk->tx };
+
+    /* Closing the link detaches the program */
+    if (xsk->link_fd != -1)
+        close(xsk->link_fd);
+    if (xsk->prog_fd != -1)
+        close(xsk->prog_fd);
+    if (xsk->map_fd != -1)
+        close(xsk->map_fd);
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (rings[i]->map != NULL)
+            munmap(rings[i]->map, rings[i]->map_size);
+        rings[i]->map = NULL;
+    }
+
+    if (xsk->fd != -1)
+        close(xsk->fd);
+
+    xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+    pthread_mutex_destroy(&xsk->tx_lock);
+}
+
+
+/* See xdp.h */
+int chirouter_xdp_recv(chirouter_xdp_t *xsk, chirouter_packet_handler_t handler, void *arg)
+{
+    chirouter_xdp_umem_t *umem = xsk->umem;
+    struct xdp_desc *descs = xsk->rx.descs;
+    uint64_t *fill_descs = xsk->fill.descs;
+    uint32_t cons = *xsk->rx.consumer;
+    uint32_t prod = __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE);
+    uint32_t fill_prod = *xsk->fill.producer;
+    uint32_t fill_cons = __atomic_load_n(xsk->fill.consumer, __ATOMIC_ACQUIRE);
+    int nframes = 0, rc = 0;
+
+    for (; cons != prod && rc == 0; cons++)
+    {
+        struct xdp_desc *desc = &descs[cons & xsk->rx.mask];
+
+        umem->rx_frame = umem->area + desc->addr;
+        umem->rx_addr = desc->addr;
+        umem->rx_sent = false;
+
+        rc = handler(arg, umem->rx_frame, desc->len);
+        nframes++;
+
+        /* Frames that were not sent go straight back to the fill
+         * ring (which has room for them, unless the kernel hasn't
+         * caught up with it yet, since they came from it) */
+        if (!umem->rx_sent)
+        {
+            if (fill_prod - fill_cons < XDP_RING_SIZE)
+                fill_descs[fill_prod++ & xsk->fill.mask] = desc->addr & ~((uint64_t) XDP_FRAME_SIZE - 1);
+            else
+                chirouter_xdp_put_frame(umem, desc->addr);
+        }
+    }
+    umem->rx_frame = NULL;
+
+    __atomic_store_n(xsk->rx.consumer, cons, __ATOMIC_RELEASE);
+    __atomic_store_n(xsk->fill.producer, fill_prod, __ATOMIC_RELEASE);
+
+    chirouter_xdp_refill(xsk);
+
+    return rc == -1 ? -1 : nframes;
+}
+
+
+/* See xdp.h */
+int chirouter_xdp_send(chirouter_xdp_t *xsk, const uint8_t *frame, size_t len, bool flush)
+{
+    chirouter_xdp_umem_t *umem = xsk->umem;
+    struct xdp_desc *descs = xsk->tx.descs;
+    uint32_t prod, cons;
+    uint64_t addr;
+    int rc = 0;
+
+    if (len > XDP_FRAME_SIZE - XDP_PACKET_HEADROOM)
+        return -1;
+
+    pthread_mutex_lock(&xsk->tx_lock);
+
+    chirouter_xdp_reap(xsk);
+
+    prod = *xsk->tx.producer;
+    cons = __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE);
+
+    /* Only the server thread can be sending the frame it is processing,
+     * and the other threads never send frames that are in the UMEM */
+    if (prod - cons == XDP_RING_SIZE)
+    {
+        rc = 1;
+    }
+    else if (frame >= umem->area && frame < umem->area + umem->size &&
+             frame == umem->rx_frame && !umem->rx_sent)
+    {
+        addr = umem->rx_addr;
+        umem->rx_sent = true;
+        xsk->tx_zerocopy++;
+    }
+    else if (chirouter_xdp_get_frame(umem, 0, &addr))
+    {
+        memcpy(umem->area + addr, frame, len);
+    }
+    else
+    {
+        rc = 1;
+    }
+
+    if (rc == 0)
+    {
+        descs[prod & xsk->tx.mask].addr = addr;
+        descs[prod & xsk->tx.mask].len = len;
+        descs[prod & xsk->tx.mask].options = 0;
+        __atomic_store_n(xsk->tx.producer, prod + 1, __ATOMIC_RELEASE);
+        xsk->tx_pending = true;
+    }
+    else
+    {
+        /* Make sure the kernel is sending what's on the ring */
+        xsk->tx_drops++;
+        flush = true;
+    }
+
+    if (flush)
+        chirouter_xdp_kick(xsk);
+
+    pthread_mutex_unlock(&xsk->tx_lock);
+
+    return rc;
+}
+
+
+/* See xdp.h */
+int chirouter_xdp_flush(chirouter_xdp_t *xsk)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&xsk->tx_lock);
+    if (xsk->tx_pending)
+        rc = chirouter_xdp_kick(xsk);
+    chirouter_xdp_reap(xsk);
+    pthread_mutex_unlock(&xsk->tx_lock);
+
+    return rc;
+}
+
+#else
+
+/* See xdp.h */
+int chirouter_xdp_umem_init(chirouter_xdp_umem_t *umem, unsigned int num_sockets)
+{
+    umem->area = NULL;
+    umem->free = NULL;
+    pthread_mutex_init(&umem->lock, NULL);
+    errno = ENOTSUP;
+    return -1;
+}
+
+/* See xdp.h */
+void chirouter_xdp_umem_destroy(chirouter_xdp_umem_t *umem)
+{
+    pthread_mutex_destroy(&umem->lock);
+}
+
+/* See xdp.h */
+int chirouter_xdp_open(chirouter_xdp_t *xsk, chirouter_xdp_umem_t *umem, const char *ifname)
+{
+    memset(xsk, 0, sizeof(*xsk));
+    xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+    errno = ENOTSUP;
+    return -1;
+}
+
+/* See xdp.h */
+void chirouter_xdp_close(chirouter_xdp_t *xsk)
+{
+}
+
+/* See xdp.h */
+int chirouter_xdp_recv(chirouter_xdp_t *xsk, chirouter_packet_handler_t handler, void *arg)
+{
+    return -1;
+}
+
+/* See xdp.h */
+int chirouter_xdp_send(chirouter_xdp_t *xsk, const uint8_t *frame, size_t len, bool flush)
+{
+    return -1;
+}
+
+/* See xdp.h */
+int chirouter_xdp_flush(chirouter_xdp_t *xsk)
+{
+    return -1;
+}
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the AF_XDP sockets used to send and receive
+ *  Ethernet frames on Linux interfaces, when chirouter routes Linux
+ *  interfaces itself (see dataplane.h), as an alternative to the
+ *  AF_PACKET sockets in packet.h.
+ *
+ *  chirouter does not depend on libbpf or libxdp: the sockets are set
+ *  up with the raw system calls, and the XDP program that redirects
+ *  the frames received on an interface to its socket is a handful of
+ *  instructions assembled in xdp.c. The program is attached with a BPF
+ *  link, so it is detached as soon as chirouter exits. The program is
+ *  attached in native mode if the driver supports it (veth does), and
+ *  in generic mode otherwise, and the socket uses zero-copy mode if the
+ *  driver supports it, and copy mode otherwise.
+ *
+ *  All the sockets share a single UMEM (the memory the frames are
+ *  received into and sent from), split into XDP_FRAME_SIZE frames:
+ *
+ *  - Frames received on a socket are processed in place, straight from
+ *    the UMEM. When the router forwards the frame it is processing (after
+ *    rewriting its headers in place), the frame is put on the transmit
+ *    ring of the outgoing socket as is, without copying it. Any other
+ *    frame (e.g., an ARP request or an ICMP message built by the router)
+ *    is copied into a free frame of the UMEM.
+ *
+ *  - Once a frame has been processed (or sent), it is put back on the
+ *    fill ring of one of the sockets, to be received into again.
+ *
+ *  If the kernel headers do not define everything we need, or if
+ *  chirouter is built with -DCHIROUTER_XDP=OFF, this module is compiled
+ *  without AF_XDP support, and chirouter_xdp_umem_init always fails.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef XDP_H
+#define XDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "packet.h"
+
+#if !defined(CHIROUTER_DISABLE_XDP) && defined(__has_include)
+#if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#endif
+#endif
+
+/* Shared UMEMs across interfaces (Linux 5.10) and BPF links for XDP
+ * programs (Linux 5.9) are the most recent features we rely on. Kernel
+ * headers with BPF_F_XDP_HAS_FRAGS (Linux 5.18) have all of them. */
+#if defined(XDP_USE_NEED_WAKEUP) && defined(XDP_SHARED_UMEM) && defined(BPF_F_XDP_HAS_FRAGS)
+#define CHIROUTER_HAVE_XDP 1
+#else
+#define CHIROUTER_HAVE_XDP 0
+#endif
+
+/* Size of each frame of the UMEM, number of frames per socket, and
+ * size of the rings of each socket (all powers of two) */
+#define XDP_FRAME_SIZE (2048u)
+#define XDP_FRAMES_PER_SOCKET (4096u)
+#define XDP_RING_SIZE (2048u)
+
+/* A ring shared with the kernel (a fill or transmit ring, which we
+ * produce, or a completion or receive ring, which we consume) */
+typedef struct chirouter_xdp_ring
+{
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t mask;
+
+    /* Where the ring is mapped */
+    void *map;
+    size_t map_size;
+} chirouter_xdp_ring_t;
+
+/* The UMEM shared by all the sockets */
+typedef struct chirouter_xdp_umem
+{
+    /* Frames */
+    uint8_t *area;
+    size_t size;
+
+    /* Free frames (addresses in the UMEM). The ARP threads also send
+     * frames (which are copied into free frames), so the free frames
+     * are protected by lock. */
+    uint64_t *free;
+    unsigned int num_free;
+    pthread_mutex_t lock;
+
+    /* Socket that registered the UMEM (the others share it), or
+     * -1 if no socket has been bound yet */
+    int owner_fd;
+
+    /* Frame being processed by the server thread (see chirouter_xdp_recv),
+     * its address in the UMEM, and whether it has been put on a
+     * transmit ring (in which case it must not be reused yet) */
+    uint8_t *rx_frame;
+    uint64_t rx_addr;
+    bool rx_sent;
+} chirouter_xdp_umem_t;
+
+/* An AF_XDP socket bound to (queue 0 of) a Linux interface */
+typedef struct chirouter_xdp
+{
+    /* Socket */
+    int fd;
+
+    /* UMEM shared by all the sockets */
+    chirouter_xdp_umem_t *umem;
+
+    /* XSKMAP with the socket, the XDP program that redirects
+     * frames to it, and the link that attaches the program */
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+
+    /* Rings. Only the server thread uses the fill and receive rings,
+     * and the transmit and completion rings are protected by tx_lock */
+    chirouter_xdp_ring_t fill;
+    chirouter_xdp_ring_t comp;
+    chirouter_xdp_ring_t rx;
+    chirouter_xdp_ring_t tx;
+    pthread_mutex_t tx_lock;
+
+    /* Whether there are frames on the transmit ring that the
+     * kernel hasn't been told to send yet */
+    bool tx_pending;
+
+    /* Statistics: frames dropped because the transmit ring was full
+     * (or because there were no free frames to copy them into), and
+     * frames forwarded without copying them */
+    uint64_t tx_drops;
+    uint64_t tx_zerocopy;
+} chirouter_xdp_t;
+
+
+/*
+ * chirouter_xdp_umem_init - Allocate the UMEM shared by all the sockets
+ *
+ * umem: UMEM
+ *
+ * num_sockets: Number of sockets that will share the UMEM
+ *
+ * Returns: 0 on success, -1 if an error happens (with errno set to
+ *          ENOTSUP if chirouter was built without AF_XDP support)
+ */
+int chirouter_xdp_umem_init(chirouter_xdp_umem_t *umem, unsigned int num_sockets);
+
+
+/*
+ * chirouter_xdp_umem_destroy - Free the UMEM shared by all the sockets
+ *
+ * Must only be called once all the sockets have been closed.
+ *
+ * umem: UMEM
+ *
+ * Returns: nothing
+ */
+void chirouter_xdp_umem_destroy(chirouter_xdp_umem_t *umem);
+
+
+/*
+ * chirouter_xdp_open - Create an AF_XDP socket bound to a Linux interface
+ *
+ * xsk: Socket
+ *
+ * umem: UMEM shared by all the sockets
+ *
+ * ifname: Name of the Linux interface
+ *
+ * Returns: 0 on success, -1 if an error happens (the socket must
+ *          still be freed with chirouter_xdp_close)
+ */
+int chirouter_xdp_open(chirouter_xdp_t *xsk, chirouter_xdp_umem_t *umem, const char *ifname);
+
+
+/*
+ * chirouter_xdp_close - Free an AF_XDP socket
+ *
+ * Also detaches the XDP program from the interface.
+ *
+ * xsk: Socket
+ *
+ * Returns: nothing
+ */
+void chirouter_xdp_close(chirouter_xdp_t *xsk);
+
+
+/*
+ * chirouter_xdp_recv - Process the frames received on a socket
+ *
+ * Must only be called from the server thread.
+ *
+ * xsk: Socket
+ *
+ * handler: Function called for each frame
+ *
+ * arg: Argument passed to the handler
+ *
+ * Returns: number of frames processed, or -1 if the handler returned -1
+ */
+int chirouter_xdp_recv(chirouter_xdp_t *xsk, chirouter_packet_handler_t handler, void *arg);
+
+
+/*
+ * chirouter_xdp_send - Queue a frame for transmission
+ *
+ * If the frame is the one being processed by chirouter_xdp_recv, it is
+ * queued as is. Otherwise, it is copied into a free frame of the UMEM.
+ * The frame is only sent once chirouter_xdp_flush is called (or right
+ * away, if flush is true). If the transmit ring is full, the frame
+ * is dropped.
+ *
+ * xsk: Socket
+ *
+ * frame: Frame
+ *
+ * len: Length of the frame
+ *
+ * flush: Whether to tell the kernel to send the frame right away
+ *
+ * Returns: 0 on success, 1 if the frame was dropped, -1 if the
+ *          frame does not fit in a frame of the UMEM
+ */
+int chirouter_xdp_send(chirouter_xdp_t *xsk, const uint8_t *frame, size_t len, bool flush);
+
+
+/*
+ * chirouter_xdp_flush - Send the frames queued for transmission
+ *
+ * Also takes back the frames the kernel is done sending.
+ *
+ * xsk: Socket
+ *
+ * Returns: 0 on success, -1 if an error happens
+ */
+int chirouter_xdp_flush(chirouter_xdp_t *xsk);
+
+#endif
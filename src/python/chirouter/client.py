@@ -1,6 +1,12 @@
 import socket
 import struct
 import errno
+import mmap
+import os
+import platform
+import select
+import ctypes
+import threading
 
 from chirouter.topology import Topology
 
@@ -15,7 +21,8 @@ class ChirouterMessage(object):
     MSG_TYPE_RTABLE_ENTRY = 5
     MSG_TYPE_END_CONFIG = 6
     MSG_TYPE_ETHERNET_FRAME = 7
-
+    MSG_TYPE_NEIGHBORS = 8
+    MSG_TYPE_FRAME_BATCH = 9
 
     SUBTYPE_NONE = 0
     SUBTYPE_TO_ROUTER = 1
@@ -31,12 +38,18 @@ class ChirouterMessage(object):
         msg_type, msg_subtype, payload_len = struct.unpack("!BBH", view[:4])
 
         if msg_type == ChirouterMessage.MSG_TYPE_HELLO:
+            flags = None
+            if payload_len >= 1:
+                flags = struct.unpack("!B", view[4:5])[0]
+
             if msg_subtype == ChirouterMessage.SUBTYPE_TO_ROUTER:
-                return ChirouterMessageHello(from_router=False)
+                return ChirouterMessageHello(from_router=False, flags=flags)
             elif msg_subtype == ChirouterMessage.SUBTYPE_FROM_ROUTER:
-                return ChirouterMessageHello(from_router=True)
+                return ChirouterMessageHello(from_router=True, flags=flags)
         elif msg_type == ChirouterMessage.MSG_TYPE_ETHERNET_FRAME:
             return ChirouterMessageEthernetFrame.from_buffer(buf)
+        elif msg_type == ChirouterMessage.MSG_TYPE_FRAME_BATCH:
+            return ChirouterMessageFrameBatch.from_buffer(buf)
 
 
         return None
@@ -52,7 +65,12 @@ class ChirouterMessage(object):
 
 
 class ChirouterMessageHello(ChirouterMessage):
-    def __init__(self, from_router):
+    FLAG_SHM = 0x01
+    FLAG_FRAME_BATCH = 0x02
+
+    def __init__(self, from_router, flags=None):
+        self.flags = flags
+
         if from_router:
             ChirouterMessage.__init__(self,
                                       msg_type=ChirouterMessage.MSG_TYPE_HELLO,
@@ -63,7 +81,10 @@ class ChirouterMessageHello(ChirouterMessage):
                                       subtype=ChirouterMessage.SUBTYPE_TO_ROUTER)
 
     def pack(self):
-        return self._pack()
+        if self.flags is None:
+            return self._pack()
+        else:
+            return self._pack(1, struct.pack("!B", self.flags))
 
 
 class ChirouterMessageRouters(ChirouterMessage):
@@ -130,6 +151,26 @@ class ChirouterMessageRTableEntry(ChirouterMessage):
         return self._pack(16, payload)
 
 
+class ChirouterMessageNeighbors(ChirouterMessage):
+    MAX_NEIGHBORS = 255
+
+    def __init__(self, rid, neighbors):
+        ChirouterMessage.__init__(self,
+                                  msg_type=ChirouterMessage.MSG_TYPE_NEIGHBORS,
+                                  subtype=ChirouterMessage.SUBTYPE_NONE)
+
+        assert len(neighbors) <= ChirouterMessageNeighbors.MAX_NEIGHBORS
+
+        self.rid = rid
+        self.neighbors = neighbors
+
+    def pack(self):
+        payload = struct.pack("!BB", self.rid, len(self.neighbors))
+        for hwaddr, ipaddr in self.neighbors:
+            payload += hwaddr + ipaddr
+        return self._pack(2 + 10 * len(self.neighbors), payload)
+
+
 class ChirouterMessageEndConfig(ChirouterMessage):
     def __init__(self):
         ChirouterMessage.__init__(self,
@@ -175,26 +216,279 @@ class ChirouterMessageEthernetFrame(ChirouterMessage):
         return cls(rid, iface_id, frame_len, buf[8:8+frame_len], from_router)
 
 
+class ChirouterMessageFrameBatch(ChirouterMessage):
+    # Each frame takes the same space as the payload of an ETHERNET FRAME message
+    MAX_PAYLOAD_LEN = 65535
+
+    def __init__(self, frames, from_router):
+
+        if from_router:
+            ChirouterMessage.__init__(self,
+                                      msg_type=ChirouterMessage.MSG_TYPE_FRAME_BATCH,
+                                      subtype=ChirouterMessage.SUBTYPE_FROM_ROUTER)
+        else:
+            ChirouterMessage.__init__(self,
+                                      msg_type=ChirouterMessage.MSG_TYPE_FRAME_BATCH,
+                                      subtype=ChirouterMessage.SUBTYPE_TO_ROUTER)
+        self.frames = frames
+
+    def pack(self):
+        payload = b"".join(struct.pack("!BBH", f.rid, f.iface_id, f.frame_len) + f.frame
+                           for f in self.frames)
+        return self._pack(len(payload), payload)
+
+    @classmethod
+    def from_buffer(cls, buf):
+        view = memoryview(buf)
+        msg_type, msg_subtype, payload_len = struct.unpack("!BBH", view[:4])
+
+        assert msg_type == ChirouterMessage.MSG_TYPE_FRAME_BATCH
+
+        if msg_subtype == ChirouterMessage.SUBTYPE_FROM_ROUTER:
+            from_router = True
+        elif  msg_subtype == ChirouterMessage.SUBTYPE_TO_ROUTER:
+            from_router = False
+
+        frames = []
+        pos = 4
+        end = payload_len + 4
+        while pos < end:
+            if pos + 4 > end:
+                raise ChirouterClientException("Received a FRAME BATCH message with a truncated frame")
+            rid, iface_id, frame_len = struct.unpack("!BBH", view[pos:pos+4])
+            if pos + 4 + frame_len > end:
+                raise ChirouterClientException("Received a FRAME BATCH message with a truncated frame")
+            frames.append(ChirouterMessageEthernetFrame(rid, iface_id, frame_len,
+                                                        buf[pos+4:pos+4+frame_len], from_router))
+            pos += 4 + frame_len
+
+        return cls(frames, from_router)
+
+
+
+def recv_fd(sock):
+    """
+    Receives a file descriptor sent by chirouter (along with a single byte)
+    """
+    if hasattr(sock, "recvmsg"):
+        fd_size = struct.calcsize("i")
+        _, ancdata, _, _ = sock.recvmsg(1, socket.CMSG_SPACE(fd_size))
+        for level, cmsg_type, data in ancdata:
+            if level == socket.SOL_SOCKET and cmsg_type == socket.SCM_RIGHTS:
+                return struct.unpack("i", data[:fd_size])[0]
+        raise ChirouterClientException("chirouter did not send a file descriptor")
+    else:
+        # Python 2 can only receive file descriptors with multiprocessing
+        import _multiprocessing
+        return _multiprocessing.recvfd(sock.fileno())
+
+
+class ChirouterSharedMemory(object):
+    """
+    The rings Ethernet frames are exchanged with chirouter through. See
+    src/c/shm.h for the layout of the shared memory, and for how each
+    side wakes up the other.
+
+    Only works on x86-64 hosts (see supported()): anywhere else, the
+    controller has to exchange the frames through the socket.
+    """
+    MAGIC = 0x43485348
+    VERSION = 1
+    HDR_SIZE = 4096
+
+    RING_TO_ROUTER = 0
+    RING_FROM_ROUTER = 1
+
+    HEAD = 0
+    TAIL = 64
+    READER_WAITING = 128
+    WRITER_WAITING = 192
+
+    # We can't put a fence between setting a waiting flag and checking
+    # the ring again, so we can miss a wake-up, and never wait for longer
+    # than this (in seconds) without checking the rings
+    RECHECK_INTERVAL = 0.01
+
+    # The heads, tails and flags are read and written through ctypes,
+    # which accesses each of them with a single aligned load or store.
+    # On x86-64, such an access is atomic, and the processor keeps stores
+    # in order (and loads in order), so chirouter never sees a partially
+    # written index, or an index before the data it covers (and we never
+    # read data before the index that covers it). Other architectures
+    # make no such guarantees, and Python has no atomics or fences.
+    SUPPORTED_MACHINES = ("x86_64", "amd64")
+
+    @classmethod
+    def supported(cls):
+        return platform.machine().lower() in cls.SUPPORTED_MACHINES
+
+    def __init__(self, memfd, router_eventfd, controller_eventfd):
+        size = os.fstat(memfd).st_size
+        self.mem = mmap.mmap(memfd, size)
+        os.close(memfd)
+
+        magic, version, self.ring_size = struct.unpack_from("=IIQ", self.mem, 0)
+        if magic != self.MAGIC or version != self.VERSION:
+            raise ChirouterClientException("Unexpected shared memory from chirouter")
+
+        self.data = [self.HDR_SIZE, self.HDR_SIZE + self.ring_size]
+        self.router_eventfd = router_eventfd
+        self.controller_eventfd = controller_eventfd
+        self.closed = False
+
+        self.fields = []
+        for ring in (self.RING_TO_ROUTER, self.RING_FROM_ROUTER):
+            offset = 64 + 256 * ring
+            self.fields.append({
+                self.HEAD: ctypes.c_uint64.from_buffer(self.mem, offset + self.HEAD),
+                self.TAIL: ctypes.c_uint64.from_buffer(self.mem, offset + self.TAIL),
+                self.READER_WAITING: ctypes.c_uint32.from_buffer(self.mem, offset + self.READER_WAITING),
+                self.WRITER_WAITING: ctypes.c_uint32.from_buffer(self.mem, offset + self.WRITER_WAITING)})
+
+    def _get(self, ring, field):
+        return self.fields[ring][field].value
+
+    def _set(self, ring, field, value):
+        self.fields[ring][field].value = value
+
+    def _wake_router(self, ring, field):
+        if self._get(ring, field):
+            self._set(ring, field, 0)
+            os.write(self.router_eventfd, struct.pack("=Q", 1))
+
+    def _wait(self, sock=None):
+        """
+        Waits for chirouter to write to our eventfd (or for the socket to
+        become readable, if given). Returns the sockets that are readable.
+        """
+        fds = [self.controller_eventfd] + ([sock] if sock is not None else [])
+        readable, _, _ = select.select(fds, [], [], self.RECHECK_INTERVAL)
+        if self.controller_eventfd in readable:
+            try:
+                os.read(self.controller_eventfd, 8)
+            except OSError:
+                pass
+        return readable
+
+    def write(self, data):
+        """
+        Writes a message to the ring to chirouter (waiting for room if
+        needed). Returns False if chirouter closed the connection while
+        we were waiting.
+        """
+        ring = self.RING_TO_ROUTER
+        tail = self._get(ring, self.TAIL)
+
+        # Ask chirouter to wake us up once it makes room (it may have
+        # done so before it could see the flag). The reader thread
+        # waits on the same eventfd, and may take our wake-up, so we
+        # also check the ring every RECHECK_INTERVAL.
+        while self.ring_size - (tail - self._get(ring, self.HEAD)) < len(data):
+            if self.closed:
+                return False
+            self._set(ring, self.WRITER_WAITING, 1)
+            if self.ring_size - (tail - self._get(ring, self.HEAD)) >= len(data):
+                self._set(ring, self.WRITER_WAITING, 0)
+                break
+            self._wait()
+
+        start = self.data[ring]
+        pos = tail % self.ring_size
+        first = min(len(data), self.ring_size - pos)
+        self.mem[start + pos:start + pos + first] = data[:first]
+        self.mem[start:start + len(data) - first] = data[first:]
+        self._set(ring, self.TAIL, tail + len(data))
+
+        self._wake_router(ring, self.READER_WAITING)
+        return True
+
+    def read(self, sock):
+        """
+        Reads whatever chirouter has written to the ring to the controller
+        (waiting for it to write something if needed). Returns an empty
+        string once chirouter closes the socket.
+        """
+        ring = self.RING_FROM_ROUTER
+        start = self.data[ring]
+
+        while True:
+            head = self._get(ring, self.HEAD)
+            tail = self._get(ring, self.TAIL)
+
+            if tail != head:
+                pos = head % self.ring_size
+                first = min(tail - head, self.ring_size - pos)
+                data = self.mem[start + pos:start + pos + first] + self.mem[start:start + tail - head - first]
+                self._set(ring, self.HEAD, tail)
+
+                self._wake_router(ring, self.WRITER_WAITING)
+                return data
+
+            self._set(ring, self.READER_WAITING, 1)
+            if self._get(ring, self.TAIL) != head:
+                continue
+
+            if sock in self._wait(sock) and len(sock.recv(1)) == 0:
+                self.closed = True
+                return ""
+
 
 class ChirouterClient(object):
-    def __init__(self, hostname, port, topology):
+    # How much we read from the socket at a time. chirouter sends packets
+    # of up to 64KB on a SOCK_SEQPACKET socket, and a packet can't be read
+    # in parts, so this must be at least that large
+    RECV_SIZE = 65536
+
+    # chirouter receives packets of up to 4KB on a SOCK_SEQPACKET socket
+    # (see SERVER_SEQPACKET_SLOT_SIZE), so that's as large as a FRAME
+    # BATCH message sent over one can be
+    SEQPACKET_MAX_BATCH_PAYLOAD_LEN = 4096 - 4
+
+    def __init__(self, hostname, port, topology, static_neighbors=False,
+                 unix_path=None, seqpacket=False, shm=False):
         self.connected = False
         self.hostname = hostname
         self.port = port
+        self.unix_path = unix_path
+        self.seqpacket = seqpacket
+        self.use_shm = shm
+        self.shm = None
         self.topology = topology
+        self.static_neighbors = static_neighbors
         self.conn = None
 
+        # If chirouter accepts FRAME BATCH messages, the Ethernet frames
+        # are queued, and a separate thread sends all the frames queued
+        # while it was sending the previous ones in a single message
+        self.frame_batch = False
+        self.batch_frames = []
+        self.batch_cond = threading.Condition()
+        self.batch_thread = None
+        self.closed = False
+
         self.router_ids = {}
         self.router_nodes = {}
         self.iface_ids = {}
         self.iface_nodes = {}
 
     def connect(self):
-        self.conn = socket.create_connection((self.hostname, self.port))
+        if self.unix_path is not None:
+            # Each send_msg() call sends a single message, which is what
+            # chirouter expects from every packet on a SOCK_SEQPACKET socket
+            sock_type = socket.SOCK_SEQPACKET if self.seqpacket else socket.SOCK_STREAM
+            self.conn = socket.socket(socket.AF_UNIX, sock_type)
+            self.conn.connect(self.unix_path)
+        else:
+            self.conn = socket.create_connection((self.hostname, self.port))
 
-        hello = ChirouterMessageHello(from_router=False)
-        self.send_msg(hello)
-        reply = self.received_messages.next()
+        if self.use_shm and self.unix_path is not None and ChirouterSharedMemory.supported():
+            self.connect_shm()
+        else:
+            hello = ChirouterMessageHello(from_router=False, flags=ChirouterMessageHello.FLAG_FRAME_BATCH)
+            self.send_msg(hello)
+            reply = self.received_messages.next()
+            self.frame_batch = bool(reply.flags is not None and
+                                    reply.flags & ChirouterMessageHello.FLAG_FRAME_BATCH)
 
         routers = ChirouterMessageRouters(self.topology.num_routers)
         self.send_msg(routers)
@@ -249,51 +543,152 @@ class ChirouterClient(object):
 
                 self.send_msg(rtable_msg)
 
+            if self.static_neighbors:
+                neighbors = [(iface.hwaddr_packed, iface.ip_packed)
+                             for iface in self.topology.neighbors(router)]
+                step = ChirouterMessageNeighbors.MAX_NEIGHBORS
+
+                for i in range(0, len(neighbors), step):
+                    neighbors_msg = ChirouterMessageNeighbors(rid = rid,
+                                                              neighbors = neighbors[i:i+step])
+                    self.send_msg(neighbors_msg)
+
             rid += 1
 
         done_msg = ChirouterMessageEndConfig()
         self.send_msg(done_msg)
         self.connected = True
 
+        if self.frame_batch:
+            self.batch_thread = threading.Thread(target=self.send_batches)
+            self.batch_thread.daemon = True
+            self.batch_thread.start()
 
 
-    @property
-    def received_messages(self):
 
-        msg_buffer = bytearray(4096)
+    def connect_shm(self):
+        # Ask for shared memory. If chirouter accepts, its HELLO is followed
+        # by the file descriptors of the shared memory, so we can't read
+        # any further than the end of the HELLO
+        hello = ChirouterMessageHello(from_router=False,
+                                      flags=ChirouterMessageHello.FLAG_SHM | ChirouterMessageHello.FLAG_FRAME_BATCH)
+        self.send_msg(hello)
 
-        bufpos = 0
+        reply = bytearray()
+        while len(reply) < 5:
+            data = self.conn.recv(5 - len(reply))
+            if len(data) == 0:
+                raise ChirouterClientException("chirouter closed the connection")
+            reply += data
 
-        reading_header = True
+        reply = ChirouterMessage.from_buffer(reply)
+        self.frame_batch = bool(reply.flags & ChirouterMessageHello.FLAG_FRAME_BATCH)
+        if reply.flags & ChirouterMessageHello.FLAG_SHM:
+            fds = [recv_fd(self.conn) for i in range(3)]
+            self.shm = ChirouterSharedMemory(*fds)
 
-        while True:
-            recv_buffer = self.conn.recv(4096)
+    @property
+    def received_messages(self):
+        """
+        Yields the messages chirouter sends (the frames in a FRAME BATCH
+        message are yielded as separate ETHERNET FRAME messages)
+        """
+        if self.shm is not None:
+            read = lambda: self.shm.read(self.conn)
+        else:
+            # On a SOCK_SEQPACKET socket, a packet can contain several
+            # messages (and the end of a message can be in the next packet)
+            read = lambda: self.conn.recv(self.RECV_SIZE)
 
-            if len(recv_buffer) == 0:
-                raise StopIteration
+        msg_buffer = bytearray()
 
-            recv_buffer = bytearray(recv_buffer)
-            for b in recv_buffer:
-                msg_buffer[bufpos] = b
-                bufpos += 1
+        while True:
+            data = read()
+            if len(data) == 0:
+                return
+
+            msg_buffer += data
+            pos = 0
+            while len(msg_buffer) - pos >= 4:
+                _, _, payload_len = struct.unpack_from("!BBH", msg_buffer, pos)
+                if len(msg_buffer) - pos < payload_len + 4:
+                    break
+
+                msg = ChirouterMessage.from_buffer(msg_buffer[pos:pos + payload_len + 4])
+                pos += payload_len + 4
+
+                if isinstance(msg, ChirouterMessageFrameBatch):
+                    for frame in msg.frames:
+                        yield frame
+                else:
+                    yield msg
 
-                if reading_header and bufpos == 4:
-                    # We have a header
-                    _, _, payload_len = struct.unpack("!BBH", msg_buffer[:4])
-                    reading_header = False
+            del msg_buffer[:pos]
 
-                if not reading_header and bufpos == (payload_len + 4):
-                    msg = ChirouterMessage.from_buffer(msg_buffer)
-                    yield msg
-                    reading_header = True
-                    bufpos = 0
-                    payload_len = 0
+    def send_batches(self):
+        """
+        Sends the queued Ethernet frames in FRAME BATCH messages (runs in
+        its own thread, see send_msg)
+        """
+        if self.seqpacket and self.shm is None:
+            max_payload_len = self.SEQPACKET_MAX_BATCH_PAYLOAD_LEN
+        else:
+            max_payload_len = ChirouterMessageFrameBatch.MAX_PAYLOAD_LEN
+
+        while True:
+            with self.batch_cond:
+                while not self.batch_frames:
+                    self.batch_cond.wait()
+                frames = self.batch_frames
+                self.batch_frames = []
+
+            batches = []
+            batch = []
+            batch_len = 0
+            for frame in frames:
+                if batch and batch_len + 4 + frame.frame_len > max_payload_len:
+                    batches.append(batch)
+                    batch = []
+                    batch_len = 0
+                batch.append(frame)
+                batch_len += 4 + frame.frame_len
+            batches.append(batch)
+
+            packed_msgs = [ChirouterMessageFrameBatch(batch, from_router=False).pack() for batch in batches]
+            if not self.send_packed(packed_msgs):
+                self.closed = True
+                return
 
     def send_msg(self, msg):
-        packed_msg = msg.pack()
+        # Once the routers are running, Ethernet frames are sent by the
+        # thread that batches them, if chirouter accepts batches
+        if self.batch_thread is not None and isinstance(msg, ChirouterMessageEthernetFrame):
+            if self.closed:
+                return False
+            with self.batch_cond:
+                self.batch_frames.append(msg)
+                self.batch_cond.notify()
+            return True
+
+        return self.send_packed([msg.pack()])
+
+    def send_packed(self, packed_msgs):
+        # Once the routers are running, Ethernet frames go through the
+        # shared memory instead of the socket
+        if self.shm is not None and self.connected:
+            for packed_msg in packed_msgs:
+                if not self.shm.write(packed_msg):
+                    return False
+            return True
 
         try:
-            self.conn.sendall(packed_msg)
+            # On a SOCK_SEQPACKET socket, each message has to be sent
+            # in a packet of its own
+            if self.seqpacket:
+                for packed_msg in packed_msgs:
+                    self.conn.sendall(packed_msg)
+            else:
+                self.conn.sendall(b"".join(packed_msgs))
         except IOError, e:
             if e.errno == errno.EPIPE:
                 return False
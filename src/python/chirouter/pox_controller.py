@@ -2,12 +2,13 @@ import threading
 import os.path
 import sys
 
-from chirouter.client import ChirouterClient, ChirouterMessageEthernetFrame
+from chirouter.client import ChirouterClient, ChirouterMessageEthernetFrame, ChirouterSharedMemory
 import chirouter.topology as topo
 
 from pox.core import core
 import pox.openflow.libopenflow_01 as of
 from pox.lib.packet.ethernet import ethernet
+from pox.lib.util import str_to_bool
 
 log = core.getLogger()
 
@@ -124,13 +125,33 @@ class SwitchController(object):
         pass
 
 
-def launch(topo_file, chirouter_host="localhost", chirouter_port="23300"):
+def launch(topo_file, chirouter_host="localhost", chirouter_port="23300", static_neighbors=False,
+           chirouter_unix=None, chirouter_seqpacket=False, chirouter_shm=False):
+    """
+    Connects the routers in the topology file to chirouter.
+
+    --static-neighbors=True sends chirouter the MAC address of every host
+    and router directly connected to each router, so it does not have to
+    ARP for them. Only interfaces with a "hwaddr" field in the topology
+    file are sent (see topologies/basic.json), so this option has no
+    effect on topologies whose hosts do not have one.
+    """
     if not os.path.exists(topo_file):
         print "ERROR: Topology file %s does not exists" % topo_file
         sys.exit(1)
 
     topology = topo.Topology.from_json(open(topo_file))
-    client = ChirouterClient(chirouter_host, int(chirouter_port), topology)
+
+    if str_to_bool(chirouter_shm) and not ChirouterSharedMemory.supported():
+        log.warning("Shared memory is only supported on x86-64 hosts: "
+                    "exchanging the Ethernet frames with chirouter through the socket instead")
+
+    # Options given on the POX command line are strings (or True, if they
+    # have no value), so bool() would turn "False" into True
+    client = ChirouterClient(chirouter_host, int(chirouter_port), topology,
+                             static_neighbors=str_to_bool(static_neighbors),
+                             unix_path=chirouter_unix, seqpacket=str_to_bool(chirouter_seqpacket),
+                             shm=str_to_bool(chirouter_shm))
     router_controllers = {}
 
     def process_messages():
@@ -22,8 +22,17 @@ class POXController(Controller):
         params  = ["log.level", "--DEBUG", "--packet=CRITICAL", "--port=%s"]
         params += ["chirouter.pox_controller"]
         params += ["--topo-file=" + topo_file]
-        params += ["--chirouter-host=" + chirouter_host]
-        params += ["--chirouter-port=" + str(chirouter_port)]
+        if chirouter_host in ("unix", "seqpacket", "shm"):
+            # chirouter is listening on a Unix domain socket (the "port"
+            # is the path of the socket)
+            params += ["--chirouter-unix=" + chirouter_port]
+            if chirouter_host == "seqpacket":
+                params += ["--chirouter-seqpacket=True"]
+            elif chirouter_host == "shm":
+                params += ["--chirouter-shm=True"]
+        else:
+            params += ["--chirouter-host=" + chirouter_host]
+            params += ["--chirouter-port=" + str(chirouter_port)]
 
         cargs = " ".join(params)
 
@@ -210,6 +210,41 @@ class Topology(object):
 
         self.links.append( (src, src_iface, dst, dst_iface) )
 
+    def neighbors(self, router):
+        """
+        Returns the interfaces (of hosts and other routers) that are on the
+        same Ethernet segment and IP subnet as one of the router's interfaces,
+        and that have a known hardware address.
+        """
+        adjacent = {}
+        for src, src_iface, dst, dst_iface in self.links:
+            adjacent.setdefault(src, []).append((src_iface, dst, dst_iface))
+            adjacent.setdefault(dst, []).append((dst_iface, src, src_iface))
+
+        neighbors = []
+        for iface_name, iface in sorted(router.interfaces.items()):
+            network = iface._iface.network
+            visited = set([router])
+            pending = [(node, node_iface) for (local_iface, node, node_iface) in adjacent.get(router, [])
+                                          if local_iface == iface_name]
+
+            # Traverse switches until we reach the hosts/routers in the segment
+            while pending:
+                node, node_iface = pending.pop()
+                if node in visited:
+                    continue
+                visited.add(node)
+
+                if isinstance(node, Router) or isinstance(node, Host):
+                    if node_iface in node.interfaces:
+                        n = node.interfaces[node_iface]
+                        if n.hwaddr is not None and n._iface.ip in network:
+                            neighbors.append(n)
+                else:
+                    pending += [(n, n_iface) for (_, n, n_iface) in adjacent.get(node, [])]
+
+        return neighbors
+
     @classmethod
     def from_json(cls, json_file):
         t = json.load(json_file)
@@ -252,7 +287,11 @@ class Topology(object):
         topo = mininet.topo.Topo()
 
         for h in self.hosts:
-            mn_host = topo.addHost(h.hostname)
+            hwaddrs = [iface.hwaddr for iface in h.interfaces.values()]
+            if len(hwaddrs) == 1 and hwaddrs[0] is not None:
+                mn_host = topo.addHost(h.hostname, mac=hwaddrs[0])
+            else:
+                mn_host = topo.addHost(h.hostname)
 
         for s in self.switches + self.routers:
             mn_switch = topo.addSwitch(s.name)
@@ -0,0 +1,186 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a benchmark for vector mode (see vector.h).
+ *
+ *  It configures a router and sends it a stream of echo requests to
+ *  forward, in ETHERNET FRAME messages, first without vector mode and
+ *  then with it, and reports the CPU time the server spends per
+ *  forwarded frame in each case. The time includes reading the
+ *  messages from the socket, parsing them, forwarding the frames and
+ *  sending the forwarded frames back to the controller, but not the
+ *  controller's side of the connection. Each mode is run BENCH_RUNS
+ *  times (alternating between them), and the best run is reported.
+ *
+ *  Usage: bench_vector [FRAMES]
+ *
+ */
+
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "harness.h"
+
+/* Default number of frames sent to the router in each run */
+#define BENCH_FRAMES (1500000u)
+
+/* Number of messages sent to the server at a time */
+#define BENCH_CHUNK (256u)
+
+/* Number of runs in each mode (the best one is reported) */
+#define BENCH_RUNS (5u)
+
+
+/*
+ * thread_cpu_ns - CPU time used so far by the calling thread
+ *
+ * Returns: CPU time, in nanoseconds
+ */
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+
+/*
+ * bench_run - Sends a stream of echo requests to a router
+ *
+ * vector: Whether to use vector mode
+ *
+ * frames: Number of echo requests to send
+ *
+ * Returns: CPU time the server spent per forwarded frame, in nanoseconds
+ */
+static double bench_run(bool vector, unsigned long frames)
+{
+    static uint8_t chunk[BENCH_CHUNK * TEST_ECHO_MSG_LEN];
+    test_ctl_t *ctl = malloc(sizeof(test_ctl_t));
+    size_t sent = 0, total = frames * TEST_ECHO_MSG_LEN;
+    unsigned long forwarded = 0;
+    uint64_t server_ns = 0;
+
+    test_ctl_connect(ctl);
+    ctl->server->vector_enabled = vector;
+    test_ctl_configure(ctl, 1);
+
+    for (unsigned int i = 0; i < BENCH_CHUNK; i++)
+        test_echo_request_msg(chunk + i * TEST_ECHO_MSG_LEN, 0, (uint16_t) i);
+
+    /* The stream of messages is the chunk over and over again */
+    while (forwarded < frames)
+    {
+        uint64_t start;
+
+        if (sent < total)
+        {
+            size_t offset = sent % sizeof(chunk);
+            size_t len = sizeof(chunk) - offset;
+            ssize_t rc;
+
+            if (len > total - sent)
+                len = total - sent;
+
+            rc = send(ctl->fd, chunk + offset, len, 0);
+            if (rc == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+                test_fail("send() to the server failed: %s", strerror(errno));
+            if (rc > 0)
+                sent += rc;
+        }
+
+        start = thread_cpu_ns();
+        if (chirouter_server_process_messages(ctl->conn) != 0)
+            test_fail("The server closed the connection");
+        server_ns += thread_cpu_ns() - start;
+
+        forwarded += test_ctl_read_frames(ctl, NULL, NULL);
+    }
+
+    test_ctl_close(ctl);
+    free(ctl);
+
+    return (double) server_ns / forwarded;
+}
+
+
+int main(int argc, char *argv[])
+{
+    unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_FRAMES;
+    double scalar_ns = 0, vector_ns = 0;
+
+    if (frames == 0)
+    {
+        fprintf(stderr, "Usage: %s [FRAMES]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned int run = 0; run < BENCH_RUNS; run++)
+    {
+        double ns = bench_run(false, frames);
+
+        if (run == 0 || ns < scalar_ns)
+            scalar_ns = ns;
+
+        ns = bench_run(true, frames);
+        if (run == 0 || ns < vector_ns)
+            vector_ns = ns;
+    }
+
+    printf("%lu frames (best of %u runs): %.0f ns per frame without -V, %.0f ns per frame with -V\n",
+           frames, BENCH_RUNS, scalar_ns, vector_ns);
+
+    return EXIT_SUCCESS;
+}
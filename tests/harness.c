@@ -0,0 +1,478 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the helpers shared by the test drivers.
+ *
+ *  See harness.h for more details
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "harness.h"
+#include "arp.h"
+#include "utils.h"
+
+/* Addresses of the hosts on each side of the routers */
+static const uint8_t host1_mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xaa, 0x01};
+static const uint8_t host2_mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xbb, 0x02};
+#define HOST1_IP "10.0.1.5"
+#define HOST2_IP "10.0.2.7"
+
+/* Identifier of the echo requests built by test_echo_request */
+#define TEST_ECHO_ID (0x7465)
+
+
+/* See harness.h */
+void test_fail(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+
+    exit(EXIT_FAILURE);
+}
+
+
+/*
+ * router_mac - Builds the MAC address of an interface of a test router
+ *
+ * mac: Where the address is stored
+ *
+ * r_id: Router ID
+ *
+ * iface_id: Interface ID
+ *
+ * Returns: nothing
+ */
+static void router_mac(uint8_t *mac, uint8_t r_id, uint8_t iface_id)
+{
+    uint8_t addr[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, (uint8_t) (r_id + 1), (uint8_t) (iface_id + 1)};
+
+    memcpy(mac, addr, ETHER_ADDR_LEN);
+}
+
+
+/*
+ * put_msg - Appends a message to a buffer
+ *
+ * buf: Buffer
+ *
+ * len: Bytes already in the buffer (updated)
+ *
+ * type, subtype: Message type and subtype
+ *
+ * payload, payload_len: Payload of the message
+ *
+ * Returns: nothing
+ */
+static void put_msg(uint8_t *buf, size_t *len, uint8_t type, uint8_t subtype,
+                    const void *payload, uint16_t payload_len)
+{
+    uint16_t nlen = htons(payload_len);
+
+    buf[*len] = type;
+    buf[*len + 1] = subtype;
+    memcpy(buf + *len + 2, &nlen, 2);
+    if (payload_len > 0)
+        memcpy(buf + *len + 4, payload, payload_len);
+    *len += MSG_HDR_LEN + payload_len;
+}
+
+
+/*
+ * send_all - Sends a buffer to the server, and has the server process it
+ *
+ * ctl: Controller side of the connection
+ *
+ * buf, len: Data to send
+ *
+ * Returns: nothing (exits if anything fails)
+ */
+static void send_all(test_ctl_t *ctl, const uint8_t *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(ctl->fd, buf, len, 0);
+
+        if (n == -1)
+            test_fail("send() to the server failed: %s", strerror(errno));
+
+        buf += n;
+        len -= n;
+
+        if (chirouter_server_process_messages(ctl->conn) != 0)
+            test_fail("The server closed the connection");
+    }
+}
+
+
+/* See harness.h */
+int test_ctl_send_msg(test_ctl_t *ctl, uint8_t type, uint8_t subtype, const void *payload, uint16_t payload_len)
+{
+    static uint8_t buf[MSG_MAX_LEN];
+    size_t len = 0;
+
+    put_msg(buf, &len, type, subtype, payload, payload_len);
+    if (send(ctl->fd, buf, len, 0) != (ssize_t) len)
+        test_fail("send() to the server failed: %s", strerror(errno));
+
+    return chirouter_server_process_messages(ctl->conn);
+}
+
+
+/* See harness.h */
+void test_ctl_connect(test_ctl_t *ctl)
+{
+    int sv[2];
+
+    memset(ctl, 0, sizeof(test_ctl_t));
+
+    if (chirouter_server_ctx_init(&ctl->server))
+        test_fail("Could not create server context");
+
+    /* Same defaults as main() */
+    ctl->server->arp_rate = 100;
+    ctl->server->arp_burst = 20;
+    ctl->server->outq_policy = OUTQ_BLOCK;
+    ctl->server->outq_size = 4096 * 1024;
+    ctl->server->outq_high = ctl->server->outq_size * 75 / 100;
+    ctl->server->outq_low = ctl->server->outq_size * 25 / 100;
+    chirouter_arp_parse_schedule("1000,1000,1000,1000,1000", ctl->server->arp_schedule,
+                                 &ctl->server->arp_schedule_len);
+
+    ctl->server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctl->server->epoll_fd == -1)
+        test_fail("Could not create epoll instance");
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        test_fail("Could not create socket pair");
+
+    /* The server's end is non-blocking, as if it had been accepted */
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+    ctl->fd = sv[1];
+
+    if (chirouter_server_conn_create(ctl->server, sv[0], "test") == -1)
+        test_fail("Could not create connection");
+    ctl->conn = ctl->server->conns;
+}
+
+
+/* See harness.h */
+void test_ctl_configure(test_ctl_t *ctl, unsigned int num_routers)
+{
+    static uint8_t buf[64 * 1024];
+    uint8_t payload[64];
+    size_t len = 0;
+    struct in_addr addr;
+    uint8_t arp[TEST_ARP_FRAME_LEN];
+
+    put_msg(buf, &len, MSG_TYPE_HELLO, TO_ROUTER, NULL, 0);
+    payload[0] = num_routers;
+    put_msg(buf, &len, MSG_TYPE_ROUTERS, 0, payload, 1);
+
+    for (unsigned int r = 0; r < num_routers; r++)
+    {
+        static const char *iface_names[] = {"eth1", "eth2"};
+        static const char *iface_ips[] = {"10.0.1.1", "10.0.2.1"};
+        static const char *networks[] = {"10.0.1.0", "10.0.2.0"};
+        char name[MAX_ROUTER_NAMELEN];
+        int name_len = snprintf(name, sizeof(name), "r%u", r + 1);
+
+        payload[0] = r;
+        payload[1] = 2;
+        payload[2] = 2;
+        memcpy(payload + 3, name, name_len);
+        put_msg(buf, &len, MSG_TYPE_ROUTER, 0, payload, 3 + name_len);
+
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            payload[0] = r;
+            payload[1] = i;
+            router_mac(payload + 2, r, i);
+            inet_pton(AF_INET, iface_ips[i], payload + 8);
+            memcpy(payload + 12, iface_names[i], 4);
+            put_msg(buf, &len, MSG_TYPE_INTERFACE, 0, payload, 16);
+        }
+
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            uint16_t metric = htons(1);
+
+            payload[0] = r;
+            payload[1] = i;
+            memcpy(payload + 2, &metric, 2);
+            inet_pton(AF_INET, networks[i], payload + 4);
+            inet_pton(AF_INET, "255.255.255.0", payload + 8);
+            inet_pton(AF_INET, "0.0.0.0", payload + 12);
+            put_msg(buf, &len, MSG_TYPE_RTABLE_ENTRY, 0, payload, 16);
+        }
+    }
+
+    put_msg(buf, &len, MSG_TYPE_END_CONFIG, 0, NULL, 0);
+    send_all(ctl, buf, len);
+
+    if (ctl->conn->state != RUNNING || ctl->conn->num_routers != num_routers)
+        test_fail("The routers were not configured");
+
+    /* Have the routers learn where 10.0.2.7 is */
+    for (unsigned int r = 0; r < num_routers; r++)
+    {
+        chirouter_ctx_t *router = &ctl->conn->routers[r];
+        size_t arp_len = test_arp_frame(arp, &router->interfaces[1], ARP_OP_REPLY,
+                                        host2_mac, HOST2_IP, "10.0.2.1");
+
+        if (chirouter_server_process_ethernet_frame(router, &router->interfaces[1], arp, arp_len) != 0)
+            test_fail("Router %u did not accept an ARP reply", r);
+
+        inet_pton(AF_INET, HOST2_IP, &addr);
+        pthread_mutex_lock(&router->lock_arp);
+        if (chirouter_arp_cache_lookup(router, &addr) == NULL)
+            test_fail("Router %u did not learn the MAC address of %s", r, HOST2_IP);
+        pthread_mutex_unlock(&router->lock_arp);
+    }
+
+    chirouter_server_flush(ctl->conn);
+    test_ctl_read_frames(ctl, NULL, NULL);
+}
+
+
+/* See harness.h */
+unsigned long test_ctl_read_frames(test_ctl_t *ctl,
+                                   void (*fn)(void *arg, uint8_t r_id, uint8_t iface_id,
+                                              const uint8_t *frame, size_t len),
+                                   void *arg)
+{
+    unsigned long nframes = 0;
+
+    while (true)
+    {
+        ssize_t n = recv(ctl->fd, ctl->buf + ctl->buf_len, sizeof(ctl->buf) - ctl->buf_len, 0);
+        size_t pos = 0;
+
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return nframes;
+        if (n <= 0)
+            test_fail("The server closed the connection");
+        ctl->buf_len += n;
+
+        while (ctl->buf_len - pos >= MSG_HDR_LEN)
+        {
+            uint8_t type = ctl->buf[pos];
+            size_t payload_len = (ctl->buf[pos + 2] << 8) | ctl->buf[pos + 3];
+            uint8_t *rec = ctl->buf + pos + MSG_HDR_LEN;
+            uint8_t *end = rec + payload_len;
+
+            if (ctl->buf_len - pos < MSG_HDR_LEN + payload_len)
+                break;
+
+            /* An ETHERNET FRAME message has a single record */
+            while ((type == MSG_TYPE_ETHERNET_FRAME || type == MSG_TYPE_FRAME_BATCH) && rec < end)
+            {
+                size_t frame_len = (rec[2] << 8) | rec[3];
+
+                if (fn != NULL)
+                    fn(arg, rec[0], rec[1], rec + 4, frame_len);
+                nframes++;
+                rec += 4 + frame_len;
+            }
+
+            pos += MSG_HDR_LEN + payload_len;
+        }
+
+        memmove(ctl->buf, ctl->buf + pos, ctl->buf_len - pos);
+        ctl->buf_len -= pos;
+    }
+}
+
+
+/* See harness.h */
+void test_ctl_stop_arp(test_ctl_t *ctl)
+{
+    for (unsigned int r = 0; r < ctl->conn->num_routers; r++)
+    {
+        chirouter_ctx_t *router = &ctl->conn->routers[r];
+
+        if (router->arp_thread_started)
+        {
+            atomic_store(&router->arp_thread_stop, true);
+            pthread_join(router->arp_thread, NULL);
+            router->arp_thread_started = false;
+        }
+    }
+
+    /* Drop whatever the threads sent before stopping */
+    chirouter_server_flush(ctl->conn);
+    test_ctl_read_frames(ctl, NULL, NULL);
+}
+
+
+/* See harness.h */
+void test_ctl_close(test_ctl_t *ctl)
+{
+    chirouter_server_ctx_destroy(ctl->server);
+    close(ctl->fd);
+}
+
+
+/* See harness.h */
+size_t test_echo_request(uint8_t *frame, uint8_t r_id, uint16_t seq)
+{
+    ethhdr_t *hdr = (ethhdr_t *) frame;
+    iphdr_t *ip = (iphdr_t *) (frame + ETHER_HDR_LEN);
+    icmp_packet_t *icmp = (icmp_packet_t *) (frame + ETHER_HDR_LEN + sizeof(iphdr_t));
+    size_t icmp_len = TEST_ECHO_FRAME_LEN - ETHER_HDR_LEN - sizeof(iphdr_t);
+    struct in_addr addr;
+
+    memset(frame, 0, TEST_ECHO_FRAME_LEN);
+
+    router_mac(hdr->dst, r_id, 0);
+    memcpy(hdr->src, host1_mac, ETHER_ADDR_LEN);
+    hdr->type = htons(ETHERTYPE_IP);
+
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->len = htons(TEST_ECHO_FRAME_LEN - ETHER_HDR_LEN);
+    ip->ttl = 64;
+    ip->proto = IPPROTO_ICMP;
+    inet_pton(AF_INET, HOST1_IP, &addr);
+    ip->src = addr.s_addr;
+    inet_pton(AF_INET, HOST2_IP, &addr);
+    ip->dst = addr.s_addr;
+    ip->cksum = cksum(ip, sizeof(iphdr_t));
+
+    icmp->type = ICMPTYPE_ECHO_REQUEST;
+    icmp->echo.identifier = htons(TEST_ECHO_ID);
+    icmp->echo.seq_num = htons(seq);
+    icmp->chksum = cksum(icmp, icmp_len);
+
+    return TEST_ECHO_FRAME_LEN;
+}
+
+
+/* See harness.h */
+size_t test_arp_frame(uint8_t *frame, chirouter_interface_t *iface, uint16_t op,
+                      const uint8_t *sha, const char *spa, const char *tpa)
+{
+    ethhdr_t *hdr = (ethhdr_t *) frame;
+    arp_packet_t *arp = (arp_packet_t *) (frame + ETHER_HDR_LEN);
+    struct in_addr addr;
+
+    if (op == ARP_OP_REQUEST)
+        memset(hdr->dst, 0xff, ETHER_ADDR_LEN);
+    else
+        memcpy(hdr->dst, iface->mac, ETHER_ADDR_LEN);
+    memcpy(hdr->src, sha, ETHER_ADDR_LEN);
+    hdr->type = htons(ETHERTYPE_ARP);
+
+    arp->hrd = htons(ARP_HRD_ETHERNET);
+    arp->pro = htons(ETHERTYPE_IP);
+    arp->hln = ETHER_ADDR_LEN;
+    arp->pln = IPV4_ADDR_LEN;
+    arp->op = htons(op);
+    memcpy(arp->sha, sha, ETHER_ADDR_LEN);
+    inet_pton(AF_INET, spa, &addr);
+    arp->spa = addr.s_addr;
+    if (op == ARP_OP_REQUEST)
+        memset(arp->tha, 0, ETHER_ADDR_LEN);
+    else
+        memcpy(arp->tha, iface->mac, ETHER_ADDR_LEN);
+    inet_pton(AF_INET, tpa, &addr);
+    arp->tpa = addr.s_addr;
+
+    return TEST_ARP_FRAME_LEN;
+}
+
+
+/* See harness.h */
+size_t test_echo_request_msg(uint8_t *buf, uint8_t r_id, uint16_t seq)
+{
+    uint8_t payload[4 + TEST_ECHO_FRAME_LEN];
+    uint16_t frame_len = htons(TEST_ECHO_FRAME_LEN);
+    size_t len = 0;
+
+    payload[0] = r_id;
+    payload[1] = 0;
+    memcpy(payload + 2, &frame_len, 2);
+    test_echo_request(payload + 4, r_id, seq);
+    put_msg(buf, &len, MSG_TYPE_ETHERNET_FRAME, 0, payload, sizeof(payload));
+
+    return len;
+}
+
+
+/* See harness.h */
+int test_echo_seq(const uint8_t *frame, size_t len)
+{
+    const ethhdr_t *hdr = (const ethhdr_t *) frame;
+    const iphdr_t *ip = (const iphdr_t *) (frame + ETHER_HDR_LEN);
+    const icmp_packet_t *icmp = (const icmp_packet_t *) (frame + ETHER_HDR_LEN + sizeof(iphdr_t));
+
+    if (len != TEST_ECHO_FRAME_LEN || ntohs(hdr->type) != ETHERTYPE_IP ||
+        memcmp(hdr->dst, host2_mac, ETHER_ADDR_LEN) != 0 || ip->proto != IPPROTO_ICMP ||
+        icmp->type != ICMPTYPE_ECHO_REQUEST || ntohs(icmp->echo.identifier) != TEST_ECHO_ID)
+    {
+        return -1;
+    }
+
+    return ntohs(icmp->echo.seq_num);
+}
@@ -0,0 +1,279 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the helpers shared by the test drivers: they
+ *  play the part of a controller, connected to the server over a socket
+ *  pair, and build the frames the tests send to the routers.
+ *
+ *  All the helpers use a router with two interfaces, like the r1 router
+ *  in topologies/basic.json: eth1 (10.0.1.1/24), where the frames come
+ *  from host 10.0.1.5, and eth2 (10.0.2.1/24), where they are forwarded
+ *  to host 10.0.2.7.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef TESTS_HARNESS_H_
+#define TESTS_HARNESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server.h"
+
+/* Functions from server.c that the tests drive directly (they are not
+ * declared in server.h, since only the server itself calls them) */
+int chirouter_server_conn_create(server_ctx_t *ctx, int client_socket, const char *name);
+void chirouter_server_conn_close(server_conn_t *conn, int rc);
+void chirouter_server_conn_destroy(server_conn_t *conn);
+int chirouter_server_process_messages(server_conn_t *conn);
+int chirouter_server_process_ethernet_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *msg, size_t len);
+int chirouter_server_handle_frame(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint8_t *frame, size_t len);
+int chirouter_server_flush(server_conn_t *conn);
+
+/* Functions from arp.c that the tests drive directly */
+bool chirouter_arp_take_token(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint64_t now);
+
+/* Size of the echo requests built by test_echo_request, and of the
+ * ETHERNET FRAME messages built by test_echo_request_msg */
+#define TEST_ECHO_FRAME_LEN (98u)
+#define TEST_ECHO_MSG_LEN (MSG_HDR_LEN + 4u + TEST_ECHO_FRAME_LEN)
+
+/* Size of the ARP messages built by test_arp_frame */
+#define TEST_ARP_FRAME_LEN (ETHER_HDR_LEN + sizeof(arp_packet_t))
+
+/* Largest number of bytes the controller side buffers while parsing */
+#define TEST_CTL_BUFFER_SIZE (256u * 1024u)
+
+/* The controller side of a connection to the server */
+typedef struct test_ctl
+{
+    /* Server, and connection to it */
+    server_ctx_t *server;
+    server_conn_t *conn;
+
+    /* Our end of the socket pair */
+    int fd;
+
+    /* Messages received but not parsed yet */
+    uint8_t buf[TEST_CTL_BUFFER_SIZE];
+    size_t buf_len;
+} test_ctl_t;
+
+
+/*
+ * test_fail - Reports a failed check and exits
+ *
+ * fmt, ...: printf-style description of the failure
+ *
+ * Returns: does not return
+ */
+void test_fail(const char *fmt, ...);
+
+
+/*
+ * test_ctl_connect - Creates a server and connects a controller to it
+ *
+ * The server is created as chirouter's main() would (with the default
+ * options), except that it does not listen for connections: the
+ * connection is created from a socket pair instead. The caller can
+ * change the server's options (e.g., start workers) before configuring
+ * the routers.
+ *
+ * ctl: Controller side of the connection
+ *
+ * Returns: nothing (exits if anything fails)
+ */
+void test_ctl_connect(test_ctl_t *ctl);
+
+
+/*
+ * test_ctl_configure - Configures the routers
+ *
+ * Sends the HELLO, the configuration of num_routers identical routers
+ * (each one like r1, with its own MAC addresses) and END CONFIG, and
+ * has the server process them. Once the routers are running, has each
+ * router learn the MAC address of 10.0.2.7 from an ARP reply.
+ *
+ * ctl: Controller side of the connection
+ *
+ * num_routers: Number of routers
+ *
+ * Returns: nothing (exits if anything fails)
+ */
+void test_ctl_configure(test_ctl_t *ctl, unsigned int num_routers);
+
+
+/*
+ * test_ctl_send_msg - Sends a message to the server, and has the server process it
+ *
+ * ctl: Controller side of the connection
+ *
+ * type, subtype: Message type and subtype
+ *
+ * payload, payload_len: Payload of the message
+ *
+ * Returns: what chirouter_server_process_messages returns (0 on
+ *          success, -1 if the server has to close the connection)
+ */
+int test_ctl_send_msg(test_ctl_t *ctl, uint8_t type, uint8_t subtype, const void *payload, uint16_t payload_len);
+
+
+/*
+ * test_ctl_read_frames - Reads the Ethernet frames the server has sent
+ *
+ * Reads whatever the server has sent so far, without waiting, and
+ * calls a function for each Ethernet frame (in an ETHERNET FRAME or
+ * a FRAME BATCH message). Other messages are skipped.
+ *
+ * ctl: Controller side of the connection
+ *
+ * fn: Function called for each frame (with the router ID, the
+ *     interface ID, the frame, and its length)
+ *
+ * arg: Passed to fn
+ *
+ * Returns: number of frames read
+ */
+unsigned long test_ctl_read_frames(test_ctl_t *ctl,
+                                   void (*fn)(void *arg, uint8_t r_id, uint8_t iface_id,
+                                              const uint8_t *frame, size_t len),
+                                   void *arg);
+
+
+/*
+ * test_ctl_stop_arp - Stops the ARP threads of the routers
+ *
+ * Once the threads are stopped, the ARP cache is only purged, and the
+ * pending ARP requests are only re-sent, when the test calls the
+ * functions the threads would call (with the times of its choosing).
+ * Any frames sent by the threads are read and discarded.
+ *
+ * ctl: Controller side of the connection (with the routers configured)
+ *
+ * Returns: nothing
+ */
+void test_ctl_stop_arp(test_ctl_t *ctl);
+
+
+/*
+ * test_ctl_close - Closes the connection and frees the server
+ *
+ * ctl: Controller side of the connection
+ *
+ * Returns: nothing
+ */
+void test_ctl_close(test_ctl_t *ctl);
+
+
+/*
+ * test_echo_request - Builds an ICMP echo request to 10.0.2.7
+ *
+ * The request comes from 10.0.1.5, and is sent to the eth1 interface
+ * of a router, which has to forward it out of eth2.
+ *
+ * frame: Buffer of at least TEST_ECHO_FRAME_LEN bytes
+ *
+ * r_id: Router ID (the MAC addresses of the routers depend on it)
+ *
+ * seq: Sequence number of the request
+ *
+ * Returns: length of the frame
+ */
+size_t test_echo_request(uint8_t *frame, uint8_t r_id, uint16_t seq);
+
+
+/*
+ * test_arp_frame - Builds an ARP message received on a router's interface
+ *
+ * Requests are broadcast, and replies are sent to the interface.
+ *
+ * frame: Buffer of at least TEST_ARP_FRAME_LEN bytes
+ *
+ * iface: Interface of the router that receives the message
+ *
+ * op: ARP_OP_REQUEST or ARP_OP_REPLY
+ *
+ * sha, spa: Sender MAC and IP address
+ *
+ * tpa: Target IP address
+ *
+ * Returns: length of the frame
+ */
+size_t test_arp_frame(uint8_t *frame, chirouter_interface_t *iface, uint16_t op,
+                      const uint8_t *sha, const char *spa, const char *tpa);
+
+
+/*
+ * test_echo_request_msg - Builds an ETHERNET FRAME message with an echo request
+ *
+ * The message carries the echo request built by test_echo_request, as
+ * received on the eth1 interface of a router.
+ *
+ * buf: Buffer of at least TEST_ECHO_MSG_LEN bytes
+ *
+ * r_id: Router ID
+ *
+ * seq: Sequence number of the request
+ *
+ * Returns: length of the message
+ */
+size_t test_echo_request_msg(uint8_t *buf, uint8_t r_id, uint16_t seq);
+
+
+/*
+ * test_echo_seq - Gets the sequence number of a forwarded echo request
+ *
+ * frame, len: Frame forwarded by a router
+ *
+ * Returns: the sequence number, or -1 if the frame isn't an echo request
+ *          built by test_echo_request
+ */
+int test_echo_seq(const uint8_t *frame, size_t len);
+
+#endif /* TESTS_HARNESS_H_ */
@@ -0,0 +1,181 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a test that checks that forwarding frames does
+ *  not allocate any memory on the heap.
+ *
+ *  The test configures a router, has it learn where the next hop is,
+ *  and then passes TEST_FRAMES echo requests through
+ *  chirouter_server_process_ethernet_frame, checking that they are all
+ *  forwarded, and that neither the allocation counters in alloc.c nor
+ *  the C library allocation functions (which the test executable wraps
+ *  at link time, see CMakeLists.txt) were called in the meantime.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "harness.h"
+#include "alloc.h"
+
+/* Number of frames forwarded (and how many are forwarded
+ * before each flush of the transmit queue) */
+#define TEST_FRAMES (100000u)
+#define TEST_BATCH (64u)
+
+/* Calls to the C library allocation functions from chirouter's code */
+static atomic_ulong libc_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add(&libc_allocs, 1);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add(&libc_allocs, 1);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&libc_allocs, 1);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    atomic_fetch_add(&libc_allocs, 1);
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+
+/*
+ * check_frame - Checks that a frame is the next forwarded echo request
+ *
+ * arg: Sequence number of the next echo request
+ *
+ * r_id, iface_id, frame, len: Frame (see test_ctl_read_frames)
+ *
+ * Returns: nothing (exits if the frame is not the expected one)
+ */
+static void check_frame(void *arg, uint8_t r_id, uint8_t iface_id, const uint8_t *frame, size_t len)
+{
+    unsigned long *next_seq = arg;
+    int seq = test_echo_seq(frame, len);
+
+    if (r_id != 0 || iface_id != 1 || seq != (int) (*next_seq & 0xFFFF))
+        test_fail("Expected echo request %lu out of eth2, got a frame out of interface %u "
+                  "(sequence number %d)", *next_seq, iface_id, seq);
+
+    (*next_seq)++;
+}
+
+
+int main(int argc, char *argv[])
+{
+    test_ctl_t *ctl = malloc(sizeof(test_ctl_t));
+    uint8_t frame[TEST_ECHO_FRAME_LEN];
+    uint64_t allocs_before, allocs_after;
+    unsigned long libc_before, libc_after;
+    unsigned long forwarded = 0;
+
+    test_ctl_connect(ctl);
+    test_ctl_configure(ctl, 1);
+
+    chirouter_ctx_t *router = &ctl->conn->routers[0];
+
+    chirouter_alloc_stats(&allocs_before, NULL);
+    libc_before = atomic_load(&libc_allocs);
+
+    for (unsigned int i = 0; i < TEST_FRAMES; i++)
+    {
+        /* Frames are forwarded in place (and their TTL decremented),
+         * so each one has to be built from scratch */
+        size_t len = test_echo_request(frame, 0, (uint16_t) i);
+
+        if (chirouter_server_process_ethernet_frame(router, &router->interfaces[0], frame, len) != 0)
+            test_fail("Router did not process echo request %u", i);
+
+        if ((i + 1) % TEST_BATCH == 0 || i + 1 == TEST_FRAMES)
+        {
+            if (chirouter_server_flush(ctl->conn) != 0)
+                test_fail("Could not send the forwarded frames to the controller");
+            test_ctl_read_frames(ctl, check_frame, &forwarded);
+        }
+    }
+
+    chirouter_alloc_stats(&allocs_after, NULL);
+    libc_after = atomic_load(&libc_allocs);
+
+    if (forwarded != TEST_FRAMES)
+        test_fail("Forwarded %lu of %u frames", forwarded, TEST_FRAMES);
+
+    if (allocs_after != allocs_before)
+        test_fail("Forwarding %u frames made %lu allocations with chirouter_calloc",
+                  TEST_FRAMES, (unsigned long) (allocs_after - allocs_before));
+
+    if (libc_after != libc_before)
+        test_fail("Forwarding %u frames called the C library allocation functions %lu times",
+                  TEST_FRAMES, libc_after - libc_before);
+
+    printf("Forwarded %lu frames without any heap allocations\n", forwarded);
+
+    test_ctl_close(ctl);
+    free(ctl);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,738 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains the tests for the ARP cache and the pending
+ *  ARP requests (see arp.h).
+ *
+ *  Each test configures a router and stops its ARP thread, so that it
+ *  can purge the cache itself, with the times of its choosing, and
+ *  then checks which ARP messages the router sends, and what ends up
+ *  in the ARP cache.
+ *
+ */
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "harness.h"
+#include "arp.h"
+#include "utils.h"
+
+/* Host on eth2 whose MAC address test_ctl_configure has the router learn */
+static const uint8_t host2_mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xbb, 0x02};
+#define HOST2_IP "10.0.2.7"
+
+/* Number of static entries added by test_static (enough for the
+ * table of static entries to grow a few times) */
+#define TEST_STATIC_ENTRIES (300u)
+
+/* Number of waits test_retransmission checks for jitter */
+#define TEST_JITTER_SAMPLES (200u)
+
+/* ARP messages sent by a router (see read_arp), and the frames
+ * it sent when it got (or gave up on getting) an ARP reply */
+typedef struct arp_sent
+{
+    unsigned int requests;
+    unsigned int replies;
+    unsigned int echo_requests;
+    unsigned int host_unreachable;
+
+    /* Destination MAC address, target IP address, and
+     * interface of the last ARP message */
+    uint8_t dst[ETHER_ADDR_LEN];
+    uint32_t tpa;
+    uint8_t iface_id;
+} arp_sent_t;
+
+
+/*
+ * count_arp - Counts a frame sent by a router
+ *
+ * arg: Frames sent so far (arp_sent_t)
+ *
+ * r_id, iface_id, frame, len: Frame (see test_ctl_read_frames)
+ *
+ * Returns: nothing
+ */
+static void count_arp(void *arg, uint8_t r_id, uint8_t iface_id, const uint8_t *frame, size_t len)
+{
+    arp_sent_t *sent = arg;
+    const ethhdr_t *hdr = (const ethhdr_t *) frame;
+    const arp_packet_t *arp = (const arp_packet_t *) (frame + ETHER_HDR_LEN);
+    const icmp_packet_t *icmp = (const icmp_packet_t *) (frame + ETHER_HDR_LEN + sizeof(iphdr_t));
+
+    if (test_echo_seq(frame, len) != -1)
+    {
+        sent->echo_requests++;
+        return;
+    }
+
+    if (ntohs(hdr->type) == ETHERTYPE_IP && len >= ETHER_HDR_LEN + sizeof(iphdr_t) + ICMP_HDR_SIZE &&
+        icmp->type == ICMPTYPE_DEST_UNREACHABLE && icmp->code == ICMPCODE_DEST_HOST_UNREACHABLE)
+    {
+        sent->host_unreachable++;
+        return;
+    }
+
+    if (len < TEST_ARP_FRAME_LEN || ntohs(hdr->type) != ETHERTYPE_ARP)
+        return;
+
+    if (ntohs(arp->op) == ARP_OP_REQUEST)
+        sent->requests++;
+    else
+        sent->replies++;
+
+    memcpy(sent->dst, hdr->dst, ETHER_ADDR_LEN);
+    sent->tpa = arp->tpa;
+    sent->iface_id = iface_id;
+}
+
+
+/*
+ * read_arp - Reads the frames the router has sent so far
+ *
+ * ctl: Controller side of the connection
+ *
+ * sent: Where to count the frames
+ *
+ * Returns: nothing
+ */
+static void read_arp(test_ctl_t *ctl, arp_sent_t *sent)
+{
+    memset(sent, 0, sizeof(arp_sent_t));
+
+    if (chirouter_server_flush(ctl->conn) != 0)
+        test_fail("Could not send the frames to the controller");
+    test_ctl_read_frames(ctl, count_arp, sent);
+}
+
+
+/*
+ * setup - Configures a router, and stops its ARP thread
+ *
+ * Returns: controller side of the connection to the router's server
+ */
+static test_ctl_t* setup(void)
+{
+    test_ctl_t *ctl = malloc(sizeof(test_ctl_t));
+
+    test_ctl_connect(ctl);
+    test_ctl_configure(ctl, 1);
+    test_ctl_stop_arp(ctl);
+
+    return ctl;
+}
+
+
+/*
+ * teardown - Frees what setup created
+ *
+ * ctl: Controller side of the connection
+ *
+ * Returns: nothing
+ */
+static void teardown(test_ctl_t *ctl)
+{
+    test_ctl_close(ctl);
+    free(ctl);
+}
+
+
+/*
+ * purge - Purges a router's ARP cache, as the ARP thread would
+ *
+ * ctx: Router context
+ *
+ * curtime: Current time, as far as the purge is concerned
+ *
+ * Returns: nothing
+ */
+static void purge(chirouter_ctx_t *ctx, time_t curtime)
+{
+    pthread_mutex_lock(&ctx->lock_arp);
+    chirouter_arp_purge(ctx, curtime);
+    pthread_mutex_unlock(&ctx->lock_arp);
+}
+
+
+/*
+ * lookup - Looks up an IP address in a router's ARP cache
+ *
+ * ctx: Router context
+ *
+ * ip: IP address (in dotted-decimal notation)
+ *
+ * Returns: the ARP cache entry, or NULL if there is none
+ */
+static chirouter_arpcache_entry_t* lookup(chirouter_ctx_t *ctx, const char *ip)
+{
+    chirouter_arpcache_entry_t *entry;
+    struct in_addr addr;
+
+    inet_pton(AF_INET, ip, &addr);
+    pthread_mutex_lock(&ctx->lock_arp);
+    entry = chirouter_arp_cache_lookup(ctx, &addr);
+    pthread_mutex_unlock(&ctx->lock_arp);
+
+    return entry;
+}
+
+
+/*
+ * receive_arp - Has a router process an ARP message
+ *
+ * ctx: Router context
+ *
+ * iface: Interface that receives the message
+ *
+ * op, sha, spa, tpa: ARP message (see test_arp_frame)
+ *
+ * Returns: nothing (exits if the router fails to process it)
+ */
+static void receive_arp(chirouter_ctx_t *ctx, chirouter_interface_t *iface, uint16_t op,
+                        const uint8_t *sha, const char *spa, const char *tpa)
+{
+    uint8_t frame[TEST_ARP_FRAME_LEN];
+    size_t len = test_arp_frame(frame, iface, op, sha, spa, tpa);
+
+    if (chirouter_server_process_ethernet_frame(ctx, iface, frame, len) != 0)
+        test_fail("The router could not process an ARP message from %s", spa);
+}
+
+
+/*
+ * test_refresh_ahead - Entries in use are re-validated before they expire
+ *
+ * Returns: nothing (exits if the check fails)
+ */
+static void test_refresh_ahead(void)
+{
+    test_ctl_t *ctl = setup();
+    chirouter_ctx_t *router = &ctl->conn->routers[0];
+    chirouter_arpcache_entry_t *entry = lookup(router, HOST2_IP);
+    time_t now = time(NULL);
+    arp_sent_t sent;
+
+    /* Make the entry old enough to be refreshed */
+    entry->time_added = now - (ARPCACHE_ENTRY_TIMEOUT - ARPCACHE_REFRESH_AHEAD);
+
+    /* An entry that hasn't been used since it was added is left to expire */
+    purge(router, now);
+    read_arp(ctl, &sent);
+    if (sent.requests != 0)
+        test_fail("The router refreshed an entry that was not in use");
+
+    entry->time_used = now;
+    purge(router, now);
+    read_arp(ctl, &sent);
+    if (sent.requests != 1 || memcmp(sent.dst, host2_mac, ETHER_ADDR_LEN) != 0 ||
+        sent.tpa != inet_addr(HOST2_IP) || sent.iface_id != 1)
+        test_fail("The router did not send a unicast ARP request out of eth2 to refresh %s", HOST2_IP);
+    if (lookup(router, HOST2_IP) != entry)
+        test_fail("The entry was removed while it was being refreshed");
+
+    /* Once the reply arrives, the entry outlives its original expiry */
+    receive_arp(router, &router->interfaces[1], ARP_OP_REPLY, host2_mac, HOST2_IP, "10.0.2.1");
+    purge(router, now + ARPCACHE_REFRESH_AHEAD + 1);
+    if (lookup(router, HOST2_IP) == NULL)
+        test_fail("A refreshed entry expired");
+
+    /* Without a reply, it expires */
+    entry->time_added = now - (ARPCACHE_ENTRY_TIMEOUT - ARPCACHE_REFRESH_AHEAD);
+    purge(router, now + ARPCACHE_REFRESH_AHEAD + 1);
+    if (lookup(router, HOST2_IP) != NULL)
+        test_fail("An entry that was not refreshed did not expire");
+
+    printf("Refreshed an entry in use before it expired\n");
+    teardown(ctl);
+}
+
+
+/*
+ * test_learning - Which ARP messages the router learns from
+ *
+ * Returns: nothing (exits if a check fails)
+ */
+static void test_learning(void)
+{
+    static const uint8_t mac_a[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xaa, 0x09};
+    static const uint8_t mac_b[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xaa, 0x0a};
+    test_ctl_t *ctl = setup();
+    chirouter_ctx_t *router = &ctl->conn->routers[0];
+    chirouter_interface_t *eth1 = &router->interfaces[0], *eth2 = &router->interfaces[1];
+    chirouter_arpcache_entry_t *entry;
+    arp_sent_t sent;
+
+    /* A request for the router creates an entry for the sender */
+    receive_arp(router, eth1, ARP_OP_REQUEST, mac_a, "10.0.1.9", "10.0.1.1");
+    entry = lookup(router, "10.0.1.9");
+    if (entry == NULL || memcmp(entry->mac, mac_a, ETHER_ADDR_LEN) != 0)
+        test_fail("The router did not learn from a request for its own address");
+    read_arp(ctl, &sent);
+    if (sent.replies != 1 || memcmp(sent.dst, mac_a, ETHER_ADDR_LEN) != 0 || sent.iface_id != 0)
+        test_fail("The router did not reply to a request for its own address");
+
+    /* A request for someone else does not... */
+    receive_arp(router, eth1, ARP_OP_REQUEST, mac_b, "10.0.1.10", "10.0.1.20");
+    if (lookup(router, "10.0.1.10") != NULL)
+        test_fail("The router learned from a request for another host");
+    read_arp(ctl, &sent);
+    if (sent.replies != 0)
+        test_fail("The router replied to a request for another host");
+
+    /* ...but it does update the sender's entry, if there is one */
+    receive_arp(router, eth2, ARP_OP_REQUEST, mac_b, HOST2_IP, "10.0.2.99");
+    entry = lookup(router, HOST2_IP);
+    if (entry == NULL || memcmp(entry->mac, mac_b, ETHER_ADDR_LEN) != 0)
+        test_fail("The router did not update an entry from a request for another host");
+
+    /* Gratuitous ARP is ignored, unless enabled with -g */
+    receive_arp(router, eth1, ARP_OP_REQUEST, mac_a, "10.0.1.11", "10.0.1.11");
+    receive_arp(router, eth2, ARP_OP_REQUEST, host2_mac, HOST2_IP, HOST2_IP);
+    if (lookup(router, "10.0.1.11") != NULL || memcmp(entry->mac, mac_b, ETHER_ADDR_LEN) != 0)
+        test_fail("The router learned from gratuitous ARP without -g");
+
+    ctl->server->arp_gratuitous = true;
+    receive_arp(router, eth1, ARP_OP_REQUEST, mac_a, "10.0.1.11", "10.0.1.11");
+    receive_arp(router, eth2, ARP_OP_REQUEST, host2_mac, HOST2_IP, HOST2_IP);
+    if (lookup(router, "10.0.1.11") == NULL || memcmp(entry->mac, host2_mac, ETHER_ADDR_LEN) != 0)
+        test_fail("The router did not learn from gratuitous ARP with -g");
+
+    printf("Learned from requests for the router, and from gratuitous ARP only with -g\n");
+    teardown(ctl);
+}
+
+
+/*
+ * test_gateway - Gateways are resolved up front, and their entries pinned
+ *
+ * Returns: nothing (exits if a check fails)
+ */
+static void test_gateway(void)
+{
+    static const uint8_t gw_mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xbb, 0xfe};
+    test_ctl_t *ctl = setup();
+    chirouter_ctx_t *router = &ctl->conn->routers[0];
+    chirouter_arpcache_entry_t *entry;
+    struct in_addr gw, addr;
+    time_t now = time(NULL);
+    arp_sent_t sent;
+
+    /* Route eth2's network through a gateway */
+    inet_pton(AF_INET, "10.0.2.254", &gw);
+    router->routing_table[1].gw = gw;
+
+    /* A single broadcast request is sent for it, however many times
+     * the router tries to resolve it before the reply arrives */
+    chirouter_arp_resolve_gateways(router);
+    chirouter_arp_resolve_gateways(router);
+    read_arp(ctl, &sent);
+    if (sent.requests != 1 || sent.dst[0] != 0xff || sent.tpa != gw.s_addr || sent.iface_id != 1)
+        test_fail("The router did not broadcast a single request for its gateway out of eth2");
+
+    receive_arp(router, &router->interfaces[1], ARP_OP_REPLY, gw_mac, "10.0.2.254", "10.0.2.1");
+    entry = lookup(router, "10.0.2.254");
+    if (entry == NULL || !entry->pinned || chirouter_arp_pending_req_lookup(router, &gw) != NULL)
+        test_fail("The router did not pin the entry of its gateway");
+
+    /* Filling the cache evicts every other entry, but not the gateway's
+     * (even though it is the least recently used one) */
+    entry->time_added = now - 1;
+    pthread_mutex_lock(&router->lock_arp);
+    for (unsigned int i = 0; i < 2 * ARPCACHE_SIZE; i++)
+    {
+        addr.s_addr = htonl(0x0a010000 + i);
+        if (chirouter_arp_cache_add(router, &addr, (uint8_t *) host2_mac) != 0)
+            test_fail("Could not add entry %u to the ARP cache", i);
+    }
+    pthread_mutex_unlock(&router->lock_arp);
+    if (lookup(router, "10.0.2.254") != entry || lookup(router, HOST2_IP) != NULL)
+        test_fail("The entry of the gateway was evicted");
+
+    /* It is refreshed before it expires, even if it was not used */
+    entry->time_added = now - (ARPCACHE_ENTRY_TIMEOUT - ARPCACHE_REFRESH_AHEAD);
+    purge(router, now);
+    read_arp(ctl, &sent);
+    if (sent.requests != 1 || memcmp(sent.dst, gw_mac, ETHER_ADDR_LEN) != 0 || sent.tpa != gw.s_addr)
+        test_fail("The router did not refresh the entry of its gateway");
+
+    receive_arp(router, &router->interfaces[1], ARP_OP_REPLY, gw_mac, "10.0.2.254", "10.0.2.1");
+    purge(router, now + ARPCACHE_REFRESH_AHEAD + 1);
+    if (lookup(router, "10.0.2.254") != entry)
+        test_fail("The refreshed entry of the gateway expired");
+
+    /* If the gateway does not answer, the router goes back to resolving it */
+    entry->time_added = now - (ARPCACHE_ENTRY_TIMEOUT - ARPCACHE_REFRESH_AHEAD);
+    purge(router, now + ARPCACHE_REFRESH_AHEAD + 1);
+    if (lookup(router, "10.0.2.254") != NULL || chirouter_arp_pending_req_lookup(router, &gw) == NULL)
+        test_fail("The router did not resolve its gateway again after its entry expired");
+
+    printf("Resolved the gateway, and kept its entry through eviction and expiry\n");
+    teardown(ctl);
+}
+
+
+/*
+ * test_static - Static entries are not evicted, and never expire
+ *
+ * Returns: nothing (exits if a check fails)
+ */
+static void test_static(void)
+{
+    static const uint8_t mac_a[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xaa, 0x32};
+    static const uint8_t mac_b[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0xaa, 0x33};
+    test_ctl_t *ctl = setup();
+    chirouter_ctx_t *router = &ctl->conn->routers[0];
+    chirouter_arpcache_entry_t *entry;
+    uint8_t mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x01, 0x00, 0x00};
+    struct in_addr addr;
+    arp_sent_t sent;
+
+    /* A static entry replaces the dynamic one for the same address */
+    receive_arp(router, &router->interfaces[0], ARP_OP_REQUEST, mac_a, "10.0.1.50", "10.0.1.1");
+    inet_pton(AF_INET, "10.0.1.50", &addr);
+    pthread_mutex_lock(&router->lock_arp);
+    if (chirouter_arp_cache_add_permanent(router, &addr, (uint8_t *) mac_b) != 0)
+        test_fail("Could not add a static entry");
+    for (unsigned int i = 0; i < ARPCACHE_SIZE; i++)
+        if (router->arpcache[i].valid && router->arpcache[i].ip.s_addr == addr.s_addr)
+            test_fail("The dynamic entry for a static address was kept");
+    pthread_mutex_unlock(&router->lock_arp);
+
+    /* The table of static entries grows as needed */
+    pthread_mutex_lock(&router->lock_arp);
+    for (unsigned int i = 0; i < TEST_STATIC_ENTRIES; i++)
+    {
+        addr.s_addr = htonl(0x0a020000 + i);
+        mac[4] = i >> 8;
+        mac[5] = i & 0xff;
+        if (chirouter_arp_cache_add_permanent(router, &addr, mac) != 0)
+            test_fail("Could not add static entry %u", i);
+    }
+
+    /* And a second entry for an address replaces the first one */
+    addr.s_addr = htonl(0x0a020000);
+    if (chirouter_arp_cache_add_permanent(router, &addr, (uint8_t *) mac_b) != 0)
+        test_fail("Could not replace static entry 0");
+
+    /* Filling the ARP cache does not evict them */
+    for (unsigned int i = 0; i < 2 * ARPCACHE_SIZE; i++)
+    {
+        addr.s_addr = htonl(0x0a010000 + i);
+        if (chirouter_arp_cache_add(router, &addr, (uint8_t *) host2_mac) != 0)
+            test_fail("Could not add entry %u to the ARP cache", i);
+    }
+    pthread_mutex_unlock(&router->lock_arp);
+
+    if (router->num_static_arp != TEST_STATIC_ENTRIES + 1 ||
+        router->static_arp_size < 2 * router->num_static_arp ||
+        (router->static_arp_size & (router->static_arp_size - 1)) != 0)
+        test_fail("The table has %u static entries in %u slots",
+                  router->num_static_arp, router->static_arp_size);
+
+    /* They never expire, and are not refreshed */
+    purge(router, time(NULL) + 100 * ARPCACHE_ENTRY_TIMEOUT);
+    read_arp(ctl, &sent);
+    if (sent.requests != 0)
+        test_fail("The router refreshed a static entry");
+
+    for (unsigned int i = 0; i < TEST_STATIC_ENTRIES; i++)
+    {
+        addr.s_addr = htonl(0x0a020000 + i);
+        mac[4] = i >> 8;
+        mac[5] = i & 0xff;
+        pthread_mutex_lock(&router->lock_arp);
+        entry = chirouter_arp_cache_lookup(router, &addr);
+        pthread_mutex_unlock(&router->lock_arp);
+        if (entry == NULL || !entry->permanent ||
+            memcmp(entry->mac, i == 0 ? mac_b : mac, ETHER_ADDR_LEN) != 0)
+            test_fail("Lost static entry %u", i);
+    }
+
+    /* ARP messages do not change them */
+    receive_arp(router, &router->interfaces[0], ARP_OP_REPLY, mac_a, "10.0.1.50", "10.0.1.1");
+    entry = lookup(router, "10.0.1.50");
+    if (entry == NULL || !entry->permanent || memcmp(entry->mac, mac_b, ETHER_ADDR_LEN) != 0)
+        test_fail("An ARP reply changed a static entry");
+
+    printf("Kept %u static entries through eviction and expiry\n", router->num_static_arp);
+    teardown(ctl);
+}
+
+
+/*
+ * test_pacing - ARP requests are paced on each interface
+ *
+ * Returns: nothing (exits if a check fails)
+ */
+static void test_pacing(void)
+{
+    test_ctl_t *ctl = setup();
+    chirouter_ctx_t *router = &ctl->conn->routers[0];
+    chirouter_interface_t *eth1 = &router->interfaces[0], *eth2 = &router->interfaces[1];
+    unsigned int burst = ctl->server->arp_burst;
+    uint64_t now = chirouter_now_ms();
+    struct in_addr addr;
+    arp_sent_t sent;
+
+    pthread_mutex_lock(&router->lock_arp);
+
+    /* A burst of requests can be sent on each interface... */
+    for (unsigned int i = 0; i < burst; i++)
+        if (!chirouter_arp_take_token(router, eth1, now) || !chirouter_arp_take_token(router, eth2, now))
+            test_fail("Could only send %u requests in a burst of %u", i, burst);
+    if (chirouter_arp_take_token(router, eth1, now) || chirouter_arp_take_token(router, eth2, now))
+        test_fail("Could send more requests than the burst size");
+
+    /* ...and then only at the ARP rate */
+    now += 1000 / ctl->server->arp_rate;
+    if (!chirouter_arp_take_token(router, eth1, now) || chirouter_arp_take_token(router, eth1, now))
+        test_fail("Could not send a single request once the rate allowed it");
+
+    /* Waiting longer does not allow a larger burst */
+    now += 60 * 1000;
+    for (unsigned int i = 0; i < burst; i++)
+        if (!chirouter_arp_take_token(router, eth1, now))
+            test_fail("Could only send %u requests in a burst of %u", i, burst);
+    if (chirouter_arp_take_token(router, eth1, now))
+        test_fail("The burst grew past its size");
+
+    /* Requests that the rate doesn't allow stay pending. With a rate of
+     * one request per second, no more are allowed while the test runs */
+    ctl->server->arp_rate = 1;
+    eth1->arp_tokens_updated = eth2->arp_tokens_updated = 0;
+    for (unsigned int i = 0; i < burst + 10; i++)
+    {
+        addr.s_addr = htonl(0x0a000264 + i);
+        chirouter_arp_pending_req_add(router, &addr, eth2);
+    }
+    inet_pton(AF_INET, "10.0.1.100", &addr);
+    chirouter_arp_pending_req_add(router, &addr, eth1);
+    chirouter_arp_process_pending_reqs(router, chirouter_now_ms());
+
+    pthread_mutex_unlock(&router->lock_arp);
+
+    read_arp(ctl, &sent);
+    if (sent.requests != burst + 1)
+        test_fail("Sent %u ARP requests, expected %u on eth2 and one on eth1", sent.requests, burst);
+    inet_pton(AF_INET, "10.0.2.100", &addr);
+    if (chirouter_arp_pending_req_lookup(router, &addr)->times_sent != 1)
+        test_fail("The first request on eth2 was not sent");
+    addr.s_addr = htonl(0x0a000264 + burst);
+    if (chirouter_arp_pending_req_lookup(router, &addr)->times_sent != 0)
+        test_fail("A request was sent after the burst on eth2");
+
+    /* Without a rate, requests are not paced */
+    ctl->server->arp_rate = 0;
+    pthread_mutex_lock(&router->lock_arp);
+    chirouter_arp_process_pending_reqs(router, chirouter_now_ms());
+    pthread_mutex_unlock(&router->lock_arp);
+    read_arp(ctl, &sent);
+    if (sent.requests != 10)
+        test_fail("Sent %u of the 10 deferred ARP requests without a rate", sent.requests);
+
+    printf("Paced ARP requests to bursts of %u per interface\n", burst);
+    teardown(ctl);
+}
+
+
+/*
+ * test_parse_schedule - Parsing the ARP retransmission schedule (-a)
+ *
+ * Returns: nothing (exits if a check fails)
+ */
+static void test_parse_schedule(void)
+{
+    static const char *invalid[] = {"", "0", "-50", "abc", "50,", ",50", "50,,100", "50;100",
+                                    "50,100x", "1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17"};
+    uint32_t schedule[ARP_MAX_RETRIES];
+    unsigned int len;
+
+    if (chirouter_arp_parse_schedule("50,100,200", schedule, &len) != 0 ||
+        len != 3 || schedule[0] != 50 || schedule[1] != 100 || schedule[2] != 200)
+        test_fail("Could not parse a valid schedule");
+
+    if (chirouter_arp_parse_schedule("1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16", schedule, &len) != 0 ||
+        len != ARP_MAX_RETRIES || schedule[ARP_MAX_RETRIES - 1] != 16)
+        test_fail("Could not parse a schedule with %u waits", ARP_MAX_RETRIES);
+
+    for (unsigned int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        if (chirouter_arp_parse_schedule(invalid[i], schedule, &len) == 0)
+            test_fail("Accepted an invalid schedule: \"%s\"", invalid[i]);
+
+    printf("Parsed the ARP retransmission schedules\n");
+}
+
+
+/*
+ * test_retransmission - Pending requests follow the retransmission schedule
+ *
+ * Returns: nothing (exits if a check fails)
+ */
+static void test_retransmission(void)
+{
+    test_ctl_t *ctl = setup();
+    chirouter_ctx_t *router = &ctl->conn->routers[0];
+    chirouter_pending_arp_req_t *pending_req;
+    uint8_t frame[TEST_ECHO_FRAME_LEN];
+    size_t len;
+    struct in_addr addr;
+    arp_sent_t sent;
+    int64_t min_wait = INT64_MAX, max_wait = 0;
+
+    chirouter_arp_parse_schedule("100,200,400", ctl->server->arp_schedule,
+                                 &ctl->server->arp_schedule_len);
+
+    /* Forget where 10.0.2.7 is */
+    lookup(router, HOST2_IP)->valid = false;
+    inet_pton(AF_INET, HOST2_IP, &addr);
+
+    /* Frames for the same host share a single request */
+    for (uint16_t seq = 0; seq < 2; seq++)
+    {
+        len = test_echo_request(frame, 0, seq);
+        if (chirouter_server_process_ethernet_frame(router, &router->interfaces[0], frame, len) != 0)
+            test_fail("The router could not process echo request %u", seq);
+    }
+    read_arp(ctl, &sent);
+    pending_req = chirouter_arp_pending_req_lookup(router, &addr);
+    if (sent.requests != 1 || sent.dst[0] != 0xff || pending_req == NULL ||
+        pending_req->withheld_frames == NULL ||
+        pending_req->withheld_frames->next == NULL || pending_req->withheld_frames->next->next != NULL)
+        test_fail("The router did not send a single ARP request for both frames");
+
+    /* The request is re-sent after each wait in the schedule (give or
+     * take the jitter), and abandoned after the last one */
+    for (unsigned int i = 0; i < ctl->server->arp_schedule_len; i++)
+    {
+        int64_t wait = pending_req->next_send - pending_req->last_sent;
+        int64_t expected = ctl->server->arp_schedule[i];
+
+        if (pending_req->times_sent != i + 1 || wait < expected * 9 / 10 || wait > expected * 11 / 10)
+            test_fail("Send %u of the request was followed by a %ld ms wait, expected %ld ms",
+                      pending_req->times_sent, (long) wait, (long) expected);
+
+        /* Not due yet */
+        pthread_mutex_lock(&router->lock_arp);
+        chirouter_arp_process_pending_reqs(router, pending_req->next_send - 1);
+        pthread_mutex_unlock(&router->lock_arp);
+        read_arp(ctl, &sent);
+        if (sent.requests != 0)
+            test_fail("The request was re-sent before it was due");
+
+        pthread_mutex_lock(&router->lock_arp);
+        chirouter_arp_process_pending_reqs(router, pending_req->next_send);
+        pthread_mutex_unlock(&router->lock_arp);
+        read_arp(ctl, &sent);
+
+        if (i + 1 < ctl->server->arp_schedule_len && sent.requests != 1)
+            test_fail("The request was not re-sent when it was due");
+    }
+    if (sent.requests != 0 || sent.host_unreachable != 2 ||
+        chirouter_arp_pending_req_lookup(router, &addr) != NULL)
+        test_fail("The router did not give up on the request after the last wait");
+
+    /* The waits are jittered */
+    ctl->server->arp_rate = 0;
+    pthread_mutex_lock(&router->lock_arp);
+    for (unsigned int i = 0; i < TEST_JITTER_SAMPLES; i++)
+    {
+        pending_req = chirouter_arp_pending_req_add(router, &addr, &router->interfaces[1]);
+        chirouter_arp_pending_req_send(router, pending_req);
+
+        int64_t wait = pending_req->next_send - pending_req->last_sent;
+        if (wait < min_wait)
+            min_wait = wait;
+        if (wait > max_wait)
+            max_wait = wait;
+
+        chirouter_arp_pending_req_remove(router, pending_req);
+    }
+    pthread_mutex_unlock(&router->lock_arp);
+    read_arp(ctl, &sent);
+    if (min_wait < 90 || max_wait > 110 || min_wait == max_wait)
+        test_fail("The first wait ranged from %ld to %ld ms, expected 90 to 110 ms",
+                  (long) min_wait, (long) max_wait);
+
+    /* When the reply arrives, all the withheld frames are forwarded */
+    pthread_mutex_lock(&router->lock_arp);
+    pending_req = chirouter_arp_pending_req_add(router, &addr, &router->interfaces[1]);
+    pthread_mutex_unlock(&router->lock_arp);
+    for (uint16_t seq = 0; seq < 3; seq++)
+    {
+        len = test_echo_request(frame, 0, seq);
+        if (chirouter_server_process_ethernet_frame(router, &router->interfaces[0], frame, len) != 0)
+            test_fail("The router could not process echo request %u", seq);
+    }
+    receive_arp(router, &router->interfaces[1], ARP_OP_REPLY, host2_mac, HOST2_IP, "10.0.2.1");
+    read_arp(ctl, &sent);
+    if (sent.echo_requests != 3 || chirouter_arp_pending_req_lookup(router, &addr) != NULL)
+        test_fail("Forwarded %u of the 3 withheld frames", sent.echo_requests);
+
+    printf("Retransmitted ARP requests on schedule, and coalesced the frames waiting on them\n");
+    teardown(ctl);
+}
+
+
+int main(int argc, char *argv[])
+{
+    test_refresh_ahead();
+    test_learning();
+    test_gateway();
+    test_static();
+    test_pacing();
+    test_parse_schedule();
+    test_retransmission();
+
+    return EXIT_SUCCESS;
+}
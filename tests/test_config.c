@@ -0,0 +1,89 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a test that checks that the server rejects
+ *  configuration messages once the routers are running.
+ *
+ *  A second END CONFIG message used to start a second ARP thread for
+ *  each router (losing track of the first one, which then outlived the
+ *  router), and to set up the routers' queues all over again. The test
+ *  configures the routers, and checks that the server closes the
+ *  connection when it gets another END CONFIG message.
+ *
+ */
+
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "harness.h"
+
+
+int main(int argc, char *argv[])
+{
+    test_ctl_t *ctl = malloc(sizeof(test_ctl_t));
+    pthread_t arp_thread;
+
+    test_ctl_connect(ctl);
+    test_ctl_configure(ctl, 2);
+
+    arp_thread = ctl->conn->routers[0].arp_thread;
+
+    if (test_ctl_send_msg(ctl, MSG_TYPE_END_CONFIG, 0, NULL, 0) != -1)
+        test_fail("The server accepted an END CONFIG message in the RUNNING state");
+
+    if (!pthread_equal(arp_thread, ctl->conn->routers[0].arp_thread))
+        test_fail("The server started another ARP thread");
+
+    printf("Rejected an END CONFIG message in the RUNNING state\n");
+
+    test_ctl_close(ctl);
+    free(ctl);
+
+    return EXIT_SUCCESS;
+}
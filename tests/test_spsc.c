@@ -0,0 +1,174 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a stress test for the single-producer,
+ *  single-consumer rings (see spsc.h) that the server thread uses to
+ *  pass frames to the workers.
+ *
+ *  A producer thread pushes TEST_ITEMS items of varying lengths
+ *  through a small ring, and the consumer (the main thread) checks
+ *  that it gets them all, in order, and with the contents they had
+ *  when they were committed.
+ *
+ */
+
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "harness.h"
+#include "spsc.h"
+
+/* Number of items pushed through the ring, and the ring's size (small,
+ * so that the producer keeps finding it full and the consumer keeps
+ * finding it empty) */
+#define TEST_ITEMS (2000000u)
+#define TEST_RING_SLOTS (8u)
+
+/* Largest payload of an item */
+#define TEST_MAX_PAYLOAD (64u)
+
+typedef struct test_item
+{
+    uint64_t seq;
+    uint32_t len;
+    uint8_t payload[TEST_MAX_PAYLOAD];
+} test_item_t;
+
+
+/*
+ * item_byte - Byte at a given position of an item's payload
+ *
+ * seq: Sequence number of the item
+ *
+ * i: Position in the payload
+ *
+ * Returns: the byte
+ */
+static uint8_t item_byte(uint64_t seq, uint32_t i)
+{
+    return (uint8_t) (seq * 31 + i * 7);
+}
+
+
+/*
+ * producer_run - Pushes TEST_ITEMS items through the ring
+ *
+ * arg: The ring
+ *
+ * Returns: NULL
+ */
+static void *producer_run(void *arg)
+{
+    chirouter_spsc_t *ring = arg;
+
+    for (uint64_t seq = 0; seq < TEST_ITEMS; seq++)
+    {
+        test_item_t *item;
+
+        while ((item = chirouter_spsc_reserve(ring)) == NULL)
+            sched_yield();
+
+        item->seq = seq;
+        item->len = (uint32_t) (seq % (TEST_MAX_PAYLOAD + 1));
+        for (uint32_t i = 0; i < item->len; i++)
+            item->payload[i] = item_byte(seq, i);
+
+        chirouter_spsc_commit(ring);
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    chirouter_spsc_t ring;
+    pthread_t producer;
+
+    if (chirouter_spsc_init(&ring, TEST_RING_SLOTS, sizeof(test_item_t)))
+        test_fail("Could not create ring");
+
+    if (pthread_create(&producer, NULL, producer_run, &ring))
+        test_fail("Could not create producer thread");
+
+    for (uint64_t seq = 0; seq < TEST_ITEMS; seq++)
+    {
+        test_item_t *item;
+
+        while ((item = chirouter_spsc_peek(&ring)) == NULL)
+            sched_yield();
+
+        if (item->seq != seq)
+            test_fail("Expected item %lu, got item %lu", (unsigned long) seq, (unsigned long) item->seq);
+
+        if (item->len != seq % (TEST_MAX_PAYLOAD + 1))
+            test_fail("Item %lu has length %u", (unsigned long) seq, item->len);
+
+        for (uint32_t i = 0; i < item->len; i++)
+            if (item->payload[i] != item_byte(seq, i))
+                test_fail("Byte %u of item %lu is corrupted", i, (unsigned long) seq);
+
+        chirouter_spsc_release(&ring);
+    }
+
+    pthread_join(producer, NULL);
+
+    if (chirouter_spsc_peek(&ring) != NULL)
+        test_fail("Ring is not empty after consuming all the items");
+
+    chirouter_spsc_destroy(&ring);
+
+    printf("Passed %u items through a %u-slot ring in order\n", TEST_ITEMS, TEST_RING_SLOTS);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/*
+ *  chirouter - A simple, testable IP router
+ *
+ *  This module contains a stress test for the worker threads (see
+ *  worker.h), and for moving routers from one worker to another.
+ *
+ *  The test starts TEST_WORKERS workers, configures TEST_ROUTERS
+ *  routers, and sends each router TEST_ROUNDS rounds of echo requests.
+ *  Halfway through each round, while the workers are still processing
+ *  the first half, every router is moved to another worker (and, every
+ *  few rounds, the workers are also rebalanced as the server would).
+ *  The test checks that every router forwards all its echo requests,
+ *  and in the order it received them.
+ *
+ */
+
+
+/*
+ * This project is based on the Simple Router assignment included in the
+ * Mininet project (https://github.com/mininet/mininet/wiki/Simple-Router) which,
+ * in turn, is based on a programming assignment developed at Stanford
+ * (http://www.scs.stanford.edu/09au-cs144/lab/router.html)
+ *
+ * While most of the code for chirouter has been written from scratch, some
+ * of the original Stanford code is still present in some places and, whenever
+ * possible, we have tried to provide the exact attribution for such code.
+ * Any omissions are not intentional and will be gladly corrected if
+ * you contact us at borja@cs.uchicago.edu
+ */
+
+/*
+ *  Copyright (c) 2016-2018, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+
+#include "harness.h"
+#include "worker.h"
+
+/* Number of workers and routers */
+#define TEST_WORKERS (4u)
+#define TEST_ROUTERS (8u)
+
+/* Number of rounds, and echo requests sent to each router in a round
+ * (all the frames of a round have to fit in a transmit ring, since
+ * the test only flushes it between rounds) */
+#define TEST_ROUNDS (2000u)
+#define TEST_FRAMES_PER_ROUND (16u)
+
+/* The workers are rebalanced every TEST_REBALANCE_ROUNDS rounds */
+#define TEST_REBALANCE_ROUNDS (10u)
+
+/* How long to wait for the frames of a round to be forwarded */
+#define TEST_ROUND_TIMEOUT_S (10)
+
+/* Sequence number of the next echo request expected from each router */
+static unsigned long next_seq[TEST_ROUTERS];
+
+
+/*
+ * check_frame - Checks that a frame is the next echo request of its router
+ *
+ * arg: Not used
+ *
+ * r_id, iface_id, frame, len: Frame (see test_ctl_read_frames)
+ *
+ * Returns: nothing (exits if the frame is not the expected one)
+ */
+static void check_frame(void *arg, uint8_t r_id, uint8_t iface_id, const uint8_t *frame, size_t len)
+{
+    int seq = test_echo_seq(frame, len);
+
+    if (r_id >= TEST_ROUTERS)
+        test_fail("Got a frame from unknown router %u", r_id);
+
+    if (iface_id != 1 || seq != (int) (next_seq[r_id] & 0xFFFF))
+        test_fail("Expected echo request %lu from router %u out of eth2, got a frame out of "
+                  "interface %u (sequence number %d)", next_seq[r_id], r_id, iface_id, seq);
+
+    next_seq[r_id]++;
+}
+
+
+/*
+ * move_router - Moves a router to another worker
+ *
+ * Does the same bookkeeping as chirouter_workers_rebalance.
+ *
+ * ctx: Server context
+ *
+ * router: Router to move
+ *
+ * worker: Worker to move it to
+ *
+ * Returns: nothing
+ */
+static void move_router(server_ctx_t *ctx, chirouter_ctx_t *router, unsigned int worker)
+{
+    if (router->worker == worker)
+        return;
+
+    ctx->workers[router->worker].num_routers--;
+    ctx->workers[worker].num_routers++;
+    router->worker = worker;
+    ctx->worker_migrations++;
+}
+
+
+/*
+ * dispatch - Sends a number of echo requests to every router
+ *
+ * ctl: Controller side of the connection
+ *
+ * seq: Sequence number of the next echo request of every router
+ *
+ * n: Number of echo requests sent to each router
+ *
+ * Returns: nothing (exits if anything fails)
+ */
+static void dispatch(test_ctl_t *ctl, unsigned long *seq, unsigned int n)
+{
+    uint8_t frame[TEST_ECHO_FRAME_LEN];
+
+    for (unsigned int i = 0; i < n; i++)
+        for (unsigned int r = 0; r < TEST_ROUTERS; r++)
+        {
+            chirouter_ctx_t *router = &ctl->conn->routers[r];
+            size_t len = test_echo_request(frame, r, (uint16_t) seq[r]);
+
+            if (chirouter_server_handle_frame(router, &router->interfaces[0], frame, len) != 0)
+                test_fail("Could not dispatch echo request %lu to router %u", seq[r], r);
+            seq[r]++;
+        }
+}
+
+
+int main(int argc, char *argv[])
+{
+    test_ctl_t *ctl = malloc(sizeof(test_ctl_t));
+    unsigned long sent[TEST_ROUTERS] = {0};
+    unsigned long forwarded = 0, expected = 0;
+
+    test_ctl_connect(ctl);
+    if (chirouter_workers_start(ctl->server, TEST_WORKERS))
+        test_fail("Could not start workers");
+    test_ctl_configure(ctl, TEST_ROUTERS);
+
+    for (unsigned int round = 0; round < TEST_ROUNDS; round++)
+    {
+        time_t deadline = time(NULL) + TEST_ROUND_TIMEOUT_S;
+
+        dispatch(ctl, sent, TEST_FRAMES_PER_ROUND / 2);
+
+        /* Move every router while its worker is (likely) still
+         * processing the frames sent to it so far */
+        for (unsigned int r = 0; r < TEST_ROUTERS; r++)
+            move_router(ctl->server, &ctl->conn->routers[r], (r + round + 1) % TEST_WORKERS);
+
+        dispatch(ctl, sent, TEST_FRAMES_PER_ROUND - TEST_FRAMES_PER_ROUND / 2);
+
+        if (round % TEST_REBALANCE_ROUNDS == 0)
+            chirouter_workers_rebalance(ctl->server);
+
+        expected += TEST_ROUTERS * TEST_FRAMES_PER_ROUND;
+        while (forwarded < expected)
+        {
+            if (chirouter_server_flush(ctl->conn) != 0)
+                test_fail("Could not send the forwarded frames to the controller");
+            forwarded += test_ctl_read_frames(ctl, check_frame, NULL);
+
+            if (forwarded < expected && time(NULL) > deadline)
+                test_fail("Round %u: forwarded %lu of %lu frames", round, forwarded, expected);
+            sched_yield();
+        }
+    }
+
+    for (unsigned int r = 0; r < TEST_ROUTERS; r++)
+    {
+        chirouter_ctx_t *router = &ctl->conn->routers[r];
+
+        if (next_seq[r] != sent[r])
+            test_fail("Router %u forwarded %lu of %lu frames", r, next_seq[r], sent[r]);
+        if (atomic_load(&router->frames_done) != router->frames_dispatched)
+            test_fail("Router %u has frames that were never processed", r);
+    }
+
+    printf("Forwarded %lu frames in order, with %lu router moves between %u workers\n",
+           forwarded, (unsigned long) ctl->server->worker_migrations, TEST_WORKERS);
+
+    test_ctl_close(ctl);
+    free(ctl);
+
+    return EXIT_SUCCESS;
+}